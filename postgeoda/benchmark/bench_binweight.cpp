@@ -0,0 +1,226 @@
+/**
+ * Changes:
+ * 2026-10-16 Add benchmark of the storage of BinWeight
+ *
+ * Compare the two ways BinWeight stores the weights read from the bytea of complete
+ * weights (e.g. of geoda_weights_cont()) on a queen contiguity grid:
+ *
+ *   map: a hash map from the index of observation to a heap allocated element that holds
+ *        a std::vector of neighbor ids and a std::vector of weights values (BinElement,
+ *        the code before the CSR arrays); GetNeighbors() copies the ids into a new vector
+ *   csr: the neighbor ids and weights of all observations in contiguous arrays with an
+ *        offset per observation (src/binweight.h); GetNeighborSpan() returns a pointer
+ *
+ * For each of them, the benchmark reports the time to build the weights from the v1
+ * bytea, the time of a pass of the local Moran statistics (the spatial lag of each
+ * observation, which is what gda_localmoran() does for each observation and each
+ * permutation), the time of a pass of GetNbrSize(), and the memory used (the increase of
+ * the resident set size). This file doesn't need PG or libgeoda.
+ *
+ * Build and run:
+ *   c++ -O2 -std=c++11 -o bench_binweight bench_binweight.cpp && ./bench_binweight [rows] [cols]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unordered_map>
+#include <vector>
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the resident set size (KB), from /proc/self/statm
+static long rss_kb() {
+    long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * 4;
+}
+
+// the v1 bytea of the complete queen weights of a rows x cols grid
+static std::vector<uint8_t> queen_grid(uint32_t rows, uint32_t cols) {
+    std::vector<uint8_t> bw;
+    uint32_t num_obs = rows * cols;
+    bw.reserve(5 + (size_t)num_obs * (6 + 4 * 8));
+    bw.push_back('a');
+    bw.insert(bw.end(), (uint8_t*)&num_obs, (uint8_t*)&num_obs + 4);
+    uint32_t nbrs[8];
+    for (uint32_t r = 0; r < rows; ++r) {
+        for (uint32_t c = 0; c < cols; ++c) {
+            uint32_t idx = r * cols + c;
+            uint16_t nn = 0;
+            for (int dr = -1; dr <= 1; ++dr) {
+                for (int dc = -1; dc <= 1; ++dc) {
+                    long rr = (long)r + dr, cc = (long)c + dc;
+                    if ((dr == 0 && dc == 0) || rr < 0 || cc < 0 || rr >= rows || cc >= cols) continue;
+                    nbrs[nn++] = (uint32_t)(rr * cols + cc);
+                }
+            }
+            bw.insert(bw.end(), (uint8_t*)&idx, (uint8_t*)&idx + 4);
+            bw.insert(bw.end(), (uint8_t*)&nn, (uint8_t*)&nn + 2);
+            bw.insert(bw.end(), (uint8_t*)nbrs, (uint8_t*)(nbrs + nn));
+        }
+    }
+    return bw;
+}
+
+// map: the storage of BinWeight before the CSR arrays
+struct MapElement {
+    uint32_t idx;
+    std::vector<uint32_t> nbrId;
+    std::vector<float> nbrWeight;
+};
+
+struct MapWeight {
+    std::unordered_map<uint32_t, MapElement*> w_dict;
+
+    explicit MapWeight(const std::vector<uint8_t>& bw) {
+        const uint8_t *buf = bw.data() + 1;
+        uint32_t n;
+        memcpy(&n, buf, 4);
+        buf += 4;
+        for (uint32_t i = 0; i < n; ++i) {
+            MapElement *e = new MapElement();
+            uint16_t nn;
+            memcpy(&e->idx, buf, 4);
+            memcpy(&nn, buf + 4, 2);
+            buf += 6;
+            e->nbrId.resize(nn);
+            memcpy(e->nbrId.data(), buf, 4 * (size_t)nn);
+            buf += 4 * (size_t)nn;
+            w_dict[e->idx] = e;
+        }
+    }
+    ~MapWeight() {
+        for (auto& it : w_dict) delete it.second;
+    }
+    const std::vector<long> GetNeighbors(int obs_idx) {
+        std::vector<long> nbrs;
+        auto it = w_dict.find(obs_idx);
+        if (it != w_dict.end()) nbrs.assign(it->second->nbrId.begin(), it->second->nbrId.end());
+        return nbrs;
+    }
+    int GetNbrSize(int obs_idx) {
+        return (int)GetNeighbors(obs_idx).size();
+    }
+};
+
+// csr: the storage of BinWeight in src/binweight.h
+struct CsrWeight {
+    std::vector<size_t> nbr_offsets;
+    std::vector<int32_t> nbr_ids;
+
+    explicit CsrWeight(const std::vector<uint8_t>& bw) {
+        const uint8_t *start = bw.data() + 1;
+        uint32_t n;
+        memcpy(&n, start, 4);
+        start += 4;
+        nbr_offsets.assign((size_t)n + 1, 0);
+        const uint8_t *buf = start;
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t idx;
+            uint16_t nn;
+            memcpy(&idx, buf, 4);
+            memcpy(&nn, buf + 4, 2);
+            buf += 6 + 4 * (size_t)nn;
+            nbr_offsets[idx + 1] = nn;
+        }
+        for (uint32_t i = 0; i < n; ++i) nbr_offsets[i + 1] += nbr_offsets[i];
+        nbr_ids.resize(nbr_offsets[n]);
+        buf = start;
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t idx;
+            uint16_t nn;
+            memcpy(&idx, buf, 4);
+            memcpy(&nn, buf + 4, 2);
+            memcpy(nbr_ids.data() + nbr_offsets[idx], buf + 6, 4 * (size_t)nn);
+            buf += 6 + 4 * (size_t)nn;
+        }
+    }
+    int GetNbrSize(int obs_idx) {
+        return (int)(nbr_offsets[obs_idx + 1] - nbr_offsets[obs_idx]);
+    }
+};
+
+int main(int argc, char **argv) {
+    uint32_t rows = argc > 1 ? (uint32_t)atol(argv[1]) : 3163;
+    uint32_t cols = argc > 2 ? (uint32_t)atol(argv[2]) : rows;
+    uint32_t n = rows * cols;
+
+    std::vector<uint8_t> bw = queen_grid(rows, cols);
+    std::vector<double> data(n);
+    uint64_t seed = 123456789;
+    double sum = 0, sum2 = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        data[i] = (double)(seed >> 11) / 9007199254740992.0;
+        sum += data[i];
+    }
+    double mean = sum / n;
+    for (uint32_t i = 0; i < n; ++i) {
+        data[i] -= mean;
+        sum2 += data[i] * data[i];
+    }
+    double var = sum2 / n;
+
+    printf("queen grid %u x %u: num_obs=%u, v1 bytea=%.1f MB\n", rows, cols, n, bw.size() / 1048576.0);
+
+    double check_map = 0, check_csr = 0;
+    long sizes_map = 0, sizes_csr = 0;
+    // csr first: the memory freed by the map may be reused and hide the memory of csr
+    {
+        long rss0 = rss_kb();
+        double t0 = now_sec();
+        CsrWeight w(bw);
+        double t1 = now_sec();
+        long rss1 = rss_kb();
+        for (uint32_t i = 0; i < n; ++i) {
+            size_t start = w.nbr_offsets[i], end = w.nbr_offsets[i + 1];
+            const int32_t *ids = w.nbr_ids.data();
+            double lag = 0;
+            for (size_t j = start; j < end; ++j) lag += data[ids[j]];
+            if (end > start) lag /= (end - start);
+            check_csr += data[i] * lag / var;
+        }
+        double t2 = now_sec();
+        for (uint32_t i = 0; i < n; ++i) sizes_csr += w.GetNbrSize(i);
+        double t3 = now_sec();
+        printf("csr: build %.3f s, local moran %.3f s, GetNbrSize %.3f s, memory %.1f MB\n",
+               t1 - t0, t2 - t1, t3 - t2, (rss1 - rss0) / 1024.0);
+    }
+
+    {
+        long rss0 = rss_kb();
+        double t0 = now_sec();
+        MapWeight w(bw);
+        double t1 = now_sec();
+        long rss1 = rss_kb();
+        for (uint32_t i = 0; i < n; ++i) {
+            std::vector<long> nbrs = w.GetNeighbors(i);
+            double lag = 0;
+            for (size_t j = 0; j < nbrs.size(); ++j) lag += data[nbrs[j]];
+            if (!nbrs.empty()) lag /= nbrs.size();
+            check_map += data[i] * lag / var;
+        }
+        double t2 = now_sec();
+        for (uint32_t i = 0; i < n; ++i) sizes_map += w.GetNbrSize(i);
+        double t3 = now_sec();
+        printf("map: build %.3f s, local moran %.3f s, GetNbrSize %.3f s, memory %.1f MB\n",
+               t1 - t0, t2 - t1, t3 - t2, (rss1 - rss0) / 1024.0);
+    }
+    if (check_map != check_csr || sizes_map != sizes_csr) {
+        printf("ERROR: the results are not the same\n");
+        return 1;
+    }
+    return 0;
+}
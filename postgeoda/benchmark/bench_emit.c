@@ -0,0 +1,207 @@
+/**
+ * Changes:
+ * 2026-10-16 Add benchmark of the per-row weights emission of the Window functions
+ *
+ * Compare the two ways of returning the weights of each row from the weights Window
+ * functions (e.g. pg_queen_weights_window):
+ *
+ *   per-row: for each row, palloc a temporary buffer, copy the neighbors one by one,
+ *            then palloc the bytea and copy the buffer into it (the code before
+ *            WeightsArena)
+ *   arena:   serialize all rows once into one buffer (weights_to_arena), then return
+ *            a pointer to the bytea of each row (weights_arena_get)
+ *
+ * palloc is replaced by a counting malloc, so the number of allocations and the bytes
+ * copied are reported together with the elapsed time. This file doesn't need PG.
+ *
+ * Build and run:
+ *   cc -O2 -o bench_emit bench_emit.c && ./bench_emit [num_obs] [num_nbrs] [w_type: a|w]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VARHDRSZ 4
+#define INTALIGN(len) (((size_t)(len) + 3) & ~((size_t)3))
+
+typedef struct {
+    uint32_t idx;
+    uint16_t num_nbrs;
+    uint32_t *nbrId;
+    float *nbrWeight;
+} PGNeighbor;
+
+typedef struct {
+    char w_type;
+    uint32_t num_obs;
+    PGNeighbor *neighbors;
+} PGWeight;
+
+static size_t n_allocs = 0;
+static size_t n_copied = 0;
+
+static void *count_alloc(size_t size) {
+    n_allocs += 1;
+    return malloc(size);
+}
+
+static void count_copy(void *dst, const void *src, size_t size) {
+    n_copied += size;
+    memcpy(dst, src, size);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the per-row emission, as it was in the Window functions
+static void *emit_per_row(const PGWeight *w, uint32_t curpos) {
+    const PGNeighbor *nbr = &w->neighbors[curpos];
+    uint16_t num_nbrs = nbr->num_nbrs;
+    size_t buf_size = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t) * num_nbrs;
+    if (w->w_type == 'w') buf_size += sizeof(float) * num_nbrs;
+
+    uint8_t *buf = count_alloc(buf_size);
+    uint8_t *pos = buf;
+    count_copy(buf, &nbr->idx, sizeof(uint32_t));
+    buf += sizeof(uint32_t);
+    count_copy(buf, &num_nbrs, sizeof(uint16_t));
+    buf += sizeof(uint16_t);
+    for (size_t j = 0; j < num_nbrs; ++j) {
+        count_copy(buf, &nbr->nbrId[j], sizeof(uint32_t));
+        buf += sizeof(uint32_t);
+    }
+    if (w->w_type == 'w') {
+        for (size_t j = 0; j < num_nbrs; ++j) {
+            count_copy(buf, &nbr->nbrWeight[j], sizeof(float));
+            buf += sizeof(float);
+        }
+    }
+
+    uint8_t *result = count_alloc(buf_size + VARHDRSZ);
+    uint32_t len = (uint32_t)(buf_size + VARHDRSZ);
+    memcpy(result, &len, sizeof(uint32_t));
+    count_copy(result + VARHDRSZ, pos, buf_size);
+    free(pos);
+    return result;
+}
+
+typedef struct {
+    uint32_t num_obs;
+    size_t *offsets;
+    uint8_t *data;
+} WeightsArena;
+
+// the same layout as weights_to_arena() in src/weights.h
+static WeightsArena *emit_arena(const PGWeight *w) {
+    WeightsArena *arena = count_alloc(sizeof(WeightsArena));
+    arena->num_obs = w->num_obs;
+    arena->offsets = count_alloc(sizeof(size_t) * (w->num_obs + 1));
+
+    size_t total = 0;
+    for (size_t i = 0; i < w->num_obs; ++i) {
+        uint16_t num_nbrs = w->neighbors[i].num_nbrs;
+        size_t buf_size = VARHDRSZ + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t) * num_nbrs;
+        if (w->w_type == 'w') buf_size += sizeof(float) * num_nbrs;
+        arena->offsets[i] = total;
+        total += INTALIGN(buf_size);
+    }
+    arena->offsets[w->num_obs] = total;
+    arena->data = count_alloc(total > 0 ? total : 1);
+
+    for (size_t i = 0; i < w->num_obs; ++i) {
+        const PGNeighbor *nbr = &w->neighbors[i];
+        uint16_t num_nbrs = nbr->num_nbrs;
+        uint8_t *row = arena->data + arena->offsets[i];
+        uint8_t *buf = row + VARHDRSZ;
+        count_copy(buf, &nbr->idx, sizeof(uint32_t));
+        buf += sizeof(uint32_t);
+        count_copy(buf, &num_nbrs, sizeof(uint16_t));
+        buf += sizeof(uint16_t);
+        count_copy(buf, nbr->nbrId, sizeof(uint32_t) * num_nbrs);
+        buf += sizeof(uint32_t) * num_nbrs;
+        if (w->w_type == 'w') {
+            count_copy(buf, nbr->nbrWeight, sizeof(float) * num_nbrs);
+            buf += sizeof(float) * num_nbrs;
+        }
+        uint32_t len = (uint32_t)(buf - row);
+        memcpy(row, &len, sizeof(uint32_t));
+    }
+    return arena;
+}
+
+int main(int argc, char **argv) {
+    uint32_t num_obs = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+    uint16_t num_nbrs = argc > 2 ? (uint16_t)atoi(argv[2]) : 6;
+    char w_type = argc > 3 ? argv[3][0] : 'a';
+
+    PGWeight w;
+    w.w_type = w_type;
+    w.num_obs = num_obs;
+    w.neighbors = malloc(sizeof(PGNeighbor) * num_obs);
+    for (uint32_t i = 0; i < num_obs; ++i) {
+        w.neighbors[i].idx = i;
+        w.neighbors[i].num_nbrs = num_nbrs;
+        w.neighbors[i].nbrId = malloc(sizeof(uint32_t) * num_nbrs);
+        w.neighbors[i].nbrWeight = malloc(sizeof(float) * num_nbrs);
+        for (uint16_t j = 0; j < num_nbrs; ++j) {
+            w.neighbors[i].nbrId[j] = (i + j + 1) % num_obs;
+            w.neighbors[i].nbrWeight[j] = 1.0f / (j + 1);
+        }
+    }
+
+    printf("num_obs=%u num_nbrs=%u w_type=%c\n", num_obs, num_nbrs, w_type);
+
+    // The executor copies the result of each row to the output of the Window (e.g. a
+    // tuplestore), which is simulated by copying the rows into `output` in both cases.
+    size_t out_size = (size_t)num_obs * (VARHDRSZ + 8 + 8 * num_nbrs);
+    uint8_t *output = malloc(out_size);
+    memset(output, 0, out_size);
+
+    // per-row: the executor frees each result after the row is copied to the output
+    n_allocs = n_copied = 0;
+    double start = now_sec();
+    uint64_t check_per_row = 0;
+    uint8_t *out = output;
+    for (uint32_t i = 0; i < num_obs; ++i) {
+        uint8_t *row = emit_per_row(&w, i);
+        uint32_t len;
+        memcpy(&len, row, sizeof(uint32_t));
+        memcpy(out, row, len);
+        out += len;
+        check_per_row += row[VARHDRSZ + 4];
+        free(row);
+    }
+    printf("per-row: %.3f s, allocations=%zu, bytes copied=%zu\n", now_sec() - start, n_allocs, n_copied);
+
+    n_allocs = n_copied = 0;
+    start = now_sec();
+    WeightsArena *arena = emit_arena(&w);
+    double built = now_sec();
+    uint64_t check_arena = 0;
+    out = output;
+    for (uint32_t i = 0; i < num_obs; ++i) {
+        uint8_t *row = arena->data + arena->offsets[i];
+        uint32_t len;
+        memcpy(&len, row, sizeof(uint32_t));
+        memcpy(out, row, len);
+        out += len;
+        check_arena += row[VARHDRSZ + 4];
+    }
+    double end = now_sec();
+    // NOTE: the build time includes the first touch (page faults) of the new arena, while
+    // the per-row path keeps reusing the same small chunks
+    printf("arena:   %.3f s (build %.3f s, rows %.3f s), allocations=%zu, bytes copied=%zu\n",
+           end - start, built - start, end - built, n_allocs, n_copied);
+
+    if (check_per_row != check_arena) {
+        printf("ERROR: the rows are not the same\n");
+        return 1;
+    }
+    return 0;
+}
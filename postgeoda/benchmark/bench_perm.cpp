@@ -0,0 +1,136 @@
+/**
+ * Changes:
+ * 2026-10-16 Add benchmark of the conditional permutations of the LISA
+ * 2026-10-16 Link with pthread for PermTable::Reserve()
+ * 2026-10-16 Link with parallel.cpp for the worker threads of parallel_for()
+ *
+ * Compare the ways to compute the spatial lags of the random neighbors of each observation
+ * in the conditional permutations of local_moran_fast():
+ *
+ *   draw:   the random neighbors of each permutation drawn one by one with a hash and a
+ *           set of the drawn neighbors (GeoDaSet), then summed (the code before PermTable)
+ *   scalar: the random neighbors read from the table of permutations (src/perm_kernel.h)
+ *   avx2:   the same with AVX2 gathers, if the CPU supports it
+ *   avx512: the same with AVX-512 gathers, if the CPU supports it
+ *
+ * For each of them, the benchmark reports the permutations per second of one core (all
+ * observations, each with nn neighbors), and checks that the table gives the same sums
+ * with all instruction sets. This file doesn't need PG or libgeoda.
+ *
+ * Build and run:
+ *   c++ -O2 -std=c++11 -pthread -I../src -o bench_perm bench_perm.cpp ../src/perm_kernel.cpp \
+ *       ../src/parallel.cpp && \
+ *   ./bench_perm [num_obs] [nn] [permutations]
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "perm_kernel.h"
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double thomas_wang_hash_double(uint64_t key) {
+    key = (~key) + (key << 21);
+    key = key ^ (key >> 24);
+    key = (key + (key << 3)) + (key << 8);
+    key = key ^ (key >> 14);
+    key = (key + (key << 2)) + (key << 4);
+    key = key ^ (key >> 28);
+    key = key + (key << 31);
+    return 5.42101086242752217E-20 * key;
+}
+
+// the random neighbors drawn one by one, as local_moran_fast() did with GeoDaSet
+static double bench_draw(const std::vector<double>& arr, uint32_t nn, uint32_t permutations, int seed) {
+    uint32_t num_obs = (uint32_t)arr.size();
+    std::vector<char> belongs(num_obs, 0);
+    std::vector<int> drawn(nn);
+    double checksum = 0;
+    for (uint32_t i = 0; i < num_obs; ++i) {
+        int seed_start = seed + i;
+        for (uint32_t perm = 0; perm < permutations; ++perm) {
+            uint32_t rand = 0;
+            while (rand < nn) {
+                double rng_val = thomas_wang_hash_double(seed_start++) * (num_obs - 1);
+                int r = (int)floor(rng_val + 0.5);
+                if (r != (int)i && !belongs[r]) {
+                    belongs[r] = 1;
+                    drawn[rand++] = r;
+                }
+            }
+            double lag = 0;
+            for (uint32_t k = 0; k < nn; ++k) {
+                lag += arr[drawn[k]];
+                belongs[drawn[k]] = 0;
+            }
+            checksum += lag;
+        }
+    }
+    return checksum;
+}
+
+static double bench_table(PermIsa isa, const PermTable& table, const std::vector<double>& arr, uint32_t nn,
+                          std::vector<double>& sums) {
+    uint32_t num_obs = (uint32_t)arr.size();
+    double checksum = 0;
+    for (uint32_t i = 0; i < num_obs; ++i) {
+        perm_lag_sums(isa, table, arr.data(), i, nn, &sums[(size_t)i * table.permutations]);
+        checksum += sums[(size_t)i * table.permutations];
+    }
+    return checksum;
+}
+
+int main(int argc, char **argv) {
+    uint32_t num_obs = argc > 1 ? (uint32_t)atoi(argv[1]) : 10000;
+    uint32_t nn = argc > 2 ? (uint32_t)atoi(argv[2]) : 8;
+    uint32_t permutations = argc > 3 ? (uint32_t)atoi(argv[3]) : 999;
+    if (num_obs < 2 || nn >= num_obs || permutations == 0) {
+        fprintf(stderr, "usage: bench_perm [num_obs] [nn < num_obs] [permutations]\n");
+        return 1;
+    }
+
+    std::vector<double> arr(num_obs);
+    srand(123456789);
+    for (uint32_t i = 0; i < num_obs; ++i) arr[i] = rand() / (double)RAND_MAX - 0.5;
+
+    double total = (double)num_obs * permutations;
+    printf("num_obs=%u, nn=%u, permutations=%u, best isa: %s\n", num_obs, nn, permutations,
+           perm_isa_name(perm_best_isa()));
+
+    double t0 = now_sec();
+    double checksum = bench_draw(arr, nn, permutations, 123456789);
+    double t = now_sec() - t0;
+    printf("draw:   %.3f s, %.2f M permutations/s (checksum %.3f)\n", t, total / t / 1e6, checksum);
+
+    t0 = now_sec();
+    PermTable table(num_obs, permutations, 123456789);
+    table.Reserve(nn);
+    printf("table:  %.3f s to build (%.1f MB)\n", now_sec() - t0,
+           (double)permutations * table.width * sizeof(int32_t) / 1048576.0);
+
+    std::vector<double> expected((size_t)num_obs * permutations), sums((size_t)num_obs * permutations);
+    int isas[3] = {PERM_ISA_SCALAR, PERM_ISA_AVX2, PERM_ISA_AVX512};
+    for (int k = 0; k < 3; ++k) {
+        PermIsa isa = (PermIsa)isas[k];
+        if (isa > perm_best_isa()) break;
+        std::vector<double>& out = isa == PERM_ISA_SCALAR ? expected : sums;
+        t0 = now_sec();
+        checksum = bench_table(isa, table, arr, nn, out);
+        t = now_sec() - t0;
+        bool same = isa == PERM_ISA_SCALAR || memcmp(expected.data(), sums.data(), sizeof(double) * sums.size()) == 0;
+        printf("%-7s %.3f s, %.2f M permutations/s (checksum %.3f)%s\n", perm_isa_name(isa), t,
+               total / t / 1e6, checksum, same ? "" : " DIFFERENT SUMS");
+    }
+    return 0;
+}
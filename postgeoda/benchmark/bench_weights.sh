@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# Benchmark of the spatial weights functions: elapsed time and peak memory
+# (VmHWM) of the backend that runs each query.
+#
+# The backend runs on the same host as psql, so its /proc/<pid>/status can be
+# read after the query. Each query runs in a new session, so VmHWM is the peak
+# of that query only.
+#
+# Usage:
+#   ./bench_weights.sh <dbname> <table> [fid column] [geom column (wkb bytea)]
+#
+# e.g. compare the WKB decoding before/after an update by running this script
+# against both builds of postgeoda on the same table:
+#   ./bench_weights.sh postgres chicago_parcels ogc_fid wkb_geometry
+
+DB=${1:?dbname}
+TABLE=${2:?table}
+FID=${3:-ogc_fid}
+GEOM=${4:-wkb_geometry}
+
+run_query() {
+    local name=$1
+    local sql=$2
+    echo "== ${name}"
+    psql -X -q -d "${DB}" <<SQL
+SELECT pg_backend_pid() AS pid \gset
+\timing on
+SELECT count(*) FROM (${sql}) t;
+\timing off
+\! grep -E 'VmHWM|VmRSS' /proc/:pid/status
+SQL
+}
+
+run_query "queen_weights" "SELECT queen_weights(${FID}, ${GEOM}) OVER() FROM ${TABLE}"
+run_query "rook_weights" "SELECT rook_weights(${FID}, ${GEOM}) OVER() FROM ${TABLE}"
+run_query "knn_weights k=6" "SELECT knn_weights(${FID}, ${GEOM}, 6) OVER() FROM ${TABLE}"
+run_query "geoda_weights_cont (aggregate)" "SELECT geoda_weights_cont(${FID}, ${GEOM}, true) FROM ${TABLE}"
+run_query "min_distthreshold (aggregate)" "SELECT min_distthreshold(${FID}, ${GEOM}) FROM ${TABLE}"
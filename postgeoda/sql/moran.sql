@@ -8,6 +8,12 @@
 -- 2021-4-27 rename and reorganize lisa functions
 -- add local_moran() with array output; add local_moran() with arguments: permutations, method, significance_cutoff,
 -- cpu_threads and seed
+-- 2026-10-16 add batch_local_moran()
+-- 2026-10-16 add local_moran_state() and local_moran_fast() with the state
+-- 2026-10-16 add local_moran_knn() and local_moran_queen()
+-- 2026-10-16 add local_moran_halo()
+-- 2026-10-17 document the weighted spatial lag of local_moran_halo()
+-- 2026-10-17 document the bounded state of local_moran_state()
 --------------------------------------
 
 --------------------------------------
@@ -24,6 +30,49 @@ CREATE OR REPLACE FUNCTION local_moran(anyelement, bytea, integer, character var
 AS 'MODULE_PATHNAME', 'pg_local_moran_window'
     LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
 
+--------------------------------------
+-- local_moran_knn(crm_prs, fid, wkb_geometry, k)
+-- local_moran_queen(crm_prs, fid, wkb_geometry)
+-- the KNN (or queen contiguity) weights are created from the geometries of the window and used
+-- directly by the local moran, in one window function; the last arguments are the same as local_moran()
+--------------------------------------
+CREATE OR REPLACE FUNCTION local_moran_knn(anyelement, integer, bytea, integer)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_local_moran_knn_window'
+    LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
+
+CREATE OR REPLACE FUNCTION local_moran_knn(anyelement, integer, bytea, integer,
+                                           integer, character varying, float8, integer, integer)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_local_moran_knn_window'
+    LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
+
+CREATE OR REPLACE FUNCTION local_moran_queen(anyelement, integer, bytea)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_local_moran_queen_window'
+    LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
+
+CREATE OR REPLACE FUNCTION local_moran_queen(anyelement, integer, bytea,
+                                             integer, character varying, float8, integer, integer)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_local_moran_queen_window'
+    LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
+
+--------------------------------------
+-- batch_local_moran(ARRAY[crm_prs, crm_prp, litercy], bytea)
+-- local moran of each variable with the same weights, decoded once, and the same permutations;
+-- returns a 2-D array {lisa, p-value, cluster} for each variable, e.g. r[2][1] is the lisa of crm_prp
+--------------------------------------
+CREATE OR REPLACE FUNCTION batch_local_moran(anyarray, bytea)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_batch_local_moran_window'
+    LANGUAGE 'c' IMMUTABLE WINDOW;
+
+CREATE OR REPLACE FUNCTION batch_local_moran(anyarray, bytea, integer, character varying, float8, integer, integer)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_batch_local_moran_window'
+    LANGUAGE 'c' IMMUTABLE WINDOW;
+
 --------------------------------------
 -- local_moran_fast(crm_prs, bytea)
 -- select "Crm_prs", wkb_geometry, Array(select "Crm_prs" from guerry) as abc FROM guerry;
@@ -32,6 +81,73 @@ CREATE OR REPLACE FUNCTION local_moran_fast(anyelement, bytea, anyarray)
     RETURNS point
 AS 'MODULE_PATHNAME', 'pg_local_moran_fast'
     LANGUAGE 'c' PARALLEL SAFE COST 1000;
+
+--------------------------------------
+-- local_moran_state(crm_prs [, permutations, seed])
+-- AGGREGATE
+-- The state of the two-phase local_moran_fast(): the mean and standard deviation of the values,
+-- the permutations (999), the seed (123456789) and the standardized values, computed once.
+-- The state is at most 512 KB: with more than 65536 rows, it keeps a uniform sample of 65536
+-- values (seeded, in the order of the rows), the random neighbors of the permutations are
+-- drawn from the sample, and the pseudo p-values are approximate. At most 4294967295 rows.
+-- DEPENDENCIES
+-- local_moran_state_transfn()
+-- local_moran_state_finalfn()
+--------------------------------------
+CREATE OR REPLACE FUNCTION local_moran_state_transfn(internal, anyelement)
+    RETURNS internal
+AS 'MODULE_PATHNAME', 'local_moran_state_transfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION local_moran_state_transfn(internal, anyelement, integer, integer)
+    RETURNS internal
+AS 'MODULE_PATHNAME', 'local_moran_state_transfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION local_moran_state_finalfn(internal)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'local_moran_state_finalfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE AGGREGATE local_moran_state(anyelement) (
+    sfunc = local_moran_state_transfn,
+    stype = internal,
+    finalfunc = local_moran_state_finalfn
+    );
+
+CREATE AGGREGATE local_moran_state(anyelement, integer, integer) (
+    sfunc = local_moran_state_transfn,
+    stype = internal,
+    finalfunc = local_moran_state_finalfn
+    );
+
+--------------------------------------
+-- local_moran_fast(crm_prs, bytea, nbr_vals, state)
+-- The local moran {lisa, pseudo p-value} of one row from its weights, the values of its neighbors
+-- (any order) and the state of local_moran_state(): each row takes O(nn * permutations).
+--------------------------------------
+CREATE OR REPLACE FUNCTION local_moran_fast(anyelement, bytea, anyarray, bytea)
+    RETURNS point
+AS 'MODULE_PATHNAME', 'pg_local_moran_fast_state'
+    LANGUAGE 'c' IMMUTABLE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- local_moran_halo(crm_prs, bytea, halo_fids, halo_vals, state [, significance_cutoff])
+-- WINDOW, used with OVER(PARTITION BY ...): the neighbors in other partitions are read from the
+-- fids and values of the halo of the partition (the same for all its rows, NULL for none), and
+-- the permutations come from the state of local_moran_state() of all rows, so the
+-- {lisa, p-value, cluster} of each row don't depend on the partitions. The weights values of a row,
+-- if any, weight its spatial lag and its permutations.
+--------------------------------------
+CREATE OR REPLACE FUNCTION local_moran_halo(anyelement, bytea, bigint[], anyarray, bytea)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_local_moran_halo_window'
+    LANGUAGE 'c' IMMUTABLE WINDOW;
+
+CREATE OR REPLACE FUNCTION local_moran_halo(anyelement, bytea, bigint[], anyarray, bytea, float8)
+    RETURNS float8[]
+AS 'MODULE_PATHNAME', 'pg_local_moran_halo_window'
+    LANGUAGE 'c' IMMUTABLE WINDOW;
 --------------------------------------
 -- local_moran_b(crm_prs, bytea)
 -- the weights should be passed as a whole in BYTEA format
@@ -5,6 +5,11 @@
 -- 2021-1-27 Reorganize Weights SQLs
 -- 2021-4-10 Expose queen_weights() as the major interface for queen weights creation
 -- 2021-4-23 Add Window SQL functions for queen_weights and rook_weights
+-- 2026-10-16 Add cpu_threads to queen_weights and rook_weights
+-- 2026-10-16 Add weights_compress() and weights_decompress()
+-- 2026-10-16 Add geoda_weights_tojson_rows()
+-- 2026-10-16 Add the aggregate weights_summary()
+-- 2026-10-17 queen_weights and rook_weights with one thread are created by libgeoda
 --------------------------------------
 
 --------------------------------------
@@ -23,6 +28,17 @@ CREATE OR REPLACE FUNCTION queen_weights(integer, bytea, integer, boolean, float
 AS 'MODULE_PATHNAME', 'pg_queen_weights_window'
     LANGUAGE 'c' STRICT WINDOW;
 
+--------------------------------------
+-- MAIN INTERFACE queen_weights(fid, wkb_geometry, 1, FALSE, 0.0, 8)
+-- the last argument is the number of threads used to create the weights: 1 is libgeoda, more
+-- threads create the same neighbors (sorted) with the contiguity builder, which doesn't support
+-- a precision threshold > 0
+--------------------------------------
+CREATE OR REPLACE FUNCTION queen_weights(integer, bytea, integer, boolean, float4, integer)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'pg_queen_weights_window'
+    LANGUAGE 'c' STRICT WINDOW;
+
 --------------------------------------
 -- MAIN INTERFACE rook_weights(fid, wkb_geometry)
 --------------------------------------
@@ -39,6 +55,17 @@ CREATE OR REPLACE FUNCTION rook_weights(integer, bytea, integer, boolean, float4
 AS 'MODULE_PATHNAME', 'pg_rook_weights_window'
     LANGUAGE 'c' STRICT WINDOW;
 
+--------------------------------------
+-- MAIN INTERFACE rook_weights(fid, wkb_geometry, 1, FALSE, 0.0, 8)
+-- the last argument is the number of threads used to create the weights: 1 is libgeoda, more
+-- threads create the same neighbors (sorted) with the contiguity builder, which doesn't support
+-- a precision threshold > 0
+--------------------------------------
+CREATE OR REPLACE FUNCTION rook_weights(integer, bytea, integer, boolean, float4, integer)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'pg_rook_weights_window'
+    LANGUAGE 'c' STRICT WINDOW;
+
 -------------------------------------------------------------------
 -- queen_weights/rook_weights('ogc_fid', 'wkb_geometry', 'queen_w', 'nat')
 -- DEPENDENCIES
@@ -232,6 +259,54 @@ CREATE OR REPLACE FUNCTION geoda_weights_tojson(bytea)
 AS 'MODULE_PATHNAME', 'weights_bytea_tojson'
     LANGUAGE c PARALLEL SAFE;
 
+--------------------------------------
+-- geoda_weights_tojson_rows(bytea)
+-- bytea of complete weights
+-- One JSON object per observation, e.g. {"id":0,"neighbors":[1,2],"weights":[0.5,0.5]},
+-- without building the text of all observations
+--------------------------------------
+CREATE OR REPLACE FUNCTION geoda_weights_tojson_rows(bytea)
+    RETURNS SETOF json
+AS 'MODULE_PATHNAME', 'weights_bytea_tojson_rows'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- weights_summary(bytea)
+-- AGGREGATE
+-- bytea of weights of ONE observation (e.g. a weights column) or of complete weights
+-- The statistics of the neighbors (not including the observation itself), computed in one pass:
+--   SELECT (weights_summary(queen_w)).* FROM nat;
+-- DEPENDENCIES
+-- weights_summary_transfn()
+-- weights_summary_finalfn()
+--------------------------------------
+CREATE TYPE geoda_weights_summary AS (
+    num_obs bigint,
+    num_nbrs bigint,
+    min_nbrs integer,
+    max_nbrs integer,
+    mean_nbrs float8,
+    median_nbrs float8,
+    isolates bigint,
+    symmetric boolean
+);
+
+CREATE OR REPLACE FUNCTION weights_summary_transfn(internal, bytea)
+    RETURNS internal
+AS 'MODULE_PATHNAME', 'weights_summary_transfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION weights_summary_finalfn(internal)
+    RETURNS geoda_weights_summary
+AS 'MODULE_PATHNAME', 'weights_summary_finalfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE AGGREGATE weights_summary(bytea) (
+    sfunc = weights_summary_transfn,
+    stype = internal,
+    finalfunc = weights_summary_finalfn
+    );
+
 
 --------------------------------------
 -- weights_astext(bytea)
@@ -243,6 +318,32 @@ AS 'MODULE_PATHNAME', 'weights_to_text'
     LANGUAGE c PARALLEL SAFE
     COST 100;
 
+--------------------------------------
+-- weights_compress(bytea) / weights_compress(bytea, 'f16')
+-- bytea of weights of ONE observation or of complete weights
+-- Convert weights to the compact v2 format: neighbor ids are stored as delta varints,
+-- weights values as 'f32' (default), 'f16' or 'q8'
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_compress(bytea)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'weights_bytea_compress'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION weights_compress(bytea, text)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'weights_bytea_compress'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- weights_decompress(bytea)
+-- bytea of weights of ONE observation or of complete weights
+-- Convert weights to the v1 format
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_decompress(bytea)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'weights_bytea_decompress'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
 --------------------------------------
 -- DEPRECATED: geoda_weights_at()
 --------------------------------------
@@ -0,0 +1,84 @@
+-------------------------------------
+-- Changes:
+-- 2026-10-16 Add knn_index(), knn_weights_block() and weights_merge() to create KNN weights in blocks
+-- 2026-10-17 Document the rows per observation of weights_merge() with geoda_weights_toset()
+--------------------------------------
+
+--------------------------------------
+-- knn_index(gid, wkb_geometry) / knn_index(gid, wkb_geometry, is_arc)
+-- AGGREGATE function: create the kd-tree of the centroids once, and store it as bytea
+-- DEPENDENCIES
+-- sfunc: bytea_knn_index_transfn()
+-- finalfunc: knn_index_finalfn()
+--------------------------------------
+CREATE OR REPLACE FUNCTION
+    knn_index_finalfn(internal)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'knn_index_finalfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+    bytea_knn_index_transfn(internal, integer, bytea)
+    RETURNS internal
+AS 'MODULE_PATHNAME', 'bytea_knn_index_transfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE AGGREGATE knn_index(integer, bytea) (
+    sfunc = bytea_knn_index_transfn,
+    stype = internal,
+    finalfunc = knn_index_finalfn
+    );
+
+CREATE OR REPLACE FUNCTION
+    bytea_knn_index_transfn(internal, integer, bytea, boolean)
+    RETURNS internal
+AS 'MODULE_PATHNAME', 'bytea_knn_index_transfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE AGGREGATE knn_index(integer, bytea, boolean) (
+    sfunc = bytea_knn_index_transfn,
+    stype = internal,
+    finalfunc = knn_index_finalfn
+    );
+
+--------------------------------------
+-- knn_weights_block(knn_index, 4, start_fid, end_fid)
+-- knn_weights_block(knn_index, 4, start_fid, end_fid, power, is_inverse, is_mile, cpu_threads)
+-- The KNN weights of the observations with start_fid <= fid < end_fid, one bytea per observation
+--------------------------------------
+CREATE OR REPLACE FUNCTION knn_weights_block(bytea, integer, bigint, bigint)
+    RETURNS SETOF bytea
+AS 'MODULE_PATHNAME', 'pg_knn_weights_block'
+    LANGUAGE 'c' IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION knn_weights_block(bytea, integer, bigint, bigint, float4, boolean, boolean, integer)
+    RETURNS SETOF bytea
+AS 'MODULE_PATHNAME', 'pg_knn_weights_block'
+    LANGUAGE 'c' IMMUTABLE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- weights_merge(w)
+-- AGGREGATE function: merge the weights of observations (e.g. the blocks of knn_weights_block())
+-- into a weights bytea, sorted by fid. An aggregate returns one value, so the rows per
+-- observation (as knn_weights()) are: SELECT geoda_weights_toset(weights_merge(w)) FROM ...
+-- DEPENDENCIES
+-- sfunc: weights_merge_transfn()
+-- finalfunc: weights_merge_finalfn()
+--------------------------------------
+CREATE OR REPLACE FUNCTION
+    weights_merge_finalfn(internal)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'weights_merge_finalfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+    weights_merge_transfn(internal, bytea)
+    RETURNS internal
+AS 'MODULE_PATHNAME', 'weights_merge_transfn'
+    LANGUAGE c PARALLEL SAFE;
+
+CREATE AGGREGATE weights_merge(bytea) (
+    sfunc = weights_merge_transfn,
+    stype = internal,
+    finalfunc = weights_merge_finalfn
+    );
@@ -0,0 +1,47 @@
+-------------------------------------
+-- Changes:
+-- 2026-10-16 Add weights_cache_stats() and weights_cache_reset() for the shared weights cache
+-- 2026-10-16 Add weights_build_cache_stats() and weights_build_cache_reset() for the weights build cache
+-- 2026-10-17 The weights build cache is disabled by default
+--------------------------------------
+
+--------------------------------------
+-- weights_cache_stats()
+-- The weights of the query Windows (e.g. of local_moran(hr60, queen_w) OVER()) shared by
+-- all backends: number of entries, size (bytes), hits and misses.
+-- Needs shared_preload_libraries = 'postgeoda'; the size is capped by postgeoda.weights_cache_size (MB)
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_cache_stats(OUT entries integer, OUT size bigint, OUT hits bigint, OUT misses bigint)
+    RETURNS record
+AS 'MODULE_PATHNAME', 'weights_cache_stats'
+    LANGUAGE c VOLATILE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- weights_cache_reset()
+-- Remove all weights from the shared weights cache
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_cache_reset()
+    RETURNS void
+AS 'MODULE_PATHNAME', 'weights_cache_reset'
+    LANGUAGE c VOLATILE STRICT PARALLEL UNSAFE;
+
+--------------------------------------
+-- weights_build_cache_stats()
+-- The weights built by queen_weights(), rook_weights(), knn_weights() and kernel_knn_weights()
+-- kept in the current backend, so the same weights (same fids, geometries and parameters)
+-- are not built again: number of entries, size (bytes), hits and misses.
+-- The size is capped by postgeoda.weights_build_cache_size (MB, 0 to disable, the default)
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_build_cache_stats(OUT entries integer, OUT size bigint, OUT hits bigint, OUT misses bigint)
+    RETURNS record
+AS 'MODULE_PATHNAME', 'weights_build_cache_stats'
+    LANGUAGE c VOLATILE STRICT PARALLEL RESTRICTED;
+
+--------------------------------------
+-- weights_build_cache_reset()
+-- Remove all weights from the weights build cache of the current backend
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_build_cache_reset()
+    RETURNS void
+AS 'MODULE_PATHNAME', 'weights_build_cache_reset'
+    LANGUAGE c VOLATILE STRICT PARALLEL RESTRICTED;
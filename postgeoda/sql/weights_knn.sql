@@ -5,6 +5,10 @@
 -- 2021-4-21 Expose knn_weights() as the major interface for queen weights creation
 -- 2012-4-26 Add knn_weights(gid, geom, 4, power, is_arc, is_mile)
 -- 2012-4-20 Add neighbor_match_test()
+-- 2026-10-16 Add knn_weights_index() using the GiST index of the geometry column
+-- 2026-10-16 Add knn_weights(..., cpu_threads) and knn_weights_sub(..., cpu_threads)
+-- 2026-10-17 knn_weights() with one thread is created by libgeoda; the fids must be unique
+-- 2026-10-17 knn_weights_index() orders the neighbors by the distance of the centroids, with the distances as weights
 --------------------------------------
 
 -- knn_weights(gid, geom, 4)
@@ -25,6 +29,22 @@ CREATE OR REPLACE FUNCTION knn_weights(anyelement, bytea, integer, numeric, bool
 AS 'MODULE_PATHNAME', 'pg_knn_weights_window'
     LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
 
+-- knn_weights(gid, geom, 4, power, is_inverse, is_arc, is_mile, cpu_threads)
+-- with cpu_threads > 1, the neighbors are queried from a kd-tree by cpu_threads threads (the
+-- weights are the distances, or distance^-power if is_inverse). The neighbors are the same as
+-- libgeoda's (one thread), sorted by distance then fid. The fids must be unique.
+CREATE OR REPLACE FUNCTION knn_weights(anyelement, bytea, integer, float4, boolean, boolean, boolean, integer)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'pg_knn_weights_window'
+    LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
+
+-- knn_weights_sub(gid, geom, 4, 0, 10000, power, is_inverse, is_arc, is_mile, cpu_threads)
+CREATE OR REPLACE FUNCTION knn_weights_sub(anyelement, bytea, integer, integer, integer,
+                                           float4, boolean, boolean, boolean, integer)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'pg_knn_weights_sub_window'
+    LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
+
 -- kernel_knn_weights(gid, geom, 4, 'gaussian')
 CREATE OR REPLACE FUNCTION kernel_knn_weights(anyelement, bytea, integer, character varying)
     RETURNS bytea
@@ -45,6 +65,21 @@ CREATE OR REPLACE FUNCTION kernel_knn_weights(anyelement, bytea, integer, charac
 AS 'MODULE_PATHNAME', 'pg_kernel_knn_weights_window'
     LANGUAGE 'c' IMMUTABLE STRICT WINDOW;
 
+-- knn_weights_index(gid, geom, 4, 'nat', 'gid', 'geom')
+-- Not a Window function: the k nearest neighbors of each row, by the distance of the centroids
+-- like knn_weights(), are queried from the table using the GiST index on the centroids of its
+-- geometry column (ORDER BY ST_Centroid(geom) <-> ST_Centroid($1) LIMIT k); the weights are
+-- the distances, or the inverse distances
+CREATE OR REPLACE FUNCTION knn_weights_index(integer, anyelement, integer, regclass, text, text)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'pg_knn_weights_index'
+    LANGUAGE 'c' STABLE STRICT PARALLEL SAFE;
+
+-- knn_weights_index(gid, geom, 4, 'nat', 'gid', 'geom', power, is_inverse)
+CREATE OR REPLACE FUNCTION knn_weights_index(integer, anyelement, integer, regclass, text, text, float4, boolean)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'pg_knn_weights_index'
+    LANGUAGE 'c' STABLE STRICT PARALLEL SAFE;
 
 -- neighbor_match_test(ARRAY[ep_pov, ep_unem], geom, 4)
 -- pg_neighbor_match_test_window
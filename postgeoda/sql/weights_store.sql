@@ -0,0 +1,63 @@
+-------------------------------------
+-- Changes:
+-- 2026-10-16 Add the weights store: weights of all observations in a server-side file, mapped read-only
+--------------------------------------
+
+--------------------------------------
+-- geoda_weights_store
+-- The weights stores by name: the path of the file (relative to the data directory or
+-- absolute), written by weights_store_export() or registered by weights_store_register()
+--------------------------------------
+CREATE TABLE geoda_weights_store (
+    name text PRIMARY KEY CHECK (octet_length(name) BETWEEN 1 AND 63),
+    path text NOT NULL,
+    num_obs bigint NOT NULL,
+    num_nbrs bigint NOT NULL,
+    has_weights boolean NOT NULL,
+    created timestamptz NOT NULL DEFAULT now()
+);
+SELECT pg_catalog.pg_extension_config_dump('geoda_weights_store', '');
+GRANT SELECT ON geoda_weights_store TO PUBLIC;
+
+--------------------------------------
+-- weights_store_export(name, w_table, w_column, path)
+-- Write the weights (bytea) in column w_column of w_table, one row per observation or
+-- a complete weights, to the weights store file path and register it as name.
+-- Needs superuser or pg_write_server_files; returns the number of observations
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_store_export(name text, w_table regclass, w_column text, path text)
+    RETURNS bigint
+AS 'MODULE_PATHNAME', 'weights_store_export'
+    LANGUAGE c VOLATILE STRICT PARALLEL UNSAFE;
+
+--------------------------------------
+-- weights_store_register(name, path)
+-- Register an existing weights store file as name, e.g. a file exported on another server.
+-- Needs superuser or pg_read_server_files; returns the number of observations
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_store_register(name text, path text)
+    RETURNS bigint
+AS 'MODULE_PATHNAME', 'weights_store_register'
+    LANGUAGE c VOLATILE STRICT PARALLEL UNSAFE;
+
+--------------------------------------
+-- weights_store_drop(name)
+-- Remove the weights store name from geoda_weights_store; the file is not removed
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_store_drop(name text)
+    RETURNS boolean
+AS $$
+    WITH d AS (DELETE FROM geoda_weights_store s WHERE s.name = $1 RETURNING 1)
+    SELECT count(*) > 0 FROM d;
+$$ LANGUAGE sql VOLATILE STRICT PARALLEL UNSAFE;
+
+--------------------------------------
+-- weights_store_ref(name, fid)
+-- The reference to the weights of observation fid in the weights store name, used as the
+-- weights of the LISA window functions, e.g.
+-- local_moran(hr60, weights_store_ref('nat_knn', ogc_fid)) OVER ()
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_store_ref(name text, fid integer)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'weights_store_ref'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
@@ -0,0 +1,131 @@
+-------------------------------------
+-- Changes:
+-- 2026-10-16 Add the geoda_weights type, weights_num_obs(), weights_num_neighbors(), weights_fid() and
+-- weights_set_compression()
+-- 2026-10-16 Add weights_neighbors()
+--------------------------------------
+
+--------------------------------------
+-- geoda_weights
+-- The weights of ONE observation or the complete weights (v1 or v2, see weights_compress()).
+-- The content is checked when it is read (text, COPY BINARY or the cast from bytea), and the
+-- type can be used wherever bytea of weights is used (implicit cast to bytea), e.g.
+--
+--   CREATE TABLE nat_w AS
+--       SELECT ogc_fid, hr60, queen_weights(ogc_fid, wkb_geometry) OVER()::geoda_weights AS queen_w FROM nat;
+--   SELECT local_moran(hr60, queen_w) OVER() FROM nat_w;
+--------------------------------------
+CREATE TYPE geoda_weights;
+
+CREATE OR REPLACE FUNCTION geoda_weights_in(cstring)
+    RETURNS geoda_weights
+AS 'MODULE_PATHNAME', 'geoda_weights_in'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION geoda_weights_out(geoda_weights)
+    RETURNS cstring
+AS 'MODULE_PATHNAME', 'geoda_weights_out'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION geoda_weights_recv(internal)
+    RETURNS geoda_weights
+AS 'MODULE_PATHNAME', 'geoda_weights_recv'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION geoda_weights_send(geoda_weights)
+    RETURNS bytea
+AS 'MODULE_PATHNAME', 'geoda_weights_send'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+-- STORAGE extended: compressed and/or stored out of line; see weights_set_compression()
+CREATE TYPE geoda_weights (
+    INPUT = geoda_weights_in,
+    OUTPUT = geoda_weights_out,
+    RECEIVE = geoda_weights_recv,
+    SEND = geoda_weights_send,
+    INTERNALLENGTH = VARIABLE,
+    ALIGNMENT = char,
+    STORAGE = extended
+);
+
+CREATE OR REPLACE FUNCTION geoda_weights(bytea)
+    RETURNS geoda_weights
+AS 'MODULE_PATHNAME', 'geoda_weights_from_bytea'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+-- bytea returned by the weights functions is checked when it is stored in a geoda_weights column
+CREATE CAST (bytea AS geoda_weights) WITH FUNCTION geoda_weights(bytea) AS ASSIGNMENT;
+
+-- the same content: all functions of bytea weights accept geoda_weights
+CREATE CAST (geoda_weights AS bytea) WITHOUT FUNCTION AS IMPLICIT;
+
+--------------------------------------
+-- weights_num_obs(w) / weights_num_neighbors(w) / weights_fid(w)
+-- Only the header of the weights is read (a slice of a TOASTed value), not the neighbors.
+-- weights_num_neighbors() and weights_fid() return NULL for the complete weights.
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_num_obs(geoda_weights)
+    RETURNS bigint
+AS 'MODULE_PATHNAME', 'weights_header_num_obs'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION weights_num_neighbors(geoda_weights)
+    RETURNS bigint
+AS 'MODULE_PATHNAME', 'weights_header_num_neighbors'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION weights_fid(geoda_weights)
+    RETURNS bigint
+AS 'MODULE_PATHNAME', 'weights_header_fid'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- weights_neighbors(w)
+-- The neighbor ids of the weights of ONE observation (bytea or geoda_weights), NULL for the
+-- complete weights, e.g. to collect the values of the neighbors for local_moran_fast()
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_neighbors(bytea)
+    RETURNS bigint[]
+AS 'MODULE_PATHNAME', 'weights_row_neighbors'
+    LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE;
+
+--------------------------------------
+-- weights_set_compression('nat', 'queen_w') / weights_set_compression('nat', 'queen_w', 'none')
+-- Set how a weights column is TOASTed:
+--   'lz4' (default): compressed with lz4 (PostgreSQL 14+ built with lz4; pglz otherwise)
+--   'pglz': compressed with pglz
+--   'none': not compressed, only moved out of line; best for the compact v2 weights, which
+--           pglz hardly compresses, and weights_num_neighbors() reads only the first bytes
+-- Only the values stored after the change are affected.
+--------------------------------------
+CREATE OR REPLACE FUNCTION weights_set_compression(tbl regclass, col name, method text DEFAULT 'lz4')
+    RETURNS text
+AS $$
+DECLARE
+    has_lz4 boolean := FALSE;
+BEGIN
+    IF method NOT IN ('lz4', 'pglz', 'none') THEN
+        RAISE EXCEPTION 'weights_set_compression: unknown method "%" (lz4, pglz or none)', method;
+    END IF;
+
+    IF method = 'none' THEN
+        EXECUTE format('ALTER TABLE %s ALTER COLUMN %I SET STORAGE EXTERNAL', tbl, col);
+        RETURN method;
+    END IF;
+
+    IF current_setting('server_version_num')::integer >= 140000 THEN
+        SELECT 'lz4' = ANY(enumvals) INTO has_lz4 FROM pg_settings WHERE name = 'default_toast_compression';
+    END IF;
+    IF method = 'lz4' AND NOT COALESCE(has_lz4, FALSE) THEN
+        RAISE NOTICE 'weights_set_compression: lz4 is not available, pglz is used';
+        method := 'pglz';
+    END IF;
+
+    EXECUTE format('ALTER TABLE %s ALTER COLUMN %I SET STORAGE EXTENDED', tbl, col);
+    IF current_setting('server_version_num')::integer >= 140000 THEN
+        EXECUTE format('ALTER TABLE %s ALTER COLUMN %I SET COMPRESSION %s', tbl, col, method);
+    END IF;
+    RETURN method;
+END
+$$
+LANGUAGE 'plpgsql';
@@ -5,124 +5,97 @@
  * 2021-1-27 Update to use libgeoda 0.0.6
  * 2021-4-28 Update constructor: when creating weights from bytea array in a query Window, remove the neighbors not in
  * the query window
+ * 2026-10-16 Read weights in v1 or v2 (weights_codec.h)
+ * 2026-10-16 Store the neighbors in CSR arrays instead of a map of BinElement
+ * 2026-10-16 Add GetCSR() and AllocCSR() for the shared weights cache
+ * 2026-10-16 Compute the statistics of the neighbors only when GetNbrStats() is called, in one pass
  */
 
+#include <algorithm>
+#include <limits>
+#include <boost/unordered_map.hpp>
+
 #include <libgeoda/pg/utils.h>
 #include "binweight.h"
 
 
-BinElement::BinElement() {
-
-}
-
-BinElement::~BinElement() {
-
-}
-
-uint32_t BinElement::getIdx() const {
-    return idx;
-}
-
-void BinElement::setIdx(uint32_t idx) {
-    BinElement::idx = idx;
-}
-
-void BinElement::setNbrIds(const std::vector<long> &nbrIds) {
-    nbr_ids = nbrIds;
-}
-
-void BinElement::setNbrWeights(const std::vector<double> &nbrWeights) {
-    nbr_weights = nbrWeights;
-}
-
-bool BinElement::checkNeighbor(uint32_t nbrIdx) {
-    // brutal force here , should be replaced by dict() check
-    for (size_t i=0; i<nbr_ids.size(); ++i) {
-        if (nbr_ids[i] == nbrIdx) {
-            return true;
-        }
-    }
-    return false;
-}
-
-const std::vector<long> &BinElement::getNbrIds() const {
-    return nbr_ids;
-}
-
-const std::vector<double> &BinElement::getNbrWeights() const {
-    return nbr_weights;
-}
-
-size_t BinElement::getSize() {
-    return nbr_ids.size();
-}
-
-
-BinWeight::BinWeight(const uint8_t* bw)
+/**
+ * Create weights from the bytea of complete weights
+ *
+ * The neighbors of the observation with index idx are at nbr_offsets[idx], so the observations
+ * are indexed by their idx (fid) as before.
+ *
+ * @param bw the content (byte) of complete weights, in v1 or v2
+ * @param bw_size
+ */
+BinWeight::BinWeight(const uint8_t* bw, size_t bw_size)
+: nbr_stats_done(false)
 {
+    WeightsReader start;
+    if (!weights_codec_open(bw, bw_size, &start)) {
+        lwerror("BinWeight: invalid weights (%d bytes).", (int)bw_size);
+    }
 
-    const uint8_t *pos = bw; // start position
-
-    // read w type from char
-    char w_type;
-    memcpy(&w_type, pos, sizeof(char));
-    pos += sizeof(char);
-
-    if (w_type == 'a') weight_type = gal_type;
-    else weight_type = gwt_type;
-
-    // first int32_t as number of observation
-    uint32_t n = 0;
-    memcpy(&n, pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t);
+    if (start.has_weights) weight_type = gwt_type;
+    else weight_type = gal_type;
 
+    uint32_t n = start.num_obs;
     this->num_obs = n;
 
-    for (size_t i=0; i<n; ++i)  {
-        uint32_t idx = 0;
-        uint16_t n_nbrs = 0;
-        uint32_t n_id=0;
-        BinElement *gl = new BinElement;
-
-        // read idx
-        memcpy(&idx, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t);
-
-        gl->setIdx(idx);
+    WeightsReader reader;
+    WeightsRow row;
+    size_t i;
 
-        // read number of neighbors
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
-
-        // read neighbor idx and weights
-        std::vector<long> nbr(n_nbrs);
-
-        for (size_t j=0; j<n_nbrs; ++j)  {
-            // read neighbor id
-            memcpy(&n_id, pos, sizeof(uint32_t));
-            pos += sizeof(uint32_t);
-            nbr[j] = n_id;
+    // the largest idx
+    size_t n_slots = n;
+    reader = start;
+    for (i=0; i<n; ++i)  {
+        if (!weights_codec_next(&reader, &row)) {
+            lwerror("BinWeight: the weights of %d-th observation are truncated.", (int)i);
         }
+        if ((size_t)row.idx + 1 > n_slots) n_slots = (size_t)row.idx + 1;
+    }
 
-        gl->setNbrIds(nbr);
+    // the number of neighbors of each idx; the last row wins if an idx is duplicated
+    nbr_offsets.assign(n_slots + 1, 0);
+    has_obs.assign(n_slots, false);
+    reader = start;
+    for (i=0; i<n; ++i)  {
+        weights_codec_next(&reader, &row);
+        nbr_offsets[row.idx + 1] = row.num_nbrs;
+        has_obs[row.idx] = true;
+    }
+    for (i=0; i<n_slots; ++i) {
+        nbr_offsets[i + 1] += nbr_offsets[i];
+    }
+    if (n_slots == n && std::find(has_obs.begin(), has_obs.end(), false) == has_obs.end()) {
+        has_obs.clear();
+    }
 
-        if (w_type == 'w') {
-            std::vector<double> nbrWeight(n_nbrs);
-            float n_weight;
+    // read neighbor idx and weights into their place
+    nbr_ids.resize(nbr_offsets[n_slots]);
+    if (start.has_weights) nbr_weights.resize(nbr_offsets[n_slots]);
 
-            for (size_t j=0; j<n_nbrs; ++j)  {
-                // read neighbor weight
-                memcpy(&n_weight, pos, sizeof(float));
-                pos += sizeof(float);
-                nbrWeight[j] = n_weight;
+    reader = start;
+    for (i=0; i<n; ++i)  {
+        weights_codec_next(&reader, &row);
+        size_t offset = nbr_offsets[row.idx];
+        if (nbr_offsets[row.idx + 1] - offset != row.num_nbrs) {
+            continue; // a duplicated idx
+        }
+        uint32_t *ids = (uint32_t*)nbr_ids.data() + offset;
+        if (!weights_codec_get_ids(&row, ids)) {
+            lwerror("BinWeight: invalid neighbors of observation %d.", (int)row.idx);
+        }
+        for (size_t j=0; j<row.num_nbrs; ++j) {
+            if (ids[j] > (uint32_t)std::numeric_limits<int32_t>::max()) {
+                lwerror("BinWeight: neighbor id %u of observation %d is too large.", ids[j], (int)row.idx);
             }
-
-            gl->setNbrWeights(nbrWeight);
         }
-
-        this->w_dict[idx] = gl;
+        if (start.has_weights) {
+            weights_codec_get_weights(&row, nbr_weights.data() + offset);
+        }
     }
-    this->GetNbrStats();
 }
 
 /**
@@ -131,105 +104,108 @@ BinWeight::BinWeight(const uint8_t* bw)
  * The weights will be constructed by removing the neighbors that are not in the query window
  *
  * @param N the length of the rows of weights (bytea)
- * @param bw the content (byte) of all weights
+ * @param bw the content (byte) of all weights, in v1 or v2
  * @param w_size the size (byte) of weights in each row
  */
 BinWeight::BinWeight(int N, const uint8_t** bw, const size_t* w_size)
+: nbr_stats_done(false)
 {
     boost::unordered_map<uint32_t, size_t> fid_dict;
+    std::vector<WeightsRow> rows(N);
+    bool has_weights = false;
+    size_t i, j;
 
     // get fids from the Window
-    for (size_t i=0; i<N; ++i)  {
-        BinElement *gl= new BinElement;
-        const uint8_t *pos = bw[i];
-        uint32_t fid;
-        // idx
-        memcpy(&fid, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t);
+    for (i=0; i<N; ++i)  {
+        if (!weights_codec_read_row(bw[i], w_size[i], &rows[i])) {
+            lwerror("BinWeight: invalid weights of %d-th row (%d bytes).", (int)i, (int)w_size[i]);
+        }
         // mapping fid to index
-        fid_dict[fid] = i;
+        fid_dict[rows[i].idx] = i;
+        if (rows[i].has_weights) has_weights = true;
+    }
+
+    // the row of each observation in the Window (the last one if a fid is duplicated)
+    std::vector<int> obs_row(N, -1);
+    for (i=0; i<N; ++i)  {
+        obs_row[fid_dict[rows[i].idx]] = (int)i;
+        this->fids.push_back(fid_dict[rows[i].idx]);
     }
 
     // update the weights by removing neighbors that are not in the query Window
-    for (size_t i=0; i<N; ++i)  {
-        BinElement *gl= new BinElement;
-        const uint8_t *pos = bw[i];
-
-        // idx
-        uint32_t fid;
-        memcpy(&fid, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t);
-
-        // number of neighbors
-        uint16_t n_nbrs;
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
-
-        // read neighbor id
-        std::vector<long> nbr;
-        std::vector<bool> nbr_flag(n_nbrs, false);
-        uint32_t n_id;
-
-        for (size_t j=0; j<n_nbrs; ++j)  {
-            // read neighbor id
-            memcpy(&n_id, pos, sizeof(uint32_t));
-            pos += sizeof(uint32_t);
-            if (fid_dict.find(n_id) != fid_dict.end()) {
-                nbr.push_back( fid_dict[n_id] );
-                nbr_flag[j] = true;
+    std::vector<uint32_t> ids;
+    std::vector<float> weights;
+    nbr_offsets.reserve(N + 1);
+    nbr_offsets.push_back(0);
+
+    for (i=0; i<N; ++i)  {
+        if (obs_row[i] >= 0) {
+            const WeightsRow& row = rows[obs_row[i]];
+            ids.resize(row.num_nbrs);
+            weights.assign(row.num_nbrs, 1.0f);
+            if (!weights_codec_get_ids(&row, ids.data())) {
+                lwerror("BinWeight: invalid neighbors of observation %d.", (int)row.idx);
             }
-        }
-        gl->setNbrIds(nbr);
-
-        // read neighbor weights, if needed
-        if (w_size[i] > (size_t)(pos - bw[i])) {
-            std::vector<double> nbrWeight;
-            float n_weight = 0;
-            for (size_t j = 0; j < n_nbrs; ++j) {
-                // read neighbor weight
-                memcpy(&n_weight, pos, sizeof(float));
-                pos += sizeof(float);
-                if (nbr_flag[j] && fid_dict.find(n_id) != fid_dict.end()) {
-                    nbrWeight.push_back(n_weight);
+            weights_codec_get_weights(&row, weights.data());
+
+            for (j=0; j<row.num_nbrs; ++j)  {
+                boost::unordered_map<uint32_t, size_t>::iterator it = fid_dict.find(ids[j]);
+                if (it != fid_dict.end()) {
+                    nbr_ids.push_back((int32_t)it->second);
+                    if (has_weights) nbr_weights.push_back(weights[j]);
                 }
             }
-            gl->setNbrWeights(nbrWeight);
         }
-
-        this->w_dict[ fid_dict[fid] ] = gl;
-        this->fids.push_back(fid_dict[fid]);
+        nbr_offsets.push_back(nbr_ids.size());
     }
 
     this->num_obs = N;
-    this->GetNbrStats();
 
-    lwdebug(1, "create_weights_from_barray(). sparsity=%f", this->GetSparsity());
+    lwdebug(1, "create_weights_from_barray(). N=%d, nnz=%d", N, (int)nbr_ids.size());
 }
 
 BinWeight::~BinWeight() {
-    // don't clean anything here, since the memory is managed by pg?
+}
+
+WeightsCSR BinWeight::GetCSR() {
+    WeightsCSR csr;
+    csr.num_obs = (uint32_t)fids.size();
+    csr.num_nbrs = nbr_ids.size();
+    csr.has_weights = !nbr_weights.empty();
+    csr.offsets = nbr_offsets.data();
+    csr.ids = nbr_ids.data();
+    csr.weights = nbr_weights.empty() ? NULL : nbr_weights.data();
+    csr.fids = fids.data();
+    return csr;
+}
+
+WeightsCSR BinWeight::AllocCSR(uint32_t n, uint64_t num_nbrs, bool has_weights) {
+    nbr_offsets.resize((size_t)n + 1);
+    nbr_ids.resize(num_nbrs);
+    nbr_weights.resize(has_weights ? num_nbrs : 0);
+    fids.resize(n);
+    has_obs.clear();
+    nbr_stats_done = false;
+    this->num_obs = n;
+    return GetCSR();
 }
 
 bool BinWeight::CheckNeighbor(int obs_idx, int nbr_idx) {
-    if (w_dict.find(obs_idx) != w_dict.end()) {
-        BinElement *el = w_dict[obs_idx];
-        return el->checkNeighbor(nbr_idx);
-    }
-    return false;
+    BinNeighbors nbrs = GetNeighborSpan(obs_idx);
+    return std::find(nbrs.begin(), nbrs.end(), nbr_idx) != nbrs.end();
 }
 
 const std::vector<long> BinWeight::GetNeighbors(int obs_idx) {
-    if (w_dict.find(obs_idx) != w_dict.end()) {
-        return w_dict[obs_idx]->getNbrIds();
-    }
-    return std::vector<long>();
+    BinNeighbors nbrs = GetNeighborSpan(obs_idx);
+    return std::vector<long>(nbrs.begin(), nbrs.end());
 }
 
 const std::vector<double> BinWeight::GetNeighborWeights(int obs_idx) {
-    if (w_dict.find(obs_idx) != w_dict.end()) {
-        return w_dict[obs_idx]->getNbrWeights();
+    BinNeighbors nbrs = GetNeighborSpan(obs_idx);
+    if (nbrs.weights == 0) {
+        return std::vector<double>();
     }
-    return std::vector<double>();
+    return std::vector<double>(nbrs.weights, nbrs.weights + nbrs.size);
 }
 
 void BinWeight::Update(const std::vector<bool> &undefs) {
@@ -242,61 +218,34 @@ bool BinWeight::HasIsolates() {
 }
 
 void BinWeight::GetNbrStats() {
-    // sparsity
-    double empties = 0;
-
-    boost::unordered_map<uint32_t, BinElement*>::iterator it;
-
-    for (it = w_dict.begin(); it!= w_dict.end(); ++it) {
-        if (it->second->getSize() == 0)
-            empties += 1;
-    }
-    sparsity = empties / (double)num_obs;
+    if (nbr_stats_done) return;
+    nbr_stats_done = true;
 
-    // density
-    // other
-    int i=0, sum_nnbrs = 0;
+    // number of neighbors (not including itself) of each observation, in one pass
+    size_t n_slots = nbr_offsets.empty() ? 0 : nbr_offsets.size() - 1;
+    double sum_nnbrs = 0;
     std::vector<int> nnbrs_array;
-    std::map<int, int> e_dict;
-
-    for (it = w_dict.begin(); it!= w_dict.end(); ++it) {
-        int n_nbrs = 0;
-        const std::vector<long>& nbrs = it->second->getNbrIds();
-        for (size_t j=0; j<nbrs.size();j++) {
-            int nbr = nbrs[j];
-            if (it->first != nbr) {
-                n_nbrs++;
-                e_dict[it->first] = nbr;
-                e_dict[nbr] = it->first;
-            }
-        }
+    nnbrs_array.reserve(n_slots);
+
+    for (size_t i=0; i<n_slots; ++i) {
+        if (!has_obs.empty() && !has_obs[i]) continue;
+        BinNeighbors nbrs = GetNeighborSpan((int)i);
+        int n_nbrs = (int)nbrs.size - (int)std::count(nbrs.begin(), nbrs.end(), (int32_t)i);
         sum_nnbrs += n_nbrs;
-        if (i==0 || n_nbrs < min_nbrs) min_nbrs = n_nbrs;
-        if (i==0 || n_nbrs > max_nbrs) max_nbrs = n_nbrs;
+        if (nnbrs_array.empty() || n_nbrs < min_nbrs) min_nbrs = n_nbrs;
+        if (nnbrs_array.empty() || n_nbrs > max_nbrs) max_nbrs = n_nbrs;
         nnbrs_array.push_back(n_nbrs);
-        i++;
     }
 
-    double n_edges = e_dict.size() / 2.0;
-    sparsity = 100.0 * sum_nnbrs / (double)(num_obs * num_obs);
-
-    if (num_obs > 0) mean_nbrs = sum_nnbrs / (double)num_obs;
+    if (num_obs == 0 || nnbrs_array.empty()) return;
 
-    std::sort(nnbrs_array.begin(), nnbrs_array.end());
-
-    if (num_obs % 2 ==0) {
-        median_nbrs = (nnbrs_array[num_obs/2-1] + nnbrs_array[num_obs/2]) / 2.0;
-    } else {
-        median_nbrs = nnbrs_array[num_obs/2];
-    }
+    sparsity = 100.0 * sum_nnbrs / ((double)num_obs * num_obs);
+    mean_nbrs = sum_nnbrs / (double)num_obs;
+    median_nbrs = median_of_counts(nnbrs_array);
 }
 
 int BinWeight::GetNbrSize(int obs_idx) {
-    if (w_dict.find(obs_idx) != w_dict.end()) {
-        BinElement *el = w_dict[obs_idx];
-        return el->getSize();
-    }
-    return 0;
+    return (int)GetNeighborSpan(obs_idx).size;
 }
 
 double BinWeight::SpatialLag(int obs_idx, const std::vector<double> &data) {
@@ -23,58 +23,116 @@
  * if nn=20, gal weights, total size = 7.6GB
  * if nn=20, gwt weights, total size = 15.08GB
  *
+ * The compact (v2) format with varint neighbor ids and optional half float or quantized
+ * weights is read as well, see weights_codec.h
+ *
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
+ * 2026-10-16 Read weights in v1 or v2 (weights_codec.h)
+ * 2026-10-16 Store the neighbors in CSR arrays instead of a map of BinElement
+ * 2026-10-16 Add GetCSR() and AllocCSR() for the shared weights cache
+ * 2026-10-16 Compute the statistics of the neighbors only when GetNbrStats() is called
  */
 
 #ifndef __BINWEIGHT__
 #define __BINWEIGHT__
 
+#include <stdint.h>
+#include <algorithm>
 #include <vector>
-#include <boost/unordered_map.hpp>
 
 #include <libgeoda/weights/GalWeight.h>
 #include <libgeoda/weights/GeodaWeight.h>
 
-class BinElement {
-protected:
-    uint32_t idx;
-
-    std::vector<long> nbr_ids;
-
-    std::vector<double> nbr_weights;
-
-public:
-    BinElement();
-    virtual ~BinElement();
-
-    void setIdx(uint32_t idx);
-    uint32_t getIdx() const;
-    void setNbrIds(const std::vector<long> &nbrIds);
-    void setNbrWeights(const std::vector<double> &nbrWeights);
-    const std::vector<long> &getNbrIds() const;
-    const std::vector<double> &getNbrWeights() const;
-    bool checkNeighbor(uint32_t nbrIdx);
-    size_t getSize();
+#include "weights_codec.h"
 
+/**
+ * median_of_counts
+ *
+ * The median of the numbers of neighbors, with std::nth_element in O(n) instead of sorting
+ * them. The order of counts is changed.
+ */
+inline double median_of_counts(std::vector<int>& counts) {
+    size_t n = counts.size();
+    if (n == 0) return 0;
+    std::vector<int>::iterator mid = counts.begin() + n / 2;
+    std::nth_element(counts.begin(), mid, counts.end());
+    if (n % 2 == 1) return *mid;
+    // the other middle is the largest of the first half
+    int lower = *std::max_element(counts.begin(), mid);
+    return (lower + *mid) / 2.0;
+}
 
+/**
+ * BinNeighbors
+ *
+ * A read-only view of the neighbors of one observation in BinWeight: no copy is made, the
+ * pointers are valid as long as the BinWeight exists.
+ */
+struct BinNeighbors {
+    const int32_t *ids;
+    const float *weights; /* NULL if the weights have no weights values (GAL) */
+    size_t size;
+
+    const int32_t *begin() const { return ids; }
+    const int32_t *end() const { return ids + size; }
+    int32_t operator[](size_t j) const { return ids[j]; }
+    float GetWeight(size_t j) const { return weights ? weights[j] : 1.0f; }
 };
 
+/**
+ * BinWeight
+ *
+ * Spatial weights read from bytea. The neighbors are stored in compressed sparse row (CSR)
+ * arrays: the neighbors of i-th observation are nbr_ids[nbr_offsets[i], nbr_offsets[i+1]),
+ * and their weights values are at the same positions in nbr_weights (empty for GAL weights).
+ * Use GetNeighborSpan() to access them without copy; GetNeighbors() and GetNeighborWeights()
+ * return copies as required by GeoDaWeight.
+ */
 class BinWeight : public GeoDaWeight {
-    boost::unordered_map<uint32_t, BinElement*> w_dict;
+    std::vector<uint64_t> nbr_offsets;
+
+    std::vector<int32_t> nbr_ids;
+
+    std::vector<float> nbr_weights;
 
     std::vector<uint32_t> fids;
 
+    // GetNbrStats() was called: the statistics are not used by the LISA, so they are not
+    // computed when the weights are created
+    bool nbr_stats_done;
+
 public:
     const std::vector<uint32_t> &getFids() const;
 
 public:
-    BinWeight() {}
-    BinWeight(const uint8_t* bw);
+    BinWeight() : nbr_stats_done(false) {}
+    BinWeight(const uint8_t* bw, size_t bw_size);
     BinWeight(int N, const uint8_t** bw, const size_t* w_size);
 
     virtual ~BinWeight();
 
+    BinNeighbors GetNeighborSpan(int obs_idx) const {
+        if (obs_idx < 0 || (size_t)obs_idx + 1 >= nbr_offsets.size()) {
+            BinNeighbors empty = {0, 0, 0};
+            return empty;
+        }
+        size_t start = nbr_offsets[obs_idx];
+        BinNeighbors nbrs;
+        nbrs.ids = nbr_ids.data() + start;
+        nbrs.weights = nbr_weights.empty() ? 0 : nbr_weights.data() + start;
+        nbrs.size = nbr_offsets[obs_idx + 1] - start;
+        return nbrs;
+    }
+
+    bool HasWeightsValues() const { return !nbr_weights.empty(); }
+
+    // the CSR arrays of the weights in Window, to copy them to the shared weights cache
+    WeightsCSR GetCSR();
+
+    // resize the CSR arrays of the weights in Window, to copy them from the shared weights cache
+    WeightsCSR AllocCSR(uint32_t n, uint64_t num_nbrs, bool has_weights);
+
     virtual bool   CheckNeighbor(int obs_idx, int nbr_idx);
     virtual const  std::vector<long> GetNeighbors(int obs_idx);
     virtual const  std::vector<double> GetNeighborWeights(int obs_idx);
@@ -94,5 +152,8 @@ public:
                         const char* id_var_name,
                         const std::vector<std::string>& id_vec) {return false;}
 
+protected:
+    // the observations that have a row in the weights, if not all (e.g. fids starting from 1)
+    std::vector<bool> has_obs;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,240 @@
+/**
+ * Changes:
+ * 2026-10-16 Add BinWeightView: read-only weights over the bytea rows of a query Window
+ * 2026-10-16 Add create_window_weights() to use the shared weights cache
+ * 2026-10-16 Compute the statistics of the neighbors only when GetNbrStats() is called, in one pass
+ * 2026-10-16 Add BinWeightView(rows) and create_store_weights() for the weights store
+ * 2026-10-17 Resolve the neighbors once into CSR arrays in Init(), read by GetNeighbors() and
+ * GetNeighborWeights()
+ */
+
+#include <algorithm>
+#include <new>
+
+#include <libgeoda/pg/utils.h>
+#include "binweight.h"
+#include "binweight_view.h"
+#include "weights_cache.h"
+#include "weights_store.h"
+
+/**
+ * Create weights from bytea in Window
+ *
+ * @param N the length of the rows of weights (bytea)
+ * @param bw the content (byte) of all weights, in v1 or v2
+ * @param w_size the size (byte) of weights in each row
+ */
+BinWeightView::BinWeightView(int N, const uint8_t** bw, const size_t* w_size)
+: has_weights(false), nbr_stats_done(false)
+{
+    rows.resize(N);
+    for (int i=0; i<N; ++i)  {
+        if (!weights_codec_read_row(bw[i], w_size[i], &rows[i])) {
+            lwerror("BinWeightView: invalid weights of %d-th row (%d bytes).", i, (int)w_size[i]);
+        }
+    }
+    Init();
+}
+
+/**
+ * Create weights from the weights of each row
+ *
+ * @param rows e.g. the rows of a weights store
+ */
+BinWeightView::BinWeightView(const std::vector<WeightsRow>& rows)
+: rows(rows), has_weights(false), nbr_stats_done(false)
+{
+    Init();
+}
+
+void BinWeightView::Init()
+{
+    int i, N = (int)rows.size();
+    fid_pos.resize(N);
+
+    for (i=0; i<N; ++i)  {
+        fid_pos[i].fid = rows[i].idx;
+        fid_pos[i].pos = (uint32_t)i;
+        if (rows[i].has_weights) has_weights = true;
+    }
+
+    // sort by fid, and keep the last row of a duplicated fid
+    std::sort(fid_pos.begin(), fid_pos.end());
+    size_t n_fids = 0;
+    for (size_t j=0; j<fid_pos.size(); ++j) {
+        if (j + 1 < fid_pos.size() && fid_pos[j + 1].fid == fid_pos[j].fid) continue;
+        fid_pos[n_fids++] = fid_pos[j];
+    }
+    fid_pos.resize(n_fids);
+
+    fids.resize(N);
+    for (i=0; i<N; ++i)  {
+        fids[i] = (uint32_t)FindFid(rows[i].idx);
+    }
+
+    // the positions of the neighbors in the Window, resolved once; a row replaced by a
+    // duplicated fid has none
+    nbr_offsets.reserve(N + 1);
+    nbr_offsets.push_back(0);
+    for (i=0; i<N; ++i)  {
+        if (fids[i] == (uint32_t)i) {
+            const WeightsRow& row = rows[i];
+            WeightsIdIter it;
+            uint32_t nbr_id;
+            weights_codec_ids_begin(&row, &it);
+            while (weights_codec_ids_next(&it, &nbr_id)) {
+                int64_t pos = FindFid(nbr_id);
+                if (pos < 0) continue;
+                nbr_pos.push_back((uint32_t)pos);
+                if (has_weights) nbr_weights.push_back((float)weights_codec_weight_at(&row, it.j - 1));
+            }
+            if (it.j != row.num_nbrs) {
+                lwerror("BinWeightView: invalid neighbors of observation %d.", (int)row.idx);
+            }
+        }
+        nbr_offsets.push_back(nbr_pos.size());
+    }
+
+    // the bytea of the rows are not read anymore
+    std::vector<WeightsRow>().swap(rows);
+
+    this->num_obs = N;
+
+    lwdebug(1, "BinWeightView(). N=%d, nnz=%d", N, (int)nbr_pos.size());
+}
+
+int64_t BinWeightView::FindFid(uint32_t fid) const {
+    FidPos key = {fid, 0};
+    std::vector<FidPos>::const_iterator it = std::lower_bound(fid_pos.begin(), fid_pos.end(), key);
+    if (it == fid_pos.end() || it->fid != fid) return -1;
+    return it->pos;
+}
+
+bool BinWeightView::CheckNeighbor(int obs_idx, int nbr_idx) {
+    if (obs_idx < 0 || obs_idx >= num_obs || nbr_idx < 0 || nbr_idx >= num_obs) return false;
+    const uint32_t *begin = nbr_pos.data() + nbr_offsets[obs_idx];
+    const uint32_t *end = nbr_pos.data() + nbr_offsets[obs_idx + 1];
+    return std::find(begin, end, (uint32_t)nbr_idx) != end;
+}
+
+const std::vector<long> BinWeightView::GetNeighbors(int obs_idx) {
+    if (obs_idx < 0 || obs_idx >= num_obs) return std::vector<long>();
+    return std::vector<long>(nbr_pos.begin() + nbr_offsets[obs_idx], nbr_pos.begin() + nbr_offsets[obs_idx + 1]);
+}
+
+const std::vector<double> BinWeightView::GetNeighborWeights(int obs_idx) {
+    if (!has_weights || obs_idx < 0 || obs_idx >= num_obs) return std::vector<double>();
+    return std::vector<double>(nbr_weights.begin() + nbr_offsets[obs_idx],
+                               nbr_weights.begin() + nbr_offsets[obs_idx + 1]);
+}
+
+bool BinWeightView::HasIsolates() {
+    for (int i=0; i<num_obs; ++i) {
+        if (nbr_offsets[i + 1] == nbr_offsets[i]) return true;
+    }
+    return false;
+}
+
+void BinWeightView::GetNbrStats() {
+    if (nbr_stats_done) return;
+    nbr_stats_done = true;
+
+    // number of neighbors (not including itself) of each observation, in one pass
+    double sum_nnbrs = 0;
+    std::vector<int> nnbrs_array(num_obs, 0);
+
+    for (int i=0; i<num_obs; ++i) {
+        int n_nbrs = 0;
+        for (uint64_t j = nbr_offsets[i]; j < nbr_offsets[i + 1]; ++j) {
+            if (nbr_pos[j] != (uint32_t)i) n_nbrs += 1;
+        }
+        sum_nnbrs += n_nbrs;
+        if (i == 0 || n_nbrs < min_nbrs) min_nbrs = n_nbrs;
+        if (i == 0 || n_nbrs > max_nbrs) max_nbrs = n_nbrs;
+        nnbrs_array[i] = n_nbrs;
+    }
+
+    if (num_obs == 0) return;
+
+    sparsity = 100.0 * sum_nnbrs / ((double)num_obs * num_obs);
+    mean_nbrs = sum_nnbrs / (double)num_obs;
+    median_nbrs = median_of_counts(nnbrs_array);
+}
+
+int BinWeightView::GetNbrSize(int obs_idx) {
+    if (obs_idx < 0 || obs_idx >= num_obs) return 0;
+    return (int)(nbr_offsets[obs_idx + 1] - nbr_offsets[obs_idx]);
+}
+
+double BinWeightView::SpatialLag(int obs_idx, const std::vector<double> &data) {
+    return 0;
+}
+
+static void alloc_binweight_csr(void *arg, WeightsCSR *csr) {
+    BinWeight *w = (BinWeight*)arg;
+    try {
+        *csr = w->AllocCSR(csr->num_obs, csr->num_nbrs, csr->has_weights);
+    } catch (std::bad_alloc&) {
+        lwerror("create_window_weights: out of memory (N=%d).", (int)csr->num_obs);
+    }
+}
+
+/**
+ * create_store_weights
+ *
+ * The weights of the rows in a query Window from the weights store of their references. A
+ * fid that is not in the weights store has no neighbors.
+ */
+static GeoDaWeight* create_store_weights(int N, const uint8_t** bw, const size_t* w_size)
+{
+    uint32_t fid;
+    const char *name, *row_name;
+    size_t name_len, row_name_len;
+    weights_codec_read_store_ref(bw[0], w_size[0], &fid, &name, &name_len);
+    const WeightsStore *store = weights_store_open(name, name_len);
+
+    std::vector<WeightsRow> rows(N);
+    for (int i=0; i<N; ++i) {
+        if (!weights_codec_read_store_ref(bw[i], w_size[i], &fid, &row_name, &row_name_len) ||
+            row_name_len != name_len || memcmp(row_name, name, name_len) != 0) {
+            lwerror("create_window_weights: %d-th row is not a reference to the same weights store.", i);
+        }
+        int64_t r = weights_store_find(store, fid);
+        if (r < 0) {
+            memset(&rows[i], 0, sizeof(WeightsRow));
+            rows[i].version = 1;
+            rows[i].idx = fid;
+        } else if (!weights_store_row(store, (uint32_t)r, &rows[i])) {
+            lwerror("create_window_weights: invalid weights of observation %d in the weights store.", (int)fid);
+        }
+    }
+    return new BinWeightView(rows);
+}
+
+GeoDaWeight* create_window_weights(int N, const uint8_t** bw, const size_t* w_size)
+{
+    uint32_t ref_fid;
+    const char *ref_name;
+    size_t ref_name_len;
+    if (N > 0 && weights_codec_read_store_ref(bw[0], w_size[0], &ref_fid, &ref_name, &ref_name_len)) {
+        return create_store_weights(N, bw, w_size);
+    }
+
+    if (!weights_cache_enabled()) {
+        return new BinWeightView(N, bw, w_size);
+    }
+
+    WeightsCacheKey key;
+    weights_cache_key(&key, N, bw, w_size);
+
+    BinWeight *w = new BinWeight();
+    if (weights_cache_get(&key, alloc_binweight_csr, w)) {
+        return w;
+    }
+    delete w;
+
+    w = new BinWeight(N, bw, w_size);
+    WeightsCSR csr = w->GetCSR();
+    weights_cache_put(&key, &csr);
+    return w;
+}
@@ -0,0 +1,117 @@
+/**
+ * Changes:
+ * 2026-10-16 Add BinWeightView: read-only weights over the bytea rows of a query Window
+ * 2026-10-16 Add create_window_weights() to use the shared weights cache
+ * 2026-10-16 Compute the statistics of the neighbors only when GetNbrStats() is called
+ * 2026-10-16 Add BinWeightView(rows) for the weights store; create_window_weights() reads the
+ * references to a weights store
+ * 2026-10-17 Resolve the neighbors once into CSR arrays in Init()
+ */
+
+#ifndef __BINWEIGHT_VIEW__
+#define __BINWEIGHT_VIEW__
+
+#include <stdint.h>
+#include <vector>
+
+#include <libgeoda/weights/GeodaWeight.h>
+
+#include "weights_codec.h"
+
+/**
+ * BinWeightView
+ *
+ * Spatial weights over the weights (bytea) of the rows in a query Window, in v1 or v2
+ * (weights_codec.h). The fids of the neighbors are mapped once to the positions in the
+ * Window, by a binary search in a sorted array, into compressed sparse row (CSR) arrays
+ * like BinWeight's, which serve GetNeighbors() and GetNeighborWeights() without decoding
+ * the bytea again. The neighbors that are not in the Window are removed, the same as
+ * BinWeight(N, bw, w_size).
+ *
+ * The memory is O(N + number of neighbors), and the bytea of the rows are only read by the
+ * constructor.
+ */
+class BinWeightView : public GeoDaWeight {
+    struct FidPos {
+        uint32_t fid;
+        uint32_t pos;
+
+        bool operator<(const FidPos& other) const {
+            return fid < other.fid || (fid == other.fid && pos < other.pos);
+        }
+    };
+
+    // the parsed header of the weights of each row, pointing to the bytea; only used by Init()
+    std::vector<WeightsRow> rows;
+
+    // (fid, position in the Window), sorted by fid; the last row wins if a fid is duplicated
+    std::vector<FidPos> fid_pos;
+
+    // the position of the fid of each row
+    std::vector<uint32_t> fids;
+
+    // the neighbors in the Window of i-th row are nbr_pos[nbr_offsets[i], nbr_offsets[i+1]),
+    // with their weights values at the same positions in nbr_weights (empty without weights)
+    std::vector<uint64_t> nbr_offsets;
+
+    std::vector<uint32_t> nbr_pos;
+
+    std::vector<float> nbr_weights;
+
+    bool has_weights;
+
+    // GetNbrStats() was called
+    bool nbr_stats_done;
+
+    // the position in the Window of the fid, or -1 if the fid is not in the Window
+    int64_t FindFid(uint32_t fid) const;
+
+    // index the fids and resolve the neighbors of the rows into the CSR arrays
+    void Init();
+
+public:
+    BinWeightView(int N, const uint8_t** bw, const size_t* w_size);
+
+    // the weights of each row of the Window, e.g. from a weights store (weights_store.h),
+    // which must exist as long as the view exists
+    explicit BinWeightView(const std::vector<WeightsRow>& rows);
+
+    virtual ~BinWeightView() {}
+
+    const std::vector<uint32_t> &getFids() const { return fids; }
+
+    virtual bool   CheckNeighbor(int obs_idx, int nbr_idx);
+    virtual const  std::vector<long> GetNeighbors(int obs_idx);
+    virtual const  std::vector<double> GetNeighborWeights(int obs_idx);
+    virtual void   Update(const std::vector<bool>& undefs) {}
+    virtual bool   HasIsolates();
+    virtual void   GetNbrStats();
+
+    virtual int    GetNbrSize(int obs_idx);
+    virtual double SpatialLag(int obs_idx, const std::vector<double>& data);
+    virtual bool   Save(const char* ofname,
+                        const char* layer_name,
+                        const char* id_var_name,
+                        const std::vector<int>& id_vec) { return false;}
+
+    virtual bool   Save(const char* ofname,
+                        const char* layer_name,
+                        const char* id_var_name,
+                        const std::vector<std::string>& id_vec) {return false;}
+};
+
+/**
+ * create_window_weights
+ *
+ * The weights in a query Window: a BinWeight copied from the shared weights cache
+ * (weights_cache.h) or created and added to the cache if it is enabled, otherwise a
+ * BinWeightView, with the neighbors resolved into CSR arrays like BinWeight's. If the rows are references to a weights store (weights_store_ref()),
+ * a BinWeightView over the mapped weights store.
+ *
+ * @param N the length of the rows of weights (bytea)
+ * @param bw the content (byte) of all weights, in v1 or v2
+ * @param w_size the size (byte) of weights in each row
+ * @return
+ */
+GeoDaWeight* create_window_weights(int N, const uint8_t** bw, const size_t* w_size);
+#endif
@@ -0,0 +1,321 @@
+/**
+ * Changes:
+ * 2026-10-16 Add ContiguityBuilder: tiled, multi-threaded queen/rook weights
+ * 2026-10-16 Use parallel_for() from parallel.h
+ * 2026-10-17 Match the vertices exactly only; remove precision_threshold
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+
+#include <libgeoda/geofeature.h>
+
+#include "contiguity.h"
+#include "parallel.h"
+
+namespace {
+
+typedef std::vector<std::pair<uint32_t, uint32_t> > PairList;
+
+struct VertexRecord {
+    int64_t x, y;
+    uint32_t poly;
+
+    bool operator<(const VertexRecord& o) const {
+        if (x != o.x) return x < o.x;
+        if (y != o.y) return y < o.y;
+        return poly < o.poly;
+    }
+    bool SameKey(const VertexRecord& o) const {
+        return x == o.x && y == o.y;
+    }
+};
+
+struct EdgeRecord {
+    int64_t x1, y1, x2, y2; // (x1,y1) < (x2,y2)
+    uint32_t poly;
+
+    bool operator<(const EdgeRecord& o) const {
+        if (x1 != o.x1) return x1 < o.x1;
+        if (y1 != o.y1) return y1 < o.y1;
+        if (x2 != o.x2) return x2 < o.x2;
+        if (y2 != o.y2) return y2 < o.y2;
+        return poly < o.poly;
+    }
+    bool SameKey(const EdgeRecord& o) const {
+        return x1 == o.x1 && y1 == o.y1 && x2 == o.x2 && y2 == o.y2;
+    }
+};
+
+/**
+ * Sort the records of a tile, and emit a pair (p, q), p < q, for each two polygons
+ * that have a record with the same key
+ */
+template <class Record>
+void pairs_in_tile(std::vector<Record>& recs, PairList& out)
+{
+    std::sort(recs.begin(), recs.end());
+
+    std::vector<uint32_t> group;
+    size_t i = 0, n = recs.size();
+    while (i < n) {
+        size_t j = i + 1;
+        while (j < n && recs[j].SameKey(recs[i])) ++j;
+        if (j - i > 1) {
+            group.clear();
+            for (size_t k = i; k < j; ++k) {
+                // records are sorted by polygon in a group
+                if (group.empty() || group.back() != recs[k].poly) group.push_back(recs[k].poly);
+            }
+            for (size_t a = 0; a < group.size(); ++a) {
+                for (size_t b = a + 1; b < group.size(); ++b) {
+                    out.push_back(std::make_pair(group[a], group[b]));
+                }
+            }
+        }
+        i = j;
+    }
+}
+
+/**
+ * Collect the records from the buckets of all threads tile by tile, and find the pairs
+ * in each tile. buckets[thread][tile] are released once the tile is done.
+ */
+template <class Record>
+void pairs_in_tiles(int n_threads, int n_tiles, std::vector<std::vector<std::vector<Record> > >& buckets,
+                    std::vector<PairList>& pairs)
+{
+    parallel_for(n_threads, n_tiles, [&](int tid, size_t start, size_t end) {
+        std::vector<Record> recs;
+        for (size_t tile = start; tile < end; ++tile) {
+            size_t n_recs = 0;
+            for (size_t t = 0; t < buckets.size(); ++t) n_recs += buckets[t][tile].size();
+
+            recs.clear();
+            recs.reserve(n_recs);
+            for (size_t t = 0; t < buckets.size(); ++t) {
+                recs.insert(recs.end(), buckets[t][tile].begin(), buckets[t][tile].end());
+                std::vector<Record>().swap(buckets[t][tile]);
+            }
+            pairs_in_tile(recs, pairs[tid]);
+        }
+    });
+}
+
+}
+
+ContiguityBuilder::ContiguityBuilder(const std::vector<gda::PolygonContents*>& polys, bool is_queen,
+                                     int n_threads)
+: polys(polys), is_queen(is_queen), n_threads(n_threads), n_tiles(1), tile_min_x(0), tile_width(0)
+{
+    if (this->n_threads < 1) this->n_threads = 1;
+}
+
+ContiguityBuilder::~ContiguityBuilder()
+{
+}
+
+ContiguityBuilder::VertexKey ContiguityBuilder::MakeKey(double x, double y, double& key_x) const
+{
+    VertexKey key;
+    // exact match of coordinates: compare the bits, with -0.0 == 0.0
+    if (x == 0) x = 0;
+    if (y == 0) y = 0;
+    memcpy(&key.x, &x, sizeof(double));
+    memcpy(&key.y, &y, sizeof(double));
+    key_x = x;
+    return key;
+}
+
+int ContiguityBuilder::GetTile(double key_x) const
+{
+    if (n_tiles <= 1) return 0;
+    double t = std::floor((key_x - tile_min_x) / tile_width);
+    if (!(t >= 0)) return 0; // also NaN
+    if (t >= n_tiles) return n_tiles - 1;
+    return (int)t;
+}
+
+void ContiguityBuilder::Build(int order, bool inc_lower)
+{
+    size_t num_obs = polys.size();
+
+    // more tiles than threads, so a dense tile doesn't keep other threads waiting
+    double min_x = 0, max_x = 0;
+    bool has_box = false;
+    for (size_t i = 0; i < num_obs; ++i) {
+        gda::PolygonContents *poly = polys[i];
+        if (poly == 0 || poly->num_points == 0) continue;
+        if (!has_box || poly->box[0] < min_x) min_x = poly->box[0];
+        if (!has_box || poly->box[2] > max_x) max_x = poly->box[2];
+        has_box = true;
+    }
+    n_tiles = n_threads > 1 ? n_threads * 4 : 1;
+    tile_min_x = min_x;
+    tile_width = (max_x - min_x) / n_tiles;
+    if (!(tile_width > 0)) n_tiles = 1;
+
+    std::vector<PairList> pairs(n_threads);
+    FindPairs(pairs);
+    MergePairs(pairs);
+
+    if (order > 1) {
+        BuildHigherOrder(order, inc_lower);
+    }
+}
+
+void ContiguityBuilder::FindPairs(std::vector<PairList>& pairs)
+{
+    size_t num_obs = polys.size();
+
+    if (is_queen) {
+        // buckets[thread][tile]
+        std::vector<std::vector<std::vector<VertexRecord> > > buckets(
+                n_threads, std::vector<std::vector<VertexRecord> >(n_tiles));
+
+        parallel_for(n_threads, num_obs, [&](int tid, size_t start, size_t end) {
+            double key_x;
+            for (size_t i = start; i < end; ++i) {
+                gda::PolygonContents *poly = polys[i];
+                if (poly == 0) continue;
+                for (int k = 0; k < poly->num_points; ++k) {
+                    VertexKey key = MakeKey(poly->points[k].x, poly->points[k].y, key_x);
+                    VertexRecord rec = {key.x, key.y, (uint32_t)i};
+                    buckets[tid][GetTile(key_x)].push_back(rec);
+                }
+            }
+        });
+        pairs_in_tiles(n_threads, n_tiles, buckets, pairs);
+
+    } else {
+        std::vector<std::vector<std::vector<EdgeRecord> > > buckets(
+                n_threads, std::vector<std::vector<EdgeRecord> >(n_tiles));
+
+        parallel_for(n_threads, num_obs, [&](int tid, size_t start, size_t end) {
+            double key_x1, key_x2;
+            for (size_t i = start; i < end; ++i) {
+                gda::PolygonContents *poly = polys[i];
+                if (poly == 0) continue;
+                for (int part = 0; part < poly->num_parts; ++part) {
+                    int p_start = poly->parts[part];
+                    int p_end = part + 1 < poly->num_parts ? poly->parts[part + 1] : poly->num_points;
+                    // rings are closed, so the consecutive points are all the edges of a ring
+                    for (int k = p_start; k + 1 < p_end; ++k) {
+                        VertexKey a = MakeKey(poly->points[k].x, poly->points[k].y, key_x1);
+                        VertexKey b = MakeKey(poly->points[k + 1].x, poly->points[k + 1].y, key_x2);
+                        if (a.x == b.x && a.y == b.y) continue;
+                        bool a_first = a.x < b.x || (a.x == b.x && a.y < b.y);
+                        EdgeRecord rec;
+                        if (a_first) {
+                            rec.x1 = a.x; rec.y1 = a.y; rec.x2 = b.x; rec.y2 = b.y;
+                        } else {
+                            rec.x1 = b.x; rec.y1 = b.y; rec.x2 = a.x; rec.y2 = a.y;
+                        }
+                        rec.poly = (uint32_t)i;
+                        buckets[tid][GetTile(a_first ? key_x1 : key_x2)].push_back(rec);
+                    }
+                }
+            }
+        });
+        pairs_in_tiles(n_threads, n_tiles, buckets, pairs);
+    }
+}
+
+void ContiguityBuilder::MergePairs(std::vector<PairList>& pairs)
+{
+    size_t num_obs = polys.size();
+
+    // count the neighbors (with duplicates from different tiles) of each observation
+    std::vector<size_t> counts(num_obs + 1, 0);
+    for (size_t t = 0; t < pairs.size(); ++t) {
+        for (size_t i = 0; i < pairs[t].size(); ++i) {
+            counts[pairs[t][i].first] += 1;
+            counts[pairs[t][i].second] += 1;
+        }
+    }
+    std::vector<size_t> starts(num_obs + 1, 0);
+    for (size_t i = 0; i < num_obs; ++i) starts[i + 1] = starts[i] + counts[i];
+
+    std::vector<uint32_t> all_nbrs(starts[num_obs]);
+    std::vector<size_t> pos(starts.begin(), starts.end() - 1);
+    for (size_t t = 0; t < pairs.size(); ++t) {
+        for (size_t i = 0; i < pairs[t].size(); ++i) {
+            uint32_t p = pairs[t][i].first, q = pairs[t][i].second;
+            all_nbrs[pos[p]++] = q;
+            all_nbrs[pos[q]++] = p;
+        }
+        PairList().swap(pairs[t]);
+    }
+
+    // sort and remove the duplicates of each neighbor list
+    std::vector<size_t> n_unique(num_obs, 0);
+    parallel_for(n_threads, num_obs, [&](int tid, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            std::vector<uint32_t>::iterator first = all_nbrs.begin() + starts[i];
+            std::vector<uint32_t>::iterator last = all_nbrs.begin() + starts[i + 1];
+            std::sort(first, last);
+            n_unique[i] = std::unique(first, last) - first;
+        }
+    });
+
+    offsets.assign(num_obs + 1, 0);
+    for (size_t i = 0; i < num_obs; ++i) offsets[i + 1] = offsets[i] + n_unique[i];
+
+    nbrs.resize(offsets[num_obs]);
+    for (size_t i = 0; i < num_obs; ++i) {
+        std::copy(all_nbrs.begin() + starts[i], all_nbrs.begin() + starts[i] + n_unique[i],
+                  nbrs.begin() + offsets[i]);
+    }
+}
+
+void ContiguityBuilder::BuildHigherOrder(int order, bool inc_lower)
+{
+    size_t num_obs = polys.size();
+    std::vector<std::vector<uint32_t> > results(num_obs);
+
+    // breadth first search from each observation, up to depth = order
+    parallel_for(n_threads, num_obs, [&](int tid, size_t start, size_t end) {
+        std::vector<int> depth(num_obs, -1);
+        std::vector<uint32_t> visited, frontier, next;
+        for (size_t i = start; i < end; ++i) {
+            visited.clear();
+            frontier.clear();
+            frontier.push_back((uint32_t)i);
+            depth[i] = 0;
+            visited.push_back((uint32_t)i);
+
+            for (int d = 1; d <= order && !frontier.empty(); ++d) {
+                next.clear();
+                for (size_t f = 0; f < frontier.size(); ++f) {
+                    uint32_t u = frontier[f];
+                    for (size_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+                        uint32_t v = nbrs[k];
+                        if (depth[v] >= 0) continue;
+                        depth[v] = d;
+                        visited.push_back(v);
+                        next.push_back(v);
+                    }
+                }
+                frontier.swap(next);
+            }
+
+            std::vector<uint32_t>& nn = results[i];
+            for (size_t k = 0; k < visited.size(); ++k) {
+                uint32_t v = visited[k];
+                if (depth[v] == order || (inc_lower && depth[v] > 0)) nn.push_back(v);
+                depth[v] = -1;
+            }
+            std::sort(nn.begin(), nn.end());
+        }
+    });
+
+    offsets.assign(num_obs + 1, 0);
+    for (size_t i = 0; i < num_obs; ++i) offsets[i + 1] = offsets[i] + results[i].size();
+    nbrs.resize(offsets[num_obs]);
+    for (size_t i = 0; i < num_obs; ++i) {
+        std::copy(results[i].begin(), results[i].end(), nbrs.begin() + offsets[i]);
+        std::vector<uint32_t>().swap(results[i]);
+    }
+}
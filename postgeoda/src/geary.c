@@ -3,6 +3,7 @@
  *
  * Changes:
  * 2021-5-6 add pg_local_geary_window(), pg_local_multigeary_window()
+ * 2026-10-16 local_geary() with the "analytic" method returns the z-score
  */
 
 
@@ -76,7 +77,7 @@ Datum pg_local_geary_window(PG_FUNCTION_ARGS) {
 
         // read arguments
         int arg_index = 2;
-        lisa_arguments args = {999, 0, 0.05, 6, 123456789};
+        lisa_arguments args = {999, 0, 0.05, 6, 123456789, false, true};
 
         read_lisa_arguments(arg_index, PG_NARGS(), winobj, &args);
 
@@ -85,8 +86,9 @@ Datum pg_local_geary_window(PG_FUNCTION_ARGS) {
         double **result = local_geary_window(N, r, (const uint8_t**)w, w_size, args.permutations, args.method,
                 args.significance_cutoff, args.cpu_threads, args.seed);
 
-        // Safe the result
+        // Safe the result; the analytic method also returns the z-score
         context->result = result;
+        context->n_values = is_analytic_perm_method(args.method) ? 4 : 3;
         context->isdone = true;
 
         // Clean
@@ -105,13 +107,13 @@ Datum pg_local_geary_window(PG_FUNCTION_ARGS) {
 
     // Wrap the results in a new PostgreSQL array object.
     double *p = context->result[curpos];
-    Datum elems[3];
-    elems[0] = Float8GetDatum(p[0]); // double to Datum
-    elems[1] = Float8GetDatum(p[1]);
-    elems[2] = Float8GetDatum(p[2]);
+    int nelems = context->n_values;
+    Datum elems[4];
+    for (int i = 0; i < nelems; ++i) {
+        elems[i] = Float8GetDatum(p[i]); // double to Datum
+    }
     free(p);
 
-    int nelems = 3;
     Oid elmtype = FLOAT8OID;
     int16 elmlen;
     bool elmbyval;
@@ -0,0 +1,178 @@
+/**
+ * Changes:
+ * 2026-10-16 Add KdTree: a read-only kd-tree for multi-threaded KNN queries
+ * 2026-10-16 Add Serialize() and the constructor from serialized bytes; ids are fids
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "kdtree.h"
+
+// ranges not larger than this are scanned linearly
+#define KDTREE_LEAF_SIZE 8
+
+#define KDTREE_MAGIC 'K'
+#define KDTREE_VERSION 1
+#define KDTREE_HEADER_SIZE 8
+
+KdTree::KdTree(const std::vector<double>& coords, const std::vector<uint32_t>& in_ids, int dim, uint8_t flags)
+: dim(dim), flags(flags), n_points(in_ids.size())
+{
+    if (dim < 2 || dim > 3 || coords.size() != n_points * dim) {
+        throw std::runtime_error("KdTree: invalid dimension of coordinates");
+    }
+
+    // Build() only moves the indexes; the points are copied in tree order at the end
+    std::vector<uint32_t> order(n_points);
+    for (size_t i = 0; i < n_points; ++i) order[i] = (uint32_t)i;
+    Build(order, coords, 0, n_points, 0);
+
+    pts.resize(n_points * dim);
+    ids.resize(n_points);
+    positions.resize(n_points);
+    for (size_t pos = 0; pos < n_points; ++pos) {
+        size_t i = order[pos];
+        for (int d = 0; d < dim; ++d) pts[pos * dim + d] = coords[i * dim + d];
+        ids[pos] = in_ids[i];
+        positions[i] = pos;
+    }
+}
+
+KdTree::KdTree(const uint8_t* buf, size_t size)
+: dim(0), flags(0), n_points(0)
+{
+    if (size < KDTREE_HEADER_SIZE || buf[0] != KDTREE_MAGIC) {
+        throw std::runtime_error("KdTree: not a serialized kd-tree");
+    }
+    if (buf[1] != KDTREE_VERSION) {
+        throw std::runtime_error("KdTree: unsupported version of serialized kd-tree");
+    }
+    dim = buf[2];
+    flags = buf[3];
+    uint32_t n = 0;
+    memcpy(&n, buf + 4, sizeof(uint32_t));
+    n_points = n;
+
+    if (dim < 2 || dim > 3 ||
+        size != KDTREE_HEADER_SIZE + n_points * (sizeof(double) * dim + sizeof(uint32_t))) {
+        throw std::runtime_error("KdTree: the size of serialized kd-tree is not valid");
+    }
+
+    const uint8_t* pos = buf + KDTREE_HEADER_SIZE;
+    pts.resize(n_points * dim);
+    memcpy(pts.data(), pos, sizeof(double) * pts.size());
+    pos += sizeof(double) * pts.size();
+
+    ids.resize(n_points);
+    memcpy(ids.data(), pos, sizeof(uint32_t) * n_points);
+}
+
+KdTree::~KdTree()
+{
+}
+
+size_t KdTree::GetSerializedSize() const
+{
+    return KDTREE_HEADER_SIZE + n_points * (sizeof(double) * dim + sizeof(uint32_t));
+}
+
+void KdTree::Serialize(uint8_t* buf) const
+{
+    uint32_t n = (uint32_t)n_points;
+    buf[0] = KDTREE_MAGIC;
+    buf[1] = KDTREE_VERSION;
+    buf[2] = (uint8_t)dim;
+    buf[3] = flags;
+    memcpy(buf + 4, &n, sizeof(uint32_t));
+
+    uint8_t* pos = buf + KDTREE_HEADER_SIZE;
+    memcpy(pos, pts.data(), sizeof(double) * pts.size());
+    pos += sizeof(double) * pts.size();
+    memcpy(pos, ids.data(), sizeof(uint32_t) * n_points);
+}
+
+void KdTree::Build(std::vector<uint32_t>& order, const std::vector<double>& coords,
+                   size_t begin, size_t end, int depth)
+{
+    if (end - begin <= KDTREE_LEAF_SIZE) return;
+
+    int split_dim = depth % dim;
+    size_t mid = begin + (end - begin) / 2;
+    const int n_dim = dim;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&coords, n_dim, split_dim](uint32_t a, uint32_t b) {
+                         return coords[(size_t)a * n_dim + split_dim] < coords[(size_t)b * n_dim + split_dim];
+                     });
+
+    Build(order, coords, begin, mid, depth + 1);
+    Build(order, coords, mid + 1, end, depth + 1);
+}
+
+void KdTree::AddCandidate(size_t pos, const double* query, size_t k, uint32_t exclude,
+                          std::vector<Neighbor>& heap) const
+{
+    uint32_t id = ids[pos];
+    if (id == exclude) return;
+
+    const double* pt = &pts[pos * dim];
+    double dist = 0;
+    for (int d = 0; d < dim; ++d) {
+        double diff = pt[d] - query[d];
+        dist += diff * diff;
+    }
+
+    Neighbor nbr(dist, id);
+    if (heap.size() < k) {
+        heap.push_back(nbr);
+        std::push_heap(heap.begin(), heap.end());
+    } else if (nbr < heap.front()) {
+        // (distance, id) is smaller than the worst neighbor found so far
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = nbr;
+        std::push_heap(heap.begin(), heap.end());
+    }
+}
+
+void KdTree::Search(size_t begin, size_t end, int depth, const double* query, size_t k, uint32_t exclude,
+                    std::vector<Neighbor>& heap) const
+{
+    if (end - begin <= KDTREE_LEAF_SIZE) {
+        for (size_t i = begin; i < end; ++i) AddCandidate(i, query, k, exclude, heap);
+        return;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    AddCandidate(mid, query, k, exclude, heap);
+
+    int split_dim = depth % dim;
+    double diff = query[split_dim] - pts[mid * dim + split_dim];
+
+    // search the side of the query point first
+    if (diff < 0) {
+        Search(begin, mid, depth + 1, query, k, exclude, heap);
+    } else {
+        Search(mid + 1, end, depth + 1, query, k, exclude, heap);
+    }
+
+    // the other side can only have a point as close as the split plane; points with the
+    // same distance as the worst neighbor are still visited, since they can win the tie by id
+    if (heap.size() < k || diff * diff <= heap.front().first) {
+        if (diff < 0) {
+            Search(mid + 1, end, depth + 1, query, k, exclude, heap);
+        } else {
+            Search(begin, mid, depth + 1, query, k, exclude, heap);
+        }
+    }
+}
+
+void KdTree::Knn(const double* query, int k, uint32_t exclude, std::vector<Neighbor>& nbrs) const
+{
+    nbrs.clear();
+    if (k <= 0 || n_points == 0) return;
+
+    nbrs.reserve(k + 1);
+    Search(0, n_points, 0, query, (size_t)k, exclude, nbrs);
+    std::sort_heap(nbrs.begin(), nbrs.end());
+}
@@ -0,0 +1,109 @@
+/**
+ * Changes:
+ * 2026-10-16 Add KdTree: a read-only kd-tree for multi-threaded KNN queries
+ * 2026-10-16 Add Serialize() and the constructor from serialized bytes; ids are fids
+ */
+
+#ifndef __POST_KDTREE__
+#define __POST_KDTREE__
+
+#include <cstddef>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * KdTree
+ *
+ * A balanced kd-tree of points in 2 or 3 dimensions. The tree is stored implicitly: the
+ * points are reordered so that the node of the range [begin, end) is the point in the middle
+ * of the range, and its children are the two halves; the split dimension is the depth of the
+ * node modulo dim. After construction the tree is read-only, and Knn() keeps no state in the
+ * tree (unlike ANN, which uses global variables), so it can be called by multiple threads at
+ * the same time.
+ *
+ * Each point has an id (e.g. fid), which has to be unique. The neighbors are sorted by
+ * (distance, id), so the result is deterministic when there are ties.
+ *
+ * The tree can be serialized into bytes (see Serialize()), e.g. to be stored in a bytea, and
+ * loaded again without rebuilding it. The layout is (native byte order):
+ *
+ * char (1 byte): 'K'
+ * uint8 (1 byte): version
+ * uint8 (1 byte): dim
+ * uint8 (1 byte): flags (not used by KdTree, e.g. arc distance)
+ * uint32 (4 bytes): number of points: N
+ * double (8 bytes x dim x N): coordinates of the points in tree order
+ * uint32 (4 bytes x N): ids of the points in tree order
+ */
+class KdTree {
+public:
+    typedef std::pair<double, uint32_t> Neighbor; // (squared distance, id of point)
+
+    /**
+     * @param coords coordinates of the points: x0, y0, (z0,) x1, y1, (z1,) ...
+     * @param ids id of each point
+     * @param dim 2 or 3
+     * @param flags stored with the tree
+     */
+    KdTree(const std::vector<double>& coords, const std::vector<uint32_t>& ids, int dim, uint8_t flags = 0);
+
+    /**
+     * Load a tree from the bytes written by Serialize(). std::runtime_error is thrown if
+     * the bytes are not a valid tree.
+     */
+    KdTree(const uint8_t* buf, size_t size);
+
+    virtual ~KdTree();
+
+    size_t GetNumPoints() const { return n_points; }
+
+    int GetDim() const { return dim; }
+
+    uint8_t GetFlags() const { return flags; }
+
+    // point at position pos of the tree order
+    const double* GetPoint(size_t pos) const { return &pts[pos * dim]; }
+
+    uint32_t GetId(size_t pos) const { return ids[pos]; }
+
+    // tree position of the i-th input point; only available for a tree built from coordinates
+    const std::vector<size_t>& GetPositions() const { return positions; }
+
+    /**
+     * Knn()
+     *
+     * Find the k nearest neighbors of the query point, excluding the point with id
+     * `exclude` (e.g. the query point itself).
+     *
+     * @param query coordinates of the query point
+     * @param k
+     * @param exclude
+     * @param nbrs output, sorted by (squared distance, id)
+     */
+    void Knn(const double* query, int k, uint32_t exclude, std::vector<Neighbor>& nbrs) const;
+
+    size_t GetSerializedSize() const;
+
+    // write the tree to buf, which has GetSerializedSize() bytes
+    void Serialize(uint8_t* buf) const;
+
+protected:
+    int dim;
+    uint8_t flags;
+    size_t n_points;
+    std::vector<double> pts; // coordinates of the points in tree order
+    std::vector<uint32_t> ids; // ids of the points in tree order
+    std::vector<size_t> positions;
+
+    void Build(std::vector<uint32_t>& order, const std::vector<double>& coords,
+               size_t begin, size_t end, int depth);
+
+    void Search(size_t begin, size_t end, int depth, const double* query, size_t k, uint32_t exclude,
+                std::vector<Neighbor>& heap) const;
+
+    void AddCandidate(size_t pos, const double* query, size_t k, uint32_t exclude,
+                      std::vector<Neighbor>& heap) const;
+};
+
+#endif
@@ -4,11 +4,20 @@
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6; Abstract it for all different lisa functions
  * 2021-4-28 add check_scale_method(), check_scale_method()
+ * 2026-10-16 add batch_lisa_context
+ * 2026-10-16 add the "sequential" permutation method, only for the functions that set allow_sequential
+ * 2026-10-16 add the "analytic" method, only for the functions that set allow_analytic
+ * 2026-10-16 cap cpu_threads with parallel_threads() (the GUC postgeoda.max_threads)
+ * 2026-10-17 add local_moran_state_init()
+ * 2026-10-17 add the "philox" permutation method, only for the functions that set allow_sequential
+ * 2026-10-17 fix the comment of lisa_context.n_values
  */
 
 #ifndef GEODA_LISA_H
 #define GEODA_LISA_H
 
+#include "parallel.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,9 +44,23 @@ typedef struct {
     bool	isdone;
     bool	isnull;
     double   **result;
+    int     n_values; /* the number of values of each result, e.g. 3 (lisa, p-value, cluster) */
     /* variable length */
 } lisa_context;
 
+/**
+ * batch_lisa_context
+ *
+ * Data structure used in LISA Windows functions of more than one variable (e.g.
+ * batch_local_moran()) to return n_vars results of each row
+ */
+typedef struct {
+    bool	isdone;
+    bool	isnull;
+    int     n_vars;
+    double   **result;
+} batch_lisa_context;
+
 /**
  * check_if_numeric_type()
  *
@@ -97,7 +120,7 @@ static inline double get_numeric_val(Oid valsType, Datum arg)
 /**
  * check_perm_method
  *
- * Check if permutation method is one of: complete or lookup
+ * Check if permutation method is one of: complete, lookup, sequential, philox or analytic
  *
  * @param method
  * @return
@@ -111,11 +134,29 @@ static inline bool check_perm_method(const char* method) {
         return true;
     } else if (strncmp(method, "lookup", 6) == 0) {
         return true;
+    } else if (strncmp(method, "sequential", 10) == 0) {
+        return true;
+    } else if (strncmp(method, "philox", 6) == 0) {
+        return true;
+    } else if (strncmp(method, "analytic", 8) == 0) {
+        return true;
     }
 
     return false;
 }
 
+static inline bool is_sequential_perm_method(const char* method) {
+    return method != 0 && strncmp(method, "sequential", 10) == 0;
+}
+
+static inline bool is_philox_perm_method(const char* method) {
+    return method != 0 && strncmp(method, "philox", 6) == 0;
+}
+
+static inline bool is_analytic_perm_method(const char* method) {
+    return method != 0 && strncmp(method, "analytic", 8) == 0;
+}
+
 static inline bool check_redcap_method(const char* method) {
     if (method == 0) {
         return false;
@@ -211,6 +252,8 @@ typedef struct {
     double significance_cutoff;
     int cpu_threads;
     int seed;
+    bool allow_sequential; /* the function supports the "sequential" and "philox" permutation methods */
+    bool allow_analytic; /* the function supports the "analytic" method (no permutations) */
 } lisa_arguments;
 
 static inline void read_lisa_arguments(int arg_index, int pg_nargs, WindowObject winobj, lisa_arguments *args) {
@@ -232,7 +275,19 @@ static inline void read_lisa_arguments(int arg_index, int pg_nargs, WindowObject
         if (!check_perm_method(args->method)) {
             ereport(ERROR,
                     (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                            errmsg("Permutation method has to be one of: complete, lookup")));
+                            errmsg("Permutation method has to be one of: complete, lookup, sequential, philox, analytic")));
+        }
+        if ((is_sequential_perm_method(args->method) || is_philox_perm_method(args->method)) &&
+            !args->allow_sequential) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("Permutation methods sequential and philox are only supported by local_moran()")));
+        }
+        if (is_analytic_perm_method(args->method) && !args->allow_analytic) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("Method analytic is only supported by local_moran(), local_g(), local_gstar() "
+                                   "and local_geary()")));
         }
     }
     arg_index += 1;
@@ -251,6 +306,7 @@ static inline void read_lisa_arguments(int arg_index, int pg_nargs, WindowObject
             args->cpu_threads = 6;
         }
     }
+    args->cpu_threads = parallel_threads(args->cpu_threads);
     arg_index += 1;
 
     if (arg_index < pg_nargs) {
@@ -262,6 +318,14 @@ static inline void read_lisa_arguments(int arg_index, int pg_nargs, WindowObject
     arg_index += 1;
 }
 
+/**
+ * local_moran_state_init
+ *
+ * Register the callback that frees the values of the local_moran_state() kept by the backend
+ * at the end of each transaction, called by _PG_init()
+ */
+void local_moran_state_init(void);
+
 #ifdef __cplusplus
 }
 #endif
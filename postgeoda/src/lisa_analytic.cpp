@@ -0,0 +1,176 @@
+/**
+ * Changes:
+ * 2026-10-16 Add LocalNeighbors and local_analytic(): the local statistics with analytical
+ * inference (the moments under conditional randomization) instead of permutations
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <libgeoda/weights/GeodaWeight.h>
+
+#include "parallel.h"
+#include "lisa_analytic.h"
+
+LocalNeighbors::LocalNeighbors(GeoDaWeight* w)
+: num_obs(w->num_obs), offsets(w->num_obs + 1, 0), max_nbrs(0), has_weights(false)
+{
+    for (size_t i = 0; i < num_obs; ++i) {
+        const std::vector<long> nbr_ids = w->GetNeighbors((int)i);
+        const std::vector<double> nbr_weights = w->GetNeighborWeights((int)i);
+        for (size_t k = 0; k < nbr_ids.size(); ++k) {
+            if (nbr_ids[k] == (long)i) continue;
+            ids.push_back((uint32_t)nbr_ids[k]);
+            weights.push_back(nbr_weights.size() == nbr_ids.size() ? nbr_weights[k] : 1.0);
+            if (weights.back() != 1.0) has_weights = true;
+        }
+        offsets[i + 1] = ids.size();
+        max_nbrs = std::max(max_nbrs, Size(i));
+    }
+}
+
+// the clusters of libgeoda (UniLocalMoran, UniG, UniGeary) of an observation without neighbors
+static double local_neighborless_cluster(LocalStat stat) {
+    return (stat == LOCAL_STAT_G || stat == LOCAL_STAT_GSTAR) ? 4 : 6;
+}
+
+static double local_undefined_cluster(LocalStat stat) {
+    return (stat == LOCAL_STAT_G || stat == LOCAL_STAT_GSTAR) ? 3 : 5;
+}
+
+/**
+ * The z-score of a weighted sum of n_sample values drawn without replacement from n_pop values
+ * with mean mu and variance var (population): (s - W mu) / sqrt(var (n_pop S1 - W^2) / (n_pop - 1))
+ */
+static double local_zscore(double s, double sum_w, double sum_w2, double n_pop, double mu, double var) {
+    if (n_pop < 2) return 0;
+    double v = std::max(var, 0.0) * (n_pop * sum_w2 - sum_w * sum_w) / (n_pop - 1);
+    if (!(v > 0)) return 0;
+    return (s - sum_w * mu) / sqrt(v);
+}
+
+double** local_analytic(LocalStat stat, const LocalNeighbors& nbrs, const std::vector<double>& values,
+                        double significance_cutoff, int cpu_threads)
+{
+    size_t n = nbrs.num_obs;
+
+    // the power sums of all values
+    double p1 = 0, p2 = 0, p3 = 0, p4 = 0;
+    for (size_t i = 0; i < n; ++i) {
+        double v = values[i], v2 = v * v;
+        p1 += v;
+        p2 += v2;
+        p3 += v2 * v;
+        p4 += v2 * v2;
+    }
+
+    double **result = (double **) malloc(sizeof(double*) * n);
+    for (size_t i = 0; i < n; ++i) {
+        result[i] = (double *) malloc(sizeof(double) * 4);
+    }
+
+    parallel_for(cpu_threads, n, [&](int tid, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            double *r = result[i];
+            uint32_t nn = nbrs.Size(i);
+            if (nn == 0) {
+                r[0] = 0;
+                r[1] = 0;
+                r[2] = local_neighborless_cluster(stat);
+                r[3] = 0;
+                continue;
+            }
+
+            // the row-standardized weights: sum_w = 1
+            const uint32_t* ids = &nbrs.ids[nbrs.offsets[i]];
+            const double* ws = &nbrs.weights[nbrs.offsets[i]];
+            double xi = values[i], sum_w = 0, sum_w2 = 0, lag = 0, lag_d = 0;
+            for (uint32_t k = 0; k < nn; ++k) {
+                double d = xi - values[ids[k]];
+                sum_w += ws[k];
+                sum_w2 += ws[k] * ws[k];
+                lag += ws[k] * values[ids[k]];
+                lag_d += ws[k] * d * d;
+            }
+            if (stat == LOCAL_STAT_GSTAR) {
+                // i is its own neighbor, with weight 1
+                sum_w += 1;
+                sum_w2 += 1;
+                lag += xi;
+            }
+            lag /= sum_w;
+            lag_d /= sum_w;
+            sum_w2 /= sum_w * sum_w;
+
+            // the population of the values of the random neighbors: n - 1 values without i,
+            // or all n values for gstar
+            double n_pop = stat == LOCAL_STAT_GSTAR ? (double)n : (double)n - 1;
+            double q1 = p1, q2 = p2, q3 = p3, q4 = p4;
+            if (stat != LOCAL_STAT_GSTAR) {
+                double xi2 = xi * xi;
+                q1 -= xi;
+                q2 -= xi2;
+                q3 -= xi2 * xi;
+                q4 -= xi2 * xi2;
+            }
+            double mu = n_pop > 0 ? q1 / n_pop : 0;
+            double var = n_pop > 0 ? q2 / n_pop - mu * mu : 0;
+
+            double value = 0, z = 0;
+            bool undefined = false;
+            if (stat == LOCAL_STAT_MORAN) {
+                value = xi * lag;
+                z = local_zscore(lag, 1, sum_w2, n_pop, mu, var);
+                if (xi < 0) z = -z;
+                if (xi == 0) z = 0;
+            } else if (stat == LOCAL_STAT_G || stat == LOCAL_STAT_GSTAR) {
+                // the denominator is the same in all permutations
+                double denom = stat == LOCAL_STAT_G ? p1 - xi : p1;
+                undefined = denom == 0;
+                value = undefined ? 0 : lag / denom;
+                z = local_zscore(lag, 1, sum_w2, n_pop, mu, var);
+                if (denom < 0) z = -z;
+            } else {
+                // the squared differences (xi - x_k)^2 of the other observations, from the power sums
+                double xi2 = xi * xi;
+                double sum_d = n_pop * xi2 - 2 * xi * q1 + q2;
+                double sum_d2 = n_pop * xi2 * xi2 - 4 * xi2 * xi * q1 + 6 * xi2 * q2 - 4 * xi * q3 + q4;
+                double mu_d = n_pop > 0 ? sum_d / n_pop : 0;
+                double var_d = n_pop > 0 ? sum_d2 / n_pop - mu_d * mu_d : 0;
+                value = lag_d;
+                z = local_zscore(lag_d, 1, sum_w2, n_pop, mu_d, var_d);
+            }
+
+            double p = 0.5 * erfc(fabs(z) / sqrt(2.0));
+            double cluster = 0;
+            if (undefined) {
+                cluster = local_undefined_cluster(stat);
+            } else if (p > significance_cutoff) {
+                cluster = 0;
+            } else if (stat == LOCAL_STAT_MORAN) {
+                if (xi > 0 && lag > 0) cluster = 1; // high-high
+                else if (xi < 0 && lag < 0) cluster = 2; // low-low
+                else if (xi < 0 && lag > 0) cluster = 3; // low-high
+                else cluster = 4; // high-low
+            } else if (stat == LOCAL_STAT_G || stat == LOCAL_STAT_GSTAR) {
+                cluster = z > 0 ? 1 : 2; // high, low
+            } else {
+                if (z < 0) {
+                    // positive spatial autocorrelation: the differences are smaller than expected
+                    if (xi > 0 && lag > 0) cluster = 1; // high-high
+                    else if (xi < 0 && lag < 0) cluster = 2; // low-low
+                    else cluster = 3; // other positive
+                } else {
+                    cluster = 4; // negative
+                }
+            }
+
+            r[0] = value;
+            r[1] = p;
+            r[2] = cluster;
+            r[3] = z;
+        }
+    });
+    return result;
+}
@@ -0,0 +1,78 @@
+/**
+ * Changes:
+ * 2026-10-16 Add LocalNeighbors and local_analytic(): the local statistics with analytical
+ * inference (the moments under conditional randomization) instead of permutations
+ */
+
+#ifndef __POST_LISA_ANALYTIC__
+#define __POST_LISA_ANALYTIC__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+class GeoDaWeight;
+
+/**
+ * LocalNeighbors
+ *
+ * The neighbors of the observations in a query Window in compressed sparse row arrays: the
+ * positions of the neighbors of i-th observation (without i itself) and their weights (1 for
+ * binary weights) are in [offsets[i], offsets[i+1]). They are read once from the weights, so
+ * they can be used by more than one thread.
+ */
+class LocalNeighbors {
+public:
+    explicit LocalNeighbors(GeoDaWeight* w);
+
+    uint32_t Size(size_t i) const { return (uint32_t)(offsets[i + 1] - offsets[i]); }
+
+    size_t num_obs;
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> ids;
+    std::vector<double> weights;
+    uint32_t max_nbrs;
+    bool has_weights; // any weight is not 1
+};
+
+enum LocalStat {
+    LOCAL_STAT_MORAN = 0,
+    LOCAL_STAT_G = 1,
+    LOCAL_STAT_GSTAR = 2,
+    LOCAL_STAT_GEARY = 3
+};
+
+/**
+ * local_analytic
+ *
+ * The local statistics with analytical inference in one pass over the weights (O(nnz)). With
+ * the row-standardized weights w_ij, each statistic is a weighted sum S_i = sum_j w_ij y_j
+ * (scaled), where under conditional randomization the y_j are drawn without replacement from a
+ * population of N values of observation i, with mean mu_i and variance s_i^2 (moments computed
+ * from the power sums of all values):
+ *
+ *   E[S_i] = W_i * mu_i,  Var[S_i] = s_i^2 * (N * S1_i - W_i^2) / (N - 1)
+ *
+ * where W_i = sum_j w_ij and S1_i = sum_j w_ij^2.
+ *
+ *   moran: z_i * sum_j w_ij z_j, y = z of the other n - 1 observations
+ *   g:     sum_j w_ij x_j / sum_{k!=i} x_k, y = x of the other n - 1 observations
+ *   gstar: sum_j w*_ij x_j / sum_k x_k, with i as its own neighbor (weight 1), y = x of all n
+ *          observations (total randomization)
+ *   geary: sum_j w_ij (z_i - z_j)^2, y = (z_i - z_k)^2 of the other n - 1 observations
+ *
+ * The z-score is (S_i - E[S_i]) / sqrt(Var[S_i]) and the p-value is one-sided in the direction of
+ * the z-score, 1 - Phi(|z|), like the folded pseudo p-value of the permutations. The clusters
+ * are the same as the clusters of libgeoda for the statistic.
+ *
+ * @param stat
+ * @param nbrs
+ * @param values the standardized values (z) for moran and geary, the values (x) for g and gstar
+ * @param significance_cutoff
+ * @param cpu_threads
+ * @return double** {statistic, p-value, cluster, z-score} of each observation (malloc)
+ */
+double** local_analytic(LocalStat stat, const LocalNeighbors& nbrs, const std::vector<double>& values,
+                        double significance_cutoff, int cpu_threads);
+
+#endif
@@ -4,6 +4,7 @@
  * Changes:
  * 2021-1-29 add local_g_window_bytea() local_gstar_window_bytea()
  * 2021-4-28 remove old function using weights as a whole; change to pg_local_g_window(), pg_local_gstar_window();
+ * 2026-10-16 local_g() and local_gstar() with the "analytic" method return the z-score
  */
 
 
@@ -86,15 +87,16 @@ Datum pg_local_g_window(PG_FUNCTION_ARGS) {
 
         // read arguments
         int arg_index = 2;
-        lisa_arguments args = {999, 0, 0.05, 6, 123456789};
+        lisa_arguments args = {999, 0, 0.05, 6, 123456789, false, true};
 
         read_lisa_arguments(arg_index, PG_NARGS(), winobj, &args);
 
         double **result = local_g_window(N, r, (const uint8_t**)w, w_size, args.permutations, args.method,
                                              args.significance_cutoff, args.cpu_threads, args.seed);
 
-        // Safe the result
+        // Safe the result; the analytic method also returns the z-score
         context->result = result;
+        context->n_values = is_analytic_perm_method(args.method) ? 4 : 3;
         context->isdone = true;
 
         // clean
@@ -114,13 +116,13 @@ Datum pg_local_g_window(PG_FUNCTION_ARGS) {
 
     // Wrap the results in a new PostgreSQL array object.
     double *p = context->result[curpos];
-    Datum elems[3];
-    elems[0] = Float8GetDatum(p[0]); // double to Datum
-    elems[1] = Float8GetDatum(p[1]);
-    elems[2] = Float8GetDatum(p[2]);
+    int nelems = context->n_values;
+    Datum elems[4];
+    for (int i = 0; i < nelems; ++i) {
+        elems[i] = Float8GetDatum(p[i]); // double to Datum
+    }
     free(p);
 
-    int nelems = 3;
     Oid elmtype = FLOAT8OID;
     int16 elmlen;
     bool elmbyval;
@@ -186,15 +188,16 @@ Datum pg_local_gstar_window(PG_FUNCTION_ARGS) {
 
         // read arguments
         int arg_index = 2;
-        lisa_arguments args = {999, 0, 0.05, 6, 123456789};
+        lisa_arguments args = {999, 0, 0.05, 6, 123456789, false, true};
 
         read_lisa_arguments(arg_index, PG_NARGS(), winobj, &args);
 
         double **result = local_gstar_window(N, r, (const uint8_t**)w, w_size, args.permutations, args.method,
                                              args.significance_cutoff, args.cpu_threads, args.seed);
 
-        // Safe the result
+        // Safe the result; the analytic method also returns the z-score
         context->result = result;
+        context->n_values = is_analytic_perm_method(args.method) ? 4 : 3;
         context->isdone = true;
 
         // clean
@@ -213,13 +216,13 @@ Datum pg_local_gstar_window(PG_FUNCTION_ARGS) {
 
     // Wrap the results in a new PostgreSQL array object.
     double *p = context->result[curpos];
-    Datum elems[3];
-    elems[0] = Float8GetDatum(p[0]); // double to Datum
-    elems[1] = Float8GetDatum(p[1]);
-    elems[2] = Float8GetDatum(p[2]);
+    int nelems = context->n_values;
+    Datum elems[4];
+    for (int i = 0; i < nelems; ++i) {
+        elems[i] = Float8GetDatum(p[i]); // double to Datum
+    }
     free(p);
 
-    int nelems = 3;
     Oid elmtype = FLOAT8OID;
     int16 elmlen;
     bool elmbyval;
@@ -3,11 +3,28 @@
  *
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
+ * 2026-10-16 Pass the size of the weights to local_moran_window_bytea()
+ * 2026-10-16 add pg_batch_local_moran_window()
+ * 2026-10-16 local_moran() with the "sequential" permutation method returns the number of permutations used
+ * 2026-10-16 local_moran() with the "analytic" method returns the z-score
+ * 2026-10-16 add the Aggregate local_moran_state() and pg_local_moran_fast_state() for the two-phase
+ * local_moran_fast()
+ * 2026-10-16 add pg_local_moran_knn_window() and pg_local_moran_queen_window(): the weights and the local moran
+ * in one Window function
+ * 2026-10-16 add pg_local_moran_halo_window(): the local moran of a partition with the halo neighbors
+ * 2026-10-17 add local_moran_state_init(): free the values of the local moran state at the end of a transaction
+ * 2026-10-17 Note that the weights of local_moran_knn() and local_moran_queen() don't depend on cpu_threads
+ * 2026-10-17 pg_local_moran_halo_window() reads the state with local_moran_get_state(), detoasted once
+ * 2026-10-17 local_moran_knn() and local_moran_queen() create the weights with libgeoda, like the default
+ * knn_weights() and queen_weights()
+ * 2026-10-17 local_moran_state() keeps the moments and a sample of at most LOCAL_MORAN_STATE_SAMPLE values
+ * 2026-10-17 Free the geometries of the Window functions with create_window_pg_geometries(), also on an ERROR
  */
 
 #include <postgres.h>
 #include <pg_config.h>
 #include <fmgr.h>
+#include <access/xact.h>
 #include <nodes/execnodes.h>
 #include <funcapi.h>
 #include <windowapi.h>
@@ -16,6 +33,7 @@
 #include <catalog/namespace.h>
 #include <utils/geo_decls.h>
 #include <utils/lsyscache.h> /* for get_typlenbyvalalign */
+#include <math.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +43,7 @@ extern "C" {
 #include <libgeoda/pg/geoms.h>
 #include "proxy.h"
 #include "lisa.h"
+#include "weights.h"
 
 #ifndef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
@@ -84,7 +103,7 @@ Datum pg_local_moran_window(PG_FUNCTION_ARGS) {
 
         // read arguments
         int arg_index = 2;
-        lisa_arguments args = {999, 0, 0.05, 6, 123456789};
+        lisa_arguments args = {999, 0, 0.05, 6, 123456789, true, true};
 
         read_lisa_arguments(arg_index, PG_NARGS(), winobj, &args);
 
@@ -93,8 +112,10 @@ Datum pg_local_moran_window(PG_FUNCTION_ARGS) {
         double **result = local_moran_window(N, r, (const uint8_t**)w, w_size, args.permutations, args.method,
                                             args.significance_cutoff, args.cpu_threads, args.seed);
 
-        // Safe the result
+        // Safe the result; the sequential method also returns the number of permutations used,
+        // and the analytic method the z-score
         context->result = result;
+        context->n_values = is_sequential_perm_method(args.method) || is_analytic_perm_method(args.method) ? 4 : 3;
         context->isdone = true;
 
         // clean
@@ -113,13 +134,13 @@ Datum pg_local_moran_window(PG_FUNCTION_ARGS) {
 
     // Wrap the results in a new PostgreSQL array object.
     double *p = context->result[curpos];
-    Datum elems[3];
-    elems[0] = Float8GetDatum(p[0]); // double to Datum
-    elems[1] = Float8GetDatum(p[1]);
-    elems[2] = Float8GetDatum(p[2]);
+    int nelems = context->n_values;
+    Datum elems[4];
+    for (int i = 0; i < nelems; ++i) {
+        elems[i] = Float8GetDatum(p[i]); // double to Datum
+    }
     free(p);
 
-    int nelems = 3;
     Oid elmtype = FLOAT8OID;
     int16 elmlen;
     bool elmbyval;
@@ -130,6 +151,314 @@ Datum pg_local_moran_window(PG_FUNCTION_ARGS) {
     PG_RETURN_ARRAYTYPE_P(array);
 }
 
+/**
+ * local_moran_build_window()
+ *
+ * The local moran with the weights created from the geometries of the Window, used by
+ * local_moran_knn(x, fid, geom, k, ...) and local_moran_queen(x, fid, geom, ...): the weights
+ * are created in memory and used directly by the local moran, instead of being written into the
+ * bytea of each row by knn_weights() or queen_weights() OVER() and read back by local_moran() in
+ * a second Window. The arguments of the local moran follow the arguments of the weights.
+ *
+ * @param fcinfo
+ * @param is_knn
+ * @return
+ */
+static Datum local_moran_build_window(PG_FUNCTION_ARGS, bool is_knn)
+{
+    WindowObject winobj = PG_WINDOW_OBJECT();
+    lisa_context *context;
+    int64 curpos;
+
+    Oid valsType = get_fn_expr_argtype(fcinfo->flinfo, 0);
+    check_if_numeric_type(valsType);
+
+    context = (lisa_context *)WinGetPartitionLocalMemory(winobj, sizeof(lisa_context));
+
+    if (!context->isdone) {
+        bool isnull, isout;
+
+        /* We also need a non-zero N */
+        int N = (int) WinGetPartitionRowCount(winobj);
+        if (N <= 0) {
+            context->isdone = true;
+            context->isnull = true;
+            PG_RETURN_NULL();
+        }
+
+        // read arguments: k of the KNN weights, then the arguments of the local moran
+        int arg_index = 3;
+        int k = 4;
+        if (is_knn) {
+            k = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
+            if (isnull || k <= 0) {
+                k = 4;
+            }
+            arg_index += 1;
+        }
+        lisa_arguments args = {999, 0, 0.05, 6, 123456789, true, true};
+        read_lisa_arguments(arg_index, PG_NARGS(), winobj, &args);
+
+        // read the values and decode the geometries of all rows
+        double *r = lwalloc(sizeof(double) * N);
+        MemoryContext geoms_ctx;
+        PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
+
+        for (size_t i = 0; i < N; i++) {
+            Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            r[i] = get_numeric_val(valsType, arg);
+
+            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            int32 fid = DatumGetInt32(arg1);
+
+            Datum arg2 = WinGetFuncArgInPartition(winobj, 2, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            add_pg_geometry_datum(geoms, fid, arg2, isnull);
+        }
+
+        // create the weights the same way as the default knn_weights(fid, geom, k) and
+        // queen_weights(fid, geom): libgeoda with one thread, args.cpu_threads is only used by
+        // the local moran
+        PGWeight *w;
+        if (is_knn) {
+            w = create_knn_weights(geoms, k, 1.0, false, false, true, 1);
+        } else {
+            w = create_cont_weights(geoms, true, 1, false, 0.0, 1);
+        }
+        free_window_pg_geometries(geoms_ctx);
+
+        double **result = local_moran_pgweight_window(N, r, w, args.permutations, args.method,
+                                                      args.significance_cutoff, args.cpu_threads, args.seed);
+
+        // Safe the result; the sequential method also returns the number of permutations used,
+        // and the analytic method the z-score
+        context->result = result;
+        context->n_values = is_sequential_perm_method(args.method) || is_analytic_perm_method(args.method) ? 4 : 3;
+        context->isdone = true;
+
+        // clean
+        free_pgweight(w);
+        lwfree(r);
+    }
+
+    if (context->isnull)
+        PG_RETURN_NULL();
+
+    curpos = WinGetCurrentPosition(winobj);
+
+    // Wrap the results in a new PostgreSQL array object.
+    double *p = context->result[curpos];
+    int nelems = context->n_values;
+    Datum elems[4];
+    for (int i = 0; i < nelems; ++i) {
+        elems[i] = Float8GetDatum(p[i]); // double to Datum
+    }
+    free(p);
+
+    Oid elmtype = FLOAT8OID;
+    int16 elmlen;
+    bool elmbyval;
+    char elmalign;
+    get_typlenbyvalalign(elmtype, &elmlen, &elmbyval, &elmalign);
+    ArrayType *array = construct_array(elems, nelems, elmtype, elmlen, elmbyval, elmalign);
+
+    PG_RETURN_ARRAYTYPE_P(array);
+}
+
+/**
+ * pg_local_moran_knn_window()
+ *
+ * The Window function for local_moran_knn(x, fid, geom, k [, permutations, method,
+ * significance_cutoff, cpu_threads, seed])
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_local_moran_knn_window(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_local_moran_knn_window);
+Datum pg_local_moran_knn_window(PG_FUNCTION_ARGS) {
+    return local_moran_build_window(fcinfo, true);
+}
+
+/**
+ * pg_local_moran_queen_window()
+ *
+ * The Window function for local_moran_queen(x, fid, geom [, permutations, method,
+ * significance_cutoff, cpu_threads, seed])
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_local_moran_queen_window(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_local_moran_queen_window);
+Datum pg_local_moran_queen_window(PG_FUNCTION_ARGS) {
+    return local_moran_build_window(fcinfo, false);
+}
+
+/**
+ * pg_batch_local_moran_window()
+ *
+ * The Window function for batch_local_moran(): the local moran of each variable in the
+ * array of the first argument, with the weights decoded once and the same permutations for
+ * all variables. The result of each row is a 2-D array: {lisa, p-value, cluster} of each
+ * variable.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_batch_local_moran_window(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_batch_local_moran_window);
+Datum pg_batch_local_moran_window(PG_FUNCTION_ARGS) {
+    WindowObject winobj = PG_WINDOW_OBJECT();
+    batch_lisa_context *context;
+    int64 curpos;
+
+    context = (batch_lisa_context *)WinGetPartitionLocalMemory(winobj, sizeof(batch_lisa_context));
+
+    if (!context->isdone) {
+        bool isnull, isout;
+
+        /* We also need a non-zero N */
+        int N = (int) WinGetPartitionRowCount(winobj);
+        if (N <= 0) {
+            context->isdone = true;
+            context->isnull = true;
+            PG_RETURN_NULL();
+        }
+
+        // the type of the elements of the array of the variables
+        Oid arrayType = get_fn_expr_argtype(fcinfo->flinfo, 0);
+        Oid elmType = get_element_type(arrayType);
+        check_if_numeric_type(elmType);
+        int16 elmWidth;
+        bool elmByValue;
+        char elmAlignmentCode;
+        get_typlenbyvalalign(elmType, &elmWidth, &elmByValue, &elmAlignmentCode);
+
+        // read data
+        uint8_t **w = lwalloc(sizeof(uint8_t *) * N);
+        size_t *w_size = lwalloc(sizeof(size_t) * N);
+        double **r = lwalloc(sizeof(double *) * N);
+        bool **r_null = lwalloc(sizeof(bool *) * N);
+        int n_vars = -1;
+
+        lwdebug(0, "Init batch_local_moran_window. N=%d", N);
+
+        for (int i = 0; i < N; i++) {
+            Datum arg = WinGetFuncArgInPartition(winobj, 0, i,
+                                                 WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            Datum *arrayContent = NULL;
+            bool *arrayNullFlags = NULL;
+            int arrayLength = 0;
+            if (!isnull) {
+                ArrayType *array = DatumGetArrayTypeP(arg);
+                if (ARR_NDIM(array) > 1) {
+                    ereport(ERROR, (errmsg("One-dimesional arrays are required")));
+                }
+                deconstruct_array(array, elmType, elmWidth, elmByValue, elmAlignmentCode,
+                                  &arrayContent, &arrayNullFlags, &arrayLength);
+                if (n_vars < 0) {
+                    n_vars = arrayLength;
+                } else if (arrayLength != n_vars) {
+                    ereport(ERROR,
+                            (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                                    errmsg("batch_local_moran: all rows should have %d variables, row %d has %d",
+                                           n_vars, i + 1, arrayLength)));
+                }
+            }
+
+            // a NULL array (or a NULL element) is undefined for all (or one) variables
+            r[i] = lwalloc(sizeof(double) * (arrayLength > 0 ? arrayLength : 1));
+            r_null[i] = arrayContent == NULL ? NULL : lwalloc(sizeof(bool) * (arrayLength > 0 ? arrayLength : 1));
+            for (int j = 0; j < arrayLength; ++j) {
+                r_null[i][j] = arrayNullFlags[j];
+                r[i][j] = arrayNullFlags[j] ? 0 : get_numeric_val(elmType, arrayContent[j]);
+            }
+
+            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i,
+                                                  WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            if (isnull) {
+                ereport(ERROR, (errmsg("batch_local_moran: the weights of row %d is NULL", i + 1)));
+            }
+            bytea *w_bytea = DatumGetByteaP(arg1);
+            w[i] = (uint8_t *) VARDATA(w_bytea);
+            w_size[i] = VARSIZE_ANY_EXHDR(w_bytea);
+        }
+
+        if (n_vars <= 0) {
+            context->isdone = true;
+            context->isnull = true;
+            PG_RETURN_NULL();
+        }
+
+        // rows with a NULL array have no defined value
+        for (int i = 0; i < N; i++) {
+            if (r_null[i] != NULL) continue;
+            lwfree(r[i]);
+            r[i] = lwalloc(sizeof(double) * n_vars);
+            r_null[i] = lwalloc(sizeof(bool) * n_vars);
+            for (int j = 0; j < n_vars; ++j) {
+                r[i][j] = 0;
+                r_null[i][j] = true;
+            }
+        }
+
+        // read arguments
+        int arg_index = 2;
+        lisa_arguments args = {999, 0, 0.05, 6, 123456789};
+
+        read_lisa_arguments(arg_index, PG_NARGS(), winobj, &args);
+
+        double **result = batch_local_moran_window(n_vars, N, (const double**)r, (const bool**)r_null,
+                                                   (const uint8_t**)w, w_size, args.permutations, args.method,
+                                                   args.significance_cutoff, args.cpu_threads, args.seed);
+
+        // Safe the result
+        context->result = result;
+        context->n_vars = n_vars;
+        context->isdone = true;
+
+        // clean
+        for (int i = 0; i < N; i++) {
+            lwfree(r[i]);
+            lwfree(r_null[i]);
+        }
+        lwfree(r);
+        lwfree(r_null);
+        lwfree(w_size);
+        lwfree(w);
+
+        lwdebug(1, "Exit batch_local_moran_window.");
+    }
+
+    if (context->isnull)
+        PG_RETURN_NULL();
+
+    curpos = WinGetCurrentPosition(winobj);
+
+    // Wrap the results in a 2-D array: n_vars x {lisa, p-value, cluster}
+    int n_vars = context->n_vars;
+    double *p = context->result[curpos];
+    Datum *elems = palloc(sizeof(Datum) * 3 * n_vars);
+    for (int j = 0; j < 3 * n_vars; ++j) {
+        elems[j] = Float8GetDatum(p[j]);
+    }
+    free(p);
+
+    int dims[2] = {n_vars, 3};
+    int lbs[2] = {1, 1};
+    Oid elmtype = FLOAT8OID;
+    int16 elmlen;
+    bool elmbyval;
+    char elmalign;
+    get_typlenbyvalalign(elmtype, &elmlen, &elmbyval, &elmalign);
+    ArrayType *array = construct_md_array(elems, NULL, 2, dims, lbs, elmtype, elmlen, elmbyval, elmalign);
+
+    PG_RETURN_ARRAYTYPE_P(array);
+}
+
 /**
  * pg_local_moran_fast()
  *
@@ -220,6 +549,450 @@ Datum pg_local_moran_fast(PG_FUNCTION_ARGS)
     PG_RETURN_POINT_P(r);
 }
 
+/**
+ * LocalMoranStateAgg
+ *
+ * This is used for collecting the values for the Aggregate SQL function `local_moran_state()`:
+ * the running mean and sum of squares (Welford), and the first LOCAL_MORAN_STATE_SAMPLE values,
+ * then a uniform sample of them (reservoir sampling), so the state is bounded for any table
+ */
+typedef struct
+{
+    double *sample; /* the values of the sample, without NULL */
+    int n_sample;
+    int capacity;
+    int64 n; /* the number of values, without NULL */
+    double mean;
+    double m2;
+    int permutations;
+    int seed;
+} LocalMoranStateAgg;
+
+/**
+ * local_moran_state_draw
+ *
+ * A random integer in [0, n] for the n-th value of the reservoir sampling (splitmix64 of the seed
+ * and n), so the sample only depends on the seed and on the order of the values
+ */
+static uint64 local_moran_state_draw(int seed, int64 n)
+{
+    uint64 z = ((uint64)(uint32)seed << 32) + (uint64)n * UINT64CONST(0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * UINT64CONST(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64CONST(0x94d049bb133111eb);
+    z = z ^ (z >> 31);
+    return z % (uint64)(n + 1);
+}
+
+/**
+ * local_moran_state_transfn
+ *
+ * sfunc for Aggregate SQL function `local_moran_state(val [, permutations, seed])`
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum local_moran_state_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(local_moran_state_transfn);
+
+Datum local_moran_state_transfn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "local_moran_state_transfn called in non-aggregate context");
+        aggcontext = NULL;  /* keep compiler quiet */
+    }
+
+    LocalMoranStateAgg* state;
+    if ( PG_ARGISNULL(0) ) {
+        // first incoming row/item
+        state = (LocalMoranStateAgg*)MemoryContextAllocZero(aggcontext, sizeof(LocalMoranStateAgg));
+        state->capacity = 1024;
+        state->sample = (double*)MemoryContextAlloc(aggcontext, sizeof(double) * state->capacity);
+        state->permutations = 999;
+        state->seed = 123456789;
+    } else {
+        state = (LocalMoranStateAgg*) PG_GETARG_POINTER(0);
+    }
+
+    // permutations and seed (optional)
+    if (PG_NARGS() > 2 && !PG_ARGISNULL(2)) {
+        state->permutations = PG_GETARG_INT32(2);
+    }
+    if (PG_NARGS() > 3 && !PG_ARGISNULL(3)) {
+        state->seed = PG_GETARG_INT32(3);
+    }
+
+    // NULL values are not in the state
+    if (PG_ARGISNULL(1)) {
+        PG_RETURN_POINTER(state);
+    }
+
+    if (state->n >= (int64)PG_UINT32_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("local_moran_state: more than %u values", PG_UINT32_MAX)));
+    }
+
+    Oid valType = get_fn_expr_argtype(fcinfo->flinfo, 1);
+    double val = get_numeric_val(valType, PG_GETARG_DATUM(1));
+
+    if (state->n_sample < LOCAL_MORAN_STATE_SAMPLE) {
+        if (state->n_sample == state->capacity) {
+            state->capacity *= 2;
+            state->sample = (double*)repalloc(state->sample, sizeof(double) * state->capacity);
+        }
+        state->sample[state->n_sample++] = val;
+    } else {
+        uint64 j = local_moran_state_draw(state->seed, state->n);
+        if (j < LOCAL_MORAN_STATE_SAMPLE) state->sample[j] = val;
+    }
+
+    state->n += 1;
+    double delta = val - state->mean;
+    state->mean += delta / (double)state->n;
+    state->m2 += delta * (val - state->mean);
+
+    PG_RETURN_POINTER(state);
+}
+
+/**
+ * local_moran_state_finalfn
+ *
+ * finalfunc for Aggregate SQL function `local_moran_state()`: the mean and standard deviation
+ * of the collected values, the permutations and the seed, and the standardized values of the
+ * sample in a bytea (see create_local_moran_state()), at most 512 KB for any number of rows.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum local_moran_state_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(local_moran_state_finalfn);
+
+Datum local_moran_state_finalfn(PG_FUNCTION_ARGS)
+{
+    lwdebug(1,"Enter local_moran_state_finalfn.");
+
+    if (PG_ARGISNULL(0))
+        PG_RETURN_NULL();   /* returns null iff no input values */
+
+    LocalMoranStateAgg *p = (LocalMoranStateAgg*) PG_GETARG_POINTER(0);
+
+    size_t buf_size = local_moran_state_size(p->n_sample);
+    double sd = p->n > 1 ? sqrt(p->m2 / (double)(p->n - 1)) : 0;
+
+    bytea *result = palloc(buf_size + VARHDRSZ);
+    SET_VARSIZE(result, buf_size + VARHDRSZ);
+    create_local_moran_state(p->n, p->mean, sd, p->n_sample, p->sample, p->permutations, p->seed,
+                             (uint8_t*)VARDATA(result));
+
+    lwdebug(1,"Exit local_moran_state_finalfn.");
+    PG_RETURN_BYTEA_P(result);
+}
+
+static void local_moran_state_xact_callback(XactEvent event, void *arg)
+{
+    if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT ||
+        event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PARALLEL_ABORT) {
+        local_moran_state_reset();
+    }
+}
+
+void local_moran_state_init(void)
+{
+    RegisterXactCallback(local_moran_state_xact_callback, NULL);
+}
+
+/**
+ * LocalMoranStateCache
+ *
+ * The detoasted state of the last row (or partition), in fn_extra: a state stored in a table is
+ * the same TOAST pointer for all rows, so it is detoasted once instead of for each row of
+ * local_moran_fast() or each partition of local_moran_halo()
+ */
+typedef struct
+{
+    struct varlena *raw; /* the datum as passed, e.g. the TOAST pointer */
+    size_t raw_size;
+    bytea *state;
+} LocalMoranStateCache;
+
+static bytea* local_moran_get_state(FunctionCallInfo fcinfo, Datum datum)
+{
+    struct varlena *raw = (struct varlena *) DatumGetPointer(datum);
+    if (!VARATT_IS_EXTENDED(raw)) {
+        // e.g. from a sub-query: used without copy
+        return (bytea*)raw;
+    }
+
+    LocalMoranStateCache *cache = (LocalMoranStateCache*)fcinfo->flinfo->fn_extra;
+    size_t raw_size = VARSIZE_ANY(raw);
+    if (cache == NULL || cache->raw_size != raw_size || memcmp(cache->raw, raw, raw_size) != 0) {
+        MemoryContext old = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+        if (cache == NULL) {
+            cache = (LocalMoranStateCache*)palloc0(sizeof(LocalMoranStateCache));
+            fcinfo->flinfo->fn_extra = cache;
+        } else {
+            pfree(cache->raw);
+            pfree(cache->state);
+        }
+        cache->raw = (struct varlena *)palloc(raw_size);
+        memcpy(cache->raw, raw, raw_size);
+        cache->raw_size = raw_size;
+        cache->state = (bytea*)PG_DETOAST_DATUM_COPY(datum);
+        MemoryContextSwitchTo(old);
+    }
+    return cache->state;
+}
+
+/**
+ * pg_local_moran_fast_state()
+ *
+ * The second phase of local_moran_fast(): the local moran of one observation from its value,
+ * its weights, the values of its neighbors (in any order) and the state created once by
+ * local_moran_state(). Unlike pg_local_moran_fast(), the values of all observations are not
+ * needed for each row, so each row takes O(nn * permutations), and the rows can be split
+ * into shards on more than one PG nodes with the same state.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_local_moran_fast_state(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pg_local_moran_fast_state);
+
+Datum pg_local_moran_fast_state(PG_FUNCTION_ARGS)
+{
+    // 1st arg
+    Oid valType = get_fn_expr_argtype(fcinfo->flinfo, 0);
+    check_if_numeric_type(valType);
+    double val = get_numeric_val(valType, PG_GETARG_DATUM(0));
+
+    // 2nd arg
+    bytea *w_bytea = PG_GETARG_BYTEA_PP(1);
+    const uint8_t *w_val = (const uint8_t *) VARDATA_ANY(w_bytea);
+    size_t bw_size = VARSIZE_ANY_EXHDR(w_bytea);
+
+    // 3rd arg: the values of the neighbors
+    ArrayType *vals = PG_GETARG_ARRAYTYPE_P(2);
+    if (ARR_NDIM(vals) > 1) {
+        ereport(ERROR, (errmsg("One-dimesional arrays are required")));
+    }
+    Oid valsType = ARR_ELEMTYPE(vals);
+    check_if_numeric_type(valsType);
+
+    int16 valsTypeWidth;
+    bool valsTypeByValue;
+    char valsTypeAlignmentCode;
+    bool *valsNullFlags;
+    Datum *valsContent;
+    int arr_size;
+
+    get_typlenbyvalalign(valsType, &valsTypeWidth, &valsTypeByValue, &valsTypeAlignmentCode);
+    deconstruct_array(vals, valsType, valsTypeWidth, valsTypeByValue, valsTypeAlignmentCode,
+                      &valsContent, &valsNullFlags, &arr_size);
+
+    double *arr = lwalloc(sizeof(double) * (arr_size > 0 ? arr_size : 1));
+    for (int i = 0; i < arr_size; ++i) {
+        if (valsNullFlags[i]) {
+            ereport(ERROR, (errmsg("local_moran_fast: the values of the neighbors can't be NULL")));
+        }
+        arr[i] = get_numeric_val(valsType, valsContent[i]);
+    }
+
+    // 4th arg: the state, the same datum for all rows
+    bytea *state = local_moran_get_state(fcinfo, PG_GETARG_DATUM(3));
+
+    Point *r = local_moran_fast_state(val, w_val, bw_size, arr, arr_size,
+                                      (const uint8_t *) VARDATA_ANY(state), VARSIZE_ANY_EXHDR(state));
+
+    // clean
+    lwfree(arr);
+    PG_FREE_IF_COPY(w_bytea, 1);
+
+    PG_RETURN_POINT_P(r);
+}
+
+/**
+ * local_moran_halo_numeric_array()
+ *
+ * The values of a 1-D numeric array (not NULL) as doubles (lwalloc)
+ */
+static double* local_moran_halo_numeric_array(ArrayType *vals, int *n)
+{
+    if (ARR_NDIM(vals) > 1) {
+        ereport(ERROR, (errmsg("One-dimesional arrays are required")));
+    }
+    Oid valsType = ARR_ELEMTYPE(vals);
+    check_if_numeric_type(valsType);
+
+    int16 valsTypeWidth;
+    bool valsTypeByValue;
+    char valsTypeAlignmentCode;
+    bool *valsNullFlags;
+    Datum *valsContent;
+
+    get_typlenbyvalalign(valsType, &valsTypeWidth, &valsTypeByValue, &valsTypeAlignmentCode);
+    deconstruct_array(vals, valsType, valsTypeWidth, valsTypeByValue, valsTypeAlignmentCode,
+                      &valsContent, &valsNullFlags, n);
+
+    double *arr = lwalloc(sizeof(double) * (*n > 0 ? *n : 1));
+    for (int i = 0; i < *n; ++i) {
+        if (valsNullFlags[i]) {
+            ereport(ERROR, (errmsg("local_moran_halo: the values of the halo can't be NULL")));
+        }
+        arr[i] = get_numeric_val(valsType, valsContent[i]);
+    }
+    return arr;
+}
+
+/**
+ * pg_local_moran_halo_window()
+ *
+ * The Window function for local_moran_halo(x, w, halo_fids, halo_vals, state [, significance_cutoff]),
+ * used with OVER(PARTITION BY ...): the neighbors of the rows that are in other partitions (the
+ * halo) are read from the fids and values of the halo, instead of being removed like local_moran()
+ * does, and the permutations, the seed, the mean and the standard deviation of all rows come from
+ * the state of local_moran_state(). So the results of each partition are the same as with
+ * OVER() over all rows. The halo and the state are read from the first row of each partition; a
+ * NULL halo is an empty halo.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_local_moran_halo_window(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_local_moran_halo_window);
+Datum pg_local_moran_halo_window(PG_FUNCTION_ARGS) {
+    WindowObject winobj = PG_WINDOW_OBJECT();
+    lisa_context *context;
+    int64 curpos;
+
+    Oid valsType = get_fn_expr_argtype(fcinfo->flinfo, 0);
+    check_if_numeric_type(valsType);
+
+    context = (lisa_context *)WinGetPartitionLocalMemory(winobj, sizeof(lisa_context));
+
+    if (!context->isdone) {
+        bool isnull, isout;
+
+        /* We also need a non-zero N */
+        int N = (int) WinGetPartitionRowCount(winobj);
+        if (N <= 0) {
+            context->isdone = true;
+            context->isnull = true;
+            PG_RETURN_NULL();
+        }
+
+        // read the values and the weights of the rows of the partition
+        uint8_t **w = lwalloc(sizeof(uint8_t *) * N);
+        size_t *w_size = lwalloc(sizeof(size_t) * N);
+        double *r = lwalloc(sizeof(double) * N);
+
+        for (size_t i = 0; i < N; i++) {
+            Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            bool val_isnull = isnull;
+            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+            if (val_isnull || isnull) {
+                ereport(ERROR, (errmsg("local_moran_halo: the value and the weights of a row can't be NULL")));
+            }
+            r[i] = get_numeric_val(valsType, arg);
+            bytea *w_bytea = DatumGetByteaP(arg1);
+            w[i] = (uint8_t *) VARDATA(w_bytea);
+            w_size[i] = VARSIZE_ANY_EXHDR(w_bytea);
+        }
+
+        // the fids and the values of the halo, from the first row
+        int n_halo = 0, n_halo_vals = 0;
+        int64 *halo_fids = NULL;
+        double *halo_vals = NULL;
+        Datum arg2 = WinGetFuncArgInPartition(winobj, 2, 0, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+        bool fids_isnull = isnull;
+        Datum arg3 = WinGetFuncArgInPartition(winobj, 3, 0, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+        if (fids_isnull != isnull) {
+            ereport(ERROR, (errmsg("local_moran_halo: the fids and the values of the halo have to be both NULL "
+                                   "or both not NULL")));
+        }
+        if (!isnull) {
+            ArrayType *fids = DatumGetArrayTypeP(arg2);
+            if (ARR_NDIM(fids) > 1) {
+                ereport(ERROR, (errmsg("One-dimesional arrays are required")));
+            }
+            int16 fidsTypeWidth;
+            bool fidsTypeByValue;
+            char fidsTypeAlignmentCode;
+            bool *fidsNullFlags;
+            Datum *fidsContent;
+            get_typlenbyvalalign(INT8OID, &fidsTypeWidth, &fidsTypeByValue, &fidsTypeAlignmentCode);
+            deconstruct_array(fids, INT8OID, fidsTypeWidth, fidsTypeByValue, fidsTypeAlignmentCode,
+                              &fidsContent, &fidsNullFlags, &n_halo);
+            halo_fids = lwalloc(sizeof(int64) * (n_halo > 0 ? n_halo : 1));
+            for (int i = 0; i < n_halo; ++i) {
+                if (fidsNullFlags[i]) {
+                    ereport(ERROR, (errmsg("local_moran_halo: the fids of the halo can't be NULL")));
+                }
+                halo_fids[i] = DatumGetInt64(fidsContent[i]);
+            }
+
+            halo_vals = local_moran_halo_numeric_array(DatumGetArrayTypeP(arg3), &n_halo_vals);
+            if (n_halo_vals != n_halo) {
+                ereport(ERROR, (errmsg("local_moran_halo: %d fids and %d values of the halo", n_halo, n_halo_vals)));
+            }
+        }
+
+        double significance_cutoff = 0.05;
+        if (PG_NARGS() > 5) {
+            significance_cutoff = DatumGetFloat8(WinGetFuncArgCurrent(winobj, 5, &isnull));
+            if (isnull || significance_cutoff <= 0) {
+                significance_cutoff = 0.05;
+            }
+        }
+
+        // the state of all rows, from the first row: detoasted once for all partitions
+        Datum arg4 = WinGetFuncArgInPartition(winobj, 4, 0, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+        if (isnull) {
+            ereport(ERROR, (errmsg("local_moran_halo: the state can't be NULL")));
+        }
+        bytea *state = local_moran_get_state(fcinfo, arg4);
+
+        double **result = local_moran_halo_window(N, r, (const uint8_t**)w, w_size, n_halo, halo_fids, halo_vals,
+                                                  (const uint8_t *) VARDATA_ANY(state), VARSIZE_ANY_EXHDR(state),
+                                                  significance_cutoff);
+
+        context->result = result;
+        context->n_values = 3;
+        context->isdone = true;
+
+        // clean
+        if (halo_fids) lwfree(halo_fids);
+        if (halo_vals) lwfree(halo_vals);
+        lwfree(r);
+        lwfree(w_size);
+        lwfree(w);
+    }
+
+    if (context->isnull)
+        PG_RETURN_NULL();
+
+    curpos = WinGetCurrentPosition(winobj);
+
+    // Wrap the results in a new PostgreSQL array object.
+    double *p = context->result[curpos];
+    int nelems = context->n_values;
+    Datum elems[3];
+    for (int i = 0; i < nelems; ++i) {
+        elems[i] = Float8GetDatum(p[i]); // double to Datum
+    }
+    free(p);
+
+    Oid elmtype = FLOAT8OID;
+    int16 elmlen;
+    bool elmbyval;
+    char elmalign;
+    get_typlenbyvalalign(elmtype, &elmlen, &elmbyval, &elmalign);
+    ArrayType *array = construct_array(elems, nelems, elmtype, elmlen, elmbyval, elmalign);
+
+    PG_RETURN_ARRAYTYPE_P(array);
+}
+
 /**
  *  local_moran_window_bytea (This is going to be depreciated)
  *
@@ -258,6 +1031,7 @@ Datum pg_local_moran_window_bytea(PG_FUNCTION_ARGS) {
             PG_RETURN_NULL();
         }
         uint8_t *w = (uint8_t*)VARDATA(bw);
+        size_t w_size = VARSIZE_ANY_EXHDR(bw);
 
         // read fids
         int64 *fids = lwalloc(sizeof(int64) * N);
@@ -279,7 +1053,7 @@ Datum pg_local_moran_window_bytea(PG_FUNCTION_ARGS) {
         }
 
         // compute lisa
-        double **result = local_moran_window_bytea(N, fids, r, w);
+        double **result = local_moran_window_bytea(N, fids, r, w, w_size);
 
         // Safe the result
         context->result = result;
@@ -3,6 +3,8 @@
  *
  * Changes:
  * 2021-4-28 add pg_neighbor_match_test_window()
+ * 2026-10-16 Decode WKB into PGGeometries instead of LWGEOM
+ * 2026-10-17 Free the geometries of the Window functions with create_window_pg_geometries(), also on an ERROR
  */
 
 
@@ -79,8 +81,8 @@ Datum pg_neighbor_match_test_window(PG_FUNCTION_ARGS) {
 
 
         // read data
-        List *geoms = 0; // raw geometries
-        List *fids = 0;
+        MemoryContext geoms_ctx;
+        PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx); // decoded geometries
         double **r = lwalloc(sizeof(double) * N);
 
         lwdebug(0, "Init pg_neighbor_match_test_window. N=%d", N);
@@ -88,6 +90,7 @@ Datum pg_neighbor_match_test_window(PG_FUNCTION_ARGS) {
         for (size_t i = 0; i < N; i++) {
             Datum arg_val = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
             if (isnull) {
+                free_window_pg_geometries(geoms_ctx);
                 PG_RETURN_NULL();
             }
             array = DatumGetArrayTypeP(arg_val);
@@ -108,16 +111,7 @@ Datum pg_neighbor_match_test_window(PG_FUNCTION_ARGS) {
 
             // the_geom
             Datum arg1 = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM(arg1);
-            uint8_t *wkb = (uint8_t*)VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(i);
-            } else {
-                geoms = lappend(geoms, lwgeom);
-                fids = lappend_int(fids, i);
-            }
+            add_pg_geometry_datum(geoms, i, arg1, isnull);
         }
 
         // read arguments
@@ -185,8 +179,9 @@ Datum pg_neighbor_match_test_window(PG_FUNCTION_ARGS) {
         arg_index += 1;
 
 
-        double **result = neighbor_match_test_window(fids, geoms, k, arrayLength, N, (const double**)r,
+        double **result = neighbor_match_test_window(geoms, k, arrayLength, N, (const double**)r,
                                                      power, is_inverse, is_arc, is_mile, scale_method, dist_type);
+        free_window_pg_geometries(geoms_ctx);
 
         // Safe the result
         context->result = result;
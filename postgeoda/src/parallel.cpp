@@ -0,0 +1,137 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the worker threads of the backend for parallel_for(), see parallel.h
+ */
+
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "parallel.h"
+
+// set by the GUC postgeoda.max_threads
+static int parallel_max_threads = INT_MAX;
+
+// the thread is a worker of the pool
+static thread_local bool in_parallel_worker = false;
+
+/**
+ * ParallelPool
+ *
+ * The worker threads of the backend: they wait for the tasks of a call of Run(), take them
+ * one by one, and wait again. There is at most one call at a time, from the backend thread.
+ */
+class ParallelPool {
+public:
+    ParallelPool() : workers(0), task(NULL), n_tasks(0), next(0), pending(0), busy(false) {}
+
+    void Run(size_t n_tasks, const std::function<void(size_t)>& task) {
+        std::unique_lock<std::mutex> lock(mutex);
+        Grow(n_tasks - 1);
+        this->task = &task;
+        this->n_tasks = n_tasks;
+        next = 0;
+        pending = n_tasks;
+        busy = true;
+        wake.notify_all();
+
+        // the calling thread takes the tasks too, so all tasks are done even without workers
+        while (next < n_tasks) {
+            size_t t = next++;
+            lock.unlock();
+            task(t);
+            lock.lock();
+            pending -= 1;
+        }
+        done.wait(lock, [this]() { return pending == 0; });
+        this->task = NULL;
+        busy = false;
+    }
+
+    bool Busy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return busy;
+    }
+
+protected:
+    // create the workers up to n_workers, with the mutex held
+    void Grow(size_t n_workers) {
+        if (workers >= n_workers) return;
+#ifndef _WIN32
+        // the workers inherit the signal mask: PG signals are for the backend thread only
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+#endif
+        try {
+            while (workers < n_workers) {
+                std::thread(&ParallelPool::Work, this).detach();
+                workers += 1;
+            }
+        } catch (const std::system_error&) {
+            // no more threads: the tasks are run by the workers there are
+        }
+#ifndef _WIN32
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+#endif
+    }
+
+    void Work() {
+        in_parallel_worker = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this]() { return task != NULL && next < n_tasks; });
+            size_t t = next++;
+            const std::function<void(size_t)>* f = task;
+            lock.unlock();
+            (*f)(t);
+            lock.lock();
+            pending -= 1;
+            if (pending == 0) done.notify_one();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t workers;
+    const std::function<void(size_t)>* task;
+    size_t n_tasks;
+    size_t next;
+    size_t pending;
+    bool busy;
+};
+
+static ParallelPool& parallel_pool()
+{
+    // never deleted: the detached workers wait on it until the backend exits
+    static ParallelPool* pool = new ParallelPool();
+    return *pool;
+}
+
+void parallel_set_max_threads(int max_threads)
+{
+    parallel_max_threads = std::max(1, max_threads);
+}
+
+int parallel_threads(int cpu_threads)
+{
+    return std::max(1, std::min(cpu_threads, parallel_max_threads));
+}
+
+void parallel_run(size_t n_tasks, const std::function<void(size_t)>& task)
+{
+    if (n_tasks == 0) return;
+    if (n_tasks == 1 || in_parallel_worker || parallel_pool().Busy()) {
+        for (size_t t = 0; t < n_tasks; ++t) task(t);
+        return;
+    }
+    parallel_pool().Run(n_tasks, task);
+}
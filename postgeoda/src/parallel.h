@@ -0,0 +1,102 @@
+/**
+ * Changes:
+ * 2026-10-16 Move parallel_for() from contiguity.cpp so it can be shared
+ * 2026-10-16 Run parallel_for() on the worker threads of the backend (parallel.cpp) instead of new threads;
+ * cap the threads with parallel_threads()
+ * 2026-10-17 Note that the threads of libgeoda are only capped by parallel_threads(), not run by the workers
+ * 2026-10-17 parallel_guc_init() also defines postgeoda.perm_isa
+ */
+
+#ifndef __POST_PARALLEL__
+#define __POST_PARALLEL__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * parallel_set_max_threads
+ *
+ * Set the maximum number of threads of a call, including the calling thread (at least 1). It is
+ * set by the GUC postgeoda.max_threads (parallel_guc.c); without it, e.g. in the benchmarks, the
+ * number of threads is not capped.
+ */
+void parallel_set_max_threads(int max_threads);
+
+/**
+ * parallel_threads
+ *
+ * The number of threads to use for cpu_threads requested by a SQL function: cpu_threads capped
+ * by parallel_set_max_threads(), at least 1. Used for the threads of parallel_for(), and as the
+ * number of threads passed to libgeoda, which creates and joins its own threads in each call (the
+ * "lookup" and "complete" permutations of the LISA, the clustering): those don't use the workers.
+ */
+int parallel_threads(int cpu_threads);
+
+/**
+ * parallel_guc_init
+ *
+ * Define the GUCs postgeoda.max_threads and postgeoda.perm_isa (perm_kernel.h), called by _PG_init()
+ * (parallel_guc.c)
+ */
+void parallel_guc_init(void);
+
+#ifdef __cplusplus
+}
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <vector>
+
+/**
+ * parallel_run
+ *
+ * Run task(0), ..., task(n_tasks - 1) on the worker threads of the backend and the calling
+ * thread, and return when all tasks are done. The workers are created the first time they are
+ * needed and kept until the backend exits (with all signals blocked, so the signals are handled
+ * by the backend thread), so a call doesn't pay for the creation of its threads. A call from a
+ * task runs its tasks in the calling thread. task must not throw.
+ */
+void parallel_run(size_t n_tasks, const std::function<void(size_t)>& task);
+
+/**
+ * parallel_for
+ *
+ * Run func(thread_id, start, end) with the items [0, n_items) split into
+ * parallel_threads(n_threads) continuous ranges. An exception thrown in a thread
+ * is re-thrown in the caller after all ranges are done.
+ *
+ * NOTE: func runs outside of the PG backend thread, so it must not call
+ * lwerror/lwdebug, palloc or any other PG function.
+ */
+template <class Func>
+void parallel_for(int n_threads, size_t n_items, Func func)
+{
+    n_threads = parallel_threads(n_threads);
+    if (n_threads <= 1 || n_items < 2) {
+        func(0, 0, n_items);
+        return;
+    }
+    size_t n = std::min((size_t)n_threads, n_items);
+    size_t chunk = (n_items + n - 1) / n;
+
+    std::vector<std::exception_ptr> errors(n);
+    parallel_run(n, [&func, &errors, n_items, chunk](size_t t) {
+        size_t start = std::min(n_items, t * chunk);
+        size_t end = std::min(n_items, start + chunk);
+        try {
+            func((int)t, start, end);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    });
+    for (size_t t = 0; t < n; ++t) {
+        if (errors[t]) std::rethrow_exception(errors[t]);
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the GUC postgeoda.max_threads, see parallel.h
+ * 2026-10-17 Add the GUC postgeoda.perm_isa, see perm_kernel.h
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <utils/guc.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "parallel.h"
+#include "perm_kernel.h"
+
+/* postgeoda.max_threads */
+static int postgeoda_max_threads = 8;
+
+/* postgeoda.perm_isa: a PermIsa, or -1 ("auto") for the best one of the CPU */
+static int postgeoda_perm_isa = -1;
+
+static const struct config_enum_entry postgeoda_perm_isa_options[] = {
+    {"auto", -1, false},
+    {"scalar", PERM_ISA_SCALAR, false},
+    {"avx2", PERM_ISA_AVX2, false},
+    {"avx512", PERM_ISA_AVX512, false},
+    {NULL, 0, false}
+};
+
+/* the threads of a call are capped by max_worker_processes too */
+static void postgeoda_max_threads_assign(int newval, void *extra)
+{
+    parallel_set_max_threads(Min(newval, Max(max_worker_processes, 1)));
+}
+
+static void postgeoda_perm_isa_assign(int newval, void *extra)
+{
+    perm_set_max_isa(newval);
+}
+
+void parallel_guc_init(void)
+{
+    DefineCustomIntVariable("postgeoda.max_threads",
+                            "Maximum number of threads of a postgeoda function in a backend.",
+                            "The cpu_threads argument of the functions is capped by it and by "
+                            "max_worker_processes.",
+                            &postgeoda_max_threads,
+                            8, 1, 1024,
+                            PGC_USERSET,
+                            0,
+                            NULL, postgeoda_max_threads_assign, NULL);
+
+    DefineCustomEnumVariable("postgeoda.perm_isa",
+                             "Instruction set of the permutations of the LISA functions.",
+                             "The sums of the random neighbors of the philox and sequential methods and of "
+                             "local_moran_fast() use the best instruction set of the CPU up to this one: "
+                             "auto, scalar, avx2 or avx512. The results are the same for all of them.",
+                             &postgeoda_perm_isa,
+                             -1,
+                             postgeoda_perm_isa_options,
+                             PGC_USERSET,
+                             0,
+                             NULL, postgeoda_perm_isa_assign, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,276 @@
+/**
+ * Changes:
+ * 2026-10-16 Add PermTable and perm_lag_sums(): the conditional permutations of the LISA
+ * with a precomputed table of permutations and AVX2/AVX-512 gathers
+ * 2026-10-16 Add the permutations in a range, the weighted lag sums and perm_sequential_test()
+ * 2026-10-16 Draw the random neighbors of PermTable with Philox4x32-10, row by row in parallel
+ * 2026-10-17 Add perm_set_max_isa() and perm_isa()
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PERM_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+#include "parallel.h"
+#include "perm_kernel.h"
+#include "philox.h"
+
+#define PERM_LANES 8
+
+PermTable::PermTable(uint32_t num_obs, uint32_t permutations, uint64_t seed)
+: num_obs(num_obs), permutations(permutations), seed(seed), width(0), draws(permutations, 0)
+{
+}
+
+void PermTable::Reserve(uint32_t max_nbrs, int n_threads)
+{
+    // an observation has at most num_obs - 1 random neighbors
+    uint32_t n_candidates = num_obs > 0 ? num_obs - 1 : 0;
+    uint32_t new_width = std::min(max_nbrs, n_candidates);
+    if (new_width <= width) return;
+
+    std::vector<int32_t> new_table((size_t)permutations * new_width);
+    // for wide rows, a bitmap of the drawn indices instead of a scan of the row
+    bool use_bitmap = new_width > 64;
+    const uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+
+    // row p only depends on (seed, p), so the rows can be drawn by any thread
+    parallel_for(n_threads, permutations, [&](int tid, size_t start, size_t end) {
+        std::vector<uint64_t> drawn(use_bitmap ? (n_candidates + 63) / 64 : 0, 0);
+        uint32_t rnd[PHILOX_LANES];
+
+        for (size_t p = start; p < end; ++p) {
+            int32_t* row = &new_table[p * new_width];
+            if (width > 0) memcpy(row, Row((uint32_t)p), sizeof(int32_t) * width);
+            if (use_bitmap) {
+                for (uint32_t k = 0; k < width; ++k) drawn[row[k] >> 6] |= 1ULL << (row[k] & 63);
+            }
+
+            // the random numbers of row p: the stream p of Philox, from the first one not used yet
+            uint64_t next = draws[p];
+            uint32_t k = width;
+            while (k < new_width) {
+                uint64_t first = next - next % PHILOX_LANES;
+                philox4x32_10_blocks(key, (uint32_t)p, first, 1, rnd);
+                for (uint64_t i = next - first; i < PHILOX_LANES && k < new_width; ++i) {
+                    next = first + i + 1;
+                    int32_t j = (int32_t)(((uint64_t)rnd[i] * n_candidates) >> 32);
+                    bool is_drawn = false;
+                    if (use_bitmap) {
+                        is_drawn = (drawn[j >> 6] >> (j & 63)) & 1;
+                        if (!is_drawn) drawn[j >> 6] |= 1ULL << (j & 63);
+                    } else {
+                        for (uint32_t q = 0; q < k && !is_drawn; ++q) is_drawn = row[q] == j;
+                    }
+                    if (!is_drawn) row[k++] = j;
+                }
+            }
+            draws[p] = next;
+
+            if (use_bitmap) {
+                for (uint32_t q = 0; q < new_width; ++q) drawn[row[q] >> 6] = 0;
+            }
+        }
+    });
+    table.swap(new_table);
+    width = new_width;
+}
+
+// lane l holds the values of the neighbors k with k % 8 == l
+static inline double perm_reduce_lanes(const double* lanes) {
+    double s0 = lanes[0] + lanes[4], s1 = lanes[1] + lanes[5];
+    double s2 = lanes[2] + lanes[6], s3 = lanes[3] + lanes[7];
+    return (s0 + s2) + (s1 + s3);
+}
+
+static inline void perm_add_tail(const int32_t* row, uint32_t start, uint32_t nn, const double* arr,
+                                 int32_t self, double* lanes) {
+    for (uint32_t k = start; k < nn; ++k) {
+        int32_t j = row[k];
+        lanes[k % PERM_LANES] += arr[j >= self ? j + 1 : j];
+    }
+}
+
+static void perm_lag_sums_scalar(const PermTable& table, const double* arr, int32_t self, uint32_t nn,
+                                 uint32_t perm_begin, uint32_t perm_end, double* sums) {
+    for (uint32_t p = perm_begin; p < perm_end; ++p) {
+        double lanes[PERM_LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        perm_add_tail(table.Row(p), 0, nn, arr, self, lanes);
+        sums[p - perm_begin] = perm_reduce_lanes(lanes);
+    }
+}
+
+#ifdef PERM_KERNEL_X86
+
+// the indices after self are shifted by one: j + (j > self - 1)
+__attribute__((target("avx2")))
+static inline __m128i perm_shift_after_self(__m128i j, __m128i self_minus_1) {
+    return _mm_sub_epi32(j, _mm_cmpgt_epi32(j, self_minus_1));
+}
+
+__attribute__((target("avx2")))
+static void perm_lag_sums_avx2(const PermTable& table, const double* arr, int32_t self, uint32_t nn,
+                               uint32_t perm_begin, uint32_t perm_end, double* sums) {
+    const __m128i self_minus_1 = _mm_set1_epi32(self - 1);
+    // the masked gathers with a zero source, which is the same as the unmasked gathers
+    const __m256d zero = _mm256_setzero_pd(), all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    uint32_t n_vec = nn - nn % PERM_LANES;
+    for (uint32_t p = perm_begin; p < perm_end; ++p) {
+        const int32_t* row = table.Row(p);
+        __m256d acc_lo = _mm256_setzero_pd(), acc_hi = _mm256_setzero_pd();
+        for (uint32_t k = 0; k < n_vec; k += PERM_LANES) {
+            __m128i j_lo = perm_shift_after_self(_mm_loadu_si128((const __m128i*)(row + k)), self_minus_1);
+            __m128i j_hi = perm_shift_after_self(_mm_loadu_si128((const __m128i*)(row + k + 4)), self_minus_1);
+            acc_lo = _mm256_add_pd(acc_lo, _mm256_mask_i32gather_pd(zero, arr, j_lo, all, 8));
+            acc_hi = _mm256_add_pd(acc_hi, _mm256_mask_i32gather_pd(zero, arr, j_hi, all, 8));
+        }
+        double lanes[PERM_LANES];
+        _mm256_storeu_pd(lanes, acc_lo);
+        _mm256_storeu_pd(lanes + 4, acc_hi);
+        perm_add_tail(row, n_vec, nn, arr, self, lanes);
+        sums[p - perm_begin] = perm_reduce_lanes(lanes);
+    }
+}
+
+__attribute__((target("avx512f,avx2")))
+static void perm_lag_sums_avx512(const PermTable& table, const double* arr, int32_t self, uint32_t nn,
+                                 uint32_t perm_begin, uint32_t perm_end, double* sums) {
+    const __m256i self_minus_1 = _mm256_set1_epi32(self - 1);
+    uint32_t n_vec = nn - nn % PERM_LANES;
+    for (uint32_t p = perm_begin; p < perm_end; ++p) {
+        const int32_t* row = table.Row(p);
+        __m512d acc = _mm512_setzero_pd();
+        for (uint32_t k = 0; k < n_vec; k += PERM_LANES) {
+            __m256i j = _mm256_loadu_si256((const __m256i*)(row + k));
+            j = _mm256_sub_epi32(j, _mm256_cmpgt_epi32(j, self_minus_1));
+            acc = _mm512_add_pd(acc, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, j, arr, 8));
+        }
+        double lanes[PERM_LANES];
+        _mm512_storeu_pd(lanes, acc);
+        perm_add_tail(row, n_vec, nn, arr, self, lanes);
+        sums[p - perm_begin] = perm_reduce_lanes(lanes);
+    }
+}
+
+#endif
+
+PermIsa perm_best_isa()
+{
+#ifdef PERM_KERNEL_X86
+    static int best = -1;
+    if (best < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            best = PERM_ISA_AVX512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            best = PERM_ISA_AVX2;
+        } else {
+            best = PERM_ISA_SCALAR;
+        }
+    }
+    return (PermIsa)best;
+#else
+    return PERM_ISA_SCALAR;
+#endif
+}
+
+static int perm_max_isa = -1;
+
+void perm_set_max_isa(int max_isa)
+{
+    perm_max_isa = max_isa;
+}
+
+PermIsa perm_isa()
+{
+    PermIsa best = perm_best_isa();
+    if (perm_max_isa < 0 || perm_max_isa >= (int)best) return best;
+    return (PermIsa)perm_max_isa;
+}
+
+const char* perm_isa_name(PermIsa isa)
+{
+    switch (isa) {
+        case PERM_ISA_AVX2:
+            return "avx2";
+        case PERM_ISA_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+void perm_lag_sums(PermIsa isa, const PermTable& table, const double* arr, uint32_t self, uint32_t nn,
+                   double* sums)
+{
+    perm_lag_sums(isa, table, arr, self, nn, 0, table.permutations, sums);
+}
+
+void perm_lag_sums(PermIsa isa, const PermTable& table, const double* arr, uint32_t self, uint32_t nn,
+                   uint32_t perm_begin, uint32_t perm_end, double* sums)
+{
+#ifdef PERM_KERNEL_X86
+    if (isa == PERM_ISA_AVX512) {
+        perm_lag_sums_avx512(table, arr, (int32_t)self, nn, perm_begin, perm_end, sums);
+        return;
+    }
+    if (isa == PERM_ISA_AVX2) {
+        perm_lag_sums_avx2(table, arr, (int32_t)self, nn, perm_begin, perm_end, sums);
+        return;
+    }
+#endif
+    perm_lag_sums_scalar(table, arr, (int32_t)self, nn, perm_begin, perm_end, sums);
+}
+
+void perm_weighted_lag_sums(const PermTable& table, const double* arr, uint32_t self, uint32_t nn,
+                            const double* weights, uint32_t perm_begin, uint32_t perm_end, double* sums)
+{
+    int32_t s = (int32_t)self;
+    for (uint32_t p = perm_begin; p < perm_end; ++p) {
+        const int32_t* row = table.Row(p);
+        double lanes[PERM_LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (uint32_t k = 0; k < nn; ++k) {
+            int32_t j = row[k];
+            lanes[k % PERM_LANES] += weights[k] * arr[j >= s ? j + 1 : j];
+        }
+        sums[p - perm_begin] = perm_reduce_lanes(lanes);
+    }
+}
+
+PermTestResult perm_sequential_test(PermIsa isa, const PermTable& table, const double* arr, uint32_t self,
+                                    uint32_t nn, const double* weights, double scale, double observed,
+                                    double significance_cutoff)
+{
+    uint32_t M = table.permutations;
+    // a test with h == 0 can't stop early
+    uint64_t h = (uint64_t)floor(significance_cutoff * (M + 1.0));
+
+    double sums[PERM_SEQUENTIAL_BLOCK];
+    uint32_t larger = 0, used = 0;
+    while (used < M) {
+        uint32_t end = std::min(M, used + PERM_SEQUENTIAL_BLOCK);
+        if (weights != NULL) {
+            perm_weighted_lag_sums(table, arr, self, nn, weights, used, end, sums);
+        } else {
+            perm_lag_sums(isa, table, arr, self, nn, used, end, sums);
+        }
+        for (uint32_t p = used; p < end; ++p) {
+            if (scale * sums[p - used] >= observed) larger += 1;
+        }
+        used = end;
+
+        uint32_t folded = std::min(larger, used - larger);
+        if (h > 0 && used < M && folded >= h) {
+            PermTestResult result = {(h + 1.0) / (used + 1.0), used};
+            return result;
+        }
+    }
+    uint32_t folded = std::min(larger, M - larger);
+    PermTestResult result = {(folded + 1.0) / (M + 1.0), M};
+    return result;
+}
@@ -0,0 +1,154 @@
+/**
+ * Changes:
+ * 2026-10-16 Add PermTable and perm_lag_sums(): the conditional permutations of the LISA
+ * with a precomputed table of permutations and AVX2/AVX-512 gathers
+ * 2026-10-16 Add the permutations in a range, the weighted lag sums and perm_sequential_test()
+ * 2026-10-16 Draw the random neighbors with Philox4x32-10 (philox.h); Reserve() with threads
+ * 2026-10-17 Add perm_set_max_isa() for the GUC postgeoda.perm_isa, and perm_isa()
+ */
+
+#ifndef __POST_PERM_KERNEL__
+#define __POST_PERM_KERNEL__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum PermIsa {
+    PERM_ISA_SCALAR = 0,
+    PERM_ISA_AVX2 = 1,
+    PERM_ISA_AVX512 = 2
+};
+
+/**
+ * perm_set_max_isa
+ *
+ * Cap the instruction set of perm_lag_sums() used by the LISA functions (a PermIsa, see perm_isa()).
+ * It is set by the GUC postgeoda.perm_isa (parallel_guc.c), e.g. to compare the kernels; without
+ * it, the best instruction set of the CPU is used.
+ */
+void perm_set_max_isa(int max_isa); // < 0: not capped
+
+#ifdef __cplusplus
+}
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * PermTable
+ *
+ * The random neighbors of the conditional permutations of the LISA (the "lookup" method of
+ * libgeoda): row p has width distinct indices in [0, num_obs - 1), drawn from the random
+ * numbers of the counter-based generator Philox4x32-10 keyed by the seed, with the counters
+ * of stream p (philox.h), so the first k indices of each row are the same for any width >= k.
+ * For observation i, an index j >= i is the observation j + 1, so i is never its own
+ * random neighbor, and the same table is used by all observations.
+ *
+ * The table only depends on (num_obs, permutations, seed): not on the number of threads, the
+ * order of the rows of a query, or the node where the query runs.
+ *
+ * The table is built once (e.g. for all rows of a query) and is read-only after Reserve(),
+ * so it can be used by more than one thread.
+ */
+class PermTable {
+public:
+    PermTable(uint32_t num_obs, uint32_t permutations, uint64_t seed);
+
+    // make the rows at least max_nbrs wide; the indices already drawn are kept. The rows are
+    // drawn by n_threads threads, with the same table for any n_threads
+    void Reserve(uint32_t max_nbrs, int n_threads = 1);
+
+    bool Matches(uint32_t num_obs, uint32_t permutations, uint64_t seed) const {
+        return this->num_obs == num_obs && this->permutations == permutations && this->seed == seed;
+    }
+
+    const int32_t* Row(uint32_t perm) const { return &table[(size_t)perm * width]; }
+
+    uint32_t num_obs;
+    uint32_t permutations;
+    uint64_t seed;
+    uint32_t width;
+
+protected:
+    std::vector<int32_t> table; // permutations x width
+    std::vector<uint64_t> draws; // the number of random numbers used by each row
+};
+
+// the best instruction set supported by the CPU, checked once
+PermIsa perm_best_isa();
+
+// the instruction set of the LISA functions: perm_best_isa() capped by perm_set_max_isa()
+PermIsa perm_isa();
+
+// e.g. "avx2"
+const char* perm_isa_name(PermIsa isa);
+
+/**
+ * perm_lag_sums
+ *
+ * The sum of the values of nn random neighbors of observation self in each permutation:
+ * sums[p] = sum(arr[k]) of the first nn indices k of row p (shifted after self). The sums are
+ * added in the same order by all instruction sets (8 lanes, then a fixed tree), so the
+ * p-values don't depend on the CPU.
+ *
+ * @param isa an instruction set supported by the CPU, e.g. perm_best_isa()
+ * @param table Reserve(nn) has been called
+ * @param arr the values of all observations
+ * @param self
+ * @param nn the number of neighbors of self, < num_obs
+ * @param sums table.permutations values
+ */
+void perm_lag_sums(PermIsa isa, const PermTable& table, const double* arr, uint32_t self, uint32_t nn,
+                   double* sums);
+
+// the same for the permutations [perm_begin, perm_end): sums[p - perm_begin]
+void perm_lag_sums(PermIsa isa, const PermTable& table, const double* arr, uint32_t self, uint32_t nn,
+                   uint32_t perm_begin, uint32_t perm_end, double* sums);
+
+// the same with the weight of each neighbor: sums[p - perm_begin] = sum(weights[k] * arr[row[k]])
+void perm_weighted_lag_sums(const PermTable& table, const double* arr, uint32_t self, uint32_t nn,
+                            const double* weights, uint32_t perm_begin, uint32_t perm_end, double* sums);
+
+// the permutations of a block of perm_sequential_test(), between two checks of the counts
+#define PERM_SEQUENTIAL_BLOCK 64
+
+typedef struct {
+    double pseudo_p;
+    uint32_t permutations; // the number of permutations used
+} PermTestResult;
+
+/**
+ * perm_sequential_test
+ *
+ * The pseudo p-value of the statistic of observation self with sequential (Besag-Clifford)
+ * early stopping: the permutations of the table are drawn in blocks, and the test stops
+ * once the number of permuted statistics on the less extreme side, the smaller of the
+ * counts >= and < the observed statistic, reaches h = floor(significance_cutoff *
+ * (table.permutations + 1)). Then the observation can't be significant with all permutations,
+ * and the pseudo p-value is (h + 1) / (l + 1) after l permutations, which is larger than
+ * significance_cutoff. Otherwise all permutations are used and the pseudo p-value is the
+ * same as with the complete test: (min(larger, M - larger) + 1) / (M + 1).
+ *
+ * The permuted statistic is scale * (lag sum of the random neighbors), e.g. z_i / nn for
+ * local Moran.
+ *
+ * @param isa
+ * @param table Reserve(nn) has been called
+ * @param arr
+ * @param self
+ * @param nn
+ * @param weights the weight of each neighbor, or NULL
+ * @param scale
+ * @param observed the statistic of self
+ * @param significance_cutoff
+ * @return
+ */
+PermTestResult perm_sequential_test(PermIsa isa, const PermTable& table, const double* arr, uint32_t self,
+                                    uint32_t nn, const double* weights, double scale, double observed,
+                                    double significance_cutoff);
+
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the counter-based random generator Philox4x32-10 for the permutations
+ *
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC 2011): the
+ * random numbers are a function of a 128-bit counter and a 64-bit key, without a state to
+ * carry from one number to the next. Any random number of any stream can be computed
+ * directly, so the same numbers are drawn whatever the number of threads or the order in
+ * which the streams are used. There are no dependencies on PG or libgeoda here.
+ */
+
+#ifndef __POST_PHILOX__
+#define __POST_PHILOX__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// the number of random numbers of each block (each counter) of philox4x32_10_blocks()
+#define PHILOX_LANES 8
+
+/**
+ * philox4x32_10
+ *
+ * The 4 random numbers of the counter ctr with the key
+ *
+ * @param ctr
+ * @param key
+ * @param out 4 random numbers
+ */
+static inline void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; ++round) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/**
+ * philox4x32_10_blocks
+ *
+ * The random numbers [first, first + n_blocks * PHILOX_LANES) of the stream (key, stream):
+ * random number i is the (i % 4)-th output of the counter {i / 4 (64 bits), stream, 0}. The
+ * rounds run on PHILOX_LANES / 4 counters at a time in plain loops over the lanes, so the
+ * compiler can use the vector units for them.
+ *
+ * @param key
+ * @param stream e.g. the index of a permutation
+ * @param first a multiple of PHILOX_LANES
+ * @param n_blocks
+ * @param out n_blocks * PHILOX_LANES random numbers
+ */
+static inline void philox4x32_10_blocks(const uint32_t key[2], uint32_t stream, uint64_t first, size_t n_blocks,
+                                        uint32_t *out) {
+    enum { N = PHILOX_LANES / 4 };
+    for (size_t b = 0; b < n_blocks; ++b) {
+        uint32_t c0[N], c1[N], c2[N], c3[N];
+        for (int l = 0; l < N; ++l) {
+            uint64_t ctr = (first + b * PHILOX_LANES) / 4 + l;
+            c0[l] = (uint32_t)ctr;
+            c1[l] = (uint32_t)(ctr >> 32);
+            c2[l] = stream;
+            c3[l] = 0;
+        }
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round) {
+            for (int l = 0; l < N; ++l) {
+                uint64_t p0 = (uint64_t)PHILOX_M0 * c0[l];
+                uint64_t p1 = (uint64_t)PHILOX_M1 * c2[l];
+                uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1[l] ^ k0;
+                uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3[l] ^ k1;
+                c1[l] = (uint32_t)p1;
+                c3[l] = (uint32_t)p0;
+                c0[l] = n0;
+                c2[l] = n2;
+            }
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        uint32_t *o = out + b * PHILOX_LANES;
+        for (int l = 0; l < N; ++l) {
+            o[4 * l] = c0[l];
+            o[4 * l + 1] = c1[l];
+            o[4 * l + 2] = c2[l];
+            o[4 * l + 3] = c3[l];
+        }
+    }
+}
+
+#endif
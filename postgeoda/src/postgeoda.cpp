@@ -4,9 +4,21 @@
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
  * 2021-4-23 Add CreateKnnWeights(); CreateDistanceWeights();
+ * 2026-10-16 Add AddWKB() using WKBReader instead of LWGEOM
+ * 2026-10-16 Use ContiguityBuilder in CreateContWeights() if cpu_threads > 1
+ * 2026-10-16 Use KdTree in CreateKnnWeights() and CreateKnnWeightsSub() if cpu_threads > 1
+ * 2026-10-16 Add CreateKnnIndex() and QueryKnnNeighbors() for KNN weights in blocks
+ * 2026-10-16 Do not limit k to 65535 in QueryKnnNeighbors()
+ * 2026-10-17 Use ContiguityBuilder in CreateContWeights() for any cpu_threads
+ * 2026-10-17 Use KdTree in CreateKnnWeights() and CreateKnnWeightsSub() for any cpu_threads
+ * 2026-10-17 CreateKnnWeights() and CreateKnnWeightsSub() use libgeoda with one thread, KdTree with more
+ * 2026-10-17 QueryKnnNeighbors() sets the number of neighbors to the neighbors found
+ * 2026-10-17 CreateContWeights() uses libgeoda with one thread, ContiguityBuilder with more
  */
 
+#include <cmath>
 #include <limits>
+#include <exception>
 #include <libgeoda/shape/centroid.h>
 #include <libgeoda/gda_weights.h>
 #include <libgeoda/weights/GeodaWeight.h>
@@ -14,13 +26,20 @@
 #include <libgeoda/pg/utils.h>
 #include "postgeoda.h"
 #include "proxy.h"
+#include "wkbreader.h"
+#include "contiguity.h"
+#include "kdtree.h"
+#include "parallel.h"
 
 
-PostGeoDa::PostGeoDa(int num_obs, const std::vector<uint32_t>& _fids)
+PostGeoDa::PostGeoDa(int num_obs)
 {
     this->map_type = gda::NULL_SHAPE;
-    this->num_obs = num_obs;
-    this->fids = _fids;
+    this->num_obs = 0;
+    if (num_obs > 0) {
+        this->fids.reserve(num_obs);
+        this->main_map.records.reserve(num_obs);
+    }
 }
 
 PostGeoDa::~PostGeoDa()
@@ -86,177 +105,32 @@ void PostGeoDa::SetMapType(int geom_type)
     }
 }
 
-void PostGeoDa::AddPoint(LWPOINT *lw_pt) {
-    /* Grab the point: note getPoint4d will correctly handle
-	the case where the POINTs don't contain Z or M coordinates */
-    POINT4D p4d;
-    p4d = getPoint4d(lw_pt->point, 0);
+void PostGeoDa::AddWKB(uint32_t fid, const uint8_t *wkb, size_t size) {
+    WKBReader reader(wkb, size);
+    int geom_type = reader.Read(this);
+    if (this->map_type == gda::NULL_SHAPE && geom_type > 0) {
+        lwdebug(1, "PostGeoDa::AddWKB: geom_type=%d", geom_type);
+        SetMapType(geom_type);
+    }
+    this->fids.push_back(fid);
+    this->num_obs += 1;
+}
 
+void PostGeoDa::AddPoint(double x, double y) {
     gda::PointContents* pt = new gda::PointContents();
-    pt->x = p4d.x;
-    pt->y = p4d.y;
+    pt->x = x;
+    pt->y = y;
     this->main_map.set_bbox(pt->x,  pt->y);
     this->main_map.records.push_back(pt);
 }
 
-void PostGeoDa::AddMultiPoint(LWMPOINT *lw_mpt) {
-    /* Grab the points: note getPoint4d will correctly handle
-	the case where the POINTs don't contain Z or M coordinates */
-    POINT4D p4d;
-    for (size_t i = 0; i < lw_mpt->ngeoms; i++)
-    {
-        p4d = getPoint4d(lw_mpt->geoms[i]->point, 0);
-
-        gda::PointContents* pt = new gda::PointContents();
-        pt->x = p4d.x;
-        pt->y = p4d.y;
-        this->main_map.set_bbox(pt->x,  pt->y);
-        this->main_map.records.push_back(pt);
-        break;// only take the first point, even it has multipoints
-    }
-}
-
-void PostGeoDa::AddPolygon(LWPOLY *lw_poly) {
-    size_t  i, j;
-    POINT4D p4d;
-    /* Allocate storage for ring pointers */
-    int shppointtotal = 0, shppoint = 0;
-
-    /* First count through all the points in each ring so we now how much memory is required */
-    for (i = 0; i < lw_poly->nrings; i++)
-        shppointtotal += lw_poly->rings[i]->npoints;
-
-
-    gda::PolygonContents *poly = new gda::PolygonContents();
-    poly->num_parts = 0;
-    poly->num_points = 0;
-
-    double minx = std::numeric_limits<double>::max();
-    double miny = std::numeric_limits<double>::max();
-    double maxx = std::numeric_limits<double>::lowest();
-    double maxy = std::numeric_limits<double>::lowest();
-    double x, y;
-
-    /* Iterate through each ring setting up shpparts to point to the beginning of each ring */
-    for (i = 0; i < lw_poly->nrings; i++) {
-        /* For each ring, store the integer coordinate offset for the start of each ring */
-        poly->num_parts += 1;
-        poly->parts.push_back(shppoint);
-
-        bool is_hole = i > 0 ? true : false;
-        poly->holes.push_back(is_hole);
-
-        for (j = 0; j < lw_poly->rings[i]->npoints; j++) {
-            p4d = getPoint4d(lw_poly->rings[i], j);
-
-            x = p4d.x;
-            y = p4d.y;
-
-            poly->points.push_back(gda::Point(x,y));
-            poly->num_points += 1;
-
-            if ( x < minx ) minx = x;
-            if ( x >= maxx ) maxx = x;
-            if ( y < miny ) miny = y;
-            if ( y >= maxy ) maxy = y;
-
-            /* Increment the point counter */
-            shppoint++;
-        }
-
-        /*
-		 * First ring should be clockwise,
-		 * other rings should be counter-clockwise
-		 */
-    }
-
-    poly->box.resize(4);
-    poly->box[0] = minx;
-    poly->box[1] = miny;
-    poly->box[2] = maxx;
-    poly->box[3] = maxy;
-
-    this->main_map.set_bbox(minx, miny);
-    this->main_map.set_bbox(maxx, maxy);
-    this->main_map.records.push_back(poly);
-}
-
-void PostGeoDa::AddMultiPolygon(LWMPOLY *lw_mpoly) {
-    POINT4D p4d;
-    uint32_t i, j, k;
-
-    int shppointtotal = 0, shppoint = 0, shpringtotal = 0, shpring = 0;
-
-    /* NOTE: Multipolygons are stored in shapefiles as Polygon* shapes with multiple outer rings */
-
-    /* First count through each ring of each polygon so we now know much memory is required */
-    for (i = 0; i < lw_mpoly->ngeoms; i++) {
-        for (j = 0; j < lw_mpoly->geoms[i]->nrings; j++) {
-            shpringtotal++;
-            shppointtotal += lw_mpoly->geoms[i]->rings[j]->npoints;
-        }
-    }
-
-    gda::PolygonContents *poly = new gda::PolygonContents();
-    poly->num_parts = 0;
-    poly->num_points = 0;
-
-    double minx = std::numeric_limits<double>::max();
-    double miny = std::numeric_limits<double>::max();
-    double maxx = std::numeric_limits<double>::lowest();
-    double maxy = std::numeric_limits<double>::lowest();
-    double x, y;
-
-    /* Iterate through each ring of each polygon in turn */
-    for (i = 0; i < lw_mpoly->ngeoms; i++) {
-        for (j = 0; j < lw_mpoly->geoms[i]->nrings; j++) {
-            /* For each ring, store the integer coordinate offset for the start of each ring */
-            poly->parts.push_back(shppoint);
-            poly->num_parts += 1;
-
-            bool is_hole = j > 0 ? true : false;
-            poly->holes.push_back(is_hole);
-
-            lwdebug(4, "Ring offset: %d", shpring);
-
-            for (k = 0; k < lw_mpoly->geoms[i]->rings[j]->npoints; k++) {
-                p4d = getPoint4d(lw_mpoly->geoms[i]->rings[j], k);
-
-                x = p4d.x;
-                y = p4d.y;
-
-                poly->points.push_back(gda::Point(x, y));
-                poly->num_points += 1;
-
-                if (x < minx) minx = x;
-                if (x >= maxx) maxx = x;
-                if (y < miny) miny = y;
-                if (y >= maxy) maxy = y;
-
-                /* Increment the point counter */
-                shppoint++;
-            }
-            /*
-			* First ring should be clockwise,
-			* other rings should be counter-clockwise
-			*/
-        }
-        /* Increment the ring counter */
-        shpring++;
-    }
-
-    lwdebug(4, "poly->box[0]=%f", minx);
-    lwdebug(4, "poly->box[1]=%f", miny);
-    lwdebug(4, "poly->box[2]=%f", maxx);
-    lwdebug(4, "poly->box[3]=%f", maxy);
-    poly->box.resize(4);
-    poly->box[0] = minx;
-    poly->box[1] = miny;
-    poly->box[2] = maxx;
-    poly->box[3] = maxy;
-
-    this->main_map.set_bbox(minx, miny);
-    this->main_map.set_bbox(maxx, maxy);
+void PostGeoDa::AddPolygon(gda::PolygonContents *poly) {
+    lwdebug(4, "poly->box[0]=%f", poly->box[0]);
+    lwdebug(4, "poly->box[1]=%f", poly->box[1]);
+    lwdebug(4, "poly->box[2]=%f", poly->box[2]);
+    lwdebug(4, "poly->box[3]=%f", poly->box[3]);
+    this->main_map.set_bbox(poly->box[0], poly->box[1]);
+    this->main_map.set_bbox(poly->box[2], poly->box[3]);
     this->main_map.records.push_back(poly);
 }
 
@@ -307,12 +181,40 @@ PGWeight *PostGeoDa::create_pgweight(GeoDaWeight* gda_w)
     return pg_w;
 }
 
+PGWeight *PostGeoDa::create_pgweight(const std::vector<size_t>& offsets, const std::vector<uint32_t>& nbrs)
+{
+    PGWeight* pg_w = (PGWeight*)malloc(sizeof(PGWeight));
+
+    pg_w->w_type = 'a'; // GAL type
+    pg_w->num_obs = this->num_obs;
+    pg_w->neighbors = (PGNeighbor*)malloc(num_obs * sizeof(PGNeighbor));
+
+    for (size_t i=0; i<this->num_obs; i++) {
+        size_t nbr_sz = offsets[i+1] - offsets[i];
+
+        PGNeighbor* pg_nbr = &pg_w->neighbors[i];
+        pg_nbr->idx = fids[i];
+        pg_nbr->num_nbrs = nbr_sz;
+        pg_nbr->nbrId = (uint32_t*)malloc(nbr_sz * sizeof(uint32_t));
+        pg_nbr->nbrWeight = 0;
+
+        for (size_t j=0; j<nbr_sz; j++) {
+            pg_nbr->nbrId[j] = fids[ nbrs[offsets[i] + j] ];
+        }
+    }
+    return pg_w;
+}
+
 /**
  * CreateKnnWeights()
  *
  * This function creates a K-NN spatial weights. It is also used to create
  * a KNN based Kernel weights.
  *
+ * Without a kernel and with cpu_threads > 1, the weights are created by CreateKnnWeightsThreads():
+ * the neighbors are the same as libgeoda's, sorted by (distance, fid). The kernel weights and
+ * the weights of one thread are created by libgeoda.
+ *
  * @param k
  * @param power
  * @param is_inverse
@@ -322,14 +224,19 @@ PGWeight *PostGeoDa::create_pgweight(GeoDaWeight* gda_w)
  * @param bandwidth
  * @param adaptive_bandwidth
  * @param use_kernel_diagonal
+ * @param cpu_threads 1: libgeoda; > 1: number of threads to query the neighbors from the kd-tree
  * @return
  */
 PGWeight *PostGeoDa::CreateKnnWeights(int k, double power, bool is_inverse, bool is_arc,
                                       bool is_mile, std::string kernel,
                                       double bandwidth, bool adaptive_bandwidth,
-                                      bool use_kernel_diagonal) {
+                                      bool use_kernel_diagonal, int cpu_threads) {
     lwdebug(1, "Enter PostGeoDa::CreateKnnWeights(k=%d).", k);
 
+    if (kernel.empty() && cpu_threads > 1) {
+        return CreateKnnWeightsThreads(k, 0, this->num_obs, power, is_inverse, is_arc, is_mile, cpu_threads);
+    }
+
     std::string poly_id = "";
     GeoDaWeight* gda_w = gda_knn_weights(this, k, power, is_inverse, is_arc, is_mile,
                                          kernel, bandwidth, adaptive_bandwidth, use_kernel_diagonal, poly_id);
@@ -349,9 +256,13 @@ PGWeight *PostGeoDa::CreateKnnWeights(int k, double power, bool is_inverse, bool
 PGWeight *PostGeoDa::CreateKnnWeightsSub(int k, int start, int end, double power, bool is_inverse, bool is_arc,
                                       bool is_mile, std::string kernel,
                                       double bandwidth, bool adaptive_bandwidth,
-                                      bool use_kernel_diagonal) {
+                                      bool use_kernel_diagonal, int cpu_threads) {
     lwdebug(1, "Enter PostGeoDa::CreateKnnWeightsSub(k=%d, start=%d, end=%d).", k, start, end);
 
+    if (kernel.empty() && cpu_threads > 1) {
+        return CreateKnnWeightsThreads(k, start, end, power, is_inverse, is_arc, is_mile, cpu_threads);
+    }
+
     std::string poly_id = "";
     GeoDaWeight* gda_w = gda_knn_weights_sub(this, k, start, end, power, is_inverse, is_arc, is_mile,
                                          kernel, bandwidth, adaptive_bandwidth, use_kernel_diagonal, poly_id);
@@ -368,6 +279,167 @@ PGWeight *PostGeoDa::CreateKnnWeightsSub(int k, int start, int end, double power
     return pg_w;
 }
 
+/**
+ * CreateKnnIndex()
+ *
+ * This function creates a kd-tree of the centroids, with the fids as the ids of the points.
+ * If is_arc, the centroids are (lon, lat) in degrees, and they are converted to the points on
+ * the unit sphere: the nearest neighbors by chord distance are the nearest by arc distance.
+ *
+ * @param is_arc
+ * @return KdTree*, which should be deleted by the caller
+ */
+KdTree *PostGeoDa::CreateKnnIndex(bool is_arc) {
+    lwdebug(1, "Enter PostGeoDa::CreateKnnIndex(is_arc=%d).", is_arc);
+    const double deg_to_rad = M_PI / 180.0;
+
+    const std::vector<gda::PointContents*>& cents = this->GetCentroids();
+    int dim = is_arc ? 3 : 2;
+    std::vector<double> coords(this->num_obs * dim);
+    for (size_t i=0; i<this->num_obs; i++) {
+        if (is_arc) {
+            double lon = cents[i]->x * deg_to_rad;
+            double lat = cents[i]->y * deg_to_rad;
+            coords[i * 3] = cos(lat) * cos(lon);
+            coords[i * 3 + 1] = cos(lat) * sin(lon);
+            coords[i * 3 + 2] = sin(lat);
+        } else {
+            coords[i * 2] = cents[i]->x;
+            coords[i * 2 + 1] = cents[i]->y;
+        }
+    }
+
+    KdTree* tree = 0;
+    try {
+        tree = new KdTree(coords, this->fids, dim, is_arc ? KNN_INDEX_ARC : 0);
+    } catch (std::exception& e) {
+        lwerror("CreateKnnIndex: %s", e.what());
+    }
+    return tree;
+}
+
+/**
+ * QueryKnnNeighbors()
+ *
+ * This function queries the k nearest neighbors of the points at `positions` of the kd-tree
+ * using cpu_threads threads. The neighbors of positions[i] are written into neighbors[i]
+ * (the arrays of neighbor ids and weights are allocated here), sorted by (distance, fid).
+ * The points with the same fid as the query point are not its neighbors, so a point can have
+ * less than k neighbors if the fids are not unique.
+ *
+ * The weights are the distances, or distance^-power if is_inverse. If the tree is created
+ * with is_arc, the distances are arc distances in miles (is_mile) or kilometers.
+ *
+ * @param tree
+ * @param positions
+ * @param k
+ * @param power
+ * @param is_inverse
+ * @param is_mile
+ * @param cpu_threads
+ * @param neighbors
+ */
+void PostGeoDa::QueryKnnNeighbors(const KdTree& tree, const std::vector<size_t>& positions, int k, double power,
+                                  bool is_inverse, bool is_mile, int cpu_threads, PGNeighbor* neighbors) {
+    const bool is_arc = (tree.GetFlags() & KNN_INDEX_ARC) != 0;
+    const double earth_radius = is_mile ? 3958.76 : 6371.0;
+    const int dim = tree.GetDim();
+
+    if (k > (int)tree.GetNumPoints() - 1) k = (int)tree.GetNumPoints() - 1;
+    if (k < 0) k = 0;
+
+    for (size_t i=0; i<positions.size(); i++) {
+        PGNeighbor* pg_nbr = &neighbors[i];
+        pg_nbr->idx = tree.GetId(positions[i]);
+        pg_nbr->num_nbrs = 0;
+        pg_nbr->nbrId = (uint32_t*)malloc(k * sizeof(uint32_t));
+        pg_nbr->nbrWeight = (float*)malloc(k * sizeof(float));
+        if (k > 0 && (pg_nbr->nbrId == 0 || pg_nbr->nbrWeight == 0)) {
+            lwerror("QueryKnnNeighbors: unable to allocate memory for neighbors.");
+        }
+    }
+
+    try {
+        // NOTE: no PG functions (e.g. lwdebug) can be called in the threads
+        parallel_for(cpu_threads, positions.size(), [&](int tid, size_t start, size_t end) {
+            std::vector<KdTree::Neighbor> nbrs;
+            for (size_t i = start; i < end; ++i) {
+                size_t pos = positions[i];
+                tree.Knn(tree.GetPoint(pos), k, tree.GetId(pos), nbrs);
+
+                PGNeighbor* pg_nbr = &neighbors[i];
+                pg_nbr->num_nbrs = (uint32_t)nbrs.size();
+                for (size_t j = 0; j < nbrs.size(); ++j) {
+                    double dist = sqrt(nbrs[j].first);
+                    if (is_arc) {
+                        // chord length on the unit sphere to arc length on the earth
+                        dist = 2.0 * asin(std::min(1.0, dist / 2.0)) * earth_radius;
+                    }
+                    pg_nbr->nbrId[j] = nbrs[j].second;
+                    pg_nbr->nbrWeight[j] = is_inverse ? (dist > 0 ? pow(dist, -power) : 0) : dist;
+                }
+            }
+        });
+    } catch (std::exception& e) {
+        lwerror("QueryKnnNeighbors: %s", e.what());
+    }
+}
+
+/**
+ * CreateKnnWeightsThreads()
+ *
+ * This function creates a K-NN spatial weights for the observations [start, end): the kd-tree
+ * of all observations is built once, then it is queried by cpu_threads threads, which write the
+ * neighbors directly into the arrays of PGWeight. The observations out of [start, end) have
+ * no neighbors. See QueryKnnNeighbors() for the weights.
+ *
+ * @param k
+ * @param start
+ * @param end
+ * @param power
+ * @param is_inverse
+ * @param is_arc
+ * @param is_mile
+ * @param cpu_threads
+ * @return
+ */
+PGWeight *PostGeoDa::CreateKnnWeightsThreads(int k, int start, int end, double power, bool is_inverse,
+                                             bool is_arc, bool is_mile, int cpu_threads) {
+    lwdebug(1, "Enter PostGeoDa::CreateKnnWeightsThreads(k=%d, cpu_threads=%d).", k, cpu_threads);
+
+    if (start < 0) start = 0;
+    if (end > this->num_obs) end = this->num_obs;
+
+    KdTree* tree = CreateKnnIndex(is_arc);
+
+    PGWeight* pg_w = (PGWeight*)malloc(sizeof(PGWeight));
+    pg_w->w_type = 'w'; // GWT type
+    pg_w->num_obs = this->num_obs;
+    pg_w->neighbors = (PGNeighbor*)malloc(num_obs * sizeof(PGNeighbor));
+
+    std::vector<size_t> positions;
+    for (size_t i=0; i<this->num_obs; i++) {
+        if ((int)i >= start && (int)i < end) {
+            positions.push_back(tree->GetPositions()[i]);
+        } else {
+            PGNeighbor* pg_nbr = &pg_w->neighbors[i];
+            pg_nbr->idx = fids[i];
+            pg_nbr->num_nbrs = 0;
+            pg_nbr->nbrId = 0;
+            pg_nbr->nbrWeight = 0;
+        }
+    }
+
+    if (!positions.empty()) {
+        QueryKnnNeighbors(*tree, positions, k, power, is_inverse, is_mile, cpu_threads, &pg_w->neighbors[start]);
+    }
+
+    delete tree;
+
+    lwdebug(1, "Exit PostGeoDa::CreateKnnWeightsThreads().");
+    return pg_w;
+}
+
 /**
  * CreateDistanceWeights()
  *
@@ -406,13 +478,22 @@ PGWeight *PostGeoDa::CreateDistanceWeights(double dist_threshold, double power,
  * CreateContWeights()
  *
  * This function creates a contiguity spatial weights (Queen or Rook).
+ *
+ * If the geometries are polygons, precision_threshold is 0 and cpu_threads > 1, the weights are
+ * created by ContiguityBuilder using cpu_threads threads: it matches the vertices exactly and
+ * finds the same neighbors as libgeoda, sorted, for any number of threads. Otherwise (e.g. one
+ * thread, the default) the weights are created by libgeoda. The callers don't use cpu_threads > 1
+ * with precision_threshold > 0.
+ *
  * @param is_queen
  * @param order
  * @param inc_lower
  * @param precision_threshold
+ * @param cpu_threads
  * @return
  */
-PGWeight *PostGeoDa::CreateContWeights(bool is_queen, int order, bool inc_lower, double precision_threshold) {
+PGWeight *PostGeoDa::CreateContWeights(bool is_queen, int order, bool inc_lower, double precision_threshold,
+                                       int cpu_threads) {
     lwdebug(1, "Enter PostGeoDa::CreateQueenWeights().");
     double shp_min_x = (double)this->main_map.bbox_x_min;
     double shp_max_x = (double)this->main_map.bbox_x_max;
@@ -424,6 +505,27 @@ PGWeight *PostGeoDa::CreateContWeights(bool is_queen, int order, bool inc_lower,
     lwdebug(3, "Enter PostGeoDa::CreateQueenWeights() shp_min_y=%f", shp_min_y);
     lwdebug(3, "Enter PostGeoDa::CreateQueenWeights() shp_max_y=%f", shp_max_y);
 
+    if (cpu_threads > 1 && precision_threshold <= 0 && this->GetMapType() == gda::POLYGON) {
+        lwdebug(1, "CreateQueenWeights: ContiguityBuilder cpu_threads=%d", cpu_threads);
+        std::vector<gda::PolygonContents*> polys(this->num_obs, 0);
+        for (size_t i=0; i<this->num_obs; i++) {
+            // null shapes have no neighbors
+            polys[i] = dynamic_cast<gda::PolygonContents*>(this->main_map.records[i]);
+        }
+
+        PGWeight* pg_w = 0;
+        try {
+            ContiguityBuilder builder(polys, is_queen, cpu_threads);
+            builder.Build(order, inc_lower);
+            pg_w = create_pgweight(builder.GetOffsets(), builder.GetNeighbors());
+        } catch (std::exception& e) {
+            lwerror("CreateContWeights: %s", e.what());
+        }
+
+        lwdebug(1, "Exit CreateQueenWeights");
+        return pg_w;
+    }
+
     GeoDaWeight* gda_w = 0;
 
     if (is_queen) {
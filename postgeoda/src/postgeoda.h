@@ -3,6 +3,11 @@
  *
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
+ * 2026-10-16 Add AddWKB(); replace LWGEOM based Add*() with coordinate based ones
+ * 2026-10-16 Add cpu_threads to CreateContWeights()
+ * 2026-10-16 Add cpu_threads to CreateKnnWeights() and CreateKnnWeightsSub()
+ * 2026-10-16 Add CreateKnnIndex() and QueryKnnNeighbors()
+ * 2026-10-17 Add GetFids()
  */
 
 #ifndef __POST_GEODA__
@@ -15,12 +20,18 @@
 #include <libgeoda/pg/geoms.h>
 
 struct PGWeight;
+struct PGNeighbor;
+class KdTree;
+
+// flags of the KdTree created by PostGeoDa::CreateKnnIndex()
+#define KNN_INDEX_ARC 0x01
 
 class PostGeoDa : public AbstractGeoDa {
 public:
     enum MapType { point_type, polygon_type, line_type, unknown_type };
 
-    PostGeoDa(int num_obs, const std::vector<uint32_t>& fids);
+    // num_obs is only a hint: the observations are added by AddWKB()
+    PostGeoDa(int num_obs = 0);
     virtual ~PostGeoDa();
 
     // interfaces from AbstractGeoDa
@@ -31,29 +42,47 @@ public:
     virtual gda::MainMap& GetMainMap();
 
     void SetMapType(int geom_type);
-    void AddPoint(LWPOINT* lw_pt);
-    void AddMultiPoint( LWMPOINT* lw_mpt);
-    void AddPolygon( LWPOLY* lw_poly);
-    void AddMultiPolygon( LWMPOLY* lw_mpoly);
+
+    // fids of the observations, in the order they are added
+    const std::vector<uint32_t>& GetFids() const { return fids; }
+
+    // Add an observation: fid and the geometry in WKB (0 or empty for null geometry)
+    void AddWKB(uint32_t fid, const uint8_t* wkb, size_t size);
+
+    void AddPoint(double x, double y);
+    void AddPolygon(gda::PolygonContents* poly);
     void AddNullGeometry();
 
     PGWeight* create_pgweight(GeoDaWeight* gda_w);
 
-    PGWeight* CreateContWeights(bool is_queen, int order, bool inc_lower, double precision_threshold);
+    // create PGWeight from neighbors (indexes of observations) nbrs[offsets[i], offsets[i+1])
+    PGWeight* create_pgweight(const std::vector<size_t>& offsets, const std::vector<uint32_t>& nbrs);
+
+    PGWeight* CreateContWeights(bool is_queen, int order, bool inc_lower, double precision_threshold,
+                                int cpu_threads = 1);
 
     PGWeight* CreateKnnWeights(int k, double power, bool is_inverse, bool is_arc, bool is_mile,
                                std::string kernel = "", double bandwidth = 0,
-                               bool adaptive_bandwidth = false, bool use_kernel_diagonal = false);
+                               bool adaptive_bandwidth = false, bool use_kernel_diagonal = false,
+                               int cpu_threads = 1);
 
     PGWeight* CreateKnnWeightsSub(int k, int start, int end, double power, bool is_inverse, bool is_arc, bool is_mile,
                                std::string kernel = "", double bandwidth = 0,
-                               bool adaptive_bandwidth = false, bool use_kernel_diagonal = false);
+                               bool adaptive_bandwidth = false, bool use_kernel_diagonal = false,
+                               int cpu_threads = 1);
 
     PGWeight* CreateDistanceWeights(double dist_threshold, double power, bool is_inverse, bool is_arc, bool is_mile,
                                     std::string kernel = "", bool use_kernel_diagonal = false);
 
     double GetMinDistThreshold(bool is_arc, bool is_mile);
 
+    // kd-tree of the centroids with fids as ids; the caller deletes it
+    KdTree* CreateKnnIndex(bool is_arc);
+
+    // query the KNN of the points at positions of the tree and write them into neighbors[i]
+    static void QueryKnnNeighbors(const KdTree& tree, const std::vector<size_t>& positions, int k, double power,
+                                  bool is_inverse, bool is_mile, int cpu_threads, PGNeighbor* neighbors);
+
 protected:
     int map_type;
 
@@ -64,6 +93,10 @@ protected:
     std::vector<gda::PointContents*> centroids;
 
     std::vector<uint32_t> fids;
+
+    // KNN weights of the observations [start, end) using KdTree and cpu_threads threads
+    PGWeight* CreateKnnWeightsThreads(int k, int start, int end, double power, bool is_inverse,
+                                      bool is_arc, bool is_mile, int cpu_threads);
 };
 
 
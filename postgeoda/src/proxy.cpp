@@ -7,12 +7,41 @@
  * add create_kernel_knn_weights();
  * 2021-4-28 add neighbor_match_test_window()
  * 2021-4-29 add pg_hinge15_aggregate()
+ * 2026-10-16 replace build_pg_geoda() with PGGeometries decoded from WKB
+ * 2026-10-16 pass cpu_threads to CreateKnnWeights() and CreateKnnWeightsSub()
+ * 2026-10-16 add PGKnnIndex and create_knn_weights_block()
+ * 2026-10-16 pass the size of the weights to BinWeight()
+ * 2026-10-16 delete BinWeight after use; free the neighbors in free_pgweight(); spatial_lag_window() reads the neighbors without copy
+ * 2026-10-16 Use BinWeightView for the weights in Window in local_moran_window(), spatial_rate_window() and
+ * spatial_eb_window()
+ * 2026-10-16 Use create_window_weights() for the shared weights cache
+ * 2026-10-16 add batch_local_moran_window()
+ * 2026-10-16 local_moran_fast() uses the table of permutations and the vectorized lag sums of perm_kernel.h
+ * 2026-10-16 add the "sequential" permutation method to local_moran_window()
+ * 2026-10-16 add the "analytic" method to local_moran_window(); local_moran_sequential() uses LocalNeighbors
+ * 2026-10-16 add the state of the two-phase local_moran_fast(): create_local_moran_state() and
+ * local_moran_fast_state()
+ * 2026-10-16 add create_gal_weights() and local_moran_pgweight_window() for local_moran_knn() and local_moran_queen()
+ * 2026-10-16 local_moran_sequential() draws the table of permutations with cpu_threads; remove ThomasWangHashDouble()
+ * 2026-10-16 add local_moran_halo_window(): the local moran of a partition with the values of the halo neighbors
+ * 2026-10-17 add knn_index_duplicate_fid()
+ * 2026-10-17 free the values of the local moran state at the end of the transaction: local_moran_state_reset()
+ * 2026-10-17 add the "philox" permutation method: local_moran_sequential() is now local_moran_philox()
+ * 2026-10-17 local_moran_halo_window() weights the lag and the permutations by the weights values of the rows
+ * 2026-10-17 Note that gda_localmoran() and gda_batchlocalmoran() create their own threads
+ * 2026-10-17 add pg_geometries_duplicate_fid()
+ * 2026-10-17 the local moran state keeps the moments and at most LOCAL_MORAN_STATE_SAMPLE values
+ * 2026-10-17 the permutations use perm_isa(), capped by the GUC postgeoda.perm_isa
  */
 
+#include <algorithm>
+#include <cmath>
+#include <string>
 #include <vector>
 
 #include <libgeoda/gda_sa.h>
 #include <libgeoda/sa/LISA.h>
+#include <libgeoda/sa/BatchLISA.h>
 #include <libgeoda/weights/GalWeight.h>
 #include <libgeoda/gda_weights.h>
 #include <libgeoda/GeoDaSet.h>
@@ -22,8 +51,14 @@
 #include <libgeoda/gda_data.h>
 
 #include "binweight.h"
+#include "binweight_view.h"
 #include "postgeoda.h"
+#include "kdtree.h"
+#include "lisa_analytic.h"
+#include "parallel.h"
+#include "perm_kernel.h"
 #include "proxy.h"
+#include "weights_codec.h"
 #include "lisa.h"
 
 void free_pgneighbor(PGNeighbor *neighbor, char w_type)
@@ -40,149 +75,216 @@ void free_pgweight(PGWeight *w)
         for (size_t i=0; i < w->num_obs; ++i) {
             free_pgneighbor(&w->neighbors[i], w->w_type);
         }
+        free(w->neighbors);
         free(w);
     }
 }
 
 /**
- * Create geoda instance from the_geom and fids of the table
- *
- * @param lfids
- * @param lwgeoms
- * @return
+ * PGGeometries: the geometries and fids of the table decoded into a PostGeoDa instance
  */
-PostGeoDa* build_pg_geoda(List *lfids, List *lwgeoms) {
-    lwdebug(1, "Enter build_pg_geoda.");
+struct PGGeometries {
+    PostGeoDa *geoda;
+};
 
-    ListCell *l;
-    size_t nelems = list_length(lwgeoms);
-    bool b_maptype = false;
-    size_t count = 0;
+PGGeometries* create_pg_geometries(int num_obs)
+{
+    lwdebug(1, "Enter create_pg_geometries: num_obs=%d", num_obs);
+    PGGeometries *geoms = new PGGeometries;
+    geoms->geoda = new PostGeoDa(num_obs);
+    return geoms;
+}
 
-    std::vector<uint32_t> fids(nelems, 0);
-    foreach(l, lfids) {
-        fids[count] = lfirst_int(l);
-        lwdebug(5, "build_pg_geoda fids=%d", fids[count]);
-        count++;
-    }
+void add_pg_geometry(PGGeometries *geoms, uint32_t fid, const uint8_t *wkb, size_t size)
+{
+    geoms->geoda->AddWKB(fid, wkb, size);
+}
 
-    lwdebug(1, "build_pg_geoda: nelems=%d", nelems);
-    PostGeoDa *geoda = new PostGeoDa(nelems, fids);
+// find a fid that is in ids more than once
+static bool find_duplicate_fid(std::vector<uint32_t>& ids, uint32_t *dup_fid)
+{
+    std::sort(ids.begin(), ids.end());
 
-    foreach (l, lwgeoms) {
-        LWGEOM *lwgeom = (LWGEOM *) (lfirst(l));
-        if (lwgeom_is_empty(lwgeom)) {
-            lwdebug(4, "build_pg_geoda: addnullgeometry()");
-            geoda->AddNullGeometry();
-        } else {
-            if (!b_maptype) {
-                lwdebug(1, "build_pg_geoda: geom_type=%d", lwgeom->type);
-                b_maptype = true;
-                geoda->SetMapType(lwgeom->type);
-            }
-            if (lwgeom->type == POINTTYPE) {
-                lwdebug(4, "build_pg_geoda: add point");
-                LWPOINT *pt = lwgeom_as_lwpoint(lwgeom);
-                geoda->AddPoint(pt);
-            } else if (lwgeom->type == MULTIPOINTTYPE) {
-                lwdebug(4, "build_pg_geoda: add multi point");
-                LWMPOINT *mpt = lwgeom_as_lwmpoint(lwgeom);
-                geoda->AddMultiPoint(mpt);
-            } else if (lwgeom->type == POLYGONTYPE) {
-                lwdebug(4, "build_pg_geoda: add polygon");
-                LWPOLY *poly = lwgeom_as_lwpoly(lwgeom);
-                geoda->AddPolygon(poly);
-            } else if (lwgeom->type == MULTIPOLYGONTYPE) {
-                lwdebug(4, "build_pg_geoda: add multi-polygon");
-                LWMPOLY *mpoly = lwgeom_as_lwmpoly(lwgeom);
-                geoda->AddMultiPolygon(mpoly);
-            } else {
-                lwdebug(4, "Unknown WKB type %s\n", lwtype_name(lwgeom->type));
-                geoda->AddNullGeometry();
-            }
-        }
-        /* Free both the original and geometries */
-        lwgeom_free(lwgeom);
+    std::vector<uint32_t>::iterator it = std::adjacent_find(ids.begin(), ids.end());
+    if (it == ids.end()) return false;
+    *dup_fid = *it;
+    return true;
+}
+
+bool pg_geometries_duplicate_fid(const PGGeometries *geoms, uint32_t *dup_fid)
+{
+    std::vector<uint32_t> ids(geoms->geoda->GetFids());
+    return find_duplicate_fid(ids, dup_fid);
+}
+
+void free_pg_geometries(PGGeometries *geoms)
+{
+    if (geoms) {
+        delete geoms->geoda;
+        delete geoms;
     }
-    return geoda;
 }
 
-double get_min_distthreshold(List *lfids, List *lwgeoms, bool is_arc, bool is_mile)
+double get_min_distthreshold(PGGeometries *geoms, bool is_arc, bool is_mile)
 {
     lwdebug(1,"Enter get_min_distthreshold.");
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
+    PostGeoDa *geoda = geoms->geoda;
     double d = geoda->GetMinDistThreshold(is_arc, is_mile);
-    delete geoda;
     lwdebug(1,"Exit get_min_distthreshold.");
     return d;
 }
 
-PGWeight* create_cont_weights(List *lfids, List *lwgeoms, bool is_queen, int order, bool inc_lower, double precision_threshold)
+PGWeight* create_cont_weights(PGGeometries *geoms, bool is_queen, int order, bool inc_lower, double precision_threshold,
+                              int cpu_threads)
 {
     lwdebug(1,"Enter create_queen_weights.");
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
-    PGWeight *w = geoda->CreateContWeights(is_queen, order, inc_lower, precision_threshold);
-    delete geoda;
+    PostGeoDa *geoda = geoms->geoda;
+    PGWeight *w = geoda->CreateContWeights(is_queen, order, inc_lower, precision_threshold, cpu_threads);
     lwdebug(1,"Exit create_queen_weights.");
     return w;
 }
 
-PGWeight* create_knn_weights(List *lfids, List *lwgeoms, int k, double power,
-                             bool is_inverse, bool is_arc, bool is_mile)
+PGWeight* create_knn_weights(PGGeometries *geoms, int k, double power,
+                             bool is_inverse, bool is_arc, bool is_mile, int cpu_threads)
 {
     lwdebug(1,"Enter create_knn_weights.");
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
-    PGWeight *w = geoda->CreateKnnWeights(k, power, is_inverse, is_arc, is_mile);
-    delete geoda;
+    PostGeoDa *geoda = geoms->geoda;
+    PGWeight *w = geoda->CreateKnnWeights(k, power, is_inverse, is_arc, is_mile, "", 0, false, false, cpu_threads);
     lwdebug(1,"Exit create_knn_weights.");
     return w;
 }
 
-PGWeight* create_knn_weights_sub(List *lfids, List *lwgeoms, int k, int start, int end, double power,
-                             bool is_inverse, bool is_arc, bool is_mile)
+PGWeight* create_knn_weights_sub(PGGeometries *geoms, int k, int start, int end, double power,
+                             bool is_inverse, bool is_arc, bool is_mile, int cpu_threads)
 {
     lwdebug(1,"Enter create_knn_weights_sub.");
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
-    PGWeight *w = geoda->CreateKnnWeightsSub(k, start, end, power, is_inverse, is_arc, is_mile);
-    delete geoda;
+    PostGeoDa *geoda = geoms->geoda;
+    PGWeight *w = geoda->CreateKnnWeightsSub(k, start, end, power, is_inverse, is_arc, is_mile, "", 0, false, false,
+                                             cpu_threads);
     lwdebug(1,"Exit create_knn_weights_sub.");
     return w;
 }
 
-PGWeight* create_kernel_knn_weights(List *lfids, List *lwgeoms, int k, double power,
+/**
+ * PGKnnIndex: a KdTree created by PostGeoDa::CreateKnnIndex() or loaded from bytes
+ */
+struct PGKnnIndex {
+    KdTree *tree;
+};
+
+PGKnnIndex* create_knn_index(PGGeometries *geoms, bool is_arc)
+{
+    lwdebug(1,"Enter create_knn_index.");
+    PGKnnIndex *index = new PGKnnIndex;
+    index->tree = geoms->geoda->CreateKnnIndex(is_arc);
+    lwdebug(1,"Exit create_knn_index.");
+    return index;
+}
+
+PGKnnIndex* load_knn_index(const uint8_t *buf, size_t size)
+{
+    KdTree *tree = 0;
+    std::string error;
+    try {
+        tree = new KdTree(buf, size);
+    } catch (std::exception& e) {
+        error = e.what();
+    }
+    if (tree == 0) {
+        lwerror("load_knn_index: %s", error.c_str());
+        return 0;
+    }
+    PGKnnIndex *index = new PGKnnIndex;
+    index->tree = tree;
+    return index;
+}
+
+size_t knn_index_size(const PGKnnIndex *index)
+{
+    return index->tree->GetSerializedSize();
+}
+
+bool knn_index_duplicate_fid(const PGKnnIndex *index, uint32_t *dup_fid)
+{
+    const KdTree *tree = index->tree;
+    std::vector<uint32_t> ids(tree->GetNumPoints());
+    for (size_t i = 0; i < ids.size(); ++i) ids[i] = tree->GetId(i);
+    return find_duplicate_fid(ids, dup_fid);
+}
+
+void serialize_knn_index(const PGKnnIndex *index, uint8_t *buf)
+{
+    index->tree->Serialize(buf);
+}
+
+void free_knn_index(PGKnnIndex *index)
+{
+    if (index) {
+        delete index->tree;
+        delete index;
+    }
+}
+
+PGWeight* create_knn_weights_block(const PGKnnIndex *index, int k, int64_t start_fid, int64_t end_fid,
+                                   double power, bool is_inverse, bool is_mile, int cpu_threads)
+{
+    lwdebug(1,"Enter create_knn_weights_block.");
+    const KdTree *tree = index->tree;
+
+    std::vector<std::pair<uint32_t, size_t> > block; // (fid, position in tree)
+    for (size_t pos=0; pos<tree->GetNumPoints(); ++pos) {
+        int64_t fid = tree->GetId(pos);
+        if (fid >= start_fid && fid < end_fid) {
+            block.push_back(std::make_pair((uint32_t)fid, pos));
+        }
+    }
+    std::sort(block.begin(), block.end());
+
+    std::vector<size_t> positions(block.size());
+    for (size_t i=0; i<block.size(); ++i) positions[i] = block[i].second;
+
+    PGWeight *w = (PGWeight*)malloc(sizeof(PGWeight));
+    w->w_type = 'w';
+    w->num_obs = block.size();
+    w->neighbors = (PGNeighbor*)malloc(block.size() * sizeof(PGNeighbor));
+
+    PostGeoDa::QueryKnnNeighbors(*tree, positions, k, power, is_inverse, is_mile, cpu_threads, w->neighbors);
+
+    lwdebug(1,"Exit create_knn_weights_block: num_obs=%d.", w->num_obs);
+    return w;
+}
+
+PGWeight* create_kernel_knn_weights(PGGeometries *geoms, int k, double power,
                                     bool is_inverse, bool is_arc, bool is_mile,
                                     const char* kernel,
                                     double bandwidth, bool adaptive_bandwidth,
                                     bool use_kernel_diagonal)
 {
     lwdebug(1,"Enter create_kernel_knn_weights.");
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
+    PostGeoDa *geoda = geoms->geoda;
     PGWeight *w = geoda->CreateKnnWeights(k, power, is_inverse, is_arc, is_mile, kernel, bandwidth,
                                           adaptive_bandwidth, use_kernel_diagonal);
-    delete geoda;
     lwdebug(1,"Exit create_kernel_knn_weights.");
     return w;
 }
 
-PGWeight* create_distance_weights(List *lfids, List *lwgeoms, double threshold, double power,
+PGWeight* create_distance_weights(PGGeometries *geoms, double threshold, double power,
                                   bool is_inverse, bool is_arc, bool is_mile)
 {
     lwdebug(1,"Enter create_distance_weights.");
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
+    PostGeoDa *geoda = geoms->geoda;
     PGWeight *w = geoda->CreateDistanceWeights(threshold, power, is_inverse, is_arc, is_mile);
-    delete geoda;
     lwdebug(1,"Exit create_distance_weights.");
     return w;
 }
 
-PGWeight* create_kernel_weights(List *lfids, List *lwgeoms, double bandwidth, double power,
+PGWeight* create_kernel_weights(PGGeometries *geoms, double bandwidth, double power,
                                 bool is_inverse, bool is_arc, bool is_mile, const char* kernel,
                                 bool use_kernel_diagonal) {
     lwdebug(1, "Enter create_kernel_weights.");
-    PostGeoDa *geoda = build_pg_geoda(lfids, lwgeoms);
+    PostGeoDa *geoda = geoms->geoda;
     PGWeight *w = geoda->CreateDistanceWeights(bandwidth, power, is_inverse, is_arc, is_mile, kernel,
                                                use_kernel_diagonal);
-    delete geoda;
     lwdebug(1, "Exit create_kernel_weights.");
     return w;
 }
@@ -290,12 +392,130 @@ PGLISA* wrapper_result(int N, LISA* lisa)
 
 
 
-double** local_moran_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
-                           char *method, double significance_cutoff, int cpu_threads, int seed)
+/**
+ * local_moran_philox
+ *
+ * The local moran with the random neighbors of PermTable (Philox4x32-10), so the p-values only
+ * depend on the seed, not on cpu_threads. With the "sequential" permutation method, the
+ * permutations of an observation stop once its significance at significance_cutoff is known
+ * (see perm_sequential_test()), e.g. after a few hundred permutations of 9999 for most of the
+ * observations that are not significant. With the "philox" method, all permutations are used.
+ *
+ * @return double** {lisa, p-value, cluster} of each row, and the permutations used ("sequential")
+ */
+static double** local_moran_philox(GeoDaWeight* w, int N, const double* r, int permutations,
+                                   double significance_cutoff, int cpu_threads, int seed, bool sequential)
+{
+    std::vector<double> z(r, r + N);
+    GenUtils::StandardizeData(z);
+
+    // the neighbors (without the observation itself) and their weights, read once
+    LocalNeighbors nbrs(w);
+    if (nbrs.max_nbrs >= (uint32_t)N) {
+        lwerror("local_moran_window: an observation has %d neighbors in %d observations.", (int)nbrs.max_nbrs, N);
+    }
+
+    PermTable table(N, permutations, seed);
+    table.Reserve(nbrs.max_nbrs, cpu_threads);
+    PermIsa isa = perm_isa();
+
+    std::vector<double> lisa_i(N, 0), lisa_p(N, 0), lisa_c(N, 0), used(N, 0);
+    parallel_for(cpu_threads, N, [&](int tid, size_t start, size_t end) {
+        std::vector<double> sums(sequential ? 0 : permutations);
+        for (size_t i = start; i < end; ++i) {
+            uint32_t nn = nbrs.Size(i);
+            if (nn == 0) {
+                lisa_c[i] = 6; // neighborless
+                continue;
+            }
+            const uint32_t* ids = &nbrs.ids[nbrs.offsets[i]];
+            const double* ws = &nbrs.weights[nbrs.offsets[i]];
+            double sum_w = 0, lag = 0;
+            for (uint32_t k = 0; k < nn; ++k) {
+                sum_w += ws[k];
+                lag += ws[k] * z[ids[k]];
+            }
+            lag /= sum_w;
+            lisa_i[i] = z[i] * lag;
+
+            if (sequential) {
+                PermTestResult test = perm_sequential_test(isa, table, z.data(), (uint32_t)i, nn,
+                                                           nbrs.has_weights ? ws : NULL, z[i] / sum_w, lisa_i[i],
+                                                           significance_cutoff);
+                lisa_p[i] = test.pseudo_p;
+                used[i] = test.permutations;
+            } else {
+                if (nbrs.has_weights) {
+                    perm_weighted_lag_sums(table, z.data(), (uint32_t)i, nn, ws, 0, permutations, sums.data());
+                } else {
+                    perm_lag_sums(isa, table, z.data(), (uint32_t)i, nn, sums.data());
+                }
+                uint64_t countLarger = 0;
+                for (int p = 0; p < permutations; ++p) {
+                    if (sums[p] / sum_w * z[i] >= lisa_i[i]) {
+                        countLarger += 1;
+                    }
+                }
+                // pick the smallest counts
+                if (permutations - countLarger <= countLarger) {
+                    countLarger = permutations - countLarger;
+                }
+                lisa_p[i] = (countLarger + 1.0) / (permutations + 1);
+            }
+
+            if (lisa_p[i] > significance_cutoff) {
+                lisa_c[i] = 0;
+            } else if (z[i] > 0 && lag > 0) {
+                lisa_c[i] = 1; // high-high
+            } else if (z[i] < 0 && lag < 0) {
+                lisa_c[i] = 2; // low-low
+            } else if (z[i] < 0 && lag > 0) {
+                lisa_c[i] = 3; // low-high
+            } else {
+                lisa_c[i] = 4; // high-low
+            }
+        }
+    });
+
+    double **result = (double **) malloc(sizeof(double*) * N);
+    for (int i = 0; i < N; i++) {
+        result[i] = (double *) malloc(sizeof(double) * (sequential ? 4 : 3));
+        result[i][0] = lisa_i[i];
+        result[i][1] = lisa_p[i];
+        result[i][2] = lisa_c[i];
+        if (sequential) result[i][3] = used[i];
+    }
+    return result;
+}
+
+/**
+ * local_moran_weights
+ *
+ * The local moran of the rows of a query Window with the weights of the rows, which are
+ * deleted by the caller
+ *
+ * @return double** {lisa, p-value, cluster} of each row, and the permutations used ("sequential")
+ * or the z-score ("analytic")
+ */
+static double** local_moran_weights(GeoDaWeight* w, int N, const double* r, int permutations, char *method,
+                                    double significance_cutoff, int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size);
     int num_obs = w->num_obs; // number of observations in weights in the query Window, == N
-    const std::vector<uint32_t>& fids = w->getFids(); // fids starts from 0
+
+    if (method != 0 && strncmp(method, "sequential", 10) == 0) {
+        return local_moran_philox(w, N, r, permutations, significance_cutoff, cpu_threads, seed, true);
+    }
+
+    if (method != 0 && strncmp(method, "philox", 6) == 0) {
+        return local_moran_philox(w, N, r, permutations, significance_cutoff, cpu_threads, seed, false);
+    }
+
+    if (method != 0 && strncmp(method, "analytic", 8) == 0) {
+        std::vector<double> z(r, r + N);
+        GenUtils::StandardizeData(z);
+        LocalNeighbors nbrs(w);
+        return local_analytic(LOCAL_STAT_MORAN, nbrs, z, significance_cutoff, cpu_threads);
+    }
 
     // construct data for observations that may or may NOT be in the Window
     // for those not in the Window, they will be treated as undefined/null
@@ -315,6 +535,7 @@ double** local_moran_window(int N, const double* r, const uint8_t** bw, const si
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
 
+    // libgeoda creates its own cpu_threads threads for the permutations, not the workers of parallel.h
     LISA* lisa = gda_localmoran(w, data, undefs, significance_cutoff, cpu_threads, permutations, perm_method, seed);
     const std::vector<double>& lisa_i = lisa->GetLISAValues();
     const std::vector<double>& lisa_p = lisa->GetLocalSignificanceValues();
@@ -336,15 +557,179 @@ double** local_moran_window(int N, const double* r, const uint8_t** bw, const si
     return result;
 }
 
-double ThomasWangHashDouble(uint64_t key) {
-    key = (~key) + (key << 21); // key = (key << 21) - key - 1;
-    key = key ^ (key >> 24);
-    key = (key + (key << 3)) + (key << 8); // key * 265
-    key = key ^ (key >> 14);
-    key = (key + (key << 2)) + (key << 4); // key * 21
-    key = key ^ (key >> 28);
-    key = key + (key << 31);
-    return 5.42101086242752217E-20 * key;
+double** local_moran_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
+                           char *method, double significance_cutoff, int cpu_threads, int seed)
+{
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
+    double **result = local_moran_weights(w, N, r, permutations, method, significance_cutoff, cpu_threads, seed);
+    delete w;
+    return result;
+}
+
+/**
+ * create_gal_weights
+ *
+ * The GalWeight of the weights of the rows of a query Window created in memory (e.g. by
+ * create_knn_weights()): the neighbor fids are converted to the positions of the rows, like
+ * BinWeightView does with the bytea of each row. If a fid is duplicated, the last row wins.
+ *
+ * @param pg_w the weights of the rows, in the order of the rows
+ * @return
+ */
+static GalWeight* create_gal_weights(const PGWeight* pg_w)
+{
+    uint32_t n = pg_w->num_obs;
+
+    std::vector<std::pair<uint32_t, uint32_t> > fid_pos(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        fid_pos[i] = std::make_pair(pg_w->neighbors[i].idx, i);
+    }
+    std::sort(fid_pos.begin(), fid_pos.end());
+
+    GalElement *gl = new GalElement[n];
+    for (uint32_t i = 0; i < n; ++i) {
+        const PGNeighbor& nbr = pg_w->neighbors[i];
+        gl[i].idx = i;
+
+        std::vector<long> nbr_pos;
+        std::vector<float> nbr_weights;
+        nbr_pos.reserve(nbr.num_nbrs);
+        for (uint32_t j = 0; j < nbr.num_nbrs; ++j) {
+            // the last (fid, pos) of the fid
+            std::vector<std::pair<uint32_t, uint32_t> >::const_iterator it =
+                    std::upper_bound(fid_pos.begin(), fid_pos.end(), std::make_pair(nbr.nbrId[j], UINT32_MAX));
+            if (it == fid_pos.begin() || (it - 1)->first != nbr.nbrId[j]) continue; // not in the Window
+            nbr_pos.push_back((it - 1)->second);
+            nbr_weights.push_back(pg_w->w_type == 'w' && nbr.nbrWeight ? nbr.nbrWeight[j] : 1.0f);
+        }
+
+        gl[i].SetSizeNbrs(nbr_pos.size());
+        for (size_t j = 0; j < nbr_pos.size(); ++j) {
+            if (pg_w->w_type == 'w') {
+                gl[i].SetNbr(j, nbr_pos[j], nbr_weights[j]);
+            } else {
+                gl[i].SetNbr(j, nbr_pos[j]);
+            }
+        }
+    }
+
+    GalWeight *w = new GalWeight();
+    w->num_obs = n;
+    w->weight_type = pg_w->w_type == 'w' ? GeoDaWeight::gwt_type : GeoDaWeight::gal_type;
+    w->gal = gl;
+    w->GetNbrStats();
+    return w;
+}
+
+double** local_moran_pgweight_window(int N, const double* r, const PGWeight* pg_w, int permutations, char *method,
+                                     double significance_cutoff, int cpu_threads, int seed)
+{
+    if (pg_w == NULL || (int)pg_w->num_obs != N) {
+        lwerror("local_moran_pgweight_window: the weights don't have the %d rows of the Window.", N);
+    }
+    GalWeight* w = create_gal_weights(pg_w);
+    double **result = local_moran_weights(w, N, r, permutations, method, significance_cutoff, cpu_threads, seed);
+    delete w;
+    return result;
+}
+
+double** batch_local_moran_window(int n_vars, int N, const double** r, const bool** r_null, const uint8_t** bw,
+                                  const size_t* w_size, int permutations, char *method, double significance_cutoff,
+                                  int cpu_threads, int seed)
+{
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window, decoded once
+    int num_obs = w->num_obs;
+
+    // a NULL value is undefined only in its variable
+    std::vector<std::vector<double> > data(n_vars, std::vector<double>(num_obs, 0));
+    std::vector<std::vector<bool> > undefs(n_vars, std::vector<bool>(num_obs, true));
+
+    for (int i=0; i<N; ++i) {
+        for (int j=0; j<n_vars; ++j) {
+            if (r_null[i][j]) continue;
+            data[j][i] = r[i][j];
+            undefs[j][i] = false;
+        }
+    }
+
+    lwdebug(1, "batch_local_moran_window: gda_batchlocalmoran(). n_vars=%d", n_vars);
+    std::string perm_method = "lookup";
+    if (method != 0) perm_method = method;
+
+    // libgeoda creates its own cpu_threads threads for the permutations, not the workers of parallel.h
+    BatchLISA* lisa = gda_batchlocalmoran(w, data, undefs, significance_cutoff, cpu_threads, permutations,
+                                          perm_method, seed);
+    const std::vector<std::vector<double> > lisa_i = lisa->GetLISAValues();
+    const std::vector<std::vector<double> > lisa_p = lisa->GetLocalSignificanceValues();
+    const std::vector<std::vector<int> > lisa_c = lisa->GetClusterIndicators();
+
+    // results: lisa, p-value and cluster of each variable
+    double **result = (double **) malloc(sizeof(double*) * N);
+    for (int i = 0; i < N; i++) {
+        result[i] = (double *) malloc(sizeof(double) * 3 * n_vars);
+        for (int j = 0; j < n_vars; ++j) {
+            result[i][3 * j] = lisa_i[j][i];
+            result[i][3 * j + 1] = lisa_p[j][i];
+            result[i][3 * j + 2] = lisa_c[j][i];
+        }
+    }
+
+    // clean
+    delete lisa;
+    delete w;
+
+    lwdebug(1, "batch_local_moran_window: return results.");
+    return result;
+}
+
+/**
+ * The table of permutations of the last query of local_moran_fast(), kept by the backend
+ * and made wider when an observation has more neighbors
+ */
+static const PermTable& lisa_perm_table(uint32_t num_obs, uint32_t permutations, uint64_t seed,
+                                        uint32_t max_nbrs)
+{
+    static PermTable* table = NULL;
+    if (table == NULL || !table->Matches(num_obs, permutations, seed)) {
+        delete table;
+        table = new PermTable(num_obs, permutations, seed);
+    }
+    table->Reserve(max_nbrs);
+    return *table;
+}
+
+/**
+ * The pseudo p-value of the lisa of observation self (arr[self] is its standardized value) with
+ * nn neighbors: the sums of the random neighbors of all permutations, from the table of
+ * permutations shared by all rows of the query. With the weights of the neighbors (or NULL),
+ * the k-th random neighbor of a permutation gets the weight of the k-th neighbor, and the lag
+ * is divided by the sum of the weights instead of nn
+ */
+static double local_moran_fast_pvalue(const double* arr, uint32_t num_obs, uint32_t self, uint32_t nn,
+                                      const double* weights, double lisa_i, int permutations, int rnd_seed)
+{
+    const PermTable& table = lisa_perm_table(num_obs, permutations, rnd_seed, nn);
+    std::vector<double> permutedLag(permutations, 0);
+    double sum_w = nn;
+    if (weights != NULL) {
+        sum_w = 0;
+        for (uint32_t k = 0; k < nn; ++k) sum_w += weights[k];
+        perm_weighted_lag_sums(table, arr, self, nn, weights, 0, permutations, permutedLag.data());
+    } else {
+        perm_lag_sums(perm_isa(), table, arr, self, nn, permutedLag.data());
+    }
+
+    uint64_t countLarger = 0;
+    for (size_t i=0; i<permutations; ++i) {
+        if (permutedLag[i] / sum_w * arr[self] >= lisa_i) {
+            countLarger += 1;
+        }
+    }
+    // pick the smallest counts
+    if (permutations-countLarger <= countLarger) {
+        countLarger = permutations-countLarger;
+    }
+    return (countLarger+1.0)/(permutations+1);
 }
 
 Point* local_moran_fast(double val, const uint8_t* bw, size_t bw_size, int num_obs, const double* vals,
@@ -408,44 +793,10 @@ Point* local_moran_fast(double val, const uint8_t* bw, size_t bw_size, int num_o
         lisa_i = val * sp_lag;
 
         // p-val
-        int seed_start = rnd_seed + idx;
-        int max_rand = num_obs-1;
-        GeoDaSet workPermutation(num_obs);
-        std::vector<double> permutedSA(permutations, 0);
-        for (size_t perm=0; perm<permutations; perm++) {
-            int rand=0, newRandom;
-            double rng_val;
-            while (rand < n_nbrs) {
-                rng_val = ThomasWangHashDouble(seed_start++) * max_rand;
-                newRandom = (int)(rng_val<0.0?ceil(rng_val - 0.5):floor(rng_val + 0.5));
-                if (newRandom != idx && !workPermutation.Belongs(newRandom) ) {
-                    workPermutation.Push(newRandom);
-                    rand++;
-                }
-            }
-            std::vector<int> permNeighbors(n_nbrs);
-            for (int cp=0; cp<n_nbrs; cp++) {
-                permNeighbors[cp] = workPermutation.Pop();
-            }
-            double permutedLag = 0;
-            for (int cp=0; cp<n_nbrs; cp++) {
-                int nb = permNeighbors[cp];
-                permutedLag += arr[nb];
-            }
-            permutedLag /= n_nbrs;
-            permutedSA[perm] = permutedLag * val;
-        }
-        uint64_t countLarger = 0;
-        for (size_t i=0; i<permutations; ++i) {
-            if (permutedSA[i] >= lisa_i) {
-                countLarger += 1;
-            }
-        }
-        // pick the smallest counts
-        if (permutations-countLarger <= countLarger) {
-            countLarger = permutations-countLarger;
+        if (n_nbrs >= num_obs) {
+            lwerror("local_moran_fast: observation %d has %d neighbors in %d observations.", idx, n_nbrs, num_obs);
         }
-        lisa_p = (countLarger+1.0)/(permutations+1);
+        lisa_p = local_moran_fast_pvalue(arr.data(), num_obs, idx, n_nbrs, NULL, lisa_i, permutations, rnd_seed);
     }
 
     lwdebug(1, "local_moran_fast: complete");
@@ -457,9 +808,302 @@ Point* local_moran_fast(double val, const uint8_t* bw, size_t bw_size, int num_o
     return r;
 }
 
-double** local_moran_window_bytea(int N, const int64* fids, const double* r, const uint8_t* bw)
+/**
+ * LocalMoranStateHeader
+ *
+ * The header of the state of the two-phase local_moran_fast(), followed by n_sample doubles:
+ * the standardized values of all observations (n_sample == num_obs), or of a uniform sample of
+ * LOCAL_MORAN_STATE_SAMPLE values of a larger table, sorted. The random neighbors of the
+ * permutations are drawn from them, so the values don't need to be in the order of the fids.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t num_obs;
+    uint32_t permutations;
+    int32_t seed;
+    uint32_t n_sample;
+    uint32_t reserved;
+    double mean;
+    double sd;
+    uint64_t id; // a hash of the state, to reuse the values of the state of the last row
+} LocalMoranStateHeader;
+
+#define LOCAL_MORAN_STATE_MAGIC 0x324d534c // "LSM2"
+
+static uint64_t local_moran_state_hash(const uint8_t* buf, size_t size, uint64_t h)
+{
+    // FNV-1a
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ buf[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+size_t local_moran_state_size(int n_sample)
+{
+    return sizeof(LocalMoranStateHeader) + sizeof(double) * (size_t)n_sample;
+}
+
+void create_local_moran_state(int64 num_obs, double mean, double sd, int n_sample, const double* sample,
+                              int permutations, int seed, uint8_t* buf)
+{
+    if (num_obs < 2 || n_sample < 2) {
+        lwerror("local_moran_state: %lld observations, at least 2 are needed.", (long long)num_obs);
+    }
+    if (num_obs > UINT32_MAX) {
+        lwerror("local_moran_state: %lld observations, at most %u are supported.", (long long)num_obs,
+                UINT32_MAX);
+    }
+    if (n_sample > num_obs || n_sample > LOCAL_MORAN_STATE_SAMPLE) {
+        lwerror("local_moran_state: invalid sample of %d values of %lld observations.", n_sample,
+                (long long)num_obs);
+    }
+    if (permutations < 1) {
+        lwerror("local_moran_state: the number of permutations has to be positive.");
+    }
+
+    if (n_sample == num_obs) {
+        // all values: the same standardization as GenUtils::StandardizeData()
+        double sum = 0;
+        for (int i = 0; i < n_sample; ++i) sum += sample[i];
+        mean = sum / (double) n_sample;
+        double ssum = 0;
+        for (int i = 0; i < n_sample; ++i) ssum += (sample[i] - mean) * (sample[i] - mean);
+        sd = sqrt(ssum / (double) (n_sample - 1.0));
+    }
+    if (!(sd > 0)) {
+        lwerror("local_moran_state: the standard deviation of the values is 0.");
+    }
+
+    std::vector<double> z(n_sample);
+    for (int i = 0; i < n_sample; ++i) z[i] = (sample[i] - mean) / sd;
+    std::sort(z.begin(), z.end());
+
+    LocalMoranStateHeader header = {LOCAL_MORAN_STATE_MAGIC, (uint32_t)num_obs, (uint32_t)permutations, seed,
+                                    (uint32_t)n_sample, 0, mean, sd, 0};
+    uint64_t id = local_moran_state_hash((const uint8_t*)&header, sizeof(header), 0xcbf29ce484222325ULL);
+    id = local_moran_state_hash((const uint8_t*)z.data(), sizeof(double) * z.size(), id);
+    header.id = id | 1; // 0 is no state
+
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), z.data(), sizeof(double) * z.size());
+}
+
+/**
+ * The standardized values of the last state, copied once for all rows of a query (the state is
+ * the same datum for all rows) and freed at the end of the transaction by local_moran_state_reset()
+ */
+static uint64_t state_values_id = 0;
+static std::vector<double> state_values;
+
+static const std::vector<double>& local_moran_state_values(const LocalMoranStateHeader& header,
+                                                           const uint8_t* values)
 {
-    BinWeight* w = new BinWeight(bw); // complete weights
+    if (state_values_id != header.id || state_values.size() != header.n_sample) {
+        state_values.resize(header.n_sample);
+        memcpy(state_values.data(), values, sizeof(double) * state_values.size());
+        state_values_id = header.id;
+    }
+    return state_values;
+}
+
+void local_moran_state_reset(void)
+{
+    state_values_id = 0;
+    std::vector<double>().swap(state_values);
+}
+
+static LocalMoranStateHeader local_moran_state_header(const uint8_t* state, size_t state_size, const char* fname)
+{
+    LocalMoranStateHeader header;
+    if (state_size < sizeof(header)) {
+        lwerror("%s: invalid state (%d bytes).", fname, (int)state_size);
+    }
+    memcpy(&header, state, sizeof(header));
+    if (header.magic != LOCAL_MORAN_STATE_MAGIC || header.n_sample < 2 || header.n_sample > header.num_obs ||
+        header.n_sample > LOCAL_MORAN_STATE_SAMPLE || state_size != local_moran_state_size(header.n_sample)) {
+        lwerror("%s: invalid state (%d bytes).", fname, (int)state_size);
+    }
+    return header;
+}
+
+// nn random neighbors can be drawn for observation idx from the values of the state
+static void local_moran_state_check_nbrs(const LocalMoranStateHeader& header, uint32_t nn, uint32_t idx,
+                                         const char* fname)
+{
+    if (nn >= header.num_obs) {
+        lwerror("%s: observation %d has %d neighbors in %d observations.", fname, (int)idx, (int)nn,
+                (int)header.num_obs);
+    }
+    if (nn >= header.n_sample) {
+        lwerror("%s: observation %d has %d neighbors, more than the %d values of the state.", fname, (int)idx,
+                (int)nn, (int)header.n_sample);
+    }
+}
+
+/**
+ * The position of the standardized value z_i in the values of the state: any observation with the
+ * same value can be excluded from the random neighbors of observation idx. With a sample of the
+ * values, z_i may not be in it, and the nearest value of the sample is excluded instead.
+ */
+static uint32_t local_moran_state_self(const LocalMoranStateHeader& header, const std::vector<double>& z,
+                                       double z_i, double val, uint32_t idx, const char* fname)
+{
+    std::vector<double>::const_iterator it = std::lower_bound(z.begin(), z.end(), z_i);
+    if (header.n_sample < header.num_obs) {
+        if (it == z.end() || (it != z.begin() && z_i - *(it - 1) < *it - z_i)) --it;
+        return (uint32_t)(it - z.begin());
+    }
+    if (it == z.end() || *it != z_i) {
+        lwerror("%s: the value %f of observation %d is not in the state.", fname, val, (int)idx);
+    }
+    return (uint32_t)(it - z.begin());
+}
+
+Point* local_moran_fast_state(double val, const uint8_t* bw, size_t bw_size, const double* nbr_vals,
+                              int n_nbr_vals, const uint8_t* state, size_t state_size)
+{
+    LocalMoranStateHeader header = local_moran_state_header(state, state_size, "local_moran_fast");
+
+    WeightsRow row;
+    if (!weights_codec_read_row(bw, bw_size, &row)) {
+        lwerror("local_moran_fast: invalid weights of an observation (%d bytes).", (int)bw_size);
+    }
+    uint32_t nn = row.num_nbrs;
+    if ((uint32_t)n_nbr_vals != nn) {
+        lwerror("local_moran_fast: %d values of neighbors for %d neighbors of observation %d.", n_nbr_vals,
+                (int)nn, (int)row.idx);
+    }
+
+    double lisa_i = 0, lisa_p = 0;
+    if (nn > 0) {
+        local_moran_state_check_nbrs(header, nn, row.idx, "local_moran_fast");
+        const std::vector<double>& z = local_moran_state_values(header, state + sizeof(header));
+
+        // the same standardization as create_local_moran_state(), so the value is found in the state
+        double z_i = (val - header.mean) / header.sd;
+        uint32_t self = local_moran_state_self(header, z, z_i, val, row.idx, "local_moran_fast");
+
+        double sp_lag = 0;
+        for (uint32_t j = 0; j < nn; ++j) {
+            sp_lag += (nbr_vals[j] - header.mean) / header.sd;
+        }
+        sp_lag /= nn;
+        lisa_i = z_i * sp_lag;
+        lisa_p = local_moran_fast_pvalue(z.data(), header.n_sample, self, nn, NULL, lisa_i,
+                                         (int)header.permutations, header.seed);
+    }
+
+    Point *r = (Point *) palloc(sizeof(Point));
+    r->x = lisa_i;
+    r->y = lisa_p;
+    return r;
+}
+
+typedef std::pair<uint32_t, double> FidValue;
+
+// the standardized value of fid in the (fid, z) sorted by fid, or NULL
+static const double* local_moran_halo_find(const std::vector<FidValue>& values, uint32_t fid)
+{
+    std::vector<FidValue>::const_iterator it =
+            std::lower_bound(values.begin(), values.end(), FidValue(fid, -HUGE_VAL));
+    if (it == values.end() || it->first != fid) return NULL;
+    return &it->second;
+}
+
+double** local_moran_halo_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int n_halo,
+                                 const int64* halo_fids, const double* halo_vals, const uint8_t* state,
+                                 size_t state_size, double significance_cutoff)
+{
+    LocalMoranStateHeader header = local_moran_state_header(state, state_size, "local_moran_halo");
+    const std::vector<double>& z = local_moran_state_values(header, state + sizeof(header));
+
+    // the weights of the rows, and the standardized values of the rows and of the halo by fid
+    std::vector<WeightsRow> rows(N);
+    std::vector<FidValue> part_z(N), halo_z(n_halo);
+    for (int i = 0; i < N; ++i) {
+        if (!weights_codec_read_row(bw[i], w_size[i], &rows[i])) {
+            lwerror("local_moran_halo: invalid weights of the %d-th row (%d bytes).", i, (int)w_size[i]);
+        }
+        part_z[i] = FidValue(rows[i].idx, (r[i] - header.mean) / header.sd);
+    }
+    for (int i = 0; i < n_halo; ++i) {
+        if (halo_fids[i] < 0 || halo_fids[i] > UINT32_MAX) {
+            lwerror("local_moran_halo: invalid fid %lld of the halo.", (long long)halo_fids[i]);
+        }
+        halo_z[i] = FidValue((uint32_t)halo_fids[i], (halo_vals[i] - header.mean) / header.sd);
+    }
+    std::sort(part_z.begin(), part_z.end());
+    std::sort(halo_z.begin(), halo_z.end());
+
+    std::vector<double> weights;
+    double **result = (double **) malloc(sizeof(double*) * N);
+    for (int i = 0; i < N; ++i) {
+        result[i] = (double *) malloc(sizeof(double) * 3);
+        const WeightsRow& row = rows[i];
+        uint32_t nn = row.num_nbrs;
+        if (nn == 0) {
+            result[i][0] = 0;
+            result[i][1] = 0;
+            result[i][2] = 6; // neighborless
+            continue;
+        }
+        local_moran_state_check_nbrs(header, nn, row.idx, "local_moran_halo");
+
+        // a neighbor is a row of the partition, or else a row of the halo; the lag is weighted
+        // by the weights values of the row, if any
+        double sp_lag = 0, sum_w = 0;
+        weights.resize(row.has_weights ? nn : 0);
+        WeightsIdIter it;
+        uint32_t nbr_id;
+        weights_codec_ids_begin(&row, &it);
+        while (weights_codec_ids_next(&it, &nbr_id)) {
+            const double* z_j = local_moran_halo_find(part_z, nbr_id);
+            if (z_j == NULL) z_j = local_moran_halo_find(halo_z, nbr_id);
+            if (z_j == NULL) {
+                lwerror("local_moran_halo: the neighbor %u of observation %d is neither in the partition nor "
+                        "in the halo.", nbr_id, (int)row.idx);
+            }
+            double w_j = weights_codec_weight_at(&row, it.j - 1);
+            if (row.has_weights) weights[it.j - 1] = w_j;
+            sp_lag += w_j * *z_j;
+            sum_w += w_j;
+        }
+        if (it.j != nn) {
+            lwerror("local_moran_halo: invalid neighbors of observation %d.", (int)row.idx);
+        }
+        if (sum_w == 0) {
+            lwerror("local_moran_halo: the weights of observation %d sum to 0.", (int)row.idx);
+        }
+        sp_lag /= sum_w;
+
+        double z_i = (r[i] - header.mean) / header.sd;
+        uint32_t self = local_moran_state_self(header, z, z_i, r[i], row.idx, "local_moran_halo");
+        double lisa_i = z_i * sp_lag;
+        double lisa_p = local_moran_fast_pvalue(z.data(), header.n_sample, self, nn,
+                                                row.has_weights ? weights.data() : NULL, lisa_i,
+                                                (int)header.permutations, header.seed);
+
+        result[i][0] = lisa_i;
+        result[i][1] = lisa_p;
+        if (lisa_p > significance_cutoff) {
+            result[i][2] = 0;
+        } else if (z_i > 0 && sp_lag > 0) {
+            result[i][2] = 1; // high-high
+        } else if (z_i < 0 && sp_lag < 0) {
+            result[i][2] = 2; // low-low
+        } else if (z_i < 0 && sp_lag > 0) {
+            result[i][2] = 3; // low-high
+        } else {
+            result[i][2] = 4; // high-low
+        }
+    }
+    return result;
+}
+
+double** local_moran_window_bytea(int N, const int64* fids, const double* r, const uint8_t* bw, size_t bw_size)
+{
+    BinWeight* w = new BinWeight(bw, bw_size); // complete weights
     int64 num_obs  = w->num_obs;
 
     // NOTE: num_obs could be larger than N
@@ -495,18 +1139,19 @@ double** local_moran_window_bytea(int N, const int64* fids, const double* r, con
 
     // clean
     delete lisa;
+    delete w;
     lwdebug(1, "Exit pg_local_moran.");
     return result;
 }
 
-double** neighbor_match_test_window(List *lfids, List *lwgeoms, int k, int n_vars, int N, const double** r,
+double** neighbor_match_test_window(PGGeometries *geoms, int k, int n_vars, int N, const double** r,
                                     double power, bool is_inverse, bool is_arc, bool is_mile,
                                     const char *scale_method, const char* dist_type)
 {
     lwdebug(1, "Enter neighbor_match_test_window.");
 
     // create KNN spatial weights
-    PostGeoDa* geoda = build_pg_geoda(lfids, lwgeoms);
+    PostGeoDa *geoda = geoms->geoda;
 
     std::string poly_id = "", kernel = "";
     double bandwidth = 0;
@@ -558,7 +1203,6 @@ double** neighbor_match_test_window(List *lfids, List *lwgeoms, int k, int n_var
 
     // clean
     delete w;
-    delete geoda;
 
     lwdebug(1, "neighbor_match_test_window: return results.");
     return result;
@@ -595,44 +1239,44 @@ double* spatial_lag_window(int N, const double* r, const uint8_t** bw, const siz
     double* result = (double*)malloc(sizeof(double)* N);
 
     for (int i=0; i<N; ++i) {
-        std::vector<long> nbrs = w->GetNeighbors(i);
-        std::vector<double> wvals = w->GetNeighborWeights(i);
+        BinNeighbors nbrs = w->GetNeighborSpan(i); // no copy
         double lag = 0;
-        if (is_binary || wvals.empty()) {
-            for (int j=0; j < nbrs.size(); ++j) {
+        if (is_binary || nbrs.weights == 0) {
+            for (size_t j=0; j < nbrs.size; ++j) {
                 if (nbrs[j] != i || inc_diag) {
                     lag += r[nbrs[j]];
                 }
             }
-            if (nbrs.empty() == false && row_stand) {
-                lag = lag / nbrs.size();
+            if (nbrs.size > 0 && row_stand) {
+                lag = lag / nbrs.size;
             }
         } else {
             double sumW = 0;
-            for (int j=0; j < nbrs.size(); ++j) {
+            for (size_t j=0; j < nbrs.size; ++j) {
                 if (nbrs[j] != i || inc_diag) {
-                    sumW += wvals[j];
+                    sumW += nbrs.weights[j];
                 }
             }
             if (sumW ==0) {
                 lag = 0;
             } else {
-                for (int j = 0; j < nbrs.size(); ++j) {
+                for (size_t j = 0; j < nbrs.size; ++j) {
                     if (nbrs[j] != i || inc_diag) {
-                        lag += r[nbrs[j]] * wvals[j] / sumW;
+                        lag += r[nbrs[j]] * nbrs.weights[j] / sumW;
                     }
                 }
             }
         }
         result[i] = lag;
     }
+    delete w;
     lwdebug(1, "spatial_lag: return results.");
     return result;
 }
 
 double* spatial_rate_window(int N, double* e, double* b, const uint8_t** bw, const size_t* w_size)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size); // weights in Window
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window
 
     std::vector<bool> undefs(N, false);
 
@@ -640,6 +1284,7 @@ double* spatial_rate_window(int N, double* e, double* b, const uint8_t** bw, con
     double* result = (double*)malloc(sizeof(double)* N);
 
     GdaAlgs::RateSmoother_SRS(N, w, b, e, result, undefs);
+    delete w;
 
     lwdebug(1, "spatial_rate_window: return results.");
     return result;
@@ -647,7 +1292,7 @@ double* spatial_rate_window(int N, double* e, double* b, const uint8_t** bw, con
 
 double* spatial_eb_window(int N, double* e, double* b, const uint8_t** bw, const size_t* w_size)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size); // weights in Window
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window
 
     std::vector<bool> undefs(N, false);
 
@@ -655,6 +1300,7 @@ double* spatial_eb_window(int N, double* e, double* b, const uint8_t** bw, const
     double* result = (double*)malloc(sizeof(double)* N);
 
     GdaAlgs::RateSmoother_SEBS(N, w, b, e, result, undefs);
+    delete w;
 
     lwdebug(1, "spatial_eb_window: return results.");
     return result;
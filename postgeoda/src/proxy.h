@@ -3,6 +3,26 @@
  *
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6; Add pg_local_joincount()
+ * 2026-10-16 Add PGGeometries to replace the lists of LWGEOM
+ * 2026-10-16 Add cpu_threads to create_knn_weights() and create_knn_weights_sub()
+ * 2026-10-16 Add PGKnnIndex and create_knn_weights_block()
+ * 2026-10-16 Add bw_size to local_moran_window_bytea()
+ * 2026-10-16 PGNeighbor.num_nbrs is uint32, for the observations with more than 65535 neighbors
+ * 2026-10-16 Add batch_local_moran_window()
+ * 2026-10-16 local_moran_window() with the "sequential" permutation method
+ * 2026-10-16 local_moran_window(), local_g_window(), local_gstar_window() and local_geary_window() with the
+ * "analytic" method
+ * 2026-10-16 Add create_local_moran_state() and local_moran_fast_state() for the two-phase local_moran_fast()
+ * 2026-10-16 Add local_moran_pgweight_window() for local_moran_knn() and local_moran_queen()
+ * 2026-10-16 Add local_moran_halo_window() for local_moran_halo()
+ * 2026-10-17 Add knn_index_duplicate_fid()
+ * 2026-10-17 Add local_moran_state_reset()
+ * 2026-10-17 local_moran_window() with the "philox" permutation method
+ * 2026-10-17 local_moran_halo_window() with the weights values of the rows
+ * 2026-10-17 Add pg_geometries_duplicate_fid()
+ * 2026-10-17 create_cont_weights() and create_knn_weights() use libgeoda with one thread
+ * 2026-10-17 create_local_moran_state() with the moments and a sample of at most LOCAL_MORAN_STATE_SAMPLE values
+ * 2026-10-17 Note the bounded state of local_moran_halo_window()
  */
 
 #ifndef __POST_PROXY__
@@ -27,6 +47,7 @@ extern "C" {
 * ...
 * uint32 (4 bytes): index of i-th observation
 * uint16 (2 bytes): number of neighbors of i-th observation (nn)
+*                   uint32 (4 bytes) if the weights type is 'A' or 'W', see weights_codec.h
 * uint32 (4 bytes x nn): neighbor id
 * float (4 bytes x nn): weights value of each neighbor
 * ...
@@ -47,7 +68,7 @@ extern "C" {
 typedef struct PGNeighbor
 {
     uint32_t idx;
-    uint16_t num_nbrs;
+    uint32_t num_nbrs; /* more than 65535 is written in the wide format, see weights_codec.h */
     uint32_t *nbrId;
     float *nbrWeight;
 } PGNeighbor;
@@ -63,41 +84,121 @@ typedef struct PGWeight
 
 void free_pgweight(PGWeight *w);
 
+/**
+ * PGGeometries
+ *
+ * The geometries (and fids) read from a query Window or collected by an Aggregate.
+ * The WKB of each row is decoded into libgeoda shapes when it is added, so the caller
+ * doesn't need to keep a copy of the WKB or build a LWGEOM for it.
+ */
+typedef struct PGGeometries PGGeometries;
+
+/**
+ * create_pg_geometries()
+ *
+ * @param num_obs expected number of observations (used to reserve memory)
+ * @return
+ */
+PGGeometries* create_pg_geometries(int num_obs);
+
+/**
+ * add_pg_geometry()
+ *
+ * Decode the WKB (or EWKB) of a geometry and add it with its fid.
+ * A NULL/empty wkb, an empty or an unsupported geometry is added as a null shape.
+ *
+ * @param geoms
+ * @param fid
+ * @param wkb
+ * @param size
+ */
+void add_pg_geometry(PGGeometries *geoms, uint32_t fid, const uint8_t *wkb, size_t size);
+
+// true if two observations have the same fid, which is written to dup_fid
+bool pg_geometries_duplicate_fid(const PGGeometries *geoms, uint32_t *dup_fid);
+
+void free_pg_geometries(PGGeometries *geoms);
+
 
 /**
  * Contiguity (queen/rook) weights functions bridging PG and libgeoda
  *
- * @param fids
  * @param geoms
  * @param is_queen
  * @param order
  * @param inc_lower
  * @param precision_threshold
+ * @param cpu_threads 1: libgeoda; > 1: number of threads of ContiguityBuilder, which finds the same
+ * neighbors as libgeoda
  * @return
  */
-PGWeight* create_cont_weights(List *fids, List *geoms, bool is_queen, int order, bool inc_lower,
-                              double precision_threshold);
+PGWeight* create_cont_weights(PGGeometries *geoms, bool is_queen, int order, bool inc_lower,
+                              double precision_threshold, int cpu_threads);
 
 /**
  * knn weights functions bridging PG and libgeoda::knn_weights
  *
- * @param fids
  * @param geoms
  * @param k
  * @param power
  * @param is_inverse
  * @param is_arc
  * @param is_mile
+ * @param cpu_threads 1: libgeoda; > 1: number of threads to query the KdTree, which finds the
+ * same neighbors as libgeoda
  * @return
  */
-PGWeight* create_knn_weights(List *fids, List *geoms, int k, double power,
-                             bool is_inverse, bool is_arc, bool is_mile);
+PGWeight* create_knn_weights(PGGeometries *geoms, int k, double power,
+                             bool is_inverse, bool is_arc, bool is_mile, int cpu_threads);
+
+PGWeight* create_knn_weights_sub(PGGeometries *geoms, int k, int start, int end, double power,
+                             bool is_inverse, bool is_arc, bool is_mile, int cpu_threads);
 
-PGWeight* create_knn_weights_sub(List *fids, List *geoms, int k, int start, int end, double power,
-                             bool is_inverse, bool is_arc, bool is_mile);
+/**
+ * PGKnnIndex
+ *
+ * The kd-tree of the centroids (fids as ids) used to create KNN weights in blocks: it is
+ * created once by the Aggregate `knn_index()` and serialized into a bytea, then each call of
+ * `knn_weights_block()` loads it and creates the KNN weights of a range of fids.
+ */
+typedef struct PGKnnIndex PGKnnIndex;
+
+PGKnnIndex* create_knn_index(PGGeometries *geoms, bool is_arc);
+
+// load the index from the bytes written by serialize_knn_index(); error if they are not valid
+PGKnnIndex* load_knn_index(const uint8_t *buf, size_t size);
+
+size_t knn_index_size(const PGKnnIndex *index);
+
+// true if two points of the index have the same fid, which is written to dup_fid
+bool knn_index_duplicate_fid(const PGKnnIndex *index, uint32_t *dup_fid);
+
+// write the index into buf, which has knn_index_size() bytes
+void serialize_knn_index(const PGKnnIndex *index, uint8_t *buf);
+
+void free_knn_index(PGKnnIndex *index);
+
+/**
+ * Create the KNN weights of the observations with start_fid <= fid < end_fid
+ *
+ * The returned PGWeight only has these observations, sorted by fid. The neighbors are
+ * sorted by (distance, fid), so the weights of the blocks can be merged into the same
+ * weights as create_knn_weights().
+ *
+ * @param index
+ * @param k
+ * @param start_fid
+ * @param end_fid
+ * @param power
+ * @param is_inverse
+ * @param is_mile
+ * @param cpu_threads
+ * @return
+ */
+PGWeight* create_knn_weights_block(const PGKnnIndex *index, int k, int64_t start_fid, int64_t end_fid,
+                                   double power, bool is_inverse, bool is_mile, int cpu_threads);
 /**
  *
- * @param fids
  * @param geoms
  * @param k
  * @param power
@@ -110,7 +211,7 @@ PGWeight* create_knn_weights_sub(List *fids, List *geoms, int k, int start, int
  * @param use_kernel_diagonal
  * @return
  */
-PGWeight* create_kernel_knn_weights(List *fids, List *geoms, int k, double power,
+PGWeight* create_kernel_knn_weights(PGGeometries *geoms, int k, double power,
                                     bool is_inverse, bool is_arc,
                                     bool is_mile, const char* kernel,
                                     double bandwidth, bool adaptive_bandwidth,
@@ -118,7 +219,6 @@ PGWeight* create_kernel_knn_weights(List *fids, List *geoms, int k, double power
 
 /**
  *
- * @param fids
  * @param geoms
  * @param dist_threshold
  * @param power
@@ -129,7 +229,7 @@ PGWeight* create_kernel_knn_weights(List *fids, List *geoms, int k, double power
  * @param use_kernel_diagonal
  * @return
  */
-PGWeight* create_kernel_weights(List *fids, List *geoms, double dist_threshold,
+PGWeight* create_kernel_weights(PGGeometries *geoms, double dist_threshold,
                                 double power, bool is_inverse, bool is_arc,
                                 bool is_mile, const char* kernel,
                                 bool use_kernel_diagonal);
@@ -137,7 +237,6 @@ PGWeight* create_kernel_weights(List *fids, List *geoms, double dist_threshold,
   *
   * distance weights functions bridging PG and libgeoda::distance_weights
   *
-  * @param fids
   * @param geoms
   * @param threshold
   * @param power
@@ -146,7 +245,7 @@ PGWeight* create_kernel_weights(List *fids, List *geoms, double dist_threshold,
   * @param is_mile
   * @return
   */
-PGWeight* create_distance_weights(List *fids, List *geoms, double threshold,
+PGWeight* create_distance_weights(PGGeometries *geoms, double threshold,
                                   double power, bool is_inverse,
                                   bool is_arc, bool is_mile);
 
@@ -155,13 +254,12 @@ PGWeight* create_distance_weights(List *fids, List *geoms, double threshold,
  *
  * This function computes the minimum pairwise distance among the observations.
  *
- * @param lfids
- * @param lwgeoms
+ * @param geoms
  * @param is_arc
  * @param is_mile
  * @return
  */
-double get_min_distthreshold(List *lfids, List *lwgeoms, bool is_arc, bool is_mile);
+double get_min_distthreshold(PGGeometries *geoms, bool is_arc, bool is_mile);
 
 /**
  * Structure to exchange lisa data between PG and libgeoda
@@ -191,14 +289,21 @@ void free_pglisa(PGLISA *lisa);
  * @param fids
  * @param r
  * @param bw
+ * @param bw_size
  * @return  double**
  */
-double** local_moran_window_bytea(int N, const int64* fids, const double* r, const uint8_t* bw);
+double** local_moran_window_bytea(int N, const int64* fids, const double* r, const uint8_t* bw, size_t bw_size);
 
 /**
  * local_moran_window()
  *
- * The local moran function used for Window SQL function local_moran()
+ * The local moran function used for Window SQL function local_moran(). With method
+ * "sequential", the permutations of each observation stop early (perm_kernel.h), and the
+ * number of permutations used is the 4th value of each result. With method "philox", all
+ * permutations draw their random neighbors from the same table (perm_kernel.h), so the p-values
+ * don't depend on cpu_threads, unlike "lookup" and "complete". With method "analytic", the
+ * p-values are from the moments under conditional randomization (lisa_analytic.h) without
+ * permutations, and the z-score is the 4th value of each result
  * @param N
  * @param r
  * @param bw
@@ -208,6 +313,40 @@ double** local_moran_window_bytea(int N, const int64* fids, const double* r, con
 double** local_moran_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
                            char *method, double significance_cutoff, int cpu_threads, int seed);
 
+/**
+ * local_moran_pgweight_window()
+ *
+ * The local moran function used for Window SQL functions local_moran_knn() and local_moran_queen():
+ * the weights of the rows are created in memory from the geometries of the Window and used
+ * directly, without the bytea of the weights of each row
+ *
+ * @param N
+ * @param r
+ * @param pg_w the weights of the N rows, in the order of the rows
+ * @return double** the same as local_moran_window()
+ */
+double** local_moran_pgweight_window(int N, const double* r, const PGWeight* pg_w, int permutations, char *method,
+                                     double significance_cutoff, int cpu_threads, int seed);
+
+/**
+ * batch_local_moran_window()
+ *
+ * The local moran of n_vars variables with the same weights, used for Window SQL function
+ * batch_local_moran(): the weights are decoded once and the permutations are shared by
+ * all variables
+ *
+ * @param n_vars
+ * @param N
+ * @param r the values of n_vars variables of each row
+ * @param r_null r_null[i][j] is true if the j-th variable of i-th row is NULL
+ * @param bw
+ * @param w_size
+ * @return double** the lisa, p-value and cluster of each variable (3 * n_vars) of each row
+ */
+double** batch_local_moran_window(int n_vars, int N, const double** r, const bool** r_null, const uint8_t** bw,
+                                  const size_t* w_size, int permutations, char *method, double significance_cutoff,
+                                  int cpu_threads, int seed);
+
 /**
  * pg_local_moran_fast()
  *
@@ -225,6 +364,90 @@ double** local_moran_window(int N, const double* r, const uint8_t** bw, const si
 Point* local_moran_fast(double val, const uint8_t* bw, size_t bw_size, int num_obs, const double* arr,
                            int permutations, int rnd_seed);
 
+// the maximum number of values in the state of local_moran_state(): 512 KB
+#define LOCAL_MORAN_STATE_SAMPLE 65536
+
+// the size of the state with n_sample values, created by create_local_moran_state()
+size_t local_moran_state_size(int n_sample);
+
+/**
+ * create_local_moran_state()
+ *
+ * The state of the two-phase local_moran_fast(), created once by the Aggregate SQL function
+ * local_moran_state(): the mean and standard deviation of the values, the permutations, the
+ * seed, and the standardized values (sorted) that the random neighbors are drawn from
+ *
+ * The state is bounded: with at most LOCAL_MORAN_STATE_SAMPLE observations it has all values,
+ * so the p-values are the same on any shard as with one query over all rows; with more, it has
+ * a uniform sample of the values, and the random neighbors are drawn from the sample.
+ *
+ * @param num_obs the number of values, at most UINT32_MAX
+ * @param mean the mean of the values, recomputed from the sample if it has all values
+ * @param sd the standard deviation of the values, recomputed the same way
+ * @param n_sample the number of values of the sample, at most LOCAL_MORAN_STATE_SAMPLE
+ * @param sample all values (n_sample == num_obs), or a uniform sample of them (not NULL)
+ * @param permutations
+ * @param seed
+ * @param buf local_moran_state_size(n_sample) bytes
+ */
+void create_local_moran_state(int64 num_obs, double mean, double sd, int n_sample, const double* sample,
+                              int permutations, int seed, uint8_t* buf);
+
+/**
+ * local_moran_state_reset()
+ *
+ * Free the copy of the standardized values of the last state read by local_moran_fast_state() or
+ * local_moran_halo_window(), called at the end of each transaction
+ */
+void local_moran_state_reset(void);
+
+/**
+ * local_moran_fast_state()
+ *
+ * The local moran of one observation used for SQL function local_moran_fast(val, w, nbr_vals, state):
+ * only the values of its neighbors are needed with the state, so each row takes
+ * O(nn * permutations) and the rows can be processed on different nodes with the same state
+ *
+ * @param val
+ * @param bw the weights of the observation
+ * @param bw_size
+ * @param nbr_vals the values of the neighbors
+ * @param n_nbr_vals the number of neighbors
+ * @param state
+ * @param state_size
+ * @return {lisa, pseudo p-value}
+ */
+Point* local_moran_fast_state(double val, const uint8_t* bw, size_t bw_size, const double* nbr_vals,
+                              int n_nbr_vals, const uint8_t* state, size_t state_size);
+
+/**
+ * local_moran_halo_window()
+ *
+ * The local moran function used for Window SQL function local_moran_halo(): the local moran of
+ * the rows of a partition with the state of local_moran_state() of all rows, where the neighbors
+ * that are not in the partition (the halo) are read from the fids and values of the halo instead
+ * of being removed. The lisa and the pseudo p-value of each row are the same as with one
+ * partition of all rows, for any partitioning, and the memory is O(N + n_halo) besides the state
+ * (at most LOCAL_MORAN_STATE_SAMPLE values).
+ * With the weights values of a row (e.g. inverse distance), the lag and the permuted lags are
+ * weighted by them; otherwise they are the mean of the neighbors, like local_moran_fast_state().
+ *
+ * @param N
+ * @param r
+ * @param bw
+ * @param w_size
+ * @param n_halo
+ * @param halo_fids the fids of the rows of the halo
+ * @param halo_vals the values of the rows of the halo
+ * @param state
+ * @param state_size
+ * @param significance_cutoff
+ * @return double** {lisa, pseudo p-value, cluster} of each row
+ */
+double** local_moran_halo_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int n_halo,
+                                 const int64* halo_fids, const double* halo_vals, const uint8_t* state,
+                                 size_t state_size, double significance_cutoff);
+
 
 double** local_joincount_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
                                 char *method, double significance_cutoff, int cpu_threads, int seed);
@@ -237,6 +460,7 @@ double** local_multijoincount_window(int N, int n_vars, const double** r, const
                                      int permutations, char *method, double significance_cutoff, int cpu_threads,
                                      int seed);
 /**
+ * With method "analytic", the z-score is the 4th value of each result (lisa_analytic.h)
  *
  * @param N
  * @param r
@@ -253,6 +477,7 @@ double** local_g_window(int N, const double* r, const uint8_t** bw, const size_t
                         char *method, double significance_cutoff, int cpu_threads, int seed);
 
 /**
+ * With method "analytic", the z-score is the 4th value of each result (lisa_analytic.h)
  *
  * @param N
  * @param r
@@ -283,7 +508,7 @@ double** local_multiquantilelisa_window(int n_vars, int* k, int* quantile, int N
                                         const size_t* w_size, int permutations, char *method,
                                         double significance_cutoff, int cpu_threads, int seed);
 
-double** neighbor_match_test_window(List *lfids, List *lwgeoms, int k, int n_vars, int N, const double** r,
+double** neighbor_match_test_window(PGGeometries *geoms, int k, int n_vars, int N, const double** r,
                                     double power, bool is_inverse, bool is_arc, bool is_mile,
                                     const char *scale_method, const char* dist_type);
 
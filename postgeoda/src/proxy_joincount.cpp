@@ -6,6 +6,10 @@
  * 2021-4-27 Change to local_joincount_window(), local_bijoincount_window(),
  * local_multijoincount_window()
  * 2021-4-28 Update functions with new BinWeight() constructor for Window query
+ * 2026-10-16 delete BinWeight after use
+ * 2026-10-16 Use BinWeightView for the weights in Window
+ * 2026-10-16 Use create_window_weights() for the shared weights cache
+ * 2026-10-17 Note that libgeoda creates its own threads
  */
 
 #include <vector>
@@ -18,14 +22,14 @@
 #include <libgeoda/pg/geoms.h>
 #include <libgeoda/pg/utils.h>
 
-#include "binweight.h"
+#include "binweight_view.h"
 #include "postgeoda.h"
 #include "proxy.h"
 
 double** local_joincount_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
                                 char *method, double significance_cutoff, int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     std::vector<double> data(num_obs, 0);
@@ -39,6 +43,7 @@ double** local_joincount_window(int N, const double* r, const uint8_t** bw, cons
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
 
+    // libgeoda creates its own cpu_threads threads, not the workers of parallel.h
     LISA* lisa = gda_localjoincount(w, data, undefs, significance_cutoff, cpu_threads, permutations, perm_method, seed);
     const std::vector<double>& lisa_i = lisa->GetLISAValues();
     const std::vector<double>& lisa_p = lisa->GetLocalSignificanceValues();
@@ -55,6 +60,7 @@ double** local_joincount_window(int N, const double* r, const uint8_t** bw, cons
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_joincount_window: return results.");
     return result;
@@ -63,7 +69,7 @@ double** local_joincount_window(int N, const double* r, const uint8_t** bw, cons
 double** local_bijoincount_window(int N, const double* r1, const double* r2, const uint8_t** bw, const size_t* w_size, int permutations,
                                   char *method, double significance_cutoff, int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     // check if w matches input fids
@@ -91,6 +97,7 @@ double** local_bijoincount_window(int N, const double* r1, const double* r2, con
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
 
+    // libgeoda creates its own cpu_threads threads, not the workers of parallel.h
     LISA* lisa = gda_localmultijoincount(w, data, undefs, significance_cutoff, cpu_threads, permutations, perm_method, seed);
     const std::vector<double>& lisa_i = lisa->GetLISAValues();
     const std::vector<double>& lisa_p = lisa->GetLocalSignificanceValues();
@@ -107,6 +114,7 @@ double** local_bijoincount_window(int N, const double* r1, const double* r2, con
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_bijoincount_window: return results.");
     return result;
@@ -117,7 +125,7 @@ double** local_multijoincount_window(int N, int n_vars, const double** r, const
 {
     lwdebug(1, "Enter local_multijoincount_window.");
 
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     std::vector<std::vector<double> > data_arr;
@@ -142,6 +150,7 @@ double** local_multijoincount_window(int N, int n_vars, const double** r, const
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
 
+    // libgeoda creates its own cpu_threads threads, not the workers of parallel.h
     LISA* lisa = gda_localmultijoincount(w, data_arr, undefs_arr, significance_cutoff, cpu_threads, permutations,
                                          perm_method, seed);
     const std::vector<double>& lisa_i = lisa->GetLISAValues();
@@ -159,6 +168,7 @@ double** local_multijoincount_window(int N, int n_vars, const double** r, const
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_multijoincount_window: return results.");
     return result;
@@ -5,6 +5,10 @@
  * 2021-1-29 Update to use libgeoda 0.0.6; add pg_local_g();
  * add pg_local_gstar()
  * 2021-4-28 Update functions with new BinWeight() constructor for Window query
+ * 2026-10-16 delete BinWeight after use
+ * 2026-10-16 Use BinWeightView for the weights in Window
+ * 2026-10-16 Use create_window_weights() for the shared weights cache
+ * 2026-10-16 Add the "analytic" method with local_analytic()
  */
 
 #include <vector>
@@ -15,13 +19,14 @@
 #include <libgeoda/pg/geoms.h>
 #include <libgeoda/pg/utils.h>
 
-#include "binweight.h"
+#include "binweight_view.h"
+#include "lisa_analytic.h"
 #include "proxy.h"
 
 double** local_g_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
                         char *method, double significance_cutoff, int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size); // weights in Window
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window
     int num_obs = w->num_obs;
 
     std::vector<double> data(num_obs, 0);
@@ -32,6 +37,14 @@ double** local_g_window(int N, const double* r, const uint8_t** bw, const size_t
         undefs[i] = false;
     }
 
+    if (method != 0 && strncmp(method, "analytic", 8) == 0) {
+        lwdebug(1, "local_g_window: local_analytic().");
+        LocalNeighbors nbrs(w);
+        double **result = local_analytic(LOCAL_STAT_G, nbrs, data, significance_cutoff, cpu_threads);
+        delete w;
+        return result;
+    }
+
     lwdebug(1, "local_g_window: gda_localg().");
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
@@ -52,6 +65,7 @@ double** local_g_window(int N, const double* r, const uint8_t** bw, const size_t
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_g_window: return results.");
     return result;
@@ -60,7 +74,7 @@ double** local_g_window(int N, const double* r, const uint8_t** bw, const size_t
 double** local_gstar_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
                         char *method, double significance_cutoff, int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size); // weights in Window
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window
     int num_obs = w->num_obs;
 
     std::vector<double> data(num_obs, 0);
@@ -71,6 +85,14 @@ double** local_gstar_window(int N, const double* r, const uint8_t** bw, const si
         undefs[i] = false;
     }
 
+    if (method != 0 && strncmp(method, "analytic", 8) == 0) {
+        lwdebug(1, "local_gstar_window: local_analytic().");
+        LocalNeighbors nbrs(w);
+        double **result = local_analytic(LOCAL_STAT_GSTAR, nbrs, data, significance_cutoff, cpu_threads);
+        delete w;
+        return result;
+    }
+
     lwdebug(1, "local_gstar_window: gda_localg().");
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
@@ -91,6 +113,7 @@ double** local_gstar_window(int N, const double* r, const uint8_t** bw, const si
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_gstar_window: return results.");
     return result;
@@ -3,6 +3,10 @@
  *
  * Changes:
  * 2021-5-6 add local_geary_window(); local_multigeary_window()
+ * 2026-10-16 delete BinWeight after use
+ * 2026-10-16 Use BinWeightView for the weights in Window
+ * 2026-10-16 Use create_window_weights() for the shared weights cache
+ * 2026-10-16 Add the "analytic" method to local_geary_window() with local_analytic()
  */
 
 #include <vector>
@@ -10,16 +14,18 @@
 #include <libgeoda/gda_sa.h>
 #include <libgeoda/sa/LISA.h>
 #include <libgeoda/GeoDaSet.h>
+#include <libgeoda/GenUtils.h>
 #include <libgeoda/pg/geoms.h>
 #include <libgeoda/pg/utils.h>
 
-#include "binweight.h"
+#include "binweight_view.h"
+#include "lisa_analytic.h"
 #include "proxy.h"
 
 double** local_geary_window(int N, const double* r, const uint8_t** bw, const size_t* w_size, int permutations,
                         char *method, double significance_cutoff, int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size); // weights in Window
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window
     int num_obs = w->num_obs;
 
     std::vector<double> data(num_obs, 0);
@@ -30,6 +36,15 @@ double** local_geary_window(int N, const double* r, const uint8_t** bw, const si
         undefs[i] = false;
     }
 
+    if (method != 0 && strncmp(method, "analytic", 8) == 0) {
+        lwdebug(1, "local_geary_window: local_analytic().");
+        GenUtils::StandardizeData(data);
+        LocalNeighbors nbrs(w);
+        double **result = local_analytic(LOCAL_STAT_GEARY, nbrs, data, significance_cutoff, cpu_threads);
+        delete w;
+        return result;
+    }
+
     lwdebug(1, "local_geary_window: gda_localgeary().");
     std::string perm_method = "lookup";
     if (method != 0) perm_method = method;
@@ -50,6 +65,7 @@ double** local_geary_window(int N, const double* r, const uint8_t** bw, const si
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_geary_window: return results.");
     return result;
@@ -61,7 +77,7 @@ double** local_multigeary_window(int n_vars, int N, const double** r, const uint
 {
     lwdebug(1, "Enter local_multigeary_window.");
 
-    BinWeight* w = new BinWeight(N, bw, w_size); // weights in Window
+    GeoDaWeight* w = create_window_weights(N, bw, w_size); // weights in Window
     int num_obs = w->num_obs;
 
     std::vector<std::vector<double> > data_arr;
@@ -103,6 +119,7 @@ double** local_multigeary_window(int n_vars, int N, const double** r, const uint
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "Exit local_multigeary_window: return results.");
     return result;
@@ -4,6 +4,9 @@
  * Changes:
  * 2021-4-9 add pg_quantilelisa()
  * 2021-4-28 Update functions with new BinWeight() constructor for Window query; add local_multiquantilelisa_window()
+ * 2026-10-16 delete BinWeight after use
+ * 2026-10-16 Use BinWeightView for the weights in Window
+ * 2026-10-16 Use create_window_weights() for the shared weights cache
  */
 
 #include <vector>
@@ -14,14 +17,14 @@
 #include <libgeoda/pg/geoms.h>
 #include <libgeoda/pg/utils.h>
 
-#include "binweight.h"
+#include "binweight_view.h"
 #include "proxy.h"
 
 double** local_quantilelisa_window(int k, int quantile, int N, const double* r, const uint8_t** bw,
                                    const size_t* w_size, int permutations, char *method, double significance_cutoff,
                                    int cpu_threads, int seed)
 {
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     std::vector<double> data(num_obs, 0);
@@ -53,6 +56,7 @@ double** local_quantilelisa_window(int k, int quantile, int N, const double* r,
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_quantilelisa_window: return results.");
     return result;
@@ -64,7 +68,7 @@ double** local_multiquantilelisa_window(int n_vars, int* k, int* quantile, int N
 {
     lwdebug(1, "Enter local_multiquantilelisa_window.");
 
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     std::vector<std::vector<double> > data_arr;
@@ -109,6 +113,7 @@ double** local_multiquantilelisa_window(int n_vars, int* k, int* quantile, int N
 
     // clean
     delete lisa;
+    delete w;
 
     lwdebug(1, "local_multiquantilelisa_window: return results.");
     return result;
@@ -3,6 +3,10 @@
  *
  * Changes:
  * 2021-4-30 add redcap_window()
+ * 2026-10-16 Use BinWeightView for the weights in Window
+ * 2026-10-16 Use create_window_weights() for the shared weights cache
+ * 2026-10-16 Cap cpu_threads of gda_redcap() with parallel_threads()
+ * 2026-10-17 Note that libgeoda creates its own threads
  */
 
 #include <vector>
@@ -13,7 +17,8 @@
 #include <libgeoda/pg/utils.h>
 #include <libgeoda/gda_clustering.h>
 
-#include "binweight.h"
+#include "binweight_view.h"
+#include "parallel.h"
 #include "proxy.h"
 
 int* redcap1_window(int k, int N, int n_vars, const double** r, const uint8_t** bw, const size_t* w_size,
@@ -21,7 +26,7 @@ int* redcap1_window(int k, int N, int n_vars, const double** r, const uint8_t**
 {
     lwdebug(1, "Enter redcap_window.");
 
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     if (w->CheckConnectivity() == false) {
@@ -64,8 +69,9 @@ int* redcap1_window(int k, int N, int n_vars, const double** r, const uint8_t**
     if (dist_type!= 0) distance_method= dist_type;
     if (redcap_type != 0 ) redcap_method = redcap_type;
 
+    // libgeoda creates its own cpu_threads threads, not the workers of parallel.h
     std::vector<std::vector<int> > cluster_ids = gda_redcap(k, w, data_arr, scale_method, redcap_method, distance_method, bound_vals,
-                                                         min_bound, seed, cpu_threads);
+                                                         min_bound, seed, parallel_threads(cpu_threads));
 
     std::vector<int> clusters = GenUtils::flat_2dclusters(N, cluster_ids);
 
@@ -88,7 +94,7 @@ int* redcap2_window(int k, int N, int n_vars, const double** r, const uint8_t**
 {
     lwdebug(1, "Enter redcap2_window.");
 
-    BinWeight* w = new BinWeight(N, bw, w_size);
+    GeoDaWeight* w = create_window_weights(N, bw, w_size);
     int num_obs = w->num_obs;
 
     std::vector<std::vector<double> > data_arr;
@@ -125,8 +131,9 @@ int* redcap2_window(int k, int N, int n_vars, const double** r, const uint8_t**
     if (dist_type!= 0) distance_method= dist_type;
     if (redcap_type!= 0) redcap_method= redcap_type;
 
+    // libgeoda creates its own cpu_threads threads, not the workers of parallel.h
     std::vector<std::vector<int> > cluster_ids = gda_redcap(k, w, data_arr, scale_method, redcap_method, distance_method, bound_vals,
-                                                            min_bound, seed, cpu_threads);
+                                                            min_bound, seed, parallel_threads(cpu_threads));
 
     std::vector<int> clusters = GenUtils::flat_2dclusters(N, cluster_ids);
 
@@ -4,6 +4,16 @@
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
  * 2021-4-23 Add function weights_to_bytea_array() for weights Window SQL functions
+ * 2026-10-16 Add add_pg_geometry_datum()
+ * 2026-10-16 Add WeightsArena for the weights Window functions
+ * 2026-10-16 Add weights_read_row(), weights_open() and weights_next_row() to read v1 or v2 weights
+ * 2026-10-16 Add weights_arena_copy() and weights_arena_size()
+ * 2026-10-16 Write weights_to_json() in one pass with StringInfo, add weights_append_row_text() and
+ * weights_append_row_json()
+ * 2026-10-16 Write the observations with more than 65535 neighbors: weights_write_neighbor_row() and
+ * the wide v1 complete weights in weights_to_bytes()
+ * 2026-10-17 Add create_agg_pg_geometries() to free the geometries of an aggregate with its aggcontext
+ * 2026-10-17 Add create_window_pg_geometries() and free_window_pg_geometries() for the Window functions
  */
 
 #ifndef __PG_WEIGHTS_HEADER__
@@ -13,133 +23,467 @@
 extern "C" {
 #endif
 
+#include <utils/memutils.h>
+#include <lib/stringinfo.h>
 #include <libgeoda/pg/utils.h>
 
-#define BUFSIZE 64
+#include "weights_codec.h"
 
 /**
- * weights_to_json
+ * add_pg_geometry_datum
  *
- * This function converts the spatial weights in format of BYTEA to a PG text object.
+ * Add the fid and the geometry (WKB in bytea) of a row to PGGeometries. The WKB
+ * is decoded when it is added, so a detoasted copy of it is released right away.
  *
- * @param bw
+ * @param geoms
+ * @param fid
+ * @param arg
+ * @param isnull
+ */
+static inline void add_pg_geometry_datum(PGGeometries *geoms, uint32_t fid, Datum arg, bool isnull) {
+    if (isnull) {
+        add_pg_geometry(geoms, fid, NULL, 0);
+        return;
+    }
+    bytea *bytea_wkb = DatumGetByteaPP(arg);
+    add_pg_geometry(geoms, fid, (uint8_t*)VARDATA_ANY(bytea_wkb), VARSIZE_ANY_EXHDR(bytea_wkb));
+    if ((Pointer)bytea_wkb != DatumGetPointer(arg)) {
+        pfree(bytea_wkb);
+    }
+}
+
+static inline void pg_geometries_reset_callback(void *arg) {
+    free_pg_geometries((PGGeometries*)arg);
+}
+
+/**
+ * create_agg_pg_geometries
+ *
+ * Create the PGGeometries of an aggregate state. It is freed when aggcontext is reset or
+ * deleted, so a finalfn can run more than once, and nothing leaks on an ERROR or a cancel
+ * before the finalfn is called.
+ *
+ * @param aggcontext
  * @return
  */
-static inline text *weights_to_json(bytea *bw) {
-    lwdebug(1,"Enter weights_to_json().");
-    uint8_t *w = (uint8_t*)VARDATA(bw);
-    const uint8_t *pos = w;
+static inline PGGeometries* create_agg_pg_geometries(MemoryContext aggcontext) {
+    PGGeometries *geoms = create_pg_geometries(0);
+    MemoryContextCallback *cb = MemoryContextAlloc(aggcontext, sizeof(MemoryContextCallback));
+    cb->func = pg_geometries_reset_callback;
+    cb->arg = geoms;
+    MemoryContextRegisterResetCallback(aggcontext, cb);
+    return geoms;
+}
 
-    uint32_t idx = 0;
-    uint16_t n_nbrs = 0;
-    char w_type;
+/**
+ * create_window_pg_geometries
+ *
+ * Create the PGGeometries of the partition of a Window function, with the same reset callback
+ * as create_agg_pg_geometries() in a child memory context of CurrentMemoryContext. They are
+ * freed by free_window_pg_geometries() once the weights are created, or with the parent context
+ * after an ERROR or a cancel (e.g. in libgeoda or while reading the rows), so nothing leaks.
+ *
+ * @param num_obs
+ * @param geoms_ctx the memory context of the geometries, for free_window_pg_geometries()
+ * @return
+ */
+static inline PGGeometries* create_window_pg_geometries(int num_obs, MemoryContext *geoms_ctx) {
+    *geoms_ctx = AllocSetContextCreate(CurrentMemoryContext, "postgeoda geometries", ALLOCSET_SMALL_SIZES);
+    MemoryContextCallback *cb = MemoryContextAlloc(*geoms_ctx, sizeof(MemoryContextCallback));
+    PGGeometries *geoms = create_pg_geometries(num_obs);
+    cb->func = pg_geometries_reset_callback;
+    cb->arg = geoms;
+    MemoryContextRegisterResetCallback(*geoms_ctx, cb);
+    return geoms;
+}
 
-    memcpy(&w_type, pos, sizeof(char));
-    pos += sizeof(char); // weights type char
+// free the geometries of create_window_pg_geometries(): the callback runs when the context is deleted
+static inline void free_window_pg_geometries(MemoryContext geoms_ctx) {
+    MemoryContextDelete(geoms_ctx);
+}
 
-    uint32_t num_obs = 0;
-    memcpy(&num_obs, pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t); // num_obs
+/**
+ * weights_neighbor_row_max_size
+ *
+ * The maximum size of the weights of one observation written by weights_write_neighbor_row()
+ *
+ * @param nbr
+ * @param has_weights
+ * @return
+ */
+static inline size_t weights_neighbor_row_max_size(const PGNeighbor *nbr, bool has_weights) {
+    size_t num_nbrs = nbr->num_nbrs;
+    if (num_nbrs > UINT16_MAX) {
+        return weights_codec_row_max_size(nbr->num_nbrs, has_weights, WEIGHTS_ENC_F32);
+    }
+    size_t size = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t) * num_nbrs;
+    if (has_weights) size += sizeof(float) * num_nbrs;
+    return size;
+}
 
-    lwdebug(1, "wtype=%s num_obs=%d", w_type, num_obs);
+/**
+ * weights_write_neighbor_row
+ *
+ * Write the weights of one observation into buf: a v1 row, or a v2 row (float weights) if
+ * the observation has more than 65535 neighbors, since the number of neighbors of a v1 row
+ * is uint16. Both are read by weights_codec_read_row().
+ *
+ * @param buf at least weights_neighbor_row_max_size() bytes
+ * @param nbr
+ * @param has_weights
+ * @return the size of the row
+ */
+static inline size_t weights_write_neighbor_row(uint8_t *buf, const PGNeighbor *nbr, bool has_weights) {
+    uint32_t num_nbrs = nbr->num_nbrs;
+    if (num_nbrs > UINT16_MAX) {
+        // v2 needs the neighbors sorted by id
+        uint32_t *ids = palloc(sizeof(uint32_t) * num_nbrs);
+        float *weights = has_weights ? palloc(sizeof(float) * num_nbrs) : NULL;
+        memcpy(ids, nbr->nbrId, sizeof(uint32_t) * num_nbrs);
+        if (has_weights) memcpy(weights, nbr->nbrWeight, sizeof(float) * num_nbrs);
+        weights_codec_sort_neighbors(ids, weights, num_nbrs);
+        size_t size = weights_codec_write_row(buf, nbr->idx, num_nbrs, ids, weights, WEIGHTS_ENC_F32);
+        pfree(ids);
+        if (weights) pfree(weights);
+        return size;
+    }
 
-    List *c_arr;
-    size_t n_arr = 0, i, j;
-    uint32_t nid;
-    float nweights;
-    char *c_nbrs;
+    uint8_t *pos = buf;
+    uint16_t nn = (uint16_t)num_nbrs;
+    memcpy(pos, &nbr->idx, sizeof(uint32_t)); // copy idx
+    pos += sizeof(uint32_t);
+    memcpy(pos, &nn, sizeof(uint16_t)); // copy n_nbrs
+    pos += sizeof(uint16_t);
+    memcpy(pos, nbr->nbrId, sizeof(uint32_t) * nn); // copy nbr_id
+    pos += sizeof(uint32_t) * nn;
+    if (has_weights) {
+        memcpy(pos, nbr->nbrWeight, sizeof(float) * nn); // copy nbr_weight
+        pos += sizeof(float) * nn;
+    }
+    return (size_t)(pos - buf);
+}
 
-    for (i = 0; i < num_obs; ++i) {
-        // read idx
-        memcpy(&idx, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t);
+/**
+ * WeightsArena
+ *
+ * The weights of all observations serialized once into a single buffer: the weights of each
+ * observation is a bytea (varlena) in the format returned by the weights Window functions,
+ * aligned so it can be returned as is. It replaces per row palloc() and copying of the
+ * neighbors when the Window function returns the weights of the current row.
+ */
+typedef struct {
+    uint32_t num_obs;
+    size_t *offsets; /* offset of the bytea of i-th observation in data */
+    uint8_t *data;
+} WeightsArena;
 
-        // read number of neighbors
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
+/**
+ * weights_to_arena
+ *
+ * Serialize PGWeight into a WeightsArena allocated in the memory context ctx (e.g. the
+ * partition context of a Window function). Only two allocations are made for all
+ * observations.
+ *
+ * @param w
+ * @param ctx
+ * @return
+ */
+static inline WeightsArena *weights_to_arena(const PGWeight *w, MemoryContext ctx) {
+    WeightsArena *arena = MemoryContextAlloc(ctx, sizeof(WeightsArena));
+    arena->num_obs = w->num_obs;
+    arena->offsets = MemoryContextAllocHuge(ctx, sizeof(size_t) * (w->num_obs + 1));
+
+    size_t total = 0;
+    for (size_t i = 0; i < w->num_obs; ++i) {
+        size_t buf_size = VARHDRSZ + weights_neighbor_row_max_size(&w->neighbors[i], w->w_type == 'w');
+        arena->offsets[i] = total;
+        total += INTALIGN(buf_size); // the varlena header is read as an int
+    }
+    arena->offsets[w->num_obs] = total;
+    arena->data = MemoryContextAllocHuge(ctx, total > 0 ? total : 1);
 
-        // create string memory
-        c_nbrs = lwalloc(BUFSIZE * n_nbrs * sizeof(char));
+    for (size_t i = 0; i < w->num_obs; ++i) {
+        bytea *row = (bytea*)(arena->data + arena->offsets[i]);
+        size_t size = weights_write_neighbor_row((uint8_t*)VARDATA(row), &w->neighbors[i], w->w_type == 'w');
+        SET_VARSIZE(row, size + VARHDRSZ);
+    }
 
-        // assign string content
-        snprintf(c_nbrs, BUFSIZE, "%d:", idx);
+    return arena;
+}
 
-        if (w_type == 'w') {
-            strcat(c_nbrs, "[");
-        }
-        strcat(c_nbrs, "[");
+/**
+ * weights_arena_size
+ *
+ * @param arena
+ * @return the number of bytes used by the arena
+ */
+static inline size_t weights_arena_size(const WeightsArena *arena) {
+    return sizeof(WeightsArena) + sizeof(size_t) * (arena->num_obs + 1) + arena->offsets[arena->num_obs];
+}
 
-        // loop neighbrs
-        for (j = 0; j < n_nbrs; ++j) {
-            char buffer[BUFSIZE];
-            // read neighbor id
-            memcpy(&nid, pos, sizeof(uint32_t));
-            pos += sizeof(uint32_t);
+/**
+ * weights_arena_copy
+ *
+ * Copy a WeightsArena into the memory context ctx, e.g. from the weights build cache into the
+ * partition context of a Window function
+ *
+ * @param arena
+ * @param ctx
+ * @return
+ */
+static inline WeightsArena *weights_arena_copy(const WeightsArena *arena, MemoryContext ctx) {
+    size_t total = arena->offsets[arena->num_obs];
+    WeightsArena *copy = MemoryContextAlloc(ctx, sizeof(WeightsArena));
+    copy->num_obs = arena->num_obs;
+    copy->offsets = MemoryContextAllocHuge(ctx, sizeof(size_t) * (arena->num_obs + 1));
+    memcpy(copy->offsets, arena->offsets, sizeof(size_t) * (arena->num_obs + 1));
+    copy->data = MemoryContextAllocHuge(ctx, total > 0 ? total : 1);
+    memcpy(copy->data, arena->data, total);
+    return copy;
+}
 
-            snprintf(buffer, BUFSIZE, "%d", nid);
+/**
+ * weights_arena_get
+ *
+ * Get the weights of the i-th observation as bytea. The returned bytea points into the arena,
+ * which is fine for the result of a Window function: the executor copies it to the output.
+ *
+ * @param arena
+ * @param i
+ * @return
+ */
+static inline bytea *weights_arena_get(const WeightsArena *arena, int64 i) {
+    return (bytea*)(arena->data + arena->offsets[i]);
+}
 
-            strcat(c_nbrs, buffer);
-            if (j < n_nbrs - 1)
-                strcat(c_nbrs, ",");
-        }
+/**
+ * weights_read_row
+ *
+ * Parse the weights of one observation (bytea) in v1 or v2, see weights_codec.h. Only
+ * the index and the number of neighbors are decoded.
+ *
+ * @param bw
+ * @param row
+ */
+static inline void weights_read_row(const bytea *bw, WeightsRow *row) {
+    size_t size = VARSIZE_ANY_EXHDR(bw);
+    if (!weights_codec_read_row((const uint8_t*)VARDATA_ANY(bw), size, row)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid weights of an observation (%zu bytes)", size)));
+    }
+}
 
-        strcat(c_nbrs, "]");
+/**
+ * weights_open
+ *
+ * Start reading the complete weights (bytea) in v1 or v2
+ *
+ * @param bw
+ * @param reader
+ */
+static inline void weights_open(const bytea *bw, WeightsReader *reader) {
+    size_t size = VARSIZE_ANY_EXHDR(bw);
+    if (!weights_codec_open((const uint8_t*)VARDATA_ANY(bw), size, reader)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid weights (%zu bytes)", size)));
+    }
+}
 
-        if (w_type == 'w') {
-            strcat(c_nbrs, ",[");
-            for (j = 0; j < n_nbrs; ++j) {
-                char buffer[BUFSIZE];
-                // read neighbor weight
-                memcpy(&nweights, pos, sizeof(float));
-                pos += sizeof(float);
+/**
+ * weights_next_row
+ *
+ * Parse the next row of the complete weights opened by weights_open()
+ *
+ * @param reader
+ * @param row
+ */
+static inline void weights_next_row(WeightsReader *reader, WeightsRow *row) {
+    if (!weights_codec_next(reader, row)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid weights: the weights of an observation are truncated")));
+    }
+}
 
-                snprintf(buffer, BUFSIZE, "%f", nweights);
-                strcat(c_nbrs, buffer);
-                if (j < n_nbrs - 1)
-                    strcat(c_nbrs, ",");
-            }
-            strcat(c_nbrs, "]]");
-        }
+/**
+ * weights_row_to_bytea
+ *
+ * Copy a row of the complete weights into a bytea of the weights of one observation, in
+ * the same version as the complete weights. A row of the wide v1 complete weights ('A' or
+ * 'W') is written as a v1 row, or as a v2 row if it has more than 65535 neighbors.
+ *
+ * @param reader
+ * @param row
+ * @return
+ */
+static inline bytea *weights_row_to_bytea(const WeightsReader *reader, const WeightsRow *row) {
+    if (row->version == 1 && row->wide_count) {
+        PGNeighbor nbr;
+        nbr.idx = row->idx;
+        nbr.num_nbrs = row->num_nbrs;
+        nbr.nbrId = palloc(sizeof(uint32_t) * (row->num_nbrs + 1));
+        nbr.nbrWeight = row->has_weights ? palloc(sizeof(float) * (row->num_nbrs + 1)) : NULL;
+        weights_codec_get_ids(row, nbr.nbrId);
+        if (row->has_weights) weights_codec_get_weights(row, nbr.nbrWeight);
+
+        bytea *result = palloc(weights_neighbor_row_max_size(&nbr, row->has_weights) + VARHDRSZ);
+        size_t size = weights_write_neighbor_row((uint8_t*)VARDATA(result), &nbr, row->has_weights);
+        SET_VARSIZE(result, size + VARHDRSZ);
+        pfree(nbr.nbrId);
+        if (nbr.nbrWeight) pfree(nbr.nbrWeight);
+        return result;
+    }
 
-        if (i < num_obs - 1)
-            strcat(c_nbrs, ",");
+    size_t size = row->end - row->start;
+    size_t buf_size = size;
+    if (row->version == 2) {
+        buf_size += 1; // header
+        if (buf_size % 2 == 0) buf_size += 1; // padding
+    }
 
-        n_arr += strlen(c_nbrs);
+    bytea *result = palloc(buf_size + VARHDRSZ);
+    SET_VARSIZE(result, buf_size + VARHDRSZ);
+    uint8_t *buf = (uint8_t*)VARDATA(result);
 
-        if (i == 0) {
-            c_arr = list_make1(c_nbrs);
-        } else {
-            c_arr = lappend(c_arr, c_nbrs);
-        }
+    if (row->version == 2) {
+        *buf++ = reader->header & ~WEIGHTS_V2_COMPLETE;
+    }
+    memcpy(buf, row->start, size);
+    if (size + 1 < buf_size) {
+        buf[size] = 0;
+    }
+    return result;
+}
 
-        lwdebug(1, "text=%s length=%d", c_nbrs, n_arr);
+/**
+ * weights_append_row_text
+ *
+ * Append the text of the weights of one observation to buf, `idx:[[id,...]]` or
+ * `idx:[[id,...],[w,...]]` with the weights values. The neighbor ids and weights are
+ * decoded one by one, so no buffer is allocated.
+ *
+ * @param buf
+ * @param row
+ */
+static inline void weights_append_row_text(StringInfo buf, const WeightsRow *row) {
+    WeightsIdIter it;
+    uint32_t nid;
+    uint32_t j;
+
+    appendStringInfo(buf, "%u:", row->idx);
+    if (row->has_weights) {
+        appendStringInfoChar(buf, '[');
     }
+    appendStringInfoChar(buf, '[');
 
-    // compose returned json string
-    char *w_str = lwalloc((n_arr + 2) * sizeof(char));
-    w_str[0] = '{';
+    weights_codec_ids_begin(row, &it);
+    for (j = 0; weights_codec_ids_next(&it, &nid); ++j) {
+        if (j > 0) appendStringInfoChar(buf, ',');
+        appendStringInfo(buf, "%u", nid);
+    }
+    if (j < row->num_nbrs) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid weights: the neighbors of observation %u are truncated", row->idx)));
+    }
+    appendStringInfoChar(buf, ']');
 
-    ListCell *l;
-    foreach (l, c_arr) {
-        char *c_nbrs = (char *) (lfirst(l));
-        strcat(w_str, c_nbrs);
-        lwfree(c_nbrs);
+    if (row->has_weights) {
+        appendStringInfoString(buf, ",[");
+        for (j = 0; j < row->num_nbrs; ++j) {
+            if (j > 0) appendStringInfoChar(buf, ',');
+            appendStringInfo(buf, "%f", weights_codec_weight_at(row, j));
+        }
+        appendStringInfoString(buf, "]]");
     }
-    strcat(w_str, "}");
+}
+
+/**
+ * weights_text_begin
+ *
+ * Start a text result in buf: the space of the varlena header is reserved, so the text
+ * is returned by weights_text_end() without copying it.
+ *
+ * @param buf
+ */
+static inline void weights_text_begin(StringInfo buf) {
+    initStringInfo(buf);
+    appendStringInfoSpaces(buf, VARHDRSZ);
+}
+
+static inline text *weights_text_end(StringInfo buf) {
+    SET_VARSIZE(buf->data, buf->len);
+    return (text*)buf->data;
+}
 
-    text *result;
-    size_t len = strlen(w_str);
-    lwdebug(1, "total length=%d", len);
+/**
+ * weights_to_json
+ *
+ * This function converts the complete spatial weights (bytea) in v1 or v2 to a PG text
+ * object: `{idx:[[id,...]],...}`. The text is written in one pass.
+ *
+ * @param bw
+ * @return
+ */
+static inline text *weights_to_json(const bytea *bw) {
+    lwdebug(1,"Enter weights_to_json().");
+    WeightsReader reader;
+    StringInfoData buf;
+
+    weights_open(bw, &reader);
+    weights_text_begin(&buf);
+
+    appendStringInfoChar(&buf, '{');
+    for (uint32_t i = 0; i < reader.num_obs; ++i) {
+        WeightsRow row;
+        weights_next_row(&reader, &row);
+        if (i > 0) appendStringInfoChar(&buf, ',');
+        weights_append_row_text(&buf, &row);
+    }
+    appendStringInfoChar(&buf, '}');
 
-    size_t res_len = len + VARHDRSZ;
+    lwdebug(1, "total length=%d", buf.len);
+    return weights_text_end(&buf);
+}
 
-    result = (text *) palloc(res_len);
-    SET_VARSIZE(result, res_len);
-    memcpy(VARDATA(result), w_str, len);
+/**
+ * weights_append_row_json
+ *
+ * Append the weights of one observation to buf as a JSON object:
+ * `{"id":idx,"neighbors":[id,...]}` or `{"id":idx,"neighbors":[id,...],"weights":[w,...]}`
+ *
+ * @param buf
+ * @param row
+ */
+static inline void weights_append_row_json(StringInfo buf, const WeightsRow *row) {
+    WeightsIdIter it;
+    uint32_t nid;
+    uint32_t j;
 
-    lwfree(w_str);
+    appendStringInfo(buf, "{\"id\":%u,\"neighbors\":[", row->idx);
+    weights_codec_ids_begin(row, &it);
+    for (j = 0; weights_codec_ids_next(&it, &nid); ++j) {
+        if (j > 0) appendStringInfoChar(buf, ',');
+        appendStringInfo(buf, "%u", nid);
+    }
+    if (j < row->num_nbrs) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid weights: the neighbors of observation %u are truncated", row->idx)));
+    }
+    appendStringInfoChar(buf, ']');
 
-    return result;
+    if (row->has_weights) {
+        appendStringInfoString(buf, ",\"weights\":[");
+        for (j = 0; j < row->num_nbrs; ++j) {
+            if (j > 0) appendStringInfoChar(buf, ',');
+            appendStringInfo(buf, "%f", weights_codec_weight_at(row, j));
+        }
+        appendStringInfoChar(buf, ']');
+    }
+    appendStringInfoChar(buf, '}');
 }
 
 /**
@@ -147,7 +491,8 @@ static inline text *weights_to_json(bytea *bw) {
  *
  *  This function converts PGWeight object to a byte object (uint8_t). The size
  *  of the byte object (size_out) should be written to the input parameter
- *  (size_t *size_out)
+ *  (size_t *size_out). If an observation has more than 65535 neighbors, the wide v1
+ *  format ('A' or 'W', uint32 numbers of neighbors) is written, see weights_codec.h
  *
  * @param w
  * @param size_out
@@ -168,11 +513,23 @@ static inline uint8_t *weights_to_bytes(PGWeight *w, size_t *size_out) {
     int32_t num_obs = w->num_obs;
     buf_size += sizeof(uint32_t); // num_obs
 
+    bool wide_count = false;
+    for (size_t i = 0; i < num_obs; ++i) {
+        if (w->neighbors[i].num_nbrs > UINT16_MAX) {
+            wide_count = true;
+            break;
+        }
+    }
+    char w_type = w->w_type;
+    if (wide_count) {
+        w_type = w->w_type == 'w' ? WEIGHTS_V1_WIDE_GWT : WEIGHTS_V1_WIDE_GAL;
+    }
+
     for (size_t i = 0; i < num_obs; ++i) {
         buf_size += sizeof(uint32_t); // idx
 
-        uint16_t num_nbrs = w->neighbors[i].num_nbrs;
-        buf_size += sizeof(uint16_t); // num_nbrs
+        uint32_t num_nbrs = w->neighbors[i].num_nbrs;
+        buf_size += wide_count ? sizeof(uint32_t) : sizeof(uint16_t); // num_nbrs
 
         buf_size = buf_size + sizeof(uint32_t) * num_nbrs;
         if (w->w_type == 'w') {
@@ -190,7 +547,7 @@ static inline uint8_t *weights_to_bytes(PGWeight *w, size_t *size_out) {
     /* Retain a pointer to the front of the buffer for later */
     uint8_t *w_out = buf;
 
-    memcpy(buf, (uint8_t *) (&w->w_type), sizeof(char)); // copy weights type
+    memcpy(buf, (uint8_t *) (&w_type), sizeof(char)); // copy weights type
     buf += sizeof(char);
 
     memcpy(buf, (uint8_t *) (&num_obs), sizeof(uint32_t));  // copy num_obs
@@ -200,10 +557,16 @@ static inline uint8_t *weights_to_bytes(PGWeight *w, size_t *size_out) {
         memcpy(buf, (uint8_t *) (&w->neighbors[i].idx), sizeof(uint32_t)); // copy idx
         buf += sizeof(uint32_t);
 
-        uint16_t num_nbrs = w->neighbors[i].num_nbrs;
+        uint32_t num_nbrs = w->neighbors[i].num_nbrs;
 
-        memcpy(buf, (uint8_t *) (&num_nbrs), sizeof(uint16_t)); // copy n_nbrs
-        buf += sizeof(uint16_t);
+        if (wide_count) {
+            memcpy(buf, (uint8_t *) (&num_nbrs), sizeof(uint32_t)); // copy n_nbrs
+            buf += sizeof(uint32_t);
+        } else {
+            uint16_t nn = (uint16_t)num_nbrs;
+            memcpy(buf, (uint8_t *) (&nn), sizeof(uint16_t)); // copy n_nbrs
+            buf += sizeof(uint16_t);
+        }
 
         for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
             memcpy(buf, (uint8_t *) (&w->neighbors[i].nbrId[j]), sizeof(uint32_t));
@@ -251,15 +614,7 @@ static inline bytea **weights_to_bytea_array(PGWeight *w) {
     bytea **results = (bytea **)palloc(sizeof(bytea*) * num_obs);
 
     for (size_t i = 0; i < num_obs; ++i) {
-        size_t buf_size = 0;
-        buf_size += sizeof(uint32_t); // idx
-        uint16_t num_nbrs = w->neighbors[i].num_nbrs;
-        buf_size += sizeof(uint16_t); // num_nbrs
-        buf_size += sizeof(uint32_t) * num_nbrs;
-        if (w->w_type == 'w') {
-            buf_size += sizeof(float) * num_nbrs;
-        }
-        buf_size_array[i] = buf_size;
+        buf_size_array[i] = weights_neighbor_row_max_size(&w->neighbors[i], w->w_type == 'w');
     }
 
     for (size_t i = 0; i < num_obs; ++i) {
@@ -268,42 +623,10 @@ static inline bytea **weights_to_bytea_array(PGWeight *w) {
             results[i] = 0;
             continue;
         }
-        uint8_t *buf = palloc(buf_size);
-        uint8_t *pos = buf; // retain the start pos
-        memcpy(buf, &(w->neighbors[i].idx), sizeof(uint32_t)); // copy idx
-        buf += sizeof(uint32_t);
-
-        uint16_t num_nbrs = w->neighbors[i].num_nbrs;
-
-        memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-        buf += sizeof(uint16_t);
-
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-            memcpy(buf, &w->neighbors[i].nbrId[j], sizeof(uint32_t));
-            buf += sizeof(uint32_t);
-        }
-
-        if (w->w_type == 'w') {
-            for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-                memcpy(buf, &w->neighbors[i].nbrWeight[j], sizeof(float));
-                buf += sizeof(float);
-                //if (i==0) {
-                //    lwdebug(1, "weights_to_bytea_array: 1st neighbors: %f", w->neighbors[i].nbrWeight[j]);
-                //}
-            }
-        }
-        // copy to bytea type
         bytea *result = palloc(buf_size + VARHDRSZ);
-        SET_VARSIZE(result, buf_size+VARHDRSZ);
-        memcpy(VARDATA(result), pos, buf_size);
-        //bytea *result = palloc(sizeof(char)+ VARHDRSZ);
-        //SET_VARSIZE(result, sizeof(char)+VARHDRSZ);
-        //memcpy(VARDATA(result), &i, sizeof(char));
-
-        results[i] =  result;
-
-        // clean
-        pfree(pos);
+        buf_size = weights_write_neighbor_row((uint8_t*)VARDATA(result), &w->neighbors[i], w->w_type == 'w');
+        SET_VARSIZE(result, buf_size + VARHDRSZ);
+        results[i] = result;
     }
 
     pfree(buf_size_array);
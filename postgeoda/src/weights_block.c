@@ -0,0 +1,421 @@
+/**
+ * Changes:
+ * 2026-10-16 Add knn_index(), knn_weights_block() and weights_merge() to create KNN weights in blocks
+ * 2026-10-16 Merge the weights of observations in v1 or v2 (weights_codec.h)
+ * 2026-10-16 Support the observations with more than 65535 neighbors
+ * 2026-10-17 Free the geometries of knn_index() with its aggcontext; error on duplicated fids
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <utils/array.h>
+#include <utils/memutils.h>
+#include <catalog/pg_type.h>
+#include <utils/lsyscache.h> /* for get_typlenbyvalalign */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libgeoda/pg/geoms.h>
+#include "proxy.h"
+
+#include "weights.h"
+
+/**
+ * KnnIndexState
+ *
+ * This is used for collecting geometries and fids for the Aggregate SQL function `knn_index()`
+ */
+typedef struct
+{
+    PGGeometries *geoms;  /* collected (decoded) geometries and fids */
+    bool is_arc;
+} KnnIndexState;
+
+/**
+ * bytea_knn_index_transfn
+ *
+ * sfunc for Aggregate SQL function `knn_index(fid, geom, is_arc)`
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum bytea_knn_index_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(bytea_knn_index_transfn);
+
+Datum bytea_knn_index_transfn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "bytea_knn_index_transfn called in non-aggregate context");
+        aggcontext = NULL;  /* keep compiler quiet */
+    }
+
+    KnnIndexState* state;
+    if ( PG_ARGISNULL(0) ) {
+        // first incoming row/item
+        state = (KnnIndexState*)MemoryContextAlloc(aggcontext, sizeof(KnnIndexState));
+        state->geoms = create_agg_pg_geometries(aggcontext);
+        state->is_arc = false;
+    } else {
+        state = (KnnIndexState*) PG_GETARG_POINTER(0);
+    }
+
+    // fid: rows without fid can't be neighbors
+    if (PG_ARGISNULL(1)) {
+        PG_RETURN_POINTER(state);
+    }
+    uint32_t fid = PG_GETARG_INT32(1);
+
+    // the_geom
+    add_pg_geometry_datum(state->geoms, fid, PG_GETARG_DATUM(2), PG_ARGISNULL(2));
+
+    // is_arc
+    if (PG_NARGS() > 3 && !PG_ARGISNULL(3)) {
+        state->is_arc = PG_GETARG_BOOL(3);
+    }
+
+    PG_RETURN_POINTER(state);
+}
+
+/**
+ * knn_index_finalfn
+ *
+ * finalfunc for Aggregate SQL function `knn_index()`: create the kd-tree of the
+ * collected geometries and serialize it into a bytea.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum knn_index_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(knn_index_finalfn);
+
+Datum knn_index_finalfn(PG_FUNCTION_ARGS)
+{
+    lwdebug(1,"Enter knn_index_finalfn.");
+
+    if (PG_ARGISNULL(0))
+        PG_RETURN_NULL();   /* returns null iff no input values */
+
+    KnnIndexState *p = (KnnIndexState*) PG_GETARG_POINTER(0);
+
+    PGKnnIndex *index = create_knn_index(p->geoms, p->is_arc);
+
+    // the kd-tree excludes a point from its own neighbors by fid, so the fids must be unique
+    uint32_t dup_fid = 0;
+    if (knn_index_duplicate_fid(index, &dup_fid)) {
+        free_knn_index(index);
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("knn_index: observation %u is duplicated", dup_fid)));
+    }
+
+    size_t buf_size = knn_index_size(index);
+    if (buf_size + VARHDRSZ > MaxAllocSize) {
+        free_knn_index(index);
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("knn index of %zu bytes exceeds the maximum size of bytea", buf_size)));
+    }
+
+    bytea *result = palloc(buf_size + VARHDRSZ);
+    SET_VARSIZE(result, buf_size + VARHDRSZ);
+    serialize_knn_index(index, (uint8_t*)VARDATA(result));
+    free_knn_index(index);
+
+    lwdebug(1,"Exit knn_index_finalfn.");
+    PG_RETURN_BYTEA_P(result);
+}
+
+/**
+ * knn_block_free
+ *
+ * Free the (malloc'ed) PGWeight of `knn_weights_block()` when its memory context is
+ * reset, so it is also freed if the query doesn't read all rows (e.g. LIMIT).
+ */
+static void knn_block_free(void *arg)
+{
+    free_pgweight((PGWeight*)arg);
+}
+
+/**
+ * pg_knn_weights_block
+ *
+ * This function is for SQL function: knn_weights_block(index, k, start_fid, end_fid, power,
+ * is_inverse, is_mile, cpu_threads)
+ *
+ * Load the kd-tree created by the Aggregate `knn_index()`, and return the KNN weights of
+ * the observations with start_fid <= fid < end_fid as a set of bytea, one row per observation
+ * in the same format as `knn_weights()`, sorted by fid. The blocks of disjoint fid ranges can
+ * be computed in different backends (or nodes) and merged by `weights_merge()`.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_knn_weights_block(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pg_knn_weights_block);
+Datum pg_knn_weights_block(PG_FUNCTION_ARGS)
+{
+    FuncCallContext     *funcctx;
+
+    // stuff done only on the first call of the function
+    if (SRF_IS_FIRSTCALL()) {
+        // create a function context for cross-call persistence
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        bytea *bindex = PG_GETARG_BYTEA_PP(0);
+
+        int k = PG_GETARG_INT32(1);
+        if (k <= 0) k = 4;
+
+        int64 start_fid = PG_GETARG_INT64(2);
+        int64 end_fid = PG_GETARG_INT64(3);
+
+        double power = 1.0;
+        if (PG_NARGS() > 4) {
+            power = PG_GETARG_FLOAT4(4);
+            if (power < 0) power = 1.0;
+        }
+
+        bool is_inverse = false;
+        if (PG_NARGS() > 5) {
+            is_inverse = PG_GETARG_BOOL(5);
+        }
+
+        bool is_mile = true;
+        if (PG_NARGS() > 6) {
+            is_mile = PG_GETARG_BOOL(6);
+        }
+
+        int cpu_threads = 1;
+        if (PG_NARGS() > 7) {
+            cpu_threads = PG_GETARG_INT32(7);
+            if (cpu_threads < 1) cpu_threads = 1;
+        }
+
+        PGKnnIndex *index = load_knn_index((uint8_t*)VARDATA_ANY(bindex), VARSIZE_ANY_EXHDR(bindex));
+        PGWeight *w = create_knn_weights_block(index, k, start_fid, end_fid, power, is_inverse, is_mile,
+                                               cpu_threads);
+        free_knn_index(index);
+        if ((Pointer)bindex != DatumGetPointer(PG_GETARG_DATUM(0))) {
+            pfree(bindex);
+        }
+
+        MemoryContextCallback *cb = palloc(sizeof(MemoryContextCallback));
+        cb->func = knn_block_free;
+        cb->arg = w;
+        MemoryContextRegisterResetCallback(funcctx->multi_call_memory_ctx, cb);
+
+        funcctx->user_fctx = w;
+        funcctx->max_calls = w->num_obs;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    // stuff done on every call of the function
+    funcctx = SRF_PERCALL_SETUP();
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        PGWeight *w = (PGWeight*)funcctx->user_fctx;
+        PGNeighbor *nbr = &w->neighbors[funcctx->call_cntr];
+
+        bytea *result = palloc(weights_neighbor_row_max_size(nbr, true) + VARHDRSZ);
+        size_t buf_size = weights_write_neighbor_row((uint8_t*)VARDATA(result), nbr, true);
+        SET_VARSIZE(result, buf_size + VARHDRSZ);
+
+        SRF_RETURN_NEXT(funcctx, PointerGetDatum(result));
+    } else {
+        // do when there is no more left
+        SRF_RETURN_DONE(funcctx);
+    }
+}
+
+/**
+ * WeightsMergeState
+ *
+ * This is used for collecting the weights of observations (bytea rows) for the Aggregate
+ * SQL function `weights_merge()`
+ */
+typedef struct
+{
+    List *rows; /* bytea copied into the aggregate context */
+} WeightsMergeState;
+
+/**
+ * weights_merge_transfn
+ *
+ * sfunc for Aggregate SQL function `weights_merge(w)`
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum weights_merge_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_merge_transfn);
+
+Datum weights_merge_transfn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "weights_merge_transfn called in non-aggregate context");
+        aggcontext = NULL;  /* keep compiler quiet */
+    }
+
+    WeightsMergeState* state;
+    if ( PG_ARGISNULL(0) ) {
+        state = (WeightsMergeState*)MemoryContextAllocZero(aggcontext, sizeof(WeightsMergeState));
+    } else {
+        state = (WeightsMergeState*) PG_GETARG_POINTER(0);
+    }
+
+    if (PG_ARGISNULL(1)) {
+        PG_RETURN_POINTER(state);
+    }
+
+    bytea *row = PG_GETARG_BYTEA_PP(1);
+    size_t row_size = VARSIZE_ANY_EXHDR(row);
+    WeightsRow w_row;
+    weights_read_row(row, &w_row);
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(aggcontext);
+    bytea *copy = palloc(row_size + VARHDRSZ);
+    SET_VARSIZE(copy, row_size + VARHDRSZ);
+    memcpy(VARDATA(copy), VARDATA_ANY(row), row_size);
+    state->rows = lappend(state->rows, copy);
+    MemoryContextSwitchTo(oldcontext);
+
+    PG_RETURN_POINTER(state);
+}
+
+static int weights_row_cmp(const void *a, const void *b)
+{
+    uint32_t idx_a = ((const WeightsRow*)a)->idx;
+    uint32_t idx_b = ((const WeightsRow*)b)->idx;
+    if (idx_a < idx_b) return -1;
+    if (idx_a > idx_b) return 1;
+    return 0;
+}
+
+/**
+ * weights_merge_finalfn
+ *
+ * finalfunc for Aggregate SQL function `weights_merge()`: sort the weights of observations
+ * by fid and compose the weights bytea (the same format as `geoda_weights_knn()`). The result
+ * doesn't depend on the order of the input rows.
+ *
+ * The result is in v1 if all rows are in v1. Otherwise, it is in v2 with the most precise
+ * encoding of the weights values of the rows (a v1 row is f32), see weights_codec.h
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum weights_merge_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_merge_finalfn);
+
+Datum weights_merge_finalfn(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0))
+        PG_RETURN_NULL();   /* returns null iff no input values */
+
+    WeightsMergeState *state = (WeightsMergeState*) PG_GETARG_POINTER(0);
+
+    uint32_t num_obs = list_length(state->rows);
+    WeightsRow *rows = palloc(sizeof(WeightsRow) * (num_obs > 0 ? num_obs : 1));
+    ListCell *l;
+    size_t i = 0;
+    foreach (l, state->rows) {
+        weights_read_row((bytea*)lfirst(l), &rows[i++]);
+    }
+    qsort(rows, num_obs, sizeof(WeightsRow), weights_row_cmp);
+
+    // the weights type: rows with neighbor weights ('w') or without ('a'), but not both
+    char w_type = 0;
+    uint8_t version = 1;
+    uint8_t w_enc = WEIGHTS_ENC_Q8;
+    uint32_t max_nbrs = 0;
+    for (i = 0; i < num_obs; ++i) {
+        char row_type = rows[i].has_weights ? 'w' : 'a';
+        uint32_t num_nbrs = rows[i].num_nbrs;
+
+        if (w_type != 0 && num_nbrs > 0 && row_type != w_type) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("weights_merge: the weights of observation %u are not "
+                                   "the same type as the others", rows[i].idx)));
+        }
+        if (i > 0 && rows[i].idx == rows[i-1].idx) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("weights_merge: observation %u is duplicated", rows[i].idx)));
+        }
+        // observations without neighbors are the same in both types
+        if (num_nbrs > 0) {
+            w_type = row_type;
+            if (rows[i].has_weights && rows[i].w_enc < w_enc) w_enc = rows[i].w_enc;
+        }
+        if (rows[i].version == 2) version = 2;
+        if (num_nbrs > max_nbrs) max_nbrs = num_nbrs;
+    }
+    if (w_type == 0) w_type = 'a';
+    if (w_type == 'a') w_enc = WEIGHTS_ENC_F32;
+
+    // v1 with uint32 numbers of neighbors ('A' or 'W') if needed
+    bool wide_count = version == 1 && max_nbrs > UINT16_MAX;
+    char header_type = w_type;
+    if (wide_count) header_type = w_type == 'w' ? WEIGHTS_V1_WIDE_GWT : WEIGHTS_V1_WIDE_GAL;
+
+    // rows without neighbors take the type of the others, so they can be copied as they are
+    for (i = 0; i < num_obs; ++i) {
+        rows[i].has_weights = w_type == 'w';
+    }
+
+    size_t buf_size = sizeof(char) + (version == 1 ? sizeof(uint32_t) : WEIGHTS_VARINT_MAX_SIZE) + 1;
+    for (i = 0; i < num_obs; ++i) {
+        buf_size += weights_codec_copy_row_max_size(&rows[i], version, w_enc);
+    }
+    if (buf_size + VARHDRSZ > MaxAllocSize) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("weights of %zu bytes exceeds the maximum size of bytea", buf_size)));
+    }
+
+    bytea *result = palloc(buf_size + VARHDRSZ);
+    uint8_t *start = (uint8_t*)VARDATA(result);
+    uint8_t *buf = start;
+    if (version == 1) {
+        memcpy(buf, &header_type, sizeof(char)); // copy weights type
+        buf += sizeof(char);
+        memcpy(buf, &num_obs, sizeof(uint32_t)); // copy num_obs
+        buf += sizeof(uint32_t);
+    } else {
+        *buf++ = weights_codec_v2_header(w_type == 'w', w_enc, true);
+        buf = weights_codec_write_varint(buf, num_obs);
+    }
+
+    // scratch to decode and encode the rows in a different encoding
+    uint32_t *nbr_ids = palloc(sizeof(uint32_t) * (max_nbrs + 1));
+    float *nbr_weights = palloc(sizeof(float) * (max_nbrs + 1));
+    for (i = 0; i < num_obs; ++i) {
+        buf = weights_codec_copy_row(&rows[i], version, w_enc, wide_count, nbr_ids, nbr_weights, buf);
+        if (buf == NULL) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("weights_merge: invalid weights of observation %u", rows[i].idx)));
+        }
+    }
+    if (version == 2 && (buf - start) % 2 == 0) {
+        *buf++ = 0; // padding
+    }
+    SET_VARSIZE(result, (buf - start) + VARHDRSZ);
+
+    pfree(nbr_ids);
+    pfree(nbr_weights);
+    pfree(rows);
+    PG_RETURN_BYTEA_P(result);
+}
+
+#ifdef __cplusplus
+}
+#endif
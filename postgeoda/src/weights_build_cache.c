@@ -0,0 +1,259 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the weights build cache, see weights_build_cache.h
+ * 2026-10-17 Keep the content of the key in the entry and compare it; disable the cache by default; create
+ * the memory context of an entry under the current one until the entry is complete
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <windowapi.h>
+#include <access/htup_details.h> /* for heap_form_tuple */
+#include <lib/ilist.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
+#if PG_VERSION_NUM >= 130000
+#include <common/hashfn.h>
+#else
+#include <utils/hashutils.h>
+#define hash_bytes_extended(k, keylen, seed) \
+    DatumGetUInt64(hash_any_extended((k), (keylen), (seed)))
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libgeoda/pg/utils.h>
+#include "weights_build_cache.h"
+
+typedef struct {
+    dlist_node node; /* most recently used first */
+    WeightsBuildKey key; /* key.data is not used, the content of the key is in key_data */
+    char *key_data;
+    MemoryContext ctx; /* owns the entry, the content of the key and the arena */
+    WeightsArena *arena;
+    Size size;
+} WeightsBuildEntry;
+
+/* postgeoda.weights_build_cache_size (MB) */
+static int weights_build_cache_size = 0;
+
+static dlist_head build_cache = DLIST_STATIC_INIT(build_cache);
+static Size build_cache_total_size = 0;
+static int build_cache_entries = 0;
+static uint64 build_cache_hits = 0;
+static uint64 build_cache_misses = 0;
+
+void weights_build_cache_init(void)
+{
+    DefineCustomIntVariable("postgeoda.weights_build_cache_size",
+                            "Maximum size (MB) of the weights built by the weights Window functions "
+                            "kept in a backend (0 to disable, the default).",
+                            NULL,
+                            &weights_build_cache_size,
+                            0, 0, INT_MAX / 2,
+                            PGC_USERSET,
+                            GUC_UNIT_MB,
+                            NULL, NULL, NULL);
+}
+
+bool weights_build_cache_enabled(void)
+{
+    return weights_build_cache_size > 0;
+}
+
+static Size weights_build_cache_max_size(void)
+{
+    return (Size)weights_build_cache_size * 1024 * 1024;
+}
+
+void weights_build_key_init(WeightsBuildKey *key, const char *method, int64 num_obs)
+{
+    key->hash = (uint64)num_obs;
+    key->size = 0;
+    key->num_obs = num_obs;
+    key->too_large = false;
+    initStringInfo(&key->data);
+    weights_build_key_add(key, method, strlen(method) + 1);
+}
+
+void weights_build_key_add(WeightsBuildKey *key, const void *data, size_t size)
+{
+    key->hash = hash_bytes_extended((const unsigned char*)data, (int)size, key->hash);
+    key->size += size;
+    if (key->too_large) return;
+
+    if (key->size > weights_build_cache_max_size() || key->size >= MaxAllocSize) {
+        // the weights of this key can't be in the cache
+        key->too_large = true;
+        pfree(key->data.data);
+        key->data.data = NULL;
+        key->data.len = 0;
+        return;
+    }
+    appendBinaryStringInfo(&key->data, (const char*)data, (int)size);
+}
+
+void weights_build_key_add_row(WeightsBuildKey *key, int64 fid, Datum geom, bool isnull)
+{
+    weights_build_key_add(key, &fid, sizeof(int64));
+    if (isnull) {
+        weights_build_key_add(key, &isnull, sizeof(bool));
+        return;
+    }
+    bytea *bytea_wkb = DatumGetByteaPP(geom);
+    weights_build_key_add(key, VARDATA_ANY(bytea_wkb), VARSIZE_ANY_EXHDR(bytea_wkb));
+    if ((Pointer)bytea_wkb != DatumGetPointer(geom)) {
+        pfree(bytea_wkb);
+    }
+}
+
+void weights_build_key_read(WeightsBuildKey *key, WindowObject winobj)
+{
+    bool isnull, isout;
+    int64 N = key->num_obs;
+
+    for (int64 i = 0; i < N; i++) {
+        Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+        int64 fid = DatumGetInt64(arg);
+
+        Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+        weights_build_key_add_row(key, fid, arg1, isnull);
+    }
+}
+
+static WeightsBuildEntry *weights_build_cache_find(const WeightsBuildKey *key)
+{
+    if (key->too_large) return NULL;
+
+    dlist_iter iter;
+    dlist_foreach(iter, &build_cache) {
+        WeightsBuildEntry *entry = dlist_container(WeightsBuildEntry, node, iter.cur);
+        if (entry->key.hash == key->hash && entry->key.size == key->size &&
+            entry->key.num_obs == key->num_obs &&
+            memcmp(entry->key_data, key->data.data, key->size) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void weights_build_cache_remove(WeightsBuildEntry *entry)
+{
+    dlist_delete(&entry->node);
+    build_cache_total_size -= entry->size;
+    build_cache_entries -= 1;
+    MemoryContextDelete(entry->ctx);
+}
+
+WeightsArena *weights_build_cache_get(const WeightsBuildKey *key, MemoryContext ctx)
+{
+    if (!weights_build_cache_enabled()) return NULL;
+
+    WeightsBuildEntry *entry = weights_build_cache_find(key);
+    if (entry == NULL) {
+        build_cache_misses += 1;
+        return NULL;
+    }
+
+    dlist_move_head(&build_cache, &entry->node);
+    build_cache_hits += 1;
+    lwdebug(1, "weights_build_cache_get: hit, N=%d", (int)key->num_obs);
+
+    // a copy: the entry can be removed by another Window function before the partition ends
+    return weights_arena_copy(entry->arena, ctx);
+}
+
+void weights_build_cache_put(const WeightsBuildKey *key, const WeightsArena *arena)
+{
+    if (!weights_build_cache_enabled()) return;
+
+    Size max_size = weights_build_cache_max_size();
+    Size size = weights_arena_size(arena) + key->size;
+    if (key->too_large || size > max_size || weights_build_cache_find(key) != NULL) return;
+
+    // remove the least recently used weights until there is room
+    while (!dlist_is_empty(&build_cache) && build_cache_total_size + size > max_size) {
+        weights_build_cache_remove(dlist_tail_element(WeightsBuildEntry, node, &build_cache));
+    }
+
+    // the context is moved under TopMemoryContext once the entry is complete: if a copy
+    // fails, it is freed with the current context
+    MemoryContext ctx = AllocSetContextCreate(CurrentMemoryContext, "postgeoda weights build cache",
+                                              ALLOCSET_DEFAULT_SIZES);
+    WeightsBuildEntry *entry = MemoryContextAlloc(ctx, sizeof(WeightsBuildEntry));
+    entry->key = *key;
+    memset(&entry->key.data, 0, sizeof(StringInfoData));
+    entry->key_data = MemoryContextAllocHuge(ctx, key->size);
+    memcpy(entry->key_data, key->data.data, key->size);
+    entry->ctx = ctx;
+    entry->arena = weights_arena_copy(arena, ctx);
+    entry->size = size;
+    MemoryContextSetParent(ctx, TopMemoryContext);
+
+    dlist_push_head(&build_cache, &entry->node);
+    build_cache_total_size += size;
+    build_cache_entries += 1;
+
+    lwdebug(1, "weights_build_cache_put: N=%d, %zu bytes", (int)key->num_obs, (size_t)size);
+}
+
+/**
+ * weights_build_cache_stats
+ *
+ * Used in SQL function weights_build_cache_stats()
+ *
+ * @param fcinfo
+ * @return record (entries, size, hits, misses)
+ */
+Datum weights_build_cache_stats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_build_cache_stats);
+
+Datum weights_build_cache_stats(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("weights_build_cache_stats: return type must be a row type")));
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+
+    values[0] = Int32GetDatum(build_cache_entries);
+    values[1] = Int64GetDatum((int64)build_cache_total_size);
+    values[2] = Int64GetDatum((int64)build_cache_hits);
+    values[3] = Int64GetDatum((int64)build_cache_misses);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/**
+ * weights_build_cache_reset
+ *
+ * Used in SQL function weights_build_cache_reset(): remove all weights from the cache of
+ * the backend
+ *
+ * @param fcinfo
+ * @return void
+ */
+Datum weights_build_cache_reset(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_build_cache_reset);
+
+Datum weights_build_cache_reset(PG_FUNCTION_ARGS)
+{
+    while (!dlist_is_empty(&build_cache)) {
+        weights_build_cache_remove(dlist_head_element(WeightsBuildEntry, node, &build_cache));
+    }
+    build_cache_hits = 0;
+    build_cache_misses = 0;
+
+    PG_RETURN_VOID();
+}
+
+#ifdef __cplusplus
+}
+#endif
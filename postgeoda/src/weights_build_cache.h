@@ -0,0 +1,122 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the weights build cache
+ * 2026-10-17 Document why cpu_threads is not in the key
+ * 2026-10-17 The weights of libgeoda and of ContiguityBuilder or the kd-tree have different keys
+ * 2026-10-17 Compare the content of the key, not only the hash; disabled by default
+ *
+ * The weights built by the weights Window functions (e.g. knn_weights() OVER()) are kept in
+ * a small LRU cache of the backend (TopMemoryContext), so a query that builds the same weights
+ * again, e.g. `SELECT local_moran(x, knn_weights(gid, geom, 4) OVER()) ...` with a different x,
+ * reuses them instead of building the kd-tree and searching the neighbors. The entries are
+ * keyed by the content of the partition: the fids, the WKB of the geometries and the
+ * parameters of the weights. The key is copied into the entry and compared after its hash
+ * matches, so a hash collision can't return other weights. A partition larger than the cache
+ * is not cached.
+ *
+ * The number of threads is not a parameter of the key, only cpu_threads > 1: the contiguity
+ * and KNN weights are built by libgeoda with one thread, and by ContiguityBuilder or the
+ * kd-tree with more. These find the same neighbors as libgeoda, but not always in the same
+ * order, and the same weights for any number of threads > 1.
+ *
+ * The size is capped by the GUC `postgeoda.weights_build_cache_size` (MB, 0 to disable). It is
+ * disabled by default: reading the key detoasts and copies the geometries of the partition
+ * once more, which only pays off if the same weights are built again.
+ */
+
+#ifndef __POST_WEIGHTS_BUILD_CACHE__
+#define __POST_WEIGHTS_BUILD_CACHE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <windowapi.h>
+#include <lib/stringinfo.h>
+
+#include "weights.h"
+
+typedef struct {
+    uint64 hash;
+    uint64 size; /* the total size of the geometries and parameters */
+    int64 num_obs;
+    StringInfoData data; /* the content of the key, in the current memory context */
+    bool too_large; /* larger than the cache: the content is not kept, and the key never matches */
+} WeightsBuildKey;
+
+/**
+ * weights_build_cache_init
+ *
+ * Define the GUC postgeoda.weights_build_cache_size, called by _PG_init()
+ */
+void weights_build_cache_init(void);
+
+bool weights_build_cache_enabled(void);
+
+/**
+ * weights_build_key_init
+ *
+ * @param key
+ * @param method the type of the weights, e.g. "knn"
+ * @param num_obs
+ */
+void weights_build_key_init(WeightsBuildKey *key, const char *method, int64 num_obs);
+
+/**
+ * weights_build_key_add
+ *
+ * Add a parameter of the weights (e.g. k) to the key
+ *
+ * @param key
+ * @param data
+ * @param size
+ */
+void weights_build_key_add(WeightsBuildKey *key, const void *data, size_t size);
+
+/**
+ * weights_build_key_add_row
+ *
+ * Add the fid and the geometry (WKB in bytea) of a row to the key
+ *
+ * @param key
+ * @param fid
+ * @param geom
+ * @param isnull
+ */
+void weights_build_key_add_row(WeightsBuildKey *key, int64 fid, Datum geom, bool isnull);
+
+/**
+ * weights_build_key_read
+ *
+ * Add the fids (argument 0) and geometries (argument 1) of all rows of the partition to
+ * the key
+ *
+ * @param key
+ * @param winobj
+ */
+void weights_build_key_read(WeightsBuildKey *key, WindowObject winobj);
+
+/**
+ * weights_build_cache_get
+ *
+ * @param key
+ * @param ctx the memory context to copy the cached weights into
+ * @return the copy of the cached weights, or NULL
+ */
+WeightsArena *weights_build_cache_get(const WeightsBuildKey *key, MemoryContext ctx);
+
+/**
+ * weights_build_cache_put
+ *
+ * Copy the weights into the cache, the least recently used weights are removed if needed
+ *
+ * @param key
+ * @param arena
+ */
+void weights_build_cache_put(const WeightsBuildKey *key, const WeightsArena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,441 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the shared weights cache, see weights_cache.h
+ * 2026-10-16 Define the GUC of the weights build cache in _PG_init()
+ * 2026-10-16 Define the GUC postgeoda.max_threads in _PG_init()
+ * 2026-10-17 Register the transaction callback of the local moran state in _PG_init()
+ * 2026-10-17 Keep the rows of the key in the entry and compare them in weights_cache_find()
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <access/htup_details.h> /* for heap_form_tuple */
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/dsm.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/builtins.h>
+#include <utils/dsa.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
+#if PG_VERSION_NUM >= 130000
+#include <common/hashfn.h>
+#else
+#include <utils/hashutils.h>
+#define hash_bytes_extended(k, keylen, seed) \
+    DatumGetUInt64(hash_any_extended((k), (keylen), (seed)))
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libgeoda/pg/utils.h>
+#include "weights_cache.h"
+#include "weights_build_cache.h"
+#include "parallel.h"
+#include "lisa.h"
+
+#ifndef DSA_HANDLE_INVALID
+#define DSA_HANDLE_INVALID ((dsa_handle) DSM_HANDLE_INVALID)
+#endif
+
+#define WEIGHTS_CACHE_MAX_ENTRIES 64
+#define WEIGHTS_CACHE_TRANCHE "postgeoda_weights_cache"
+
+typedef struct {
+    WeightsCacheKey key;
+    bool in_use;
+    bool has_weights;
+    uint64_t num_nbrs;
+    Size size;
+    dsa_pointer data; /* offsets, ids, weights (if has_weights), fids, then the rows of the key */
+    Size key_offset; /* the size of each row (uint32) then the rows, at data + key_offset */
+    pg_atomic_uint64 last_used;
+} WeightsCacheEntry;
+
+typedef struct {
+    LWLock *lock;
+    int dsa_tranche;
+    dsa_handle area_handle;
+    Size total_size;
+    pg_atomic_uint64 clock;
+    pg_atomic_uint64 hits;
+    pg_atomic_uint64 misses;
+    WeightsCacheEntry entries[WEIGHTS_CACHE_MAX_ENTRIES];
+} WeightsCacheShared;
+
+/* postgeoda.weights_cache_size (MB) */
+static int weights_cache_size = 256;
+
+static WeightsCacheShared *cache_shared = NULL;
+static dsa_area *cache_area = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+void _PG_init(void);
+
+static void weights_cache_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (prev_shmem_request_hook) prev_shmem_request_hook();
+#endif
+    RequestAddinShmemSpace(MAXALIGN(sizeof(WeightsCacheShared)));
+    RequestNamedLWLockTranche(WEIGHTS_CACHE_TRANCHE, 1);
+}
+
+static void weights_cache_shmem_startup(void)
+{
+    bool found;
+    if (prev_shmem_startup_hook) prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    cache_shared = ShmemInitStruct("postgeoda weights cache", sizeof(WeightsCacheShared), &found);
+    if (!found) {
+        memset(cache_shared, 0, sizeof(WeightsCacheShared));
+        cache_shared->lock = &(GetNamedLWLockTranche(WEIGHTS_CACHE_TRANCHE))->lock;
+        cache_shared->dsa_tranche = LWLockNewTrancheId();
+        cache_shared->area_handle = DSA_HANDLE_INVALID;
+        pg_atomic_init_u64(&cache_shared->clock, 0);
+        pg_atomic_init_u64(&cache_shared->hits, 0);
+        pg_atomic_init_u64(&cache_shared->misses, 0);
+        for (int i = 0; i < WEIGHTS_CACHE_MAX_ENTRIES; ++i) {
+            pg_atomic_init_u64(&cache_shared->entries[i].last_used, 0);
+        }
+    }
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/**
+ * _PG_init
+ *
+ * Define the GUC postgeoda.weights_cache_size and, if postgeoda is in shared_preload_libraries,
+ * reserve the shared memory of the weights cache. Define the GUCs of the weights build cache and
+ * of the threads, and register the transaction callback of the local moran state.
+ */
+void _PG_init(void)
+{
+    weights_build_cache_init();
+    parallel_guc_init();
+    local_moran_state_init();
+
+    DefineCustomIntVariable("postgeoda.weights_cache_size",
+                            "Maximum size (MB) of the weights shared by the backends (0 to disable).",
+                            "Needs postgeoda in shared_preload_libraries.",
+                            &weights_cache_size,
+                            256, 0, INT_MAX / 2,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MB,
+                            NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress) return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = weights_cache_shmem_request;
+#else
+    weights_cache_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = weights_cache_shmem_startup;
+}
+
+bool weights_cache_enabled(void)
+{
+    return cache_shared != NULL && weights_cache_size > 0;
+}
+
+/**
+ * weights_cache_attach
+ *
+ * Attach to (or create) the DSA of the cache, once in a backend
+ */
+static void weights_cache_attach(void)
+{
+    if (cache_area != NULL) return;
+
+    MemoryContext old_ctx = MemoryContextSwitchTo(TopMemoryContext);
+    LWLockRegisterTranche(cache_shared->dsa_tranche, WEIGHTS_CACHE_TRANCHE);
+
+    LWLockAcquire(cache_shared->lock, LW_EXCLUSIVE);
+    if (cache_shared->area_handle == DSA_HANDLE_INVALID) {
+        cache_area = dsa_create(cache_shared->dsa_tranche);
+        dsa_pin(cache_area);
+        cache_shared->area_handle = dsa_get_handle(cache_area);
+    } else {
+        cache_area = dsa_attach(cache_shared->area_handle);
+    }
+    dsa_pin_mapping(cache_area);
+    LWLockRelease(cache_shared->lock);
+
+    MemoryContextSwitchTo(old_ctx);
+}
+
+void weights_cache_key(WeightsCacheKey *key, int N, const uint8_t **bw, const size_t *w_size)
+{
+    uint64_t hash = (uint64_t)N;
+    uint64_t size = 0;
+    for (int i = 0; i < N; ++i) {
+        hash = hash_bytes_extended(bw[i], (int)w_size[i], hash);
+        size += w_size[i];
+    }
+    key->hash = hash;
+    key->size = size;
+    key->num_obs = (uint32_t)N;
+    key->bw = bw;
+    key->w_size = w_size;
+}
+
+/* the size of the CSR arrays; the rows of the key follow them */
+static Size weights_cache_csr_size(uint32_t num_obs, uint64_t num_nbrs, bool has_weights)
+{
+    Size size = sizeof(uint64_t) * ((Size)num_obs + 1) + sizeof(int32_t) * num_nbrs;
+    if (has_weights) size += sizeof(float) * num_nbrs;
+    return size + sizeof(uint32_t) * num_obs;
+}
+
+/* the rows of the entry are the rows of the key; the lock should be held */
+static bool weights_cache_key_equal(const WeightsCacheEntry *entry, const WeightsCacheKey *key)
+{
+    if (entry->key.hash != key->hash || entry->key.size != key->size || entry->key.num_obs != key->num_obs) {
+        return false;
+    }
+
+    const char *data = (const char*)dsa_get_address(cache_area, entry->data) + entry->key_offset;
+    const uint32_t *row_sizes = (const uint32_t*)data;
+    data += sizeof(uint32_t) * key->num_obs;
+    for (uint32_t i = 0; i < key->num_obs; ++i) {
+        if (row_sizes[i] != key->w_size[i] || memcmp(data, key->bw[i], row_sizes[i]) != 0) {
+            return false;
+        }
+        data += row_sizes[i];
+    }
+    return true;
+}
+
+/* the entry of the key, or -1; the lock should be held */
+static int weights_cache_find(const WeightsCacheKey *key)
+{
+    for (int i = 0; i < WEIGHTS_CACHE_MAX_ENTRIES; ++i) {
+        WeightsCacheEntry *entry = &cache_shared->entries[i];
+        if (entry->in_use && weights_cache_key_equal(entry, key)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool weights_cache_get(const WeightsCacheKey *key, WeightsCSRAlloc alloc, void *arg)
+{
+    if (!weights_cache_enabled()) return false;
+    weights_cache_attach();
+
+    LWLockAcquire(cache_shared->lock, LW_SHARED);
+    int i = weights_cache_find(key);
+    if (i < 0) {
+        LWLockRelease(cache_shared->lock);
+        pg_atomic_fetch_add_u64(&cache_shared->misses, 1);
+        return false;
+    }
+
+    WeightsCacheEntry *entry = &cache_shared->entries[i];
+    WeightsCSR csr;
+    csr.num_obs = entry->key.num_obs;
+    csr.num_nbrs = entry->num_nbrs;
+    csr.has_weights = entry->has_weights;
+    alloc(arg, &csr);
+
+    const char *data = (const char*)dsa_get_address(cache_area, entry->data);
+    memcpy(csr.offsets, data, sizeof(uint64_t) * ((size_t)csr.num_obs + 1));
+    data += sizeof(uint64_t) * ((size_t)csr.num_obs + 1);
+    memcpy(csr.ids, data, sizeof(int32_t) * csr.num_nbrs);
+    data += sizeof(int32_t) * csr.num_nbrs;
+    if (csr.has_weights) {
+        memcpy(csr.weights, data, sizeof(float) * csr.num_nbrs);
+        data += sizeof(float) * csr.num_nbrs;
+    }
+    memcpy(csr.fids, data, sizeof(uint32_t) * csr.num_obs);
+
+    pg_atomic_write_u64(&entry->last_used, pg_atomic_add_fetch_u64(&cache_shared->clock, 1));
+    LWLockRelease(cache_shared->lock);
+
+    pg_atomic_fetch_add_u64(&cache_shared->hits, 1);
+    lwdebug(1, "weights_cache_get: hit, N=%d", (int)csr.num_obs);
+    return true;
+}
+
+void weights_cache_put(const WeightsCacheKey *key, const WeightsCSR *csr)
+{
+    if (!weights_cache_enabled()) return;
+
+    Size max_size = (Size)weights_cache_size * 1024 * 1024;
+    Size key_offset = weights_cache_csr_size(csr->num_obs, csr->num_nbrs, csr->has_weights);
+    Size size = key_offset + sizeof(uint32_t) * (Size)key->num_obs + key->size;
+    if (size > max_size) return;
+
+    weights_cache_attach();
+
+    // copy the weights before taking the lock
+    dsa_pointer dp = dsa_allocate_extended(cache_area, size, DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM);
+    if (!DsaPointerIsValid(dp)) return;
+
+    char *data = (char*)dsa_get_address(cache_area, dp);
+    memcpy(data, csr->offsets, sizeof(uint64_t) * ((size_t)csr->num_obs + 1));
+    data += sizeof(uint64_t) * ((size_t)csr->num_obs + 1);
+    memcpy(data, csr->ids, sizeof(int32_t) * csr->num_nbrs);
+    data += sizeof(int32_t) * csr->num_nbrs;
+    if (csr->has_weights) {
+        memcpy(data, csr->weights, sizeof(float) * csr->num_nbrs);
+        data += sizeof(float) * csr->num_nbrs;
+    }
+    memcpy(data, csr->fids, sizeof(uint32_t) * csr->num_obs);
+    data += sizeof(uint32_t) * csr->num_obs;
+
+    // the rows of the key, to compare them in weights_cache_find()
+    uint32_t *row_sizes = (uint32_t*)data;
+    data += sizeof(uint32_t) * key->num_obs;
+    for (uint32_t i = 0; i < key->num_obs; ++i) {
+        row_sizes[i] = (uint32_t)key->w_size[i];
+        memcpy(data, key->bw[i], key->w_size[i]);
+        data += key->w_size[i];
+    }
+
+    LWLockAcquire(cache_shared->lock, LW_EXCLUSIVE);
+    if (weights_cache_find(key) >= 0) {
+        // added by another backend
+        LWLockRelease(cache_shared->lock);
+        dsa_free(cache_area, dp);
+        return;
+    }
+
+    // evict the least recently used entries until there is room
+    int slot = -1;
+    for (;;) {
+        int lru = -1;
+        slot = -1;
+        for (int i = 0; i < WEIGHTS_CACHE_MAX_ENTRIES; ++i) {
+            WeightsCacheEntry *entry = &cache_shared->entries[i];
+            if (!entry->in_use) {
+                if (slot < 0) slot = i;
+            } else if (lru < 0 || pg_atomic_read_u64(&entry->last_used) <
+                                  pg_atomic_read_u64(&cache_shared->entries[lru].last_used)) {
+                lru = i;
+            }
+        }
+        if (slot >= 0 && cache_shared->total_size + size <= max_size) break;
+        if (lru < 0) break;
+
+        WeightsCacheEntry *entry = &cache_shared->entries[lru];
+        dsa_free(cache_area, entry->data);
+        cache_shared->total_size -= entry->size;
+        entry->in_use = false;
+    }
+
+    if (slot < 0 || cache_shared->total_size + size > max_size) {
+        LWLockRelease(cache_shared->lock);
+        dsa_free(cache_area, dp);
+        return;
+    }
+
+    WeightsCacheEntry *entry = &cache_shared->entries[slot];
+    entry->key = *key;
+    entry->key.bw = NULL; // the rows of the key are in the entry
+    entry->key.w_size = NULL;
+    entry->key_offset = key_offset;
+    entry->has_weights = csr->has_weights;
+    entry->num_nbrs = csr->num_nbrs;
+    entry->size = size;
+    entry->data = dp;
+    entry->in_use = true;
+    pg_atomic_write_u64(&entry->last_used, pg_atomic_add_fetch_u64(&cache_shared->clock, 1));
+    cache_shared->total_size += size;
+    LWLockRelease(cache_shared->lock);
+
+    lwdebug(1, "weights_cache_put: N=%d, %zu bytes", (int)csr->num_obs, (size_t)size);
+}
+
+/**
+ * weights_cache_stats
+ *
+ * Used in SQL function weights_cache_stats()
+ *
+ * @param fcinfo
+ * @return record (entries, size, hits, misses)
+ */
+Datum weights_cache_stats(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_cache_stats);
+
+Datum weights_cache_stats(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("weights_cache_stats: return type must be a row type")));
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+    int32 n_entries = 0;
+    int64 size = 0, hits = 0, misses = 0;
+
+    if (cache_shared != NULL) {
+        LWLockAcquire(cache_shared->lock, LW_SHARED);
+        for (int i = 0; i < WEIGHTS_CACHE_MAX_ENTRIES; ++i) {
+            if (cache_shared->entries[i].in_use) n_entries += 1;
+        }
+        size = (int64)cache_shared->total_size;
+        LWLockRelease(cache_shared->lock);
+        hits = (int64)pg_atomic_read_u64(&cache_shared->hits);
+        misses = (int64)pg_atomic_read_u64(&cache_shared->misses);
+    }
+
+    values[0] = Int32GetDatum(n_entries);
+    values[1] = Int64GetDatum(size);
+    values[2] = Int64GetDatum(hits);
+    values[3] = Int64GetDatum(misses);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/**
+ * weights_cache_reset
+ *
+ * Used in SQL function weights_cache_reset(): remove all weights from the shared cache
+ *
+ * @param fcinfo
+ * @return void
+ */
+Datum weights_cache_reset(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_cache_reset);
+
+Datum weights_cache_reset(PG_FUNCTION_ARGS)
+{
+    if (cache_shared == NULL) PG_RETURN_VOID();
+    weights_cache_attach();
+
+    LWLockAcquire(cache_shared->lock, LW_EXCLUSIVE);
+    for (int i = 0; i < WEIGHTS_CACHE_MAX_ENTRIES; ++i) {
+        WeightsCacheEntry *entry = &cache_shared->entries[i];
+        if (entry->in_use) {
+            dsa_free(cache_area, entry->data);
+            entry->in_use = false;
+        }
+    }
+    cache_shared->total_size = 0;
+    LWLockRelease(cache_shared->lock);
+    pg_atomic_write_u64(&cache_shared->hits, 0);
+    pg_atomic_write_u64(&cache_shared->misses, 0);
+
+    PG_RETURN_VOID();
+}
+
+#ifdef __cplusplus
+}
+#endif
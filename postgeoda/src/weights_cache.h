@@ -0,0 +1,69 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the shared weights cache
+ * 2026-10-17 Compare the content of the weights, not only the hash, to find an entry
+ *
+ * The weights of a query Window, decoded in CSR arrays (WeightsCSR), are cached in dynamic
+ * shared memory (DSA) and shared by all backends, so the repeated LISA queries on the same
+ * weights column skip decoding the weights. The entries are keyed by the content of all
+ * weights (bytea) in the Window: a Window function only sees the values, not the table or
+ * column they come from, and any UPDATE of the weights changes the key, so a stale entry is
+ * never used and is evicted (least recently used first). An entry keeps a copy of the bytea
+ * of the rows, which is compared with the rows of the Window after the hash matches, so a
+ * hash collision can't return the weights of other rows.
+ *
+ * The cache needs `shared_preload_libraries = 'postgeoda'`; its size is capped by the GUC
+ * `postgeoda.weights_cache_size` (MB, 0 to disable).
+ */
+
+#ifndef __POST_WEIGHTS_CACHE__
+#define __POST_WEIGHTS_CACHE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "weights_codec.h"
+
+typedef struct {
+    uint64_t hash;
+    uint64_t size; /* the total size of the weights */
+    uint32_t num_obs;
+    /* the rows of the weights, which must exist as long as the key is used */
+    const uint8_t **bw;
+    const size_t *w_size;
+} WeightsCacheKey;
+
+/**
+ * WeightsCSRAlloc
+ *
+ * Allocate the arrays of csr (num_obs, num_nbrs and has_weights are set) to copy an entry
+ * of the cache into
+ */
+typedef void (*WeightsCSRAlloc)(void *arg, WeightsCSR *csr);
+
+bool weights_cache_enabled(void);
+
+void weights_cache_key(WeightsCacheKey *key, int N, const uint8_t **bw, const size_t *w_size);
+
+/**
+ * weights_cache_get
+ *
+ * @param key
+ * @param alloc allocate the arrays to copy the cached weights into
+ * @param arg
+ * @return false if the weights are not in the cache
+ */
+bool weights_cache_get(const WeightsCacheKey *key, WeightsCSRAlloc alloc, void *arg);
+
+void weights_cache_put(const WeightsCacheKey *key, const WeightsCSR *csr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,894 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the compact (v2) binary format of spatial weights
+ * 2026-10-16 Add WeightsIdIter and weights_codec_weight_at() to read a row without buffers
+ * 2026-10-16 Add weights_codec_validate() and weights_codec_read_header()
+ * 2026-10-16 Add WeightsCSR
+ * 2026-10-16 Add the wide v1 complete weights ('A'/'W') with uint32 numbers of neighbors
+ * 2026-10-16 Add the reference to the weights of an observation in a weights store
+ *
+ * Read and write the binary formats of spatial weights. There are no dependencies on PG
+ * or libgeoda here, so the same code is used by the SQL functions (C) and BinWeight (C++).
+ *
+ * v1: the weights of one observation (a "row")
+ *
+ * uint32 (4 bytes): index of the observation
+ * uint16 (2 bytes): number of neighbors (nn)
+ * uint32 (4 bytes x nn): neighbor id
+ * float (4 bytes x nn): weights value of each neighbor, only in GWT weights
+ *
+ * v2: the weights of one observation
+ *
+ * uint8 (1 byte): header, version (high 4 bits: 2) and flags (low 4 bits)
+ * varint: index of the observation
+ * varint: number of neighbors (nn)
+ * varint x nn: neighbor ids, sorted. The first one is stored as zigzag(id - index),
+ *              the others as the difference to the previous id
+ * weights of the neighbors, only if WEIGHTS_V2_HAS_WEIGHTS:
+ *     WEIGHTS_ENC_F32: float (4 bytes x nn)
+ *     WEIGHTS_ENC_F16: half float (2 bytes x nn)
+ *     WEIGHTS_ENC_Q8: float min, float max, uint8 (1 byte x nn): min + q * (max - min) / 255
+ * uint8 (0 or 1 byte): padding, so the size is always odd
+ *
+ * The complete weights (all observations) are:
+ *
+ * v1: char (1 byte) weights type 'a'->GAL 'w'->GWT, uint32 (4 bytes) N, then N rows
+ *     or 'A'->GAL 'W'->GWT (wide): the same, but the number of neighbors of each row is
+ *     uint32 (4 bytes) instead of uint16, for the observations with more than 65535 neighbors
+ * v2: uint8 (1 byte) header with WEIGHTS_V2_COMPLETE, varint N, then N rows without
+ *     header and padding, and a padding byte if needed, so the size is always odd
+ *
+ * A v1 row is always an even number of bytes and a v1 complete weights is always an odd
+ * number of bytes, so any weights bytea is recognized by its size and the first byte.
+ * A v1 row has no header to carry a flag, so a single row with more than 65535 neighbors
+ * is written in v2 (the number of neighbors is a varint there).
+ *
+ * The weights of an observation can also be a reference to a weights store (weights_store.h),
+ * returned by weights_store_ref() and resolved by the LISA functions:
+ *
+ * uint8 (1 byte): header WEIGHTS_STORE_REF
+ * varint: fid of the observation
+ * char (1 byte x n): the name of the weights store, without NUL
+ * uint8 (0 or 1 byte): padding, so the size is always odd
+ *
+ * Neighbor ids are spatially close in most tables, so the delta varints take 1-2 bytes
+ * instead of 4: e.g. the queen weights of a 3163 x 3163 grid (10 million observations,
+ * nn=8) take 17 bytes per observation instead of 38, and 33 bytes instead of 70 with
+ * half float weights.
+ */
+
+#ifndef __POST_WEIGHTS_CODEC__
+#define __POST_WEIGHTS_CODEC__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WEIGHTS_V2 0x20
+#define WEIGHTS_V2_HAS_WEIGHTS 0x01
+#define WEIGHTS_V2_ENC_MASK 0x06
+#define WEIGHTS_V2_COMPLETE 0x08
+
+// the header of a reference to a weights store
+#define WEIGHTS_STORE_REF 0x30
+#define WEIGHTS_STORE_NAME_MAX 63
+#define WEIGHTS_STORE_REF_MAX_SIZE (1 + 5 + WEIGHTS_STORE_NAME_MAX + 1)
+
+// the weights types of the wide v1 complete weights: uint32 numbers of neighbors
+#define WEIGHTS_V1_WIDE_GAL 'A'
+#define WEIGHTS_V1_WIDE_GWT 'W'
+
+// encodings of the weights values in v2
+#define WEIGHTS_ENC_F32 0
+#define WEIGHTS_ENC_F16 1
+#define WEIGHTS_ENC_Q8 2
+
+#define WEIGHTS_VARINT_MAX_SIZE 10
+
+/**
+ * WeightsRow
+ *
+ * The weights of one observation in v1 or v2. Only the index and the number of neighbors
+ * are decoded, use weights_codec_get_ids() and weights_codec_get_weights() for the rest.
+ */
+typedef struct {
+    uint8_t version; /* 1 or 2 */
+    uint8_t w_enc; /* WEIGHTS_ENC_*, only in v2 */
+    bool has_weights;
+    bool wide_count; /* v1: the number of neighbors is uint32, see WEIGHTS_V1_WIDE_GAL */
+    uint32_t idx;
+    uint32_t num_nbrs;
+    const uint8_t *start; /* the start of the row, after the header byte in v2 */
+    const uint8_t *ids; /* the encoded neighbor ids */
+    const uint8_t *weights; /* the encoded weights, or NULL */
+    const uint8_t *end; /* the end of the row, without padding */
+} WeightsRow;
+
+/**
+ * WeightsReader
+ *
+ * Read the rows of the complete weights one by one
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t header; /* the weights type ('a', 'w', 'A' or 'W') in v1 or the header byte in v2 */
+    bool has_weights;
+    bool wide_count; /* v1: 'A' or 'W' */
+    uint32_t num_obs;
+    const uint8_t *pos;
+    const uint8_t *end;
+} WeightsReader;
+
+static inline uint64_t weights_codec_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t weights_codec_unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t *weights_codec_write_varint(uint8_t *buf, uint64_t v) {
+    while (v >= 0x80) {
+        *buf++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *buf++ = (uint8_t)v;
+    return buf;
+}
+
+static inline bool weights_codec_read_varint(const uint8_t **pos, const uint8_t *end, uint64_t *v) {
+    const uint8_t *p = *pos;
+    uint64_t val = 0;
+    for (int shift = 0; shift < 7 * WEIGHTS_VARINT_MAX_SIZE; shift += 7) {
+        if (p >= end) return false;
+        uint8_t b = *p++;
+        val |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *pos = p;
+            *v = val;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * weights_codec_f16_from_f32
+ *
+ * Convert float to IEEE half float (rounded to nearest even)
+ */
+static inline uint16_t weights_codec_f16_from_f32(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+    uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    uint32_t f_exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+
+    if (f_exp == 0xff) {
+        // inf or nan
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    }
+    int32_t exp = (int32_t)f_exp - 127 + 15;
+    if (exp >= 31) {
+        // overflow to inf
+        return sign | 0x7c00;
+    }
+    if (exp <= 0) {
+        // subnormal or zero
+        if (exp < -10) return sign;
+        mant |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exp);
+        uint32_t half = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rest > mid || (rest == mid && (half & 1))) half += 1;
+        return sign | (uint16_t)half;
+    }
+    uint32_t half = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1fff;
+    // a carry into the exponent is still correct (up to inf)
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half += 1;
+    return sign | (uint16_t)half;
+}
+
+static inline float weights_codec_f32_from_f16(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            // subnormal: normalize it
+            uint32_t f_exp = 127 - 15 + 1;
+            while ((mant & 0x400) == 0) {
+                mant <<= 1;
+                f_exp -= 1;
+            }
+            x = sign | (f_exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+}
+
+/**
+ * weights_codec_weights_size
+ *
+ * The size of the encoded weights values of nn neighbors in v2
+ */
+static inline size_t weights_codec_weights_size(uint8_t w_enc, uint32_t nn) {
+    if (w_enc == WEIGHTS_ENC_F16) return sizeof(uint16_t) * (size_t)nn;
+    if (w_enc == WEIGHTS_ENC_Q8) return nn > 0 ? sizeof(float) * 2 + nn : 0;
+    return sizeof(float) * (size_t)nn;
+}
+
+/**
+ * weights_codec_parse_row_v1
+ *
+ * Parse a v1 row in [pos, end); the row ends at row->end. The number of neighbors is
+ * uint32 if wide_count (in 'A' or 'W' complete weights), otherwise uint16.
+ */
+static inline bool weights_codec_parse_row_v1(const uint8_t *pos, const uint8_t *end, bool has_weights,
+                                              bool wide_count, WeightsRow *row) {
+    size_t count_size = wide_count ? sizeof(uint32_t) : sizeof(uint16_t);
+    if ((size_t)(end - pos) < sizeof(uint32_t) + count_size) return false;
+    row->version = 1;
+    row->w_enc = WEIGHTS_ENC_F32;
+    row->has_weights = has_weights;
+    row->wide_count = wide_count;
+    row->start = pos;
+    memcpy(&row->idx, pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+    if (wide_count) {
+        memcpy(&row->num_nbrs, pos, sizeof(uint32_t));
+    } else {
+        uint16_t nn;
+        memcpy(&nn, pos, sizeof(uint16_t));
+        row->num_nbrs = nn;
+    }
+    pos += count_size;
+
+    size_t size = sizeof(uint32_t) * (size_t)row->num_nbrs;
+    if (has_weights) size += sizeof(float) * (size_t)row->num_nbrs;
+    if ((size_t)(end - pos) < size) return false;
+
+    row->ids = pos;
+    row->weights = has_weights ? pos + sizeof(uint32_t) * (size_t)row->num_nbrs : NULL;
+    row->end = pos + size;
+    return true;
+}
+
+/**
+ * weights_codec_parse_row_v2
+ *
+ * Parse the body (without header and padding) of a v2 row in [pos, end); the flags are
+ * from the header byte of the row or the complete weights.
+ */
+static inline bool weights_codec_parse_row_v2(const uint8_t *pos, const uint8_t *end, uint8_t flags,
+                                              WeightsRow *row) {
+    row->version = 2;
+    row->wide_count = false;
+    row->has_weights = (flags & WEIGHTS_V2_HAS_WEIGHTS) != 0;
+    row->w_enc = (flags & WEIGHTS_V2_ENC_MASK) >> 1;
+    if (row->w_enc > WEIGHTS_ENC_Q8) return false;
+    row->start = pos;
+
+    uint64_t idx, nn;
+    if (!weights_codec_read_varint(&pos, end, &idx) || idx > UINT32_MAX) return false;
+    if (!weights_codec_read_varint(&pos, end, &nn) || nn > UINT32_MAX) return false;
+    row->idx = (uint32_t)idx;
+    row->num_nbrs = (uint32_t)nn;
+
+    // skip the neighbor ids
+    row->ids = pos;
+    for (uint32_t j = 0; j < row->num_nbrs; ++j) {
+        uint64_t v;
+        if (!weights_codec_read_varint(&pos, end, &v)) return false;
+    }
+
+    row->weights = NULL;
+    if (row->has_weights) {
+        size_t size = weights_codec_weights_size(row->w_enc, row->num_nbrs);
+        if ((size_t)(end - pos) < size) return false;
+        row->weights = pos;
+        pos += size;
+    }
+    row->end = pos;
+    return true;
+}
+
+/**
+ * weights_codec_read_row
+ *
+ * Parse the weights of one observation (e.g. returned by the weights Window functions)
+ * in v1 or v2.
+ *
+ * @param buf
+ * @param size
+ * @param row
+ * @return false if the weights are not valid
+ */
+static inline bool weights_codec_read_row(const uint8_t *buf, size_t size, WeightsRow *row) {
+    const uint8_t *end = buf + size;
+    if (size % 2 == 0) {
+        // v1: GAL or GWT is known by the size
+        if (size < sizeof(uint32_t) + sizeof(uint16_t)) return false;
+        uint16_t nn;
+        memcpy(&nn, buf + sizeof(uint32_t), sizeof(uint16_t));
+        size_t gal_size = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t) * (size_t)nn;
+        bool has_weights = size == gal_size + sizeof(float) * (size_t)nn && nn > 0;
+        if (!has_weights && size != gal_size) return false;
+        return weights_codec_parse_row_v1(buf, end, has_weights, false, row) && row->end == end;
+    }
+
+    if ((buf[0] & 0xf0) != WEIGHTS_V2 || (buf[0] & WEIGHTS_V2_COMPLETE)) return false;
+    if (!weights_codec_parse_row_v2(buf + 1, end, buf[0], row)) return false;
+    // the only byte allowed after the row is the padding
+    return end - row->end <= 1;
+}
+
+/**
+ * weights_codec_open
+ *
+ * Start reading the complete weights in v1 or v2
+ *
+ * @param buf
+ * @param size
+ * @param reader
+ * @return false if it is not a complete weights
+ */
+static inline bool weights_codec_open(const uint8_t *buf, size_t size, WeightsReader *reader) {
+    // the complete weights are always an odd number of bytes, a v1 row is not
+    if (size < 2 || size % 2 == 0) return false;
+    const uint8_t *pos = buf;
+    reader->end = buf + size;
+    reader->header = *pos++;
+
+    if (reader->header == 'a' || reader->header == 'w' ||
+        reader->header == WEIGHTS_V1_WIDE_GAL || reader->header == WEIGHTS_V1_WIDE_GWT) {
+        if (size < sizeof(char) + sizeof(uint32_t)) return false;
+        reader->version = 1;
+        reader->has_weights = reader->header == 'w' || reader->header == WEIGHTS_V1_WIDE_GWT;
+        reader->wide_count = reader->header == WEIGHTS_V1_WIDE_GAL || reader->header == WEIGHTS_V1_WIDE_GWT;
+        memcpy(&reader->num_obs, pos, sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+    } else if ((reader->header & 0xf0) == WEIGHTS_V2 && (reader->header & WEIGHTS_V2_COMPLETE)) {
+        reader->version = 2;
+        reader->has_weights = (reader->header & WEIGHTS_V2_HAS_WEIGHTS) != 0;
+        reader->wide_count = false;
+        uint64_t num_obs;
+        if (!weights_codec_read_varint(&pos, reader->end, &num_obs) || num_obs > UINT32_MAX) return false;
+        reader->num_obs = (uint32_t)num_obs;
+    } else {
+        return false;
+    }
+    reader->pos = pos;
+    return true;
+}
+
+/**
+ * weights_codec_next
+ *
+ * Parse the next row of the complete weights
+ *
+ * @param reader
+ * @param row
+ * @return false if the row is not valid
+ */
+static inline bool weights_codec_next(WeightsReader *reader, WeightsRow *row) {
+    bool ok;
+    if (reader->version == 1) {
+        ok = weights_codec_parse_row_v1(reader->pos, reader->end, reader->has_weights, reader->wide_count, row);
+    } else {
+        ok = weights_codec_parse_row_v2(reader->pos, reader->end, reader->header, row);
+    }
+    if (ok) reader->pos = row->end;
+    return ok;
+}
+
+/**
+ * weights_codec_get_ids
+ *
+ * Decode the neighbor ids of the row into ids (row->num_nbrs elements)
+ */
+static inline bool weights_codec_get_ids(const WeightsRow *row, uint32_t *ids) {
+    if (row->version == 1) {
+        memcpy(ids, row->ids, sizeof(uint32_t) * (size_t)row->num_nbrs);
+        return true;
+    }
+    const uint8_t *pos = row->ids;
+    int64_t prev = row->idx;
+    for (uint32_t j = 0; j < row->num_nbrs; ++j) {
+        uint64_t v;
+        if (!weights_codec_read_varint(&pos, row->end, &v) || v > UINT32_MAX * 2ull + 1) return false;
+        int64_t id = j == 0 ? prev + weights_codec_unzigzag(v) : prev + (int64_t)v;
+        if (id < 0 || id > UINT32_MAX) return false;
+        ids[j] = (uint32_t)id;
+        prev = id;
+    }
+    return true;
+}
+
+/**
+ * weights_codec_get_weights
+ *
+ * Decode the weights values of the row into weights (row->num_nbrs elements)
+ *
+ * @return false if the row has no weights values
+ */
+static inline bool weights_codec_get_weights(const WeightsRow *row, float *weights) {
+    if (!row->has_weights) return false;
+    const uint8_t *pos = row->weights;
+    uint32_t nn = row->num_nbrs;
+
+    if (row->w_enc == WEIGHTS_ENC_F16) {
+        for (uint32_t j = 0; j < nn; ++j) {
+            uint16_t h;
+            memcpy(&h, pos, sizeof(uint16_t));
+            pos += sizeof(uint16_t);
+            weights[j] = weights_codec_f32_from_f16(h);
+        }
+    } else if (row->w_enc == WEIGHTS_ENC_Q8) {
+        if (nn == 0) return true;
+        float w_min, w_max;
+        memcpy(&w_min, pos, sizeof(float));
+        memcpy(&w_max, pos + sizeof(float), sizeof(float));
+        pos += sizeof(float) * 2;
+        float step = (w_max - w_min) / 255.0f;
+        for (uint32_t j = 0; j < nn; ++j) {
+            weights[j] = pos[j] == 255 ? w_max : w_min + pos[j] * step;
+        }
+    } else {
+        memcpy(weights, pos, sizeof(float) * (size_t)nn);
+    }
+    return true;
+}
+
+/**
+ * WeightsIdIter
+ *
+ * Decode the neighbor ids of a row one by one, without a buffer for all of them
+ */
+typedef struct {
+    const WeightsRow *row;
+    const uint8_t *pos;
+    int64_t prev;
+    uint32_t j;
+} WeightsIdIter;
+
+static inline void weights_codec_ids_begin(const WeightsRow *row, WeightsIdIter *it) {
+    it->row = row;
+    it->pos = row->ids;
+    it->prev = row->idx;
+    it->j = 0;
+}
+
+/**
+ * weights_codec_ids_next
+ *
+ * @return false at the end of the neighbors or if the row is not valid
+ */
+static inline bool weights_codec_ids_next(WeightsIdIter *it, uint32_t *id) {
+    if (it->j >= it->row->num_nbrs) return false;
+    if (it->row->version == 1) {
+        memcpy(id, it->pos, sizeof(uint32_t));
+        it->pos += sizeof(uint32_t);
+        it->j += 1;
+        return true;
+    }
+    uint64_t v;
+    if (!weights_codec_read_varint(&it->pos, it->row->end, &v) || v > UINT32_MAX * 2ull + 1) return false;
+    int64_t nbr_id = it->j == 0 ? it->prev + weights_codec_unzigzag(v) : it->prev + (int64_t)v;
+    if (nbr_id < 0 || nbr_id > UINT32_MAX) return false;
+    *id = (uint32_t)nbr_id;
+    it->prev = nbr_id;
+    it->j += 1;
+    return true;
+}
+
+/**
+ * weights_codec_weight_at
+ *
+ * Decode the weights value of j-th neighbor of the row (1.0 if the row has no weights values)
+ */
+static inline float weights_codec_weight_at(const WeightsRow *row, uint32_t j) {
+    if (!row->has_weights) return 1.0f;
+    float w;
+    if (row->w_enc == WEIGHTS_ENC_F16) {
+        uint16_t h;
+        memcpy(&h, row->weights + sizeof(uint16_t) * (size_t)j, sizeof(uint16_t));
+        return weights_codec_f32_from_f16(h);
+    }
+    if (row->w_enc == WEIGHTS_ENC_Q8) {
+        float w_max;
+        uint8_t q = row->weights[sizeof(float) * 2 + j];
+        memcpy(&w, row->weights, sizeof(float));
+        memcpy(&w_max, row->weights + sizeof(float), sizeof(float));
+        return q == 255 ? w_max : w + q * ((w_max - w) / 255.0f);
+    }
+    memcpy(&w, row->weights + sizeof(float) * (size_t)j, sizeof(float));
+    return w;
+}
+
+/**
+ * weights_codec_validate_row
+ *
+ * @return true if all neighbor ids of the row can be decoded
+ */
+static inline bool weights_codec_validate_row(const WeightsRow *row) {
+    WeightsIdIter it;
+    uint32_t nbr_id;
+    weights_codec_ids_begin(row, &it);
+    while (weights_codec_ids_next(&it, &nbr_id)) {}
+    return it.j == row->num_nbrs;
+}
+
+/**
+ * weights_codec_validate
+ *
+ * Check the weights of one observation or the complete weights, in v1 or v2: all rows
+ * and neighbor ids can be decoded and there are no bytes left (except the padding).
+ *
+ * @param buf
+ * @param size
+ * @return false if the weights are not valid
+ */
+static inline bool weights_codec_validate(const uint8_t *buf, size_t size) {
+    WeightsRow row;
+    WeightsReader reader;
+    if (weights_codec_open(buf, size, &reader)) {
+        for (uint32_t i = 0; i < reader.num_obs; ++i) {
+            if (!weights_codec_next(&reader, &row) || !weights_codec_validate_row(&row)) return false;
+        }
+        return reader.end - reader.pos <= (reader.version == 2 ? 1 : 0);
+    }
+    return weights_codec_read_row(buf, size, &row) && weights_codec_validate_row(&row);
+}
+
+/**
+ * WeightsCSR
+ *
+ * The weights of a query Window in compressed sparse row arrays, as in BinWeight: the
+ * neighbors (positions in the Window) of i-th observation are ids[offsets[i], offsets[i+1]),
+ * fids[i] is the position of the fid of i-th row. Used to copy the weights to and from
+ * the shared weights cache (weights_cache.h).
+ */
+typedef struct {
+    uint32_t num_obs;
+    uint64_t num_nbrs; /* the total number of neighbors */
+    bool has_weights;
+    uint64_t *offsets; /* num_obs + 1 */
+    int32_t *ids; /* num_nbrs */
+    float *weights; /* num_nbrs, or NULL */
+    uint32_t *fids; /* num_obs */
+} WeightsCSR;
+
+/**
+ * WeightsHeader
+ *
+ * What can be known from the first bytes of the weights, without reading the rows
+ */
+typedef struct {
+    uint8_t version;
+    bool is_complete;
+    bool has_weights;
+    uint32_t num_obs; /* 1 if not complete */
+    uint32_t idx; /* only if not complete */
+    uint32_t num_nbrs; /* only if not complete */
+} WeightsHeader;
+
+/* the prefix needed by weights_codec_read_header() */
+#define WEIGHTS_HEADER_MAX_SIZE (1 + 2 * WEIGHTS_VARINT_MAX_SIZE)
+
+/**
+ * weights_codec_read_header
+ *
+ * Read the header of the weights from its first bytes (e.g. a slice of a TOASTed value)
+ *
+ * @param prefix the first bytes of the weights
+ * @param prefix_size min(size, WEIGHTS_HEADER_MAX_SIZE) is enough
+ * @param size the size of the whole weights
+ * @param header
+ * @return false if it is not a valid header
+ */
+static inline bool weights_codec_read_header(const uint8_t *prefix, size_t prefix_size, size_t size,
+                                             WeightsHeader *header) {
+    if (prefix_size > size) prefix_size = size;
+    const uint8_t *end = prefix + prefix_size;
+    memset(header, 0, sizeof(WeightsHeader));
+    header->num_obs = 1;
+
+    if (size % 2 == 0) {
+        // v1 row
+        uint16_t nn;
+        if (prefix_size < sizeof(uint32_t) + sizeof(uint16_t)) return false;
+        memcpy(&header->idx, prefix, sizeof(uint32_t));
+        memcpy(&nn, prefix + sizeof(uint32_t), sizeof(uint16_t));
+        size_t gal_size = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t) * (size_t)nn;
+        header->version = 1;
+        header->num_nbrs = nn;
+        header->has_weights = nn > 0 && size == gal_size + sizeof(float) * (size_t)nn;
+        return header->has_weights || size == gal_size;
+    }
+
+    if (prefix_size < 1) return false;
+    if (prefix[0] == 'a' || prefix[0] == 'w' ||
+        prefix[0] == WEIGHTS_V1_WIDE_GAL || prefix[0] == WEIGHTS_V1_WIDE_GWT) {
+        if (prefix_size < sizeof(char) + sizeof(uint32_t)) return false;
+        header->version = 1;
+        header->is_complete = true;
+        header->has_weights = prefix[0] == 'w' || prefix[0] == WEIGHTS_V1_WIDE_GWT;
+        memcpy(&header->num_obs, prefix + 1, sizeof(uint32_t));
+        return true;
+    }
+    if ((prefix[0] & 0xf0) != WEIGHTS_V2) return false;
+
+    const uint8_t *pos = prefix + 1;
+    uint64_t v;
+    header->version = 2;
+    header->has_weights = (prefix[0] & WEIGHTS_V2_HAS_WEIGHTS) != 0;
+    header->is_complete = (prefix[0] & WEIGHTS_V2_COMPLETE) != 0;
+    if (!weights_codec_read_varint(&pos, end, &v) || v > UINT32_MAX) return false;
+    if (header->is_complete) {
+        header->num_obs = (uint32_t)v;
+        return true;
+    }
+    header->idx = (uint32_t)v;
+    if (!weights_codec_read_varint(&pos, end, &v) || v > UINT32_MAX) return false;
+    header->num_nbrs = (uint32_t)v;
+    return true;
+}
+
+/**
+ * weights_codec_sort_neighbors
+ *
+ * Sort the neighbor ids (and the weights values, if not NULL) by id in place (heap sort),
+ * as required by weights_codec_write_row()
+ */
+static inline void weights_codec_sort_neighbors(uint32_t *ids, float *weights, uint32_t nn) {
+    if (nn < 2) return;
+    size_t n = nn;
+    size_t start = n / 2;
+    size_t end = n;
+    while (end > 1) {
+        if (start > 0) {
+            start -= 1;
+        } else {
+            end -= 1;
+            uint32_t tmp_id = ids[0]; ids[0] = ids[end]; ids[end] = tmp_id;
+            if (weights) {
+                float tmp_w = weights[0]; weights[0] = weights[end]; weights[end] = tmp_w;
+            }
+        }
+        // sift down
+        size_t root = start;
+        while (2 * root + 1 < end) {
+            size_t child = 2 * root + 1;
+            if (child + 1 < end && ids[child] < ids[child + 1]) child += 1;
+            if (ids[root] >= ids[child]) break;
+            uint32_t tmp_id = ids[root]; ids[root] = ids[child]; ids[child] = tmp_id;
+            if (weights) {
+                float tmp_w = weights[root]; weights[root] = weights[child]; weights[child] = tmp_w;
+            }
+            root = child;
+        }
+    }
+}
+
+/**
+ * weights_codec_row_max_size
+ *
+ * The maximum size of a v2 row (with header and padding) of nn neighbors
+ */
+static inline size_t weights_codec_row_max_size(uint32_t nn, bool has_weights, uint8_t w_enc) {
+    // idx and nn take at most 5 bytes, the first (signed) neighbor id 10 bytes and the others 5 bytes
+    size_t size = 1 + 5 * 2 + 10 + 5 * (size_t)nn + 1;
+    if (has_weights) size += weights_codec_weights_size(w_enc, nn);
+    return size;
+}
+
+/**
+ * weights_codec_write_row_body
+ *
+ * Write a v2 row without header and padding
+ *
+ * @param buf at least weights_codec_row_max_size() bytes
+ * @param idx
+ * @param nn
+ * @param ids neighbor ids sorted by weights_codec_sort_neighbors()
+ * @param weights weights values, or NULL
+ * @param w_enc
+ * @return the end of the row in buf
+ */
+static inline uint8_t *weights_codec_write_row_body(uint8_t *buf, uint32_t idx, uint32_t nn, const uint32_t *ids,
+                                                    const float *weights, uint8_t w_enc) {
+    buf = weights_codec_write_varint(buf, idx);
+    buf = weights_codec_write_varint(buf, nn);
+    for (uint32_t j = 0; j < nn; ++j) {
+        uint64_t v = j == 0 ? weights_codec_zigzag((int64_t)ids[0] - idx) : ids[j] - ids[j - 1];
+        buf = weights_codec_write_varint(buf, v);
+    }
+    if (weights == NULL) return buf;
+
+    if (w_enc == WEIGHTS_ENC_F16) {
+        for (uint32_t j = 0; j < nn; ++j) {
+            uint16_t h = weights_codec_f16_from_f32(weights[j]);
+            memcpy(buf, &h, sizeof(uint16_t));
+            buf += sizeof(uint16_t);
+        }
+    } else if (w_enc == WEIGHTS_ENC_Q8) {
+        if (nn == 0) return buf;
+        float w_min = weights[0], w_max = weights[0];
+        for (uint32_t j = 1; j < nn; ++j) {
+            if (weights[j] < w_min) w_min = weights[j];
+            if (weights[j] > w_max) w_max = weights[j];
+        }
+        memcpy(buf, &w_min, sizeof(float));
+        memcpy(buf + sizeof(float), &w_max, sizeof(float));
+        buf += sizeof(float) * 2;
+        float scale = w_max > w_min ? 255.0f / (w_max - w_min) : 0.0f;
+        for (uint32_t j = 0; j < nn; ++j) {
+            float q = (weights[j] - w_min) * scale + 0.5f;
+            *buf++ = q >= 255.0f ? 255 : (q > 0.0f ? (uint8_t)q : 0);
+        }
+    } else {
+        memcpy(buf, weights, sizeof(float) * (size_t)nn);
+        buf += sizeof(float) * (size_t)nn;
+    }
+    return buf;
+}
+
+/**
+ * weights_codec_v2_header
+ *
+ * The header byte of a v2 row, or of a v2 complete weights if is_complete
+ */
+static inline uint8_t weights_codec_v2_header(bool has_weights, uint8_t w_enc, bool is_complete) {
+    uint8_t header = WEIGHTS_V2 | (uint8_t)(w_enc << 1);
+    if (has_weights) header |= WEIGHTS_V2_HAS_WEIGHTS;
+    if (is_complete) header |= WEIGHTS_V2_COMPLETE;
+    return header;
+}
+
+/**
+ * weights_codec_write_row
+ *
+ * Write the weights of one observation in v2 (header, row and padding)
+ *
+ * @return the size of the row
+ */
+static inline size_t weights_codec_write_row(uint8_t *buf, uint32_t idx, uint32_t nn, const uint32_t *ids,
+                                             const float *weights, uint8_t w_enc) {
+    uint8_t *pos = buf;
+    *pos++ = weights_codec_v2_header(weights != NULL, w_enc, false);
+    pos = weights_codec_write_row_body(pos, idx, nn, ids, weights, w_enc);
+    if ((pos - buf) % 2 == 0) *pos++ = 0;
+    return (size_t)(pos - buf);
+}
+
+/**
+ * weights_codec_copy_row_max_size
+ *
+ * The maximum size of the row written by weights_codec_copy_row() (in v1, with a uint32
+ * number of neighbors)
+ */
+static inline size_t weights_codec_copy_row_max_size(const WeightsRow *row, uint8_t version, uint8_t w_enc) {
+    if (version == 1) {
+        size_t size = sizeof(uint32_t) * 2 + sizeof(uint32_t) * (size_t)row->num_nbrs;
+        if (row->has_weights) size += sizeof(float) * (size_t)row->num_nbrs;
+        return size;
+    }
+    return weights_codec_row_max_size(row->num_nbrs, row->has_weights, w_enc);
+}
+
+/**
+ * weights_codec_copy_row
+ *
+ * Write a row as a v1 row or as the body of a v2 row (without header and padding) in
+ * the encoding w_enc. The bytes are copied as they are if the row is already in this
+ * version and encoding, otherwise the row is decoded and encoded again.
+ *
+ * @param row
+ * @param version 1 or 2
+ * @param w_enc
+ * @param wide_count v1: write the number of neighbors as uint32 (for 'A' or 'W' complete
+ * weights), otherwise row->num_nbrs should not be more than UINT16_MAX
+ * @param ids scratch of row->num_nbrs elements
+ * @param weights scratch of row->num_nbrs elements
+ * @param buf at least weights_codec_copy_row_max_size() bytes
+ * @return the end of the row in buf, or NULL if the row is not valid
+ */
+static inline uint8_t *weights_codec_copy_row(const WeightsRow *row, uint8_t version, uint8_t w_enc,
+                                              bool wide_count, uint32_t *ids, float *weights, uint8_t *buf) {
+    if (row->version == version && (version == 1 ? row->wide_count == wide_count
+                                                 : !row->has_weights || row->w_enc == w_enc)) {
+        size_t size = (size_t)(row->end - row->start);
+        memcpy(buf, row->start, size);
+        return buf + size;
+    }
+    if (!weights_codec_get_ids(row, ids)) return NULL;
+    if (row->has_weights) weights_codec_get_weights(row, weights);
+
+    if (version == 2) {
+        weights_codec_sort_neighbors(ids, row->has_weights ? weights : NULL, row->num_nbrs);
+        return weights_codec_write_row_body(buf, row->idx, row->num_nbrs, ids,
+                                            row->has_weights ? weights : NULL, w_enc);
+    }
+
+    uint32_t nn = row->num_nbrs;
+    memcpy(buf, &row->idx, sizeof(uint32_t));
+    buf += sizeof(uint32_t);
+    if (wide_count) {
+        memcpy(buf, &nn, sizeof(uint32_t));
+        buf += sizeof(uint32_t);
+    } else {
+        if (nn > UINT16_MAX) return NULL;
+        uint16_t nn16 = (uint16_t)nn;
+        memcpy(buf, &nn16, sizeof(uint16_t));
+        buf += sizeof(uint16_t);
+    }
+    memcpy(buf, ids, sizeof(uint32_t) * (size_t)nn);
+    buf += sizeof(uint32_t) * (size_t)nn;
+    if (row->has_weights) {
+        memcpy(buf, weights, sizeof(float) * (size_t)nn);
+        buf += sizeof(float) * (size_t)nn;
+    }
+    return buf;
+}
+
+/**
+ * weights_codec_write_store_ref
+ *
+ * Write a reference to the weights of observation fid in the weights store name
+ *
+ * @param buf at least WEIGHTS_STORE_REF_MAX_SIZE bytes
+ * @param fid
+ * @param name
+ * @param name_len 1 to WEIGHTS_STORE_NAME_MAX bytes, without NUL
+ * @return the size of the reference
+ */
+static inline size_t weights_codec_write_store_ref(uint8_t *buf, uint32_t fid, const char *name, size_t name_len) {
+    uint8_t *pos = buf;
+    *pos++ = WEIGHTS_STORE_REF;
+    pos = weights_codec_write_varint(pos, fid);
+    memcpy(pos, name, name_len);
+    pos += name_len;
+    if ((pos - buf) % 2 == 0) *pos++ = 0;
+    return (size_t)(pos - buf);
+}
+
+/**
+ * weights_codec_read_store_ref
+ *
+ * @param buf
+ * @param size
+ * @param fid
+ * @param name points into buf, not NUL terminated
+ * @param name_len
+ * @return false if it is not a reference to a weights store
+ */
+static inline bool weights_codec_read_store_ref(const uint8_t *buf, size_t size, uint32_t *fid, const char **name,
+                                                size_t *name_len) {
+    if (size < 3 || size % 2 == 0 || buf[0] != WEIGHTS_STORE_REF) return false;
+    const uint8_t *pos = buf + 1;
+    const uint8_t *end = buf + size;
+    uint64_t v;
+    if (!weights_codec_read_varint(&pos, end, &v) || v > UINT32_MAX) return false;
+    if (end[-1] == 0) end -= 1; // padding
+    if (end <= pos || end - pos > WEIGHTS_STORE_NAME_MAX || memchr(pos, 0, end - pos) != NULL) return false;
+    *fid = (uint32_t)v;
+    *name = (const char*)pos;
+    *name_len = (size_t)(end - pos);
+    return true;
+}
+
+#endif
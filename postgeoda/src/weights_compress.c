@@ -0,0 +1,189 @@
+/**
+ * Changes:
+ * 2026-10-16 Add weights_compress() and weights_decompress() to convert weights between v1 and v2
+ * 2026-10-16 Decompress the observations with more than 65535 neighbors to the wide v1 format
+ * 2026-10-17 Document that v2 keeps the neighbors sorted by id, not in their v1 order
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <utils/builtins.h> /* for text_to_cstring */
+#include <utils/memutils.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "proxy.h"
+
+#include "weights.h"
+
+/**
+ * weights_convert
+ *
+ * Convert the weights (bytea) of one observation or the complete weights to v1 or v2
+ * (in the encoding w_enc). See weights_codec.h
+ *
+ * v2 stores the neighbor ids sorted (delta varints), with their weights in the same order, so
+ * a v1 row whose neighbors are not sorted by id, e.g. KNN weights sorted by distance, comes back
+ * from v2 with the same neighbors and weights in the order of the ids.
+ *
+ * @param bw
+ * @param version
+ * @param w_enc
+ * @return
+ */
+static bytea *weights_convert(const bytea *bw, uint8_t version, uint8_t w_enc)
+{
+    const uint8_t *data = (const uint8_t*)VARDATA_ANY(bw);
+    size_t size = VARSIZE_ANY_EXHDR(bw);
+
+    WeightsReader reader;
+    bool is_complete = weights_codec_open(data, size, &reader);
+    uint32_t num_obs = 1;
+    WeightsRow row;
+    if (is_complete) {
+        num_obs = reader.num_obs;
+    } else {
+        weights_read_row(bw, &row);
+    }
+
+    // first pass: the maximum size of the result and of the neighbors
+    WeightsReader first = reader;
+    size_t buf_size = sizeof(char) + (version == 1 ? sizeof(uint32_t) : WEIGHTS_VARINT_MAX_SIZE) + 1;
+    uint32_t max_nbrs = 0;
+    bool has_weights = false;
+    for (size_t i = 0; i < num_obs; ++i) {
+        if (is_complete) weights_next_row(&first, &row);
+        // a v1 row has no header for the wide format, only the complete weights have
+        if (version == 1 && !is_complete && row.num_nbrs > UINT16_MAX) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("weights_decompress: observation %u has more than %d neighbors",
+                                   row.idx, UINT16_MAX)));
+        }
+        buf_size += weights_codec_copy_row_max_size(&row, version, w_enc);
+        if (row.num_nbrs > max_nbrs) max_nbrs = row.num_nbrs;
+        has_weights = row.has_weights;
+    }
+    if (is_complete) has_weights = reader.has_weights;
+    if (!has_weights) w_enc = WEIGHTS_ENC_F32;
+    bool wide_count = version == 1 && max_nbrs > UINT16_MAX;
+
+    if (buf_size + VARHDRSZ > MaxAllocSize) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("weights of %zu bytes exceeds the maximum size of bytea", buf_size)));
+    }
+
+    bytea *result = palloc(buf_size + VARHDRSZ);
+    uint8_t *start = (uint8_t*)VARDATA(result);
+    uint8_t *buf = start;
+
+    // header
+    if (version == 1 && is_complete) {
+        char w_type = has_weights ? 'w' : 'a';
+        if (wide_count) w_type = has_weights ? WEIGHTS_V1_WIDE_GWT : WEIGHTS_V1_WIDE_GAL;
+        memcpy(buf, &w_type, sizeof(char)); // copy weights type
+        buf += sizeof(char);
+        memcpy(buf, &num_obs, sizeof(uint32_t)); // copy num_obs
+        buf += sizeof(uint32_t);
+    } else if (version == 2) {
+        *buf++ = weights_codec_v2_header(has_weights, w_enc, is_complete);
+        if (is_complete) buf = weights_codec_write_varint(buf, num_obs);
+    }
+
+    // second pass: copy or encode the rows
+    uint32_t *nbr_ids = palloc(sizeof(uint32_t) * (max_nbrs + 1));
+    float *nbr_weights = palloc(sizeof(float) * (max_nbrs + 1));
+    for (size_t i = 0; i < num_obs; ++i) {
+        if (is_complete) weights_next_row(&reader, &row);
+        buf = weights_codec_copy_row(&row, version, w_enc, wide_count, nbr_ids, nbr_weights, buf);
+        if (buf == NULL) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("invalid weights of observation %u", row.idx)));
+        }
+    }
+    if (version == 2 && (buf - start) % 2 == 0) {
+        *buf++ = 0; // padding
+    }
+    SET_VARSIZE(result, (buf - start) + VARHDRSZ);
+
+    pfree(nbr_ids);
+    pfree(nbr_weights);
+    return result;
+}
+
+/**
+ * weights_bytea_compress
+ *
+ * Used in SQL function weights_compress(w) or weights_compress(w, 'f16')
+ *
+ * Convert the weights of one observation (e.g. returned by queen_weights()) or the complete
+ * weights (e.g. returned by geoda_weights_cont()) to the compact v2 format. The weights values
+ * are stored as 'f32' (float, default), 'f16' (half float) or 'q8' (8-bit quantized per observation).
+ *
+ * @param fcinfo
+ * @return bytea
+ */
+Datum weights_bytea_compress(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_bytea_compress);
+
+Datum weights_bytea_compress(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+
+    uint8_t w_enc = WEIGHTS_ENC_F32;
+    if (PG_NARGS() > 1 && !PG_ARGISNULL(1)) {
+        char *encoding = text_to_cstring(PG_GETARG_TEXT_PP(1));
+        if (strcmp(encoding, "f32") == 0) {
+            w_enc = WEIGHTS_ENC_F32;
+        } else if (strcmp(encoding, "f16") == 0) {
+            w_enc = WEIGHTS_ENC_F16;
+        } else if (strcmp(encoding, "q8") == 0) {
+            w_enc = WEIGHTS_ENC_Q8;
+        } else {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("weights_compress: unknown encoding \"%s\" (f32, f16 or q8)", encoding)));
+        }
+        pfree(encoding);
+    }
+
+    bytea *bw = PG_GETARG_BYTEA_PP(0);
+    bytea *result = weights_convert(bw, 2, w_enc);
+    PG_FREE_IF_COPY(bw, 0);
+    PG_RETURN_BYTEA_P(result);
+}
+
+/**
+ * weights_bytea_decompress
+ *
+ * Used in SQL function weights_decompress(w)
+ *
+ * Convert the weights of one observation or the complete weights to the v1 format.
+ *
+ * @param fcinfo
+ * @return bytea
+ */
+Datum weights_bytea_decompress(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_bytea_decompress);
+
+Datum weights_bytea_decompress(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+
+    bytea *bw = PG_GETARG_BYTEA_PP(0);
+    bytea *result = weights_convert(bw, 1, WEIGHTS_ENC_F32);
+    PG_FREE_IF_COPY(bw, 0);
+    PG_RETURN_BYTEA_P(result);
+}
+
+#ifdef __cplusplus
+}
+#endif
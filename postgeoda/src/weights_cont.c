@@ -4,6 +4,17 @@
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
  * 2021-4-23 Add contiguity_context, pg_queen_weights_window()
+ * 2026-10-16 Decode WKB into PGGeometries instead of LWGEOM
+ * 2026-10-16 Add cpu_threads argument to queen_weights() and rook_weights()
+ * 2026-10-16 Return the weights of each row from a WeightsArena
+ * 2026-10-16 Read the weights in v1 or v2 (weights_codec.h)
+ * 2026-10-16 Reuse the weights of queen_weights() and rook_weights() from the weights build cache
+ * 2026-10-16 Write weights_to_text() and weights_bytea_tojson() in one pass, add weights_bytea_tojson_rows()
+ * 2026-10-17 Free the geometries of the aggregate when its aggcontext is reset
+ * 2026-10-17 Note why cpu_threads is not in the key of the weights build cache
+ * 2026-10-17 Error on cpu_threads > 1 with a precision_threshold; the key of the weights build cache has
+ * whether the weights are created by libgeoda (one thread) or ContiguityBuilder
+ * 2026-10-17 Free the geometries of the Window functions with create_window_pg_geometries(), also on an ERROR
  */
 
 #include <postgres.h>
@@ -26,6 +37,7 @@ extern "C" {
 #include <libgeoda/pg/geoms.h>
 #include "proxy.h"
 #include "weights.h"
+#include "weights_build_cache.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
@@ -43,10 +55,28 @@ typedef struct {
     bool	isdone;
     bool	isnull;
     bytea   **result;
-    PGWeight *w;
+    WeightsArena *arena;
     /* variable length */
 } contiguity_context;
 
+/**
+ * cont_check_threads
+ *
+ * Error if cpu_threads > 1 is used with a precision_threshold > 0: the weights with a
+ * precision threshold are only created by libgeoda, with one thread.
+ *
+ * @param func_name
+ * @param precision_threshold
+ * @param cpu_threads
+ */
+static void cont_check_threads(const char *func_name, double precision_threshold, int cpu_threads) {
+    if (precision_threshold > 0 && cpu_threads > 1) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("%s: cpu_threads must be 1 with a precision_threshold > 0", func_name)));
+    }
+}
+
 /**
  * Window function for SQL `queen_weights()`
  * This will be the main interface for Queen weights
@@ -78,32 +108,9 @@ Datum pg_queen_weights_window(PG_FUNCTION_ARGS) {
             PG_RETURN_NULL();
         }
 
-        // Read all the geometries from the partition window into a list
-        List *geoms = 0;
-        List *fids = 0;
-
-        for (size_t i = 0; i < N; i++) {
-            // fid
-            Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            int64 fid = DatumGetInt64(arg);
-
-            // the_geom
-            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t*)VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                geoms = lappend(geoms, lwgeom);
-                fids = lappend_int(fids, fid);
-            }
-        }
-
         int arg_index = 2;
 
-        // bool is_queen, int order, bool inc_lower, double precision_threshold
+        // bool is_queen, int order, bool inc_lower, double precision_threshold, int cpu_threads
         int order = 1;
         if (arg_index < PG_NARGS() ) {
             order = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
@@ -128,16 +135,59 @@ Datum pg_queen_weights_window(PG_FUNCTION_ARGS) {
         }
         arg_index +=1;
 
-        // create weights
-        PGWeight* w = create_cont_weights(fids, geoms, true, order, inc_lower, precision_threshold);
-        //bytea **result = weights_to_bytea_array(w);
+        int cpu_threads = 1;
+        if (arg_index < PG_NARGS()) {
+            cpu_threads = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
+            if (isnull || cpu_threads < 1) {
+                cpu_threads = 1;
+            }
+        }
+        arg_index +=1;
+        cont_check_threads("queen_weights", precision_threshold, cpu_threads);
+
+        // reuse the weights built from the same geometries and parameters, see weights_build_cache.h
+        WeightsBuildKey key;
+        bool use_cache = weights_build_cache_enabled();
+        if (use_cache) {
+            // not cpu_threads, only libgeoda (1) or ContiguityBuilder (> 1): the builder creates
+            // the same weights for any number of threads
+            bool use_builder = cpu_threads > 1;
+            weights_build_key_init(&key, "queen", N);
+            weights_build_key_add(&key, &order, sizeof(int));
+            weights_build_key_add(&key, &inc_lower, sizeof(bool));
+            weights_build_key_add(&key, &precision_threshold, sizeof(double));
+            weights_build_key_add(&key, &use_builder, sizeof(bool));
+            weights_build_key_read(&key, winobj);
+            context->arena = weights_build_cache_get(&key, GetMemoryChunkContext(context));
+        }
+
+        if (context->arena == NULL) {
+            // Read and decode all the geometries from the partition window
+            MemoryContext geoms_ctx;
+            PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
-        // Safe the result
-        context->w = w;
-        context->isdone = true;
+            for (size_t i = 0; i < N; i++) {
+                // fid
+                Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                int64 fid = DatumGetInt64(arg);
+
+                // the_geom
+                Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                add_pg_geometry_datum(geoms, fid, arg1, isnull);
+            }
 
-        // free PGWeight
-        //free_pgweight(w);
+            // create weights
+            PGWeight* w = create_cont_weights(geoms, true, order, inc_lower, precision_threshold, cpu_threads);
+            free_window_pg_geometries(geoms_ctx);
+
+            // Serialize the weights of all rows into the partition memory, then free PGWeight
+            context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
+            free_pgweight(w);
+            if (use_cache) {
+                weights_build_cache_put(&key, context->arena);
+            }
+        }
+        context->isdone = true;
 
         lwdebug(1, "Exit pg_queen_weights_window. done.");
     }
@@ -147,44 +197,8 @@ Datum pg_queen_weights_window(PG_FUNCTION_ARGS) {
     }
     curpos = WinGetCurrentPosition(winobj);
 
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
-
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
-
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
-
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
-    }
-
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
-    }
-
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
-
-    // clean
-    pfree(pos);
-
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 /**
@@ -218,32 +232,9 @@ Datum pg_rook_weights_window(PG_FUNCTION_ARGS) {
             PG_RETURN_NULL();
         }
 
-        // Read all the geometries from the partition window into a list
-        List *geoms = 0;
-        List *fids = 0;
-
-        for (size_t i = 0; i < N; i++) {
-            // fid
-            Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            int64 fid = DatumGetInt64(arg);
-
-            // the_geom
-            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t*)VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                geoms = lappend(geoms, lwgeom);
-                fids = lappend_int(fids, fid);
-            }
-        }
-
         int arg_index = 2;
 
-        // bool is_queen, int order, bool inc_lower, double precision_threshold
+        // bool is_queen, int order, bool inc_lower, double precision_threshold, int cpu_threads
         int order = 1;
         if (arg_index < PG_NARGS()) {
             order = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
@@ -268,16 +259,59 @@ Datum pg_rook_weights_window(PG_FUNCTION_ARGS) {
         }
         arg_index += 1;
 
-        // create weights
-        PGWeight* w = create_cont_weights(fids, geoms, false, order, inc_lower, precision_threshold);
-        //bytea **result = weights_to_bytea_array(w);
+        int cpu_threads = 1;
+        if (arg_index < PG_NARGS()) {
+            cpu_threads = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
+            if (isnull || cpu_threads < 1) {
+                cpu_threads = 1;
+            }
+        }
+        arg_index += 1;
+        cont_check_threads("rook_weights", precision_threshold, cpu_threads);
+
+        // reuse the weights built from the same geometries and parameters, see weights_build_cache.h
+        WeightsBuildKey key;
+        bool use_cache = weights_build_cache_enabled();
+        if (use_cache) {
+            // not cpu_threads, only libgeoda (1) or ContiguityBuilder (> 1): the builder creates
+            // the same weights for any number of threads
+            bool use_builder = cpu_threads > 1;
+            weights_build_key_init(&key, "rook", N);
+            weights_build_key_add(&key, &order, sizeof(int));
+            weights_build_key_add(&key, &inc_lower, sizeof(bool));
+            weights_build_key_add(&key, &precision_threshold, sizeof(double));
+            weights_build_key_add(&key, &use_builder, sizeof(bool));
+            weights_build_key_read(&key, winobj);
+            context->arena = weights_build_cache_get(&key, GetMemoryChunkContext(context));
+        }
 
-        // Safe the result
-        context->w = w;
-        context->isdone = true;
+        if (context->arena == NULL) {
+            // Read and decode all the geometries from the partition window
+            MemoryContext geoms_ctx;
+            PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
-        // free PGWeight
-        //free_pgweight(w);
+            for (size_t i = 0; i < N; i++) {
+                // fid
+                Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                int64 fid = DatumGetInt64(arg);
+
+                // the_geom
+                Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                add_pg_geometry_datum(geoms, fid, arg1, isnull);
+            }
+
+            // create weights
+            PGWeight* w = create_cont_weights(geoms, false, order, inc_lower, precision_threshold, cpu_threads);
+            free_window_pg_geometries(geoms_ctx);
+
+            // Serialize the weights of all rows into the partition memory, then free PGWeight
+            context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
+            free_pgweight(w);
+            if (use_cache) {
+                weights_build_cache_put(&key, context->arena);
+            }
+        }
+        context->isdone = true;
 
         lwdebug(1, "Exit pg_rook_weights_window. done.");
     }
@@ -288,44 +322,8 @@ Datum pg_rook_weights_window(PG_FUNCTION_ARGS) {
 
     curpos = WinGetCurrentPosition(winobj);
 
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
-
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
-
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
-
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
-    }
-
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
-    }
-
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
-
-    // clean
-    pfree(pos);
-
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 
@@ -335,9 +333,9 @@ Datum pg_rook_weights_window(PG_FUNCTION_ARGS) {
  * Used in NORAML SQL query: GEODA_WEIGHTS_ASTEXT(bytea)
  *
  * The input is a bytea, which represents weights information for
- * one observation in one row
+ * one observation in one row, in v1 or v2 (see weights_codec.h)
  *
- * BINARY format:
+ * BINARY format (v1):
  * uint32 (4 bytes): index of i-th observation
  * uint16 (2 bytes): number of neighbors of i-th observation (nn)
  * uint32 (4 bytes x nn): neighbor id
@@ -354,80 +352,19 @@ Datum weights_to_text(PG_FUNCTION_ARGS)
         PG_RETURN_NULL();   /* returns null iff no input values */
     }
 
-    bytea *bytea_w = PG_GETARG_BYTEA_P(0);
-    uint8_t *bw = (uint8_t *) VARDATA(bytea_w);
-    size_t bw_size = VARSIZE_ANY_EXHDR(bytea_w);
-
-    uint32_t fid;
-    uint16_t n_nbrs;
-
-    uint8_t *pos = bw;
-
-    // idx
-    memcpy(&fid, pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t);
-
-    lwdebug(4,"Enter weights_to_text(). fid=%d", fid);
-
-    // number of neighbors
-    memcpy(&n_nbrs, pos, sizeof(uint16_t));
-    pos += sizeof(uint16_t);
-
-    char *c_nbrs = lwalloc(BUFSIZE * n_nbrs * sizeof(char));
-    snprintf(c_nbrs, BUFSIZE, "%d:", fid);
-
-    // check if has weight val (wval)
-    bool has_wval = bw_size > (size_t)(pos + sizeof(uint32_t) * n_nbrs - bw);
-
-    if (has_wval) {
-        strcat(c_nbrs, "[");
-    }
-    strcat(c_nbrs, "[");
-
-    // read neighbor id
-    uint32_t n_id;
-    for (size_t j=0; j<n_nbrs; ++j)  {
-        char buffer[BUFSIZE];
-        memcpy(&n_id, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t);
-
-        snprintf(buffer, BUFSIZE, "%d", n_id);
-        strcat(c_nbrs, buffer);
-        if (j < n_nbrs-1)
-            strcat(c_nbrs, ",");
-    }
-
-    strcat(c_nbrs, "]");
-
-    // read neighbor weights
-    if (has_wval) {
-        strcat(c_nbrs, ",[");
-        float weight;
-        char buffer[BUFSIZE];
-        for (size_t j=0; j<n_nbrs; ++j)  {
-            memcpy(&weight, pos, sizeof(float));
-            pos += sizeof(float);
-
-            snprintf(buffer, BUFSIZE, "%f", weight);
-            strcat(c_nbrs, buffer);
-            if (j < n_nbrs - 1)
-                strcat(c_nbrs, ",");
-        }
-        strcat(c_nbrs, "]]");
-    }
+    bytea *bytea_w = PG_GETARG_BYTEA_PP(0);
 
-    // prepare result
-    text *result;
-    size_t len = strlen(c_nbrs);
+    WeightsRow row;
+    weights_read_row(bytea_w, &row);
 
-    size_t res_len = len + VARHDRSZ;
-    result = (text*)palloc(res_len);
-    SET_VARSIZE(result, res_len);
-    memcpy(VARDATA(result), c_nbrs, len);
+    lwdebug(4,"Enter weights_to_text(). fid=%d", row.idx);
 
-    lwfree(c_nbrs);
+    StringInfoData buf;
+    weights_text_begin(&buf);
+    weights_append_row_text(&buf, &row);
+    text *result = weights_text_end(&buf);
 
-    lwdebug(4,"Exit weights_to_text(). fid=%d", fid);
+    lwdebug(4,"Exit weights_to_text(). fid=%d", row.idx);
 
     PG_RETURN_TEXT_P(result);
 }
@@ -444,8 +381,7 @@ typedef struct WeightsAccessState
 
 typedef struct CollectionBuildState
 {
-    List *geoms;  /* collected geometries */
-    List *ogc_fids;
+    PGGeometries *geoms;  /* collected (decoded) geometries and fids */
     bool is_queen;
     int order;
     bool inc_lower;
@@ -457,9 +393,7 @@ typedef struct CollectionBuildState
 
 typedef struct WeightsAccessContext
 {
-    char w_type;
-    uint32_t num_obs;
-    uint8_t *pos;
+    WeightsReader reader; /* complete weights in v1 or v2 */
 } WeightsAccessContext;
 
 /**
@@ -492,18 +426,10 @@ Datum weights_bytea_to_set(PG_FUNCTION_ARGS)
         funcctx->user_fctx = w_fct;
 
         bytea *bw = PG_GETARG_BYTEA_P(0);
-        uint8_t *pos = (uint8_t*)VARDATA(bw);
-
-        memcpy(&w_fct->w_type, pos, sizeof(char));
-        pos += sizeof(char);
-
-        memcpy(&w_fct->num_obs, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t); // skip num_obs
-
-        w_fct->pos  = pos;
+        weights_open(bw, &w_fct->reader);
 
         // total number of tuples to be returned
-        funcctx->max_calls = w_fct->num_obs;
+        funcctx->max_calls = w_fct->reader.num_obs;
 
         MemoryContextSwitchTo(oldcontext);
     }
@@ -514,35 +440,15 @@ Datum weights_bytea_to_set(PG_FUNCTION_ARGS)
     max_calls = funcctx->max_calls;
 
     WeightsAccessContext *w_fct = (WeightsAccessContext*)funcctx->user_fctx;
-    uint16_t n_nbrs;
 
     //  do when there is more left to send
     if (call_cntr < max_calls) {
-        // read for every observation
-        uint8_t *pos = w_fct->pos;
-        // read idx
-        pos += sizeof(uint32_t);
-        // read number of neighbors
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
-        // read neighbor idx and weights
-        for (size_t j=0; j<n_nbrs; ++j)  {
-            pos += sizeof(uint32_t);
-        }
-        if (w_fct->w_type == 'w') {
-            for (size_t j=0; j<n_nbrs; ++j)  {
-                // read neighbor weight
-                pos += sizeof(float);
-            }
-        }
+        // read for every observation, and move to next observation
+        WeightsRow row;
+        weights_next_row(&w_fct->reader, &row);
 
-        size_t buf_size = pos - w_fct->pos;
-        bytea *result = palloc(buf_size + VARHDRSZ);
-        memcpy(VARDATA(result), w_fct->pos, buf_size);
-        SET_VARSIZE(result, buf_size+VARHDRSZ);
-
-        // move pointer to next observation
-        w_fct->pos = pos;
+        // the weights of the observation in the same version as the complete weights
+        bytea *result = weights_row_to_bytea(&w_fct->reader, &row);
 
         SRF_RETURN_NEXT(funcctx, PointerGetDatum(result));
     } else {
@@ -581,18 +487,10 @@ Datum weights_bytea_getfids(PG_FUNCTION_ARGS)
         funcctx->user_fctx = w_fct;
 
         bytea *bw = PG_GETARG_BYTEA_P(0);
-        uint8_t *pos = (uint8_t*)VARDATA(bw);
-
-        memcpy(&w_fct->w_type, pos, sizeof(char));
-        pos += sizeof(char);
-
-        memcpy(&w_fct->num_obs, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t); // skip num_obs
-
-        w_fct->pos  = pos;
+        weights_open(bw, &w_fct->reader);
 
         // total number of tuples to be returned
-        funcctx->max_calls = w_fct->num_obs;
+        funcctx->max_calls = w_fct->reader.num_obs;
 
         MemoryContextSwitchTo(oldcontext);
     }
@@ -603,35 +501,14 @@ Datum weights_bytea_getfids(PG_FUNCTION_ARGS)
     max_calls = funcctx->max_calls;
 
     WeightsAccessContext *w_fct = (WeightsAccessContext*)funcctx->user_fctx;
-    uint32_t fid;
-    uint16_t n_nbrs;
 
     //  do when there is more left to send
     if (call_cntr < max_calls) {
-        // read for every observation
-        uint8_t *pos = w_fct->pos;
-        // read idx
-        memcpy(&fid, pos, sizeof(uint16_t));
-        pos += sizeof(uint32_t);
-
-        // read number of neighbors
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
-        // read neighbor idx and weights
-        for (size_t j=0; j<n_nbrs; ++j)  {
-            pos += sizeof(uint32_t);
-        }
-        if (w_fct->w_type == 'w') {
-            for (size_t j=0; j<n_nbrs; ++j)  {
-                // read neighbor weight
-                pos += sizeof(float);
-            }
-        }
-
-        // move pointer to next observation
-        w_fct->pos = pos;
+        // read idx for every observation, and move to next observation
+        WeightsRow row;
+        weights_next_row(&w_fct->reader, &row);
 
-        SRF_RETURN_NEXT(funcctx, Int64GetDatum(fid));
+        SRF_RETURN_NEXT(funcctx, Int64GetDatum(row.idx));
     } else {
         // do when there is no more left
         SRF_RETURN_DONE(funcctx);
@@ -673,8 +550,7 @@ Datum bytea_to_geom_transfn(PG_FUNCTION_ARGS)
     if ( PG_ARGISNULL(0) ) {
         // first incoming row/item
 		state = (CollectionBuildState*)MemoryContextAlloc(aggcontext, sizeof(CollectionBuildState));
-		state->geoms = NULL;
-		state->ogc_fids = NULL;
+		state->geoms = create_agg_pg_geometries(aggcontext);
 		state->is_queen = true;
 		state->order = 1;
 		state->inc_lower = false;
@@ -685,12 +561,8 @@ Datum bytea_to_geom_transfn(PG_FUNCTION_ARGS)
 		state = (CollectionBuildState*) PG_GETARG_POINTER(0);
 	}
 
-    LWGEOM* geom = 0;
     int idx = 0;
 
-    /* Take a copy of the geometry into the aggregate context */
-    MemoryContext old = MemoryContextSwitchTo(aggcontext);
-
     int arg_index = 1;
 
     // fid
@@ -699,15 +571,8 @@ Datum bytea_to_geom_transfn(PG_FUNCTION_ARGS)
     }
     arg_index += 1;
 
-    // the_geom
-    if (!PG_ARGISNULL(arg_index)) {
-        bytea *bytea_wkb = PG_GETARG_BYTEA_P(arg_index);
-        uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-        LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-        geom = lwgeom_clone_deep(lwgeom);
-        lwgeom_free(lwgeom);
-        //PG_FREE_IF_COPY(bytea_wkb, 0);
-    }
+    // the_geom: decoded right away, no copy is kept in the aggregate context
+    add_pg_geometry_datum(state->geoms, idx, PG_GETARG_DATUM(arg_index), PG_ARGISNULL(arg_index));
     arg_index += 1;
 
     // is_queen
@@ -734,19 +599,6 @@ Datum bytea_to_geom_transfn(PG_FUNCTION_ARGS)
     }
     arg_index += 1;
 
-    /* Initialize or append to list as necessary */
-    if (state->geoms) {
-        lwdebug(4, "lappend geom.");
-        state->geoms = lappend(state->geoms, geom); // pg_list
-        state->ogc_fids = lappend_int(state->ogc_fids, idx);
-    } else {
-        lwdebug(4, "list_make.");
-        state->geoms = list_make1(geom);
-        state->ogc_fids = list_make1_int(idx);
-    }
-
-    MemoryContextSwitchTo(old);
-
     PG_RETURN_POINTER(state);
 }
 
@@ -769,125 +621,59 @@ Datum weights_bytea_tojson(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0))
         PG_RETURN_NULL();   /* returns null iff no input values */
 
-    bytea *bw = PG_GETARG_BYTEA_P(0);
-
-    uint8_t *pos = (uint8_t*)VARDATA(bw);
-
-    uint32_t idx = 0;
-    uint16_t n_nbrs = 0;
-    char w_type;
-
-    memcpy(&w_type, pos, sizeof(char));
-    pos += sizeof(char); // weights type char
-
-    uint32_t num_obs = 0;
-    memcpy(&num_obs, pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t); // num_obs
-
-    lwdebug(5, "num_obs=%d", num_obs);
-
-    List *c_arr = 0;
-    size_t n_arr = 0, i, j;
-    uint32_t nid;
-    float nweights;
-    char *c_nbrs;
-
-    for (i = 0; i < num_obs; ++i) {
-        // read idx
-        memcpy(&idx, pos, sizeof(uint32_t));
-        pos += sizeof(uint32_t);
-
-        // read number of neighbors
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
-
-        // create string memory
-        c_nbrs = lwalloc(BUFSIZE * n_nbrs * sizeof(char));
-
-        // assign string content
-        snprintf(c_nbrs, BUFSIZE, "%d:", idx);
-
-        if (w_type == 'w') {
-            strcat(c_nbrs, "[");
-        }
-        strcat(c_nbrs, "[");
-
-        // loop neighbrs
-        for (j = 0; j < n_nbrs; ++j) {
-            char buffer[BUFSIZE];
-            // read neighbor id
-            memcpy(&nid, pos, sizeof(uint32_t));
-            pos += sizeof(uint32_t);
-
-            snprintf(buffer, BUFSIZE, "%d", nid);
-
-            strcat(c_nbrs, buffer);
-            if (j < n_nbrs - 1)
-                strcat(c_nbrs, ",");
-        }
-
-        strcat(c_nbrs, "]");
+    bytea *bw = PG_GETARG_BYTEA_PP(0);
+    text *result = weights_to_json(bw);
 
-        if (w_type == 'w') {
-            strcat(c_nbrs, ",[");
-            for (j = 0; j < n_nbrs; ++j) {
-                char buffer[BUFSIZE];
-                // read neighbor weight
-                memcpy(&nweights, pos, sizeof(float));
-                pos += sizeof(float);
+    lwdebug(1,"Exit weights_bytea_tojson.");
+    PG_RETURN_TEXT_P(result);
+}
 
-                snprintf(buffer, BUFSIZE, "%f", nweights);
-                strcat(c_nbrs, buffer);
-                if (j < n_nbrs - 1)
-                    strcat(c_nbrs, ",");
-            }
-            strcat(c_nbrs, "]]");
-        }
+/**
+ * weights_bytea_tojson_rows
+ *
+ * Used in sql GEODA_WEIGHTS_TOJSON_ROWS
+ * Input parameter is the bytea of a complete weights. Return the weights of each observation
+ * as a JSON object, one row at a time, so the complete text is never built.
+ *
+ * @param fcinfo
+ * @return setof json
+ */
+Datum weights_bytea_tojson_rows(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_bytea_tojson_rows);
 
-        if (i < num_obs - 1)
-            strcat(c_nbrs, ",");
+Datum weights_bytea_tojson_rows(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
 
-        n_arr += strlen(c_nbrs);
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
-        if (i == 0) {
-            c_arr = list_make1(c_nbrs);
-        } else {
-            c_arr = lappend(c_arr, c_nbrs);
-        }
+        WeightsAccessContext *w_fct = palloc(sizeof(WeightsAccessContext));
+        funcctx->user_fctx = w_fct;
 
-        //lwdebug(1, "text=%s length=%d", c_nbrs, n_arr);
-    }
+        bytea *bw = PG_GETARG_BYTEA_PP(0);
+        weights_open(bw, &w_fct->reader);
+        funcctx->max_calls = w_fct->reader.num_obs;
 
-    // compose returned json string
-    size_t len = n_arr + 2;
-    char *w_str = palloc(len * sizeof(char));
-    char *o_w_str = w_str;
-    strcpy(w_str, "{");
-    w_str += 1;
-
-    ListCell *l;
-    foreach (l, c_arr) {
-        char *c_nbrs = (char *) (lfirst(l));
-        strcpy(w_str, c_nbrs);
-        //lwdebug(1, "text=%s", o_w_str);
-        w_str += strlen(c_nbrs);
-        lwfree(c_nbrs);
+        MemoryContextSwitchTo(oldcontext);
     }
-    strcpy(w_str, "}");
-
-    text *result;
-    //lwdebug(1, "new text=%s, total length=%d", o_w_str, len);
 
-    size_t res_len = len + VARHDRSZ;
+    funcctx = SRF_PERCALL_SETUP();
+    WeightsAccessContext *w_fct = (WeightsAccessContext*)funcctx->user_fctx;
 
-    result = (text *) palloc(res_len);
-    SET_VARSIZE(result, res_len);
-    memcpy(VARDATA(result), o_w_str, len);
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        WeightsRow row;
+        weights_next_row(&w_fct->reader, &row);
 
-    pfree(o_w_str);
+        StringInfoData buf;
+        weights_text_begin(&buf);
+        weights_append_row_json(&buf, &row);
 
-    lwdebug(1,"Exit weights_bytea_tojson.");
-    PG_RETURN_TEXT_P(result);
+        SRF_RETURN_NEXT(funcctx, PointerGetDatum(weights_text_end(&buf)));
+    } else {
+        SRF_RETURN_DONE(funcctx);
+    }
 }
 
 /**
@@ -919,8 +705,8 @@ Datum geom_to_contweights_finalfn(PG_FUNCTION_ARGS)
     // get State from aggregate internal function
     p = (CollectionBuildState*) PG_GETARG_POINTER(0);
 
-    PGWeight* w = create_cont_weights(p->ogc_fids, p->geoms, p->is_queen, p->order, p->inc_lower,
-            p->precision_threshold);
+    PGWeight* w = create_cont_weights(p->geoms, p->is_queen, p->order, p->inc_lower,
+            p->precision_threshold, 1);
 
     size_t buf_size = 0;
     uint8_t* w_bytes = weights_to_bytes(w, &buf_size);
@@ -952,57 +738,22 @@ Datum PGWeight_at(PG_FUNCTION_ARGS)
     int64 fid = PG_GETARG_INT64(0);
 
     bytea *bw = PG_GETARG_BYTEA_P(1);
-    uint8_t *w = (uint8_t*)VARDATA(bw);
-
-    const uint8_t *pos = w;
-
-    uint32_t idx = 0;
-    uint16_t n_nbrs = 0;
-
-    char w_type;
-    memcpy(&w_type, pos, sizeof(char));
-    pos += sizeof(char); // skip weights type char
-
-    uint32_t num_obs = 0;
-    memcpy(&num_obs, pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t); // skip num_obs
 
-    const uint8_t *start = pos;
-    size_t buf_size = 0;
+    WeightsReader reader;
+    weights_open(bw, &reader);
 
-    for (size_t i=0; i<num_obs; ++i)  {
-        // read idx
-        memcpy(&idx, pos, sizeof(uint32_t));
-        if (idx == fid) {
-            start = pos;
-        }
-        pos += sizeof(uint32_t);
-
-        // read number of neighbors
-        memcpy(&n_nbrs, pos, sizeof(uint16_t));
-        pos += sizeof(uint16_t);
-        // read neighbor idx and weights
-        for (size_t j=0; j<n_nbrs; ++j)  {
-            pos += sizeof(uint32_t);
-        }
-        if (w_type == 'w') {
-            for (size_t j=0; j<n_nbrs; ++j)  {
-                // read neighbor weight
-                pos += sizeof(float);
-            }
-        }
-        if (idx == fid) {
-            buf_size = pos - start;
+    bytea *result = NULL;
+    for (size_t i=0; i<reader.num_obs; ++i)  {
+        WeightsRow row;
+        weights_next_row(&reader, &row);
+        if (row.idx == fid) {
+            result = weights_row_to_bytea(&reader, &row);
             break;
         }
     }
-    if (buf_size == 0)
+    if (result == NULL)
         PG_RETURN_NULL();
 
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    memcpy(VARDATA(result), start, buf_size);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-
     PG_RETURN_BYTEA_P(result);
 }
 
@@ -3,6 +3,10 @@
  *
  * Changes:
  * 2021-4-23 Add pg_distance_weights_window()
+ * 2026-10-16 Decode WKB into PGGeometries instead of LWGEOM
+ * 2026-10-16 Return the weights of each row from a WeightsArena
+ * 2026-10-17 Free the geometries of the aggregate when its aggcontext is reset
+ * 2026-10-17 Free the geometries of the Window functions with create_window_pg_geometries(), also on an ERROR
  */
 
 #include <postgres.h>
@@ -41,7 +45,7 @@ typedef struct {
     bool	isdone;
     bool	isnull;
     //bytea **result;
-    PGWeight *w;
+    WeightsArena *arena;
     /* variable length */
 } distance_context;
 
@@ -77,8 +81,8 @@ Datum pg_distance_weights_window(PG_FUNCTION_ARGS) {
         }
 
         // read data
-        List *geoms = 0;
-        List *fids = 0;
+        MemoryContext geoms_ctx;
+        PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
         for (size_t i = 0; i < N; i++) {
             // fid
@@ -88,16 +92,7 @@ Datum pg_distance_weights_window(PG_FUNCTION_ARGS) {
 
             // the_geom
             Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                lappend(geoms, lwgeom);
-                lappend_int(fids, fid);
-            }
+            add_pg_geometry_datum(geoms, fid, arg1, isnull);
         }
 
         lwdebug(4, "pg_distance_weights_window: read dist_thres");
@@ -143,15 +138,14 @@ Datum pg_distance_weights_window(PG_FUNCTION_ARGS) {
 
         lwdebug(4, "pg_distance_weights_window: create_distance_weights");
         // create weights
-        PGWeight* w = create_distance_weights(fids, geoms, dist_thres, power, is_inverse, is_arc, is_mile);
+        PGWeight* w = create_distance_weights(geoms, dist_thres, power, is_inverse, is_arc, is_mile);
+        free_window_pg_geometries(geoms_ctx);
         //bytea **result = weights_to_bytea_array(w);
 
-        // Safe the result
-        context->w = w;
+        // Serialize the weights of all rows into the partition memory, then free PGWeight
+        context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
         context->isdone = true;
-
-        // free PGWeight
-        //free_pgweight(w);
+        free_pgweight(w);
 
         lwdebug(1, "Exit pg_distance_weights_window. done.");
     }
@@ -161,44 +155,9 @@ Datum pg_distance_weights_window(PG_FUNCTION_ARGS) {
     }
 
     curpos = WinGetCurrentPosition(winobj);
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
-
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
-
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
-
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
-    }
-
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
-    }
-
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
-
-    // clean
-    pfree(pos);
 
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 /**
@@ -233,8 +192,8 @@ Datum pg_kernel_weights_window(PG_FUNCTION_ARGS) {
         }
 
         // read data
-        List *geoms = 0;
-        List *fids = 0;
+        MemoryContext geoms_ctx;
+        PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
         for (size_t i = 0; i < N; i++) {
             // fid
@@ -244,16 +203,7 @@ Datum pg_kernel_weights_window(PG_FUNCTION_ARGS) {
 
             // the_geom
             Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                lappend(geoms, lwgeom);
-                lappend_int(fids, fid);
-            }
+            add_pg_geometry_datum(geoms, fid, arg1, isnull);
         }
 
         lwdebug(4, "pg_kernel_weights_window: read dist_thres");
@@ -319,16 +269,15 @@ Datum pg_kernel_weights_window(PG_FUNCTION_ARGS) {
 
         lwdebug(4, "pg_kernel_weights_window: create_distance_weights");
         // create weights
-        PGWeight* w = create_kernel_weights(fids, geoms, dist_thres, power, is_inverse, is_arc, is_mile, kernel,
+        PGWeight* w = create_kernel_weights(geoms, dist_thres, power, is_inverse, is_arc, is_mile, kernel,
                                             use_kernel_diagonals);
+        free_window_pg_geometries(geoms_ctx);
         //bytea **result = weights_to_bytea_array(w);
 
-        // Safe the result
-        context->w = w;
+        // Serialize the weights of all rows into the partition memory, then free PGWeight
+        context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
         context->isdone = true;
-
-        // free PGWeight
-        //free_pgweight(w);
+        free_pgweight(w);
 
         lwdebug(1, "Exit pg_kernel_weights_window. done.");
     }
@@ -338,44 +287,9 @@ Datum pg_kernel_weights_window(PG_FUNCTION_ARGS) {
     }
 
     curpos = WinGetCurrentPosition(winobj);
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
-
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
 
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
-
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
-    }
-
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
-    }
-
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
-
-    // clean
-    pfree(pos);
-
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 /**
@@ -385,8 +299,7 @@ Datum pg_kernel_weights_window(PG_FUNCTION_ARGS) {
  */
 typedef struct
 {
-    List *geoms;  /* collected geometries */
-    List *fids;
+    PGGeometries *geoms;  /* collected (decoded) geometries and fids */
     bool is_arc;
     bool is_mile;
     Oid geomOid;
@@ -424,8 +337,7 @@ Datum bytea_to_geom_dist_transfn(PG_FUNCTION_ARGS)
     if ( PG_ARGISNULL(0) ) {
         // first incoming row/item
         state = (WeightsCollectionState*)MemoryContextAlloc(aggcontext, sizeof(WeightsCollectionState));
-        state->geoms = NULL;
-        state->fids = NULL;
+        state->geoms = create_agg_pg_geometries(aggcontext);
         state->is_mile = false;
         state->is_arc = false;
         state->geomOid = argType;
@@ -434,12 +346,8 @@ Datum bytea_to_geom_dist_transfn(PG_FUNCTION_ARGS)
         state = (WeightsCollectionState*) PG_GETARG_POINTER(0);
     }
 
-    LWGEOM* geom = 0;
     int idx = 0;
 
-    // Take a copy of the geometry into the aggregate context
-    MemoryContext old = MemoryContextSwitchTo(aggcontext);
-
     int arg_index = 1;
 
     // fid
@@ -448,13 +356,8 @@ Datum bytea_to_geom_dist_transfn(PG_FUNCTION_ARGS)
     }
     arg_index += 1;
 
-    // the_geom
-    if (!PG_ARGISNULL(arg_index)) {
-        bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(PG_GETARG_DATUM(arg_index));
-        uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-        geom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-        //PG_FREE_IF_COPY(bytea_wkb, 0);
-    }
+    // the_geom: decoded right away, no copy is kept in the aggregate context
+    add_pg_geometry_datum(state->geoms, idx, PG_GETARG_DATUM(arg_index), PG_ARGISNULL(arg_index));
     arg_index += 1;
 
     // is_arc
@@ -469,19 +372,6 @@ Datum bytea_to_geom_dist_transfn(PG_FUNCTION_ARGS)
     }
     arg_index += 1;
 
-    // Initialize or append to list as necessary
-    if (state->geoms) {
-        lwdebug(4, "lappend geom.");
-        state->geoms = lappend(state->geoms, geom); // pg_list
-        state->fids = lappend_int(state->fids, idx);
-    } else {
-        lwdebug(4, "list_make.");
-        state->geoms = list_make1(geom);
-        state->fids = list_make1_int(idx);
-    }
-
-    MemoryContextSwitchTo(old);
-
     PG_RETURN_POINTER(state);
 }
 /**
@@ -507,7 +397,7 @@ Datum geom_to_dist_threshold_finalfn(PG_FUNCTION_ARGS)
     // get State from aggregate internal function
     p = (WeightsCollectionState*) PG_GETARG_POINTER(0);
 
-    double dist = get_min_distthreshold(p->fids, p->geoms, p->is_arc, p->is_mile);
+    double dist = get_min_distthreshold(p->geoms, p->is_arc, p->is_mile);
 
     lwdebug(1,"Exit geom_to_dist_threshold_finalfn.");
     PG_RETURN_FLOAT4(dist);
@@ -4,6 +4,19 @@
  * Changes:
  * 2021-1-27 Update to use libgeoda 0.0.6
  * 2021-4-26 Add pg_kernel_knn_weights_window() for kernel weights
+ * 2026-10-16 Decode WKB into PGGeometries instead of LWGEOM
+ * 2026-10-16 Add pg_knn_weights_index() for index-driven KNN weights via SPI
+ * 2026-10-16 Add cpu_threads to pg_knn_weights_window() and pg_knn_weights_sub_window()
+ * 2026-10-16 Return the weights of each row from a WeightsArena
+ * 2026-10-16 Reuse the weights of pg_knn_weights_window() and pg_kernel_knn_weights_window() from
+ * the weights build cache
+ * 2026-10-17 Free the geometries of the aggregate when its aggcontext is reset
+ * 2026-10-17 Note why cpu_threads is not in the key of the weights build cache
+ * 2026-10-17 Error on duplicated fids in pg_knn_weights_window() and pg_knn_weights_sub_window(); the key of
+ * the weights build cache has whether the weights are created by libgeoda (one thread) or the kd-tree
+ * 2026-10-17 knn_weights_index() orders the neighbors by the distance of the centroids, and always writes
+ * the distances as weights
+ * 2026-10-17 Free the geometries of the Window functions with create_window_pg_geometries(), also on an ERROR
  */
 
 #include <postgres.h>
@@ -17,6 +30,9 @@
 #include <catalog/namespace.h>
 #include <utils/geo_decls.h>
 #include <utils/lsyscache.h> /* for get_typlenbyvalalign */
+#include <utils/builtins.h> /* for quote_identifier, text_to_cstring */
+#include <executor/spi.h>
+#include <math.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -27,6 +43,7 @@ extern "C" {
 #include "proxy.h"
 
 #include "weights.h"
+#include "weights_build_cache.h"
 
 #ifndef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
@@ -42,10 +59,29 @@ PG_MODULE_MAGIC;
 typedef struct {
     bool	isdone;
     bool	isnull;
-    PGWeight *w;
+    WeightsArena *arena;
     /* variable length */
 } knn_context;
 
+/**
+ * knn_check_fids
+ *
+ * Error if two observations have the same fid: the weights are written by fid, and the
+ * kd-tree excludes a point from its own neighbors by fid. The geometries of
+ * create_window_pg_geometries() are freed by the reset callback of their memory context.
+ *
+ * @param geoms
+ * @param func_name
+ */
+static void knn_check_fids(PGGeometries *geoms, const char *func_name) {
+    uint32_t dup_fid = 0;
+    if (pg_geometries_duplicate_fid(geoms, &dup_fid)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("%s: observation %u is duplicated", func_name, dup_fid)));
+    }
+}
+
 /**
  * Window function for SQL `knn_weights()`
  * This will be the main interface for knn weights.
@@ -76,31 +112,7 @@ Datum pg_knn_weights_window(PG_FUNCTION_ARGS) {
             context->isnull = true;
             PG_RETURN_NULL();
         }
-
-        // read data
-        List *geoms = 0;
-        List *fids = 0;
-
-        for (size_t i = 0; i < N; i++) {
-            // fid
-            Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            int64 fid = DatumGetInt64(arg);
-            //lwdebug(1, "local_g_window_bytea: %d-th:%d", i, fids[i]);
-
-            // the_geom
-            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                lappend(geoms, lwgeom);
-                lappend_int(fids, fid);
-            }
-        }
-        lwdebug(1, "pg_knn_weights. N=%d, geoms=%d", N, list_length(geoms));
+        lwdebug(1, "pg_knn_weights. N=%d", N);
 
         int arg_index = 2;
 
@@ -141,64 +153,75 @@ Datum pg_knn_weights_window(PG_FUNCTION_ARGS) {
         }
         arg_index += 1;
 
-        // create weights
-        PGWeight* w = create_knn_weights(fids, geoms, k, power, is_inverse, is_arc, is_mile);
-        //bytea **result = weights_to_bytea_array(w);
-
-        // Safe the result
-        context->w = w;
-        context->isdone = true;
+        int cpu_threads = 1;
+        if (arg_index < PG_NARGS()) {
+            cpu_threads = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
+            if (isnull || cpu_threads < 1) {
+                cpu_threads = 1;
+            }
+        }
+        arg_index += 1;
 
-        // free PGWeight
-        //free_pgweight(w);
+        // reuse the weights built from the same geometries and parameters, see weights_build_cache.h
+        WeightsBuildKey key;
+        bool use_cache = weights_build_cache_enabled();
+        if (use_cache) {
+            // not cpu_threads, only libgeoda (1) or the kd-tree (> 1): the kd-tree finds the same
+            // neighbors for any number of threads
+            bool use_kdtree = cpu_threads > 1;
+            weights_build_key_init(&key, "knn", N);
+            weights_build_key_add(&key, &k, sizeof(int));
+            weights_build_key_add(&key, &power, sizeof(double));
+            weights_build_key_add(&key, &is_inverse, sizeof(bool));
+            weights_build_key_add(&key, &is_arc, sizeof(bool));
+            weights_build_key_add(&key, &is_mile, sizeof(bool));
+            weights_build_key_add(&key, &use_kdtree, sizeof(bool));
+            weights_build_key_read(&key, winobj);
+            context->arena = weights_build_cache_get(&key, GetMemoryChunkContext(context));
+        }
 
-        lwdebug(1, "Exit pg_knn_weights. done.");
-    }
+        if (context->arena == NULL) {
+            // read data
+            MemoryContext geoms_ctx;
+            PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
-    if (context->isnull) {
-        PG_RETURN_NULL();
-    }
+            for (size_t i = 0; i < N; i++) {
+                // fid
+                Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                int64 fid = DatumGetInt64(arg);
+                //lwdebug(1, "local_g_window_bytea: %d-th:%d", i, fids[i]);
 
-    curpos = WinGetCurrentPosition(winobj);
+                // the_geom
+                Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                add_pg_geometry_datum(geoms, fid, arg1, isnull);
+            }
 
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
+            knn_check_fids(geoms, "knn_weights");
 
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
+            // create weights
+            PGWeight* w = create_knn_weights(geoms, k, power, is_inverse, is_arc, is_mile, cpu_threads);
+            free_window_pg_geometries(geoms_ctx);
 
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
+            // Serialize the weights of all rows into the partition memory, then free PGWeight
+            context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
+            free_pgweight(w);
+            if (use_cache) {
+                weights_build_cache_put(&key, context->arena);
+            }
+        }
+        context->isdone = true;
 
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
+        lwdebug(1, "Exit pg_knn_weights. done.");
     }
 
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
+    if (context->isnull) {
+        PG_RETURN_NULL();
     }
 
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
-
-    // clean
-    pfree(pos);
+    curpos = WinGetCurrentPosition(winobj);
 
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 /**
@@ -233,8 +256,8 @@ Datum pg_knn_weights_sub_window(PG_FUNCTION_ARGS) {
         }
 
         // read data
-        List *geoms = 0;
-        List *fids = 0;
+        MemoryContext geoms_ctx;
+        PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
         for (size_t i = 0; i < N; i++) {
             // fid
@@ -244,16 +267,7 @@ Datum pg_knn_weights_sub_window(PG_FUNCTION_ARGS) {
 
             // the_geom
             Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                lappend(geoms, lwgeom);
-                lappend_int(fids, fid);
-            }
+            add_pg_geometry_datum(geoms, fid, arg1, isnull);
         }
 
         int arg_index = 2;
@@ -309,16 +323,26 @@ Datum pg_knn_weights_sub_window(PG_FUNCTION_ARGS) {
         }
         arg_index += 1;
 
+        int cpu_threads = 1;
+        if (arg_index < PG_NARGS()) {
+            cpu_threads = DatumGetInt32(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
+            if (isnull || cpu_threads < 1) {
+                cpu_threads = 1;
+            }
+        }
+        arg_index += 1;
+
+        knn_check_fids(geoms, "knn_weights_sub");
+
         // create weights
-        PGWeight* w = create_knn_weights_sub(fids, geoms, k, start, end, power, is_inverse, is_arc, is_mile);
+        PGWeight* w = create_knn_weights_sub(geoms, k, start, end, power, is_inverse, is_arc, is_mile, cpu_threads);
+        free_window_pg_geometries(geoms_ctx);
         //bytea **result = weights_to_bytea_array(w);
 
-        // Safe the result
-        context->w = w;
+        // Serialize the weights of all rows into the partition memory, then free PGWeight
+        context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
         context->isdone = true;
-
-        // free PGWeight
-        //free_pgweight(w);
+        free_pgweight(w);
 
         lwdebug(1, "Exit pg_knn_weights_sub_window. done.");
     }
@@ -328,44 +352,9 @@ Datum pg_knn_weights_sub_window(PG_FUNCTION_ARGS) {
     }
 
     curpos = WinGetCurrentPosition(winobj);
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
-
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
-
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
-
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
-    }
-
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
-    }
-
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
 
-    // clean
-    pfree(pos);
-
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 /**
@@ -397,30 +386,6 @@ Datum pg_kernel_knn_weights_window(PG_FUNCTION_ARGS) {
             PG_RETURN_NULL();
         }
 
-        // read data
-        List *geoms = 0;
-        List *fids = 0;
-
-        for (size_t i = 0; i < N; i++) {
-            // fid
-            Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            int64 fid = DatumGetInt64(arg);
-            //lwdebug(1, "pg_kernel_knn_weights_window: %d-th:%d", i, fids[i]);
-
-            // the_geom
-            Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
-            bytea *bytea_wkb = (bytea*)PG_DETOAST_DATUM_COPY(arg1);
-            uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-            LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-            if (i==0) {
-                geoms = list_make1(lwgeom);
-                fids = list_make1_int(fid);
-            } else {
-                lappend(geoms, lwgeom);
-                lappend_int(fids, fid);
-            }
-        }
-
         int arg_index = 2;
 
         // read arguments
@@ -434,9 +399,11 @@ Datum pg_kernel_knn_weights_window(PG_FUNCTION_ARGS) {
         arg_index += 1;
 
         char *kernel = 0;
+        size_t kernel_size = 0;
         if (arg_index < PG_NARGS()) {
             VarChar *arg = (VarChar *)DatumGetVarCharPP(WinGetFuncArgCurrent(winobj, arg_index, &isnull));
             kernel = (char *)VARDATA(arg);
+            kernel_size = VARSIZE_ANY_EXHDR(arg);
             lwdebug(1, "Get kernel: %s", kernel);
         }
         if (!check_kernel(kernel)) {
@@ -491,19 +458,54 @@ Datum pg_kernel_knn_weights_window(PG_FUNCTION_ARGS) {
         }
         arg_index += 1;
 
-        // create weights
-        lwdebug(1, "Exit pg_kernel_knn_weights_window. create weights.");
-        double bandwidth = 0;
-        PGWeight* w = create_kernel_knn_weights(fids, geoms, k, power, is_inverse, is_arc, is_mile,
-                                                kernel, bandwidth, adaptive_bandwidth, use_kernel_diagonals);
-        //bytea **result = weights_to_bytea_array(w);
+        // reuse the weights built from the same geometries and parameters, see weights_build_cache.h
+        WeightsBuildKey key;
+        bool use_cache = weights_build_cache_enabled();
+        if (use_cache) {
+            weights_build_key_init(&key, "kernel_knn", N);
+            weights_build_key_add(&key, &k, sizeof(int));
+            weights_build_key_add(&key, kernel, kernel_size);
+            weights_build_key_add(&key, &adaptive_bandwidth, sizeof(bool));
+            weights_build_key_add(&key, &use_kernel_diagonals, sizeof(bool));
+            weights_build_key_add(&key, &power, sizeof(double));
+            weights_build_key_add(&key, &is_inverse, sizeof(bool));
+            weights_build_key_add(&key, &is_arc, sizeof(bool));
+            weights_build_key_add(&key, &is_mile, sizeof(bool));
+            weights_build_key_read(&key, winobj);
+            context->arena = weights_build_cache_get(&key, GetMemoryChunkContext(context));
+        }
 
-        // Safe the result
-        context->w = w;
-        context->isdone = true;
+        if (context->arena == NULL) {
+            // read data
+            MemoryContext geoms_ctx;
+            PGGeometries *geoms = create_window_pg_geometries(N, &geoms_ctx);
 
-        // free PGWeight
-        //free_pgweight(w);
+            for (size_t i = 0; i < N; i++) {
+                // fid
+                Datum arg = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                int64 fid = DatumGetInt64(arg);
+                //lwdebug(1, "pg_kernel_knn_weights_window: %d-th:%d", i, fids[i]);
+
+                // the_geom
+                Datum arg1 = WinGetFuncArgInPartition(winobj, 1, i, WINDOW_SEEK_HEAD, false, &isnull, &isout);
+                add_pg_geometry_datum(geoms, fid, arg1, isnull);
+            }
+
+            // create weights
+            lwdebug(1, "Exit pg_kernel_knn_weights_window. create weights.");
+            double bandwidth = 0;
+            PGWeight* w = create_kernel_knn_weights(geoms, k, power, is_inverse, is_arc, is_mile,
+                                                    kernel, bandwidth, adaptive_bandwidth, use_kernel_diagonals);
+            free_window_pg_geometries(geoms_ctx);
+
+            // Serialize the weights of all rows into the partition memory, then free PGWeight
+            context->arena = weights_to_arena(w, GetMemoryChunkContext(context));
+            free_pgweight(w);
+            if (use_cache) {
+                weights_build_cache_put(&key, context->arena);
+            }
+        }
+        context->isdone = true;
 
         lwdebug(1, "Exit pg_kernel_knn_weights_window. done.");
     }
@@ -513,44 +515,9 @@ Datum pg_kernel_knn_weights_window(PG_FUNCTION_ARGS) {
     }
 
     curpos = WinGetCurrentPosition(winobj);
-    size_t buf_size = 0;
-    buf_size += sizeof(uint32_t); // idx
-    uint16_t num_nbrs = context->w->neighbors[curpos].num_nbrs;
-    buf_size += sizeof(uint16_t); // num_nbrs
-    buf_size += sizeof(uint32_t) * num_nbrs;
-    if (context->w->w_type == 'w') {
-        buf_size += sizeof(float) * num_nbrs;
-    }
-
-    uint8_t *buf = palloc(buf_size);
-    uint8_t *pos = buf; // retain the start pos
-    memcpy(buf, &(context->w->neighbors[curpos].idx), sizeof(uint32_t)); // copy idx
-    buf += sizeof(uint32_t);
-
-    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
-    buf += sizeof(uint16_t);
 
-    for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_id
-        memcpy(buf, &context->w->neighbors[curpos].nbrId[j], sizeof(uint32_t));
-        buf += sizeof(uint32_t);
-    }
-
-    if (context->w->w_type == 'w') {
-        for (size_t j = 0; j < num_nbrs; ++j) { // copy nbr_weight
-            memcpy(buf, &context->w->neighbors[curpos].nbrWeight[j], sizeof(float));
-            buf += sizeof(float);
-        }
-    }
-
-    // copy to bytea type
-    bytea *result = palloc(buf_size + VARHDRSZ);
-    SET_VARSIZE(result, buf_size+VARHDRSZ);
-    memcpy(VARDATA(result), pos, buf_size);
-
-    // clean
-    pfree(pos);
-
-    PG_RETURN_BYTEA_P(result);
+    // the bytea of the current row is in the arena: no allocation or copy here
+    PG_RETURN_BYTEA_P(weights_arena_get(context->arena, curpos));
 }
 
 /**
@@ -560,8 +527,7 @@ Datum pg_kernel_knn_weights_window(PG_FUNCTION_ARGS) {
  */
 typedef struct
 {
-    List *geoms;  /* collected geometries */
-    List *ogc_fids;
+    PGGeometries *geoms;  /* collected (decoded) geometries and fids */
     int k;
     double power;
     bool is_arc;
@@ -602,8 +568,7 @@ Datum bytea_knn_geom_transfn(PG_FUNCTION_ARGS)
     if ( PG_ARGISNULL(0) ) {
         // first incoming row/item
         state = (KnnCollectionState*)MemoryContextAlloc(aggcontext, sizeof(KnnCollectionState));
-        state->geoms = NULL;
-        state->ogc_fids = NULL;
+        state->geoms = create_agg_pg_geometries(aggcontext);
         state->k = 4;
         state->power = 1.0;
         state->is_arc = false;
@@ -614,12 +579,8 @@ Datum bytea_knn_geom_transfn(PG_FUNCTION_ARGS)
         state = (KnnCollectionState*) PG_GETARG_POINTER(0);
     }
 
-    LWGEOM* geom = 0;
     int idx = 0;
 
-    /* Take a copy of the geometry into the aggregate context */
-    MemoryContext old = MemoryContextSwitchTo(aggcontext);
-
     int arg_index = 1;
 
     // fid
@@ -628,16 +589,9 @@ Datum bytea_knn_geom_transfn(PG_FUNCTION_ARGS)
         arg_index += 1;
     }
 
-    // the_geom
-    if (!PG_ARGISNULL(arg_index)) {
-        bytea *bytea_wkb = PG_GETARG_BYTEA_P(arg_index);
-        uint8_t *wkb = (uint8_t *) VARDATA(bytea_wkb);
-        LWGEOM *lwgeom = lwgeom_from_wkb(wkb, VARSIZE_ANY_EXHDR(bytea_wkb), LW_PARSER_CHECK_ALL);
-        geom = lwgeom_clone_deep(lwgeom);
-        lwgeom_free(lwgeom);
-        //PG_FREE_IF_COPY(bytea_wkb, 0);
-        arg_index += 1;
-    }
+    // the_geom: decoded right away, no copy is kept in the aggregate context
+    add_pg_geometry_datum(state->geoms, idx, PG_GETARG_DATUM(arg_index), PG_ARGISNULL(arg_index));
+    arg_index += 1;
 
     // k
     int k= 4;
@@ -659,17 +613,6 @@ Datum bytea_knn_geom_transfn(PG_FUNCTION_ARGS)
         arg_index += 1;
     }
 
-    /* Initialize or append to list as necessary */
-    if (state->geoms) {
-        state->geoms = lappend(state->geoms, geom); // pg_list
-        state->ogc_fids = lappend_int(state->ogc_fids, idx);
-    } else {
-        state->geoms = list_make1(geom);
-        state->ogc_fids = list_make1_int(idx);
-    }
-
-    MemoryContextSwitchTo(old);
-
     lwdebug(5, "Exit bytea_knn_geom_transfn().");
     PG_RETURN_POINTER(state);
 }
@@ -689,7 +632,7 @@ Datum geom_knn_weights_bin_finalfn(PG_FUNCTION_ARGS)
 
     p = (KnnCollectionState*) PG_GETARG_POINTER(0);
 
-    PGWeight* w = create_knn_weights(p->ogc_fids, p->geoms, p->k, 1.0, false, false, false);
+    PGWeight* w = create_knn_weights(p->geoms, p->k, 1.0, false, false, false, 1);
 
     size_t buf_size = 0;
     uint8_t* w_bytes = weights_to_bytes(w, &buf_size);
@@ -706,6 +649,203 @@ Datum geom_knn_weights_bin_finalfn(PG_FUNCTION_ARGS)
     PG_RETURN_BYTEA_P(result);
 }
 
+/**
+ * knn_index_cache
+ *
+ * The prepared SPI plan of `pg_knn_weights_index`, which is cached in fn_extra so it is
+ * only prepared once per query (per backend or parallel worker).
+ */
+typedef struct {
+    Oid relid;
+    Oid geomOid;
+    char *fid_col;
+    char *geom_col;
+    SPIPlanPtr plan;
+} knn_index_cache;
+
+static SPIPlanPtr knn_index_get_plan(FunctionCallInfo fcinfo, Oid relid, Oid geomOid,
+                                     const char *fid_col, const char *geom_col) {
+    knn_index_cache *cache = (knn_index_cache*)fcinfo->flinfo->fn_extra;
+
+    if (cache != NULL && cache->relid == relid && cache->geomOid == geomOid &&
+        strcmp(cache->fid_col, fid_col) == 0 && strcmp(cache->geom_col, geom_col) == 0) {
+        return cache->plan;
+    }
+
+    if (cache == NULL) {
+        cache = (knn_index_cache*)MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(knn_index_cache));
+        fcinfo->flinfo->fn_extra = cache;
+    } else {
+        if (cache->plan) SPI_freeplan(cache->plan);
+        pfree(cache->fid_col);
+        pfree(cache->geom_col);
+    }
+
+    char *rel_name = get_rel_name(relid);
+    if (rel_name == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_TABLE),
+                        errmsg("relation with OID %u does not exist", relid)));
+    }
+    const char *tbl = quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)), rel_name);
+    const char *fid = quote_identifier(fid_col);
+    const char *geom = quote_identifier(geom_col);
+
+    // The neighbors are ordered by the distance of the centroids, like knn_weights(), not by the
+    // distance of the geometries (<-> of two polygons). With a GiST index on ST_Centroid(geom),
+    // the ORDER BY <-> LIMIT is a KNN index scan, so only k rows are read for each query; ties
+    // are broken by fid.
+    StringInfoData sql;
+    initStringInfo(&sql);
+    appendStringInfo(&sql,
+                     "SELECT %s, ST_Distance(ST_Centroid(%s), ST_Centroid($1)) FROM %s WHERE %s <> $2 AND %s IS NOT NULL "
+                     "ORDER BY ST_Centroid(%s) <-> ST_Centroid($1), %s LIMIT $3",
+                     fid, geom, tbl, fid, geom, geom, fid);
+    lwdebug(1, "knn_index_get_plan: %s", sql.data);
+
+    Oid argtypes[3] = {geomOid, INT8OID, INT4OID};
+    SPIPlanPtr plan = SPI_prepare(sql.data, 3, argtypes);
+    if (plan == NULL) {
+        elog(ERROR, "knn_weights_index: SPI_prepare failed: %s", SPI_result_code_string(SPI_result));
+    }
+    SPI_keepplan(plan);
+    pfree(sql.data);
+
+    cache->relid = relid;
+    cache->geomOid = geomOid;
+    cache->fid_col = MemoryContextStrdup(fcinfo->flinfo->fn_mcxt, fid_col);
+    cache->geom_col = MemoryContextStrdup(fcinfo->flinfo->fn_mcxt, geom_col);
+    cache->plan = plan;
+
+    return plan;
+}
+
+/**
+ * pg_knn_weights_index
+ *
+ * This function is for SQL function: knn_weights_index(fid, geom, k, table, fid_col, geom_col)
+ *
+ * Unlike the Window function `knn_weights()`, it is a plain (per-row) function: the k nearest
+ * neighbors of the input geometry, by the distance of the centroids, are queried from the table
+ * using the GiST index on ST_Centroid() of its geometry column (operator <->), so only O(k)
+ * memory is used for each row, and the query can run in parallel workers.
+ *
+ * The returned bytea has the same format as the result of `knn_weights()` for one row: the
+ * weights are the distances of the centroids to the neighbors, or the inverse distances
+ * (d^-power) if is_inverse is true.
+ *
+ * NOTE: the distances are the ones of ST_Distance(), so is_arc is not supported. The
+ * neighbors of rows with same distance are ordered by fid.
+ *
+ * @param fcinfo
+ * @return
+ */
+Datum pg_knn_weights_index(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pg_knn_weights_index);
+Datum pg_knn_weights_index(PG_FUNCTION_ARGS) {
+    int64 fid = PG_GETARG_INT32(0);
+    Datum geom = PG_GETARG_DATUM(1);
+    int k = PG_GETARG_INT32(2);
+    Oid relid = PG_GETARG_OID(3);
+    char *fid_col = text_to_cstring(PG_GETARG_TEXT_PP(4));
+    char *geom_col = text_to_cstring(PG_GETARG_TEXT_PP(5));
+
+    double power = 1.0;
+    if (PG_NARGS() > 6) {
+        power = PG_GETARG_FLOAT4(6);
+        if (power < 0) power = 1.0;
+    }
+
+    bool is_inverse = false;
+    if (PG_NARGS() > 7) {
+        is_inverse = PG_GETARG_BOOL(7);
+    }
+
+    if (k <= 0) k = 4;
+    if (k > UINT16_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("k has to be less than %d", UINT16_MAX)));
+    }
+
+    Oid geomOid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+    if (geomOid == InvalidOid) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("could not determine input data type")));
+    }
+
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        elog(ERROR, "knn_weights_index: SPI_connect failed");
+    }
+
+    SPIPlanPtr plan = knn_index_get_plan(fcinfo, relid, geomOid, fid_col, geom_col);
+
+    Datum values[3] = {geom, Int64GetDatum(fid), Int32GetDatum(k)};
+    int ret = SPI_execute_plan(plan, values, NULL, true, 0);
+    if (ret != SPI_OK_SELECT) {
+        elog(ERROR, "knn_weights_index: SPI_execute_plan failed: %s", SPI_result_code_string(ret));
+    }
+
+    uint16_t num_nbrs = (uint16_t)SPI_processed;
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    Oid fid_type = SPI_gettypeid(tupdesc, 1);
+    if (fid_type != INT2OID && fid_type != INT4OID && fid_type != INT8OID) {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATATYPE_MISMATCH),
+                        errmsg("column \"%s\" has to be an integer type", fid_col)));
+    }
+
+    size_t buf_size = 0;
+    buf_size += sizeof(uint32_t); // idx
+    buf_size += sizeof(uint16_t); // num_nbrs
+    buf_size += sizeof(uint32_t) * num_nbrs;
+    buf_size += sizeof(float) * num_nbrs; // the weights, like knn_weights()
+
+    // allocated in the caller's memory context, so it is still valid after SPI_finish()
+    bytea *result = (bytea*)SPI_palloc(buf_size + VARHDRSZ);
+    SET_VARSIZE(result, buf_size + VARHDRSZ);
+
+    uint8_t *buf = (uint8_t*)VARDATA(result);
+    uint32_t idx = (uint32_t)fid;
+    memcpy(buf, &idx, sizeof(uint32_t)); // copy idx
+    buf += sizeof(uint32_t);
+
+    memcpy(buf, &num_nbrs, sizeof(uint16_t)); // copy n_nbrs
+    buf += sizeof(uint16_t);
+
+    uint8_t *wbuf = buf + sizeof(uint32_t) * num_nbrs;
+
+    for (uint16_t j = 0; j < num_nbrs; ++j) {
+        HeapTuple tuple = SPI_tuptable->vals[j];
+        bool isnull;
+
+        Datum nbr = SPI_getbinval(tuple, tupdesc, 1, &isnull);
+        uint32_t nid = 0;
+        if (!isnull) {
+            if (fid_type == INT2OID) nid = (uint32_t)DatumGetInt16(nbr);
+            else if (fid_type == INT4OID) nid = (uint32_t)DatumGetInt32(nbr);
+            else nid = (uint32_t)DatumGetInt64(nbr);
+        }
+        memcpy(buf, &nid, sizeof(uint32_t)); // copy nbr_id
+        buf += sizeof(uint32_t);
+
+        double dist = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+        if (isnull) dist = 0;
+        float nweight = (float)dist;
+        if (is_inverse) {
+            // coincident neighbors get weight 0 instead of infinity
+            nweight = dist <= 0 ? 0 : (float)pow(dist, -power);
+        }
+        memcpy(wbuf, &nweight, sizeof(float)); // copy nbr_weight
+        wbuf += sizeof(float);
+    }
+
+    SPI_finish();
+
+    PG_RETURN_BYTEA_P(result);
+}
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
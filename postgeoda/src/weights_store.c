@@ -0,0 +1,711 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the weights store, see weights_store.h
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <catalog/pg_authid.h>
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <lib/ilist.h>
+#include <storage/fd.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libgeoda/pg/utils.h>
+#include "weights.h"
+#include "weights_store.h"
+
+#if PG_VERSION_NUM < 110000
+#define OpenTransientFile(path, flags) OpenTransientFile((path), (flags), 0)
+#elif PG_VERSION_NUM < 140000
+#define ROLE_PG_READ_SERVER_FILES DEFAULT_ROLE_READ_SERVER_FILES
+#define ROLE_PG_WRITE_SERVER_FILES DEFAULT_ROLE_WRITE_SERVER_FILES
+#endif
+
+/* the number of rows fetched at once from the weights column */
+#define WEIGHTS_STORE_FETCH_SIZE 10000
+
+/**
+ * WeightsStoreMap
+ *
+ * A weights store mapped by the backend
+ */
+typedef struct {
+    dlist_node node;
+    char name[WEIGHTS_STORE_NAME_MAX + 1];
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    void *base;
+    WeightsStore store;
+} WeightsStoreMap;
+
+static dlist_head store_maps = DLIST_STATIC_INIT(store_maps);
+
+/**
+ * WeightsStoreWriter
+ *
+ * The state of weights_store_export(): the neighbors are written to the file (and the
+ * weights values to a temporary file) row by row, the fids and offsets are kept in memory
+ * and written at the end.
+ */
+typedef struct {
+    char *path;
+    char *tmp_path;
+    char *weights_path;
+    FILE *file;
+    FILE *weights_file;
+    int has_weights; /* -1 until a row with neighbors is read */
+    uint64 num_obs;
+    uint64 num_nbrs;
+    uint64 capacity;
+    uint32 *fids;
+    uint64 *offsets;
+    uint32 scratch_size;
+    uint32 *ids; /* scratch to decode a row */
+    float *weights;
+} WeightsStoreWriter;
+
+static void weights_store_check_role(bool write)
+{
+    if (superuser()) return;
+#if PG_VERSION_NUM >= 110000
+    if (has_privs_of_role(GetUserId(), write ? ROLE_PG_WRITE_SERVER_FILES : ROLE_PG_READ_SERVER_FILES)) return;
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                    errmsg("must be superuser or a member of the %s role to %s a weights store file",
+                           write ? "pg_write_server_files" : "pg_read_server_files",
+                           write ? "write" : "read")));
+#else
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                    errmsg("must be superuser to %s a weights store file", write ? "write" : "read")));
+#endif
+}
+
+static char *weights_store_check_name(const text *name)
+{
+    size_t len = VARSIZE_ANY_EXHDR(name);
+    if (len == 0 || len > WEIGHTS_STORE_NAME_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("the name of a weights store has to be 1 to %d bytes", WEIGHTS_STORE_NAME_MAX)));
+    }
+    return text_to_cstring(name);
+}
+
+/* an absolute path, relative paths are in the data directory, as in COPY */
+static char *weights_store_path(const text *path_text)
+{
+    char *path = text_to_cstring(path_text);
+    if (!is_absolute_path(path)) {
+        path = psprintf("%s/%s", DataDir, path);
+    }
+    canonicalize_path(path);
+    return path;
+}
+
+/**
+ * weights_store_registry
+ *
+ * The qualified name of the table geoda_weights_store, in the schema of the extension
+ * (it is relocatable). Called in a SPI connection.
+ */
+static char *weights_store_registry(void)
+{
+    int ret = SPI_execute("SELECT n.nspname FROM pg_catalog.pg_extension e "
+                          "JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+                          "WHERE e.extname = 'postgeoda'", true, 1);
+    if (ret != SPI_OK_SELECT || SPI_processed != 1) {
+        elog(ERROR, "weights store: the extension postgeoda is not installed");
+    }
+    char *nspname = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+    return psprintf("%s.geoda_weights_store", quote_identifier(nspname));
+}
+
+/**
+ * weights_store_lookup
+ *
+ * @param name
+ * @return the path of the weights store registered as name (in the current memory context)
+ */
+static char *weights_store_lookup(const char *name)
+{
+    MemoryContext ctx = CurrentMemoryContext;
+    char *path = NULL;
+
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        elog(ERROR, "weights store: SPI_connect failed");
+    }
+    char *sql = psprintf("SELECT path FROM %s WHERE name = $1", weights_store_registry());
+    Oid argtypes[1] = {TEXTOID};
+    Datum values[1] = {CStringGetTextDatum(name)};
+    int ret = SPI_execute_with_args(sql, 1, argtypes, values, NULL, true, 1);
+    if (ret != SPI_OK_SELECT) {
+        elog(ERROR, "weights store: SPI_execute failed: %s", SPI_result_code_string(ret));
+    }
+    if (SPI_processed == 1) {
+        char *value = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+        if (value != NULL) path = MemoryContextStrdup(ctx, value);
+    }
+    SPI_finish();
+
+    if (path == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                        errmsg("weights store \"%s\" is not registered", name)));
+    }
+    return path;
+}
+
+/**
+ * weights_store_register_file
+ *
+ * Add or replace the weights store name in geoda_weights_store. Called in a SPI connection.
+ */
+static void weights_store_register_file(const char *name, const char *path, uint64 num_obs, uint64 num_nbrs,
+                                        bool has_weights)
+{
+    char *sql = psprintf("INSERT INTO %s (name, path, num_obs, num_nbrs, has_weights) "
+                         "VALUES ($1, $2, $3, $4, $5) "
+                         "ON CONFLICT (name) DO UPDATE SET path = EXCLUDED.path, num_obs = EXCLUDED.num_obs, "
+                         "num_nbrs = EXCLUDED.num_nbrs, has_weights = EXCLUDED.has_weights, created = now()",
+                         weights_store_registry());
+    Oid argtypes[5] = {TEXTOID, TEXTOID, INT8OID, INT8OID, BOOLOID};
+    Datum values[5];
+    values[0] = CStringGetTextDatum(name);
+    values[1] = CStringGetTextDatum(path);
+    values[2] = Int64GetDatum((int64)num_obs);
+    values[3] = Int64GetDatum((int64)num_nbrs);
+    values[4] = BoolGetDatum(has_weights);
+
+    int ret = SPI_execute_with_args(sql, 5, argtypes, values, NULL, false, 0);
+    if (ret != SPI_OK_INSERT) {
+        elog(ERROR, "weights store: SPI_execute failed: %s", SPI_result_code_string(ret));
+    }
+}
+
+/**
+ * weights_store_map_file
+ *
+ * Map the file read-only and shared, so its pages in the OS page cache are shared by all
+ * backends
+ *
+ * @param path
+ * @param st the status of the mapped file
+ * @return
+ */
+static void *weights_store_map_file(const char *path, struct stat *st)
+{
+    int fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+    if (fd < 0) {
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not open file \"%s\": %m", path)));
+    }
+    if (fstat(fd, st) < 0) {
+        int save_errno = errno;
+        CloseTransientFile(fd);
+        errno = save_errno;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not stat file \"%s\": %m", path)));
+    }
+    if (st->st_size < (off_t)sizeof(WeightsStoreHeader)) {
+        CloseTransientFile(fd);
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("\"%s\" is not a weights store file", path)));
+    }
+
+    void *base = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int save_errno = errno;
+    CloseTransientFile(fd);
+    if (base == MAP_FAILED) {
+        errno = save_errno;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not map file \"%s\": %m", path)));
+    }
+    return base;
+}
+
+static void weights_store_attach_file(const char *path, void *base, size_t size, WeightsStore *store)
+{
+    if (!weights_store_attach((const uint8_t*)base, size, store)) {
+        munmap(base, size);
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("\"%s\" is not a valid weights store file", path)));
+    }
+}
+
+const WeightsStore *weights_store_open(const char *name, size_t name_len)
+{
+    char *store_name = pnstrdup(name, name_len);
+    char *path = weights_store_lookup(store_name);
+
+    WeightsStoreMap *map = NULL;
+    dlist_iter iter;
+    dlist_foreach(iter, &store_maps) {
+        WeightsStoreMap *m = dlist_container(WeightsStoreMap, node, iter.cur);
+        if (strcmp(m->name, store_name) == 0) {
+            map = m;
+            break;
+        }
+    }
+
+    // the file is the same if it is not exported again
+    struct stat st;
+    if (map != NULL && strcmp(map->path, path) == 0 && stat(path, &st) == 0 &&
+        st.st_dev == map->dev && st.st_ino == map->ino && st.st_size == map->size && st.st_mtime == map->mtime) {
+        pfree(store_name);
+        pfree(path);
+        return &map->store;
+    }
+
+    if (map != NULL) {
+        dlist_delete(&map->node);
+        munmap(map->base, (size_t)map->size);
+        pfree(map->path);
+        pfree(map);
+    }
+
+    void *base = weights_store_map_file(path, &st);
+    map = MemoryContextAllocZero(TopMemoryContext, sizeof(WeightsStoreMap));
+    weights_store_attach_file(path, base, (size_t)st.st_size, &map->store);
+
+    strlcpy(map->name, store_name, sizeof(map->name));
+    map->path = MemoryContextStrdup(TopMemoryContext, path);
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+    map->size = st.st_size;
+    map->mtime = st.st_mtime;
+    map->base = base;
+    dlist_push_head(&store_maps, &map->node);
+
+    lwdebug(1, "weights_store_open: %s, N=%d", path, (int)map->store.num_obs);
+    pfree(store_name);
+    pfree(path);
+    return &map->store;
+}
+
+static void weights_store_fwrite(FILE *file, const char *path, const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not write to file \"%s\": %m", path)));
+    }
+}
+
+/* write zeros up to the next 8 bytes */
+static uint64 weights_store_pad(WeightsStoreWriter *writer, uint64 pos)
+{
+    static const uint8 zeros[8] = {0};
+    uint64 aligned = weights_store_align(pos);
+    weights_store_fwrite(writer->file, writer->tmp_path, zeros, (size_t)(aligned - pos));
+    return aligned;
+}
+
+static void weights_store_writer_begin(WeightsStoreWriter *writer, char *path)
+{
+    WeightsStoreHeader header;
+
+    memset(writer, 0, sizeof(WeightsStoreWriter));
+    writer->path = path;
+    writer->tmp_path = psprintf("%s.tmp", path);
+    writer->weights_path = psprintf("%s.weights.tmp", path);
+    writer->has_weights = -1;
+    writer->capacity = 1024;
+    writer->fids = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(uint32) * writer->capacity);
+    writer->offsets = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(uint64) * (writer->capacity + 1));
+    writer->scratch_size = 1024;
+    writer->ids = palloc(sizeof(uint32) * writer->scratch_size);
+    writer->weights = palloc(sizeof(float) * writer->scratch_size);
+
+    writer->file = AllocateFile(writer->tmp_path, PG_BINARY_W);
+    if (writer->file == NULL) {
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not create file \"%s\": %m", writer->tmp_path)));
+    }
+    writer->weights_file = AllocateFile(writer->weights_path, PG_BINARY_W);
+    if (writer->weights_file == NULL) {
+        int save_errno = errno;
+        FreeFile(writer->file);
+        unlink(writer->tmp_path);
+        errno = save_errno;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not create file \"%s\": %m", writer->weights_path)));
+    }
+
+    // the header is written at the end
+    memset(&header, 0, sizeof(WeightsStoreHeader));
+    weights_store_fwrite(writer->file, writer->tmp_path, &header, sizeof(WeightsStoreHeader));
+}
+
+static void weights_store_add_row(WeightsStoreWriter *writer, const WeightsRow *row)
+{
+    uint32 nn = row->num_nbrs;
+
+    // observations without neighbors are the same with or without weights values
+    if (nn > 0) {
+        if (writer->has_weights < 0) {
+            writer->has_weights = row->has_weights;
+        } else if (writer->has_weights != (int)row->has_weights) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("weights_store_export: the weights of observation %u are not "
+                                   "the same type as the others", row->idx)));
+        }
+    }
+    if (writer->num_obs >= UINT32_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("weights_store_export: more than %u observations", UINT32_MAX)));
+    }
+
+    if (writer->num_obs == writer->capacity) {
+        writer->capacity *= 2;
+        writer->fids = repalloc_huge(writer->fids, sizeof(uint32) * writer->capacity);
+        writer->offsets = repalloc_huge(writer->offsets, sizeof(uint64) * (writer->capacity + 1));
+    }
+    writer->fids[writer->num_obs] = row->idx;
+    writer->offsets[writer->num_obs] = writer->num_nbrs;
+
+    if (nn > writer->scratch_size) {
+        writer->scratch_size = nn;
+        writer->ids = repalloc_huge(writer->ids, sizeof(uint32) * nn);
+        writer->weights = repalloc_huge(writer->weights, sizeof(float) * nn);
+    }
+    if (!weights_codec_get_ids(row, writer->ids)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("weights_store_export: invalid neighbors of observation %u", row->idx)));
+    }
+    weights_store_fwrite(writer->file, writer->tmp_path, writer->ids, sizeof(uint32) * (size_t)nn);
+    if (nn > 0 && row->has_weights) {
+        weights_codec_get_weights(row, writer->weights);
+        weights_store_fwrite(writer->weights_file, writer->weights_path, writer->weights,
+                             sizeof(float) * (size_t)nn);
+    }
+
+    writer->num_obs += 1;
+    writer->num_nbrs += nn;
+}
+
+static int weights_store_fid_cmp(const void *a, const void *b, void *arg)
+{
+    const uint32 *fids = (const uint32*)arg;
+    uint32 fa = fids[*(const uint32*)a], fb = fids[*(const uint32*)b];
+    return fa < fb ? -1 : (fa > fb ? 1 : 0);
+}
+
+/**
+ * weights_store_writer_end
+ *
+ * Write the weights values, the fids, the offsets, the rows sorted by fid and the header,
+ * then rename the temporary file to the weights store file
+ */
+static void weights_store_writer_end(WeightsStoreWriter *writer)
+{
+    WeightsStoreHeader header;
+    uint64 N = writer->num_obs;
+    bool has_weights = writer->has_weights > 0;
+
+    memset(&header, 0, sizeof(WeightsStoreHeader));
+    memcpy(header.magic, WEIGHTS_STORE_MAGIC, sizeof(header.magic));
+    header.version = WEIGHTS_STORE_VERSION;
+    header.flags = has_weights ? WEIGHTS_STORE_HAS_WEIGHTS : 0;
+    header.num_obs = N;
+    header.num_nbrs = writer->num_nbrs;
+
+    header.ids_offset = sizeof(WeightsStoreHeader);
+    uint64 pos = weights_store_pad(writer, header.ids_offset + sizeof(uint32) * writer->num_nbrs);
+
+    // append the weights values from the temporary file
+    if (FreeFile(writer->weights_file) != 0) {
+        writer->weights_file = NULL;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not close file \"%s\": %m", writer->weights_path)));
+    }
+    writer->weights_file = NULL;
+    if (has_weights) {
+        FILE *weights_file = AllocateFile(writer->weights_path, PG_BINARY_R);
+        if (weights_file == NULL) {
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                            errmsg("could not open file \"%s\": %m", writer->weights_path)));
+        }
+        char *buf = palloc(BLCKSZ * 8);
+        size_t n;
+        while ((n = fread(buf, 1, BLCKSZ * 8, weights_file)) > 0) {
+            weights_store_fwrite(writer->file, writer->tmp_path, buf, n);
+        }
+        if (ferror(weights_file)) {
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                            errmsg("could not read file \"%s\": %m", writer->weights_path)));
+        }
+        FreeFile(weights_file);
+        pfree(buf);
+
+        header.weights_offset = pos;
+        pos = weights_store_pad(writer, pos + sizeof(float) * writer->num_nbrs);
+    }
+    unlink(writer->weights_path);
+
+    header.fids_offset = pos;
+    weights_store_fwrite(writer->file, writer->tmp_path, writer->fids, sizeof(uint32) * N);
+    pos = weights_store_pad(writer, pos + sizeof(uint32) * N);
+
+    header.offsets_offset = pos;
+    writer->offsets[N] = writer->num_nbrs;
+    weights_store_fwrite(writer->file, writer->tmp_path, writer->offsets, sizeof(uint64) * (N + 1));
+    pos += sizeof(uint64) * (N + 1);
+
+    // the rows sorted by fid: a fid can't be in more than one row
+    uint32 *order = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(uint32) * (N > 0 ? N : 1));
+    for (uint64 i = 0; i < N; ++i) order[i] = (uint32)i;
+    qsort_arg(order, N, sizeof(uint32), weights_store_fid_cmp, writer->fids);
+    for (uint64 i = 1; i < N; ++i) {
+        if (writer->fids[order[i]] == writer->fids[order[i - 1]]) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("weights_store_export: observation %u is duplicated",
+                                   writer->fids[order[i]])));
+        }
+    }
+    header.order_offset = pos;
+    weights_store_fwrite(writer->file, writer->tmp_path, order, sizeof(uint32) * N);
+    pos += sizeof(uint32) * N;
+    pfree(order);
+
+    header.file_size = pos;
+    if (fseeko(writer->file, 0, SEEK_SET) != 0) {
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not seek in file \"%s\": %m", writer->tmp_path)));
+    }
+    weights_store_fwrite(writer->file, writer->tmp_path, &header, sizeof(WeightsStoreHeader));
+
+    if (fflush(writer->file) != 0 || pg_fsync(fileno(writer->file)) != 0) {
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not write to file \"%s\": %m", writer->tmp_path)));
+    }
+    if (FreeFile(writer->file) != 0) {
+        writer->file = NULL;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                        errmsg("could not close file \"%s\": %m", writer->tmp_path)));
+    }
+    writer->file = NULL;
+
+    // a backend that has mapped the old file keeps it until it opens the weights store again
+    durable_rename(writer->tmp_path, writer->path, ERROR);
+}
+
+static void weights_store_writer_abort(WeightsStoreWriter *writer)
+{
+    // the files are closed at the end of the transaction
+    unlink(writer->tmp_path);
+    unlink(writer->weights_path);
+}
+
+/**
+ * weights_store_export
+ *
+ * Used in SQL function weights_store_export(name, w_table, w_column, path)
+ *
+ * Write the weights (bytea) of all rows of w_column in w_table, in v1 or v2, to a weights
+ * store file and register it as name in geoda_weights_store. The rows are read with a
+ * cursor, so only the fids and the offsets of the neighbors are kept in memory.
+ *
+ * @param fcinfo
+ * @return the number of observations
+ */
+Datum weights_store_export(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_store_export);
+
+Datum weights_store_export(PG_FUNCTION_ARGS)
+{
+    char *name = weights_store_check_name(PG_GETARG_TEXT_PP(0));
+    Oid relid = PG_GETARG_OID(1);
+    char *column = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    char *path = weights_store_path(PG_GETARG_TEXT_PP(3));
+
+    weights_store_check_role(true);
+
+    char *relname = get_rel_name(relid);
+    if (relname == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_TABLE),
+                        errmsg("weights_store_export: relation with OID %u does not exist", relid)));
+    }
+    char *query = psprintf("SELECT %s FROM %s", quote_identifier(column),
+                           quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)), relname));
+
+    WeightsStoreWriter writer;
+    weights_store_writer_begin(&writer, path);
+    MemoryContext row_ctx = AllocSetContextCreate(CurrentMemoryContext, "weights_store_export rows",
+                                                  ALLOCSET_DEFAULT_SIZES);
+
+    PG_TRY();
+    {
+        if (SPI_connect() != SPI_OK_CONNECT) {
+            elog(ERROR, "weights_store_export: SPI_connect failed");
+        }
+        SPIPlanPtr plan = SPI_prepare(query, 0, NULL);
+        if (plan == NULL) {
+            elog(ERROR, "weights_store_export: SPI_prepare failed: %s", SPI_result_code_string(SPI_result));
+        }
+        Portal portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+        for (;;) {
+            SPI_cursor_fetch(portal, true, WEIGHTS_STORE_FETCH_SIZE);
+            if (SPI_processed == 0) break;
+
+            TupleDesc tupdesc = SPI_tuptable->tupdesc;
+            if (SPI_gettypeid(tupdesc, 1) != BYTEAOID) {
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATATYPE_MISMATCH),
+                                errmsg("weights_store_export: column \"%s\" is not bytea", column)));
+            }
+
+            MemoryContext old_ctx = MemoryContextSwitchTo(row_ctx);
+            for (uint64 i = 0; i < SPI_processed; ++i) {
+                bool isnull;
+                Datum value = SPI_getbinval(SPI_tuptable->vals[i], tupdesc, 1, &isnull);
+                if (isnull) continue;
+
+                // the weights of one observation, or the complete weights
+                bytea *bw = DatumGetByteaPP(value);
+                WeightsRow row;
+                WeightsReader reader;
+                if (weights_codec_open((const uint8_t*)VARDATA_ANY(bw), VARSIZE_ANY_EXHDR(bw), &reader)) {
+                    for (uint32 j = 0; j < reader.num_obs; ++j) {
+                        weights_next_row(&reader, &row);
+                        weights_store_add_row(&writer, &row);
+                    }
+                } else {
+                    weights_read_row(bw, &row);
+                    weights_store_add_row(&writer, &row);
+                }
+            }
+            MemoryContextSwitchTo(old_ctx);
+            MemoryContextReset(row_ctx);
+            SPI_freetuptable(SPI_tuptable);
+        }
+        SPI_cursor_close(portal);
+
+        weights_store_writer_end(&writer);
+        weights_store_register_file(name, path, writer.num_obs, writer.num_nbrs, writer.has_weights > 0);
+        SPI_finish();
+    }
+    PG_CATCH();
+    {
+        weights_store_writer_abort(&writer);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    MemoryContextDelete(row_ctx);
+    lwdebug(1, "weights_store_export: %s, N=%d", path, (int)writer.num_obs);
+    PG_RETURN_INT64((int64)writer.num_obs);
+}
+
+/**
+ * weights_store_register
+ *
+ * Used in SQL function weights_store_register(name, path)
+ *
+ * Register an existing weights store file (e.g. copied from another server) as name
+ *
+ * @param fcinfo
+ * @return the number of observations
+ */
+Datum weights_store_register(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_store_register);
+
+Datum weights_store_register(PG_FUNCTION_ARGS)
+{
+    char *name = weights_store_check_name(PG_GETARG_TEXT_PP(0));
+    char *path = weights_store_path(PG_GETARG_TEXT_PP(1));
+
+    weights_store_check_role(false);
+
+    struct stat st;
+    WeightsStore store;
+    void *base = weights_store_map_file(path, &st);
+    weights_store_attach_file(path, base, (size_t)st.st_size, &store);
+    munmap(base, (size_t)st.st_size);
+
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        elog(ERROR, "weights_store_register: SPI_connect failed");
+    }
+    weights_store_register_file(name, path, store.num_obs, store.num_nbrs, store.has_weights);
+    SPI_finish();
+
+    PG_RETURN_INT64((int64)store.num_obs);
+}
+
+/**
+ * weights_store_ref
+ *
+ * Used in SQL function weights_store_ref(name, fid)
+ *
+ * A reference to the weights of observation fid in the weights store name, which can be
+ * used in place of the weights (bytea) in the LISA functions, see weights_codec.h
+ *
+ * @param fcinfo
+ * @return bytea
+ */
+Datum weights_store_ref(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_store_ref);
+
+Datum weights_store_ref(PG_FUNCTION_ARGS)
+{
+    text *name = PG_GETARG_TEXT_PP(0);
+    int32 fid = PG_GETARG_INT32(1);
+    size_t name_len = VARSIZE_ANY_EXHDR(name);
+
+    if (name_len == 0 || name_len > WEIGHTS_STORE_NAME_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("the name of a weights store has to be 1 to %d bytes", WEIGHTS_STORE_NAME_MAX)));
+    }
+    if (fid < 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("weights_store_ref: fid can not be negative")));
+    }
+
+    bytea *result = palloc(WEIGHTS_STORE_REF_MAX_SIZE + VARHDRSZ);
+    size_t size = weights_codec_write_store_ref((uint8_t*)VARDATA(result), (uint32)fid, VARDATA_ANY(name), name_len);
+    SET_VARSIZE(result, size + VARHDRSZ);
+    PG_RETURN_BYTEA_P(result);
+}
+
+#ifdef __cplusplus
+}
+#endif
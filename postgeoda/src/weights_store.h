@@ -0,0 +1,195 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the weights store: spatial weights in a server-side file, mapped read-only
+ *
+ * A weights store is a file with the weights of all observations in compressed sparse row
+ * arrays, written by weights_store_export() from a weights column and registered by name in
+ * the table geoda_weights_store. The LISA functions read it with mmap() instead of the
+ * weights (bytea) of each row, e.g.
+ *
+ *   SELECT local_moran(hr60, weights_store_ref('nat_knn', ogc_fid)) OVER () FROM nat;
+ *
+ * so the weights of a large table (e.g. KNN weights of 50 million observations) are not read
+ * from TOAST in each query, and the pages of the file are shared by all backends through the
+ * OS page cache.
+ *
+ * The file (native byte order, all sections aligned to 8 bytes):
+ *
+ * WeightsStoreHeader
+ * uint32 x num_nbrs: the fids of the neighbors of all observations
+ * float x num_nbrs: the weights values, only if WEIGHTS_STORE_HAS_WEIGHTS
+ * uint32 x num_obs: the fid of each observation (row)
+ * uint64 x (num_obs + 1): the neighbors of i-th row are [offsets[i], offsets[i+1])
+ * uint32 x num_obs: the rows sorted by fid, to find the row of a fid
+ */
+
+#ifndef __POST_WEIGHTS_STORE__
+#define __POST_WEIGHTS_STORE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "weights_codec.h"
+
+#define WEIGHTS_STORE_MAGIC "GDWSTORE"
+#define WEIGHTS_STORE_VERSION 1
+#define WEIGHTS_STORE_HAS_WEIGHTS 0x01
+
+typedef struct {
+    char magic[8]; /* WEIGHTS_STORE_MAGIC, without NUL */
+    uint32_t version;
+    uint32_t flags;
+    uint64_t num_obs;
+    uint64_t num_nbrs; /* the total number of neighbors */
+    uint64_t ids_offset;
+    uint64_t weights_offset; /* 0 if there are no weights values */
+    uint64_t fids_offset;
+    uint64_t offsets_offset;
+    uint64_t order_offset;
+    uint64_t file_size;
+} WeightsStoreHeader;
+
+/**
+ * WeightsStore
+ *
+ * The sections of a weights store file in memory
+ */
+typedef struct {
+    uint32_t num_obs;
+    uint64_t num_nbrs;
+    bool has_weights;
+    const uint32_t *ids;
+    const float *weights; /* or NULL */
+    const uint32_t *fids;
+    const uint64_t *offsets;
+    const uint32_t *order;
+} WeightsStore;
+
+static inline uint64_t weights_store_align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static inline bool weights_store_section_ok(uint64_t offset, uint64_t count, uint64_t elem_size,
+                                            uint64_t file_size) {
+    return offset % 8 == 0 && offset >= sizeof(WeightsStoreHeader) && offset <= file_size &&
+           count <= (file_size - offset) / elem_size;
+}
+
+/**
+ * weights_store_attach
+ *
+ * Check the header of a weights store file in memory (e.g. mapped by mmap()) and set the
+ * sections of store. The offsets are checked when a row is read.
+ *
+ * @param base aligned to 8 bytes
+ * @param size
+ * @param store
+ * @return false if it is not a valid weights store
+ */
+static inline bool weights_store_attach(const uint8_t *base, size_t size, WeightsStore *store) {
+    WeightsStoreHeader header;
+    if (size < sizeof(WeightsStoreHeader)) return false;
+    memcpy(&header, base, sizeof(WeightsStoreHeader));
+
+    if (memcmp(header.magic, WEIGHTS_STORE_MAGIC, sizeof(header.magic)) != 0) return false;
+    if (header.version != WEIGHTS_STORE_VERSION || header.file_size != size) return false;
+    if (header.num_obs > UINT32_MAX) return false;
+
+    bool has_weights = (header.flags & WEIGHTS_STORE_HAS_WEIGHTS) != 0;
+    if (!weights_store_section_ok(header.ids_offset, header.num_nbrs, sizeof(uint32_t), size) ||
+        (has_weights && !weights_store_section_ok(header.weights_offset, header.num_nbrs, sizeof(float), size)) ||
+        !weights_store_section_ok(header.fids_offset, header.num_obs, sizeof(uint32_t), size) ||
+        !weights_store_section_ok(header.offsets_offset, header.num_obs + 1, sizeof(uint64_t), size) ||
+        !weights_store_section_ok(header.order_offset, header.num_obs, sizeof(uint32_t), size)) {
+        return false;
+    }
+
+    store->num_obs = (uint32_t)header.num_obs;
+    store->num_nbrs = header.num_nbrs;
+    store->has_weights = has_weights;
+    store->ids = (const uint32_t*)(base + header.ids_offset);
+    store->weights = has_weights ? (const float*)(base + header.weights_offset) : NULL;
+    store->fids = (const uint32_t*)(base + header.fids_offset);
+    store->offsets = (const uint64_t*)(base + header.offsets_offset);
+    store->order = (const uint32_t*)(base + header.order_offset);
+    return true;
+}
+
+/**
+ * weights_store_find
+ *
+ * @param store
+ * @param fid
+ * @return the row of the fid, or -1 if the fid is not in the store
+ */
+static inline int64_t weights_store_find(const WeightsStore *store, uint32_t fid) {
+    uint32_t lo = 0, hi = store->num_obs;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t row = store->order[mid];
+        if (row >= store->num_obs) return -1;
+        if (store->fids[row] < fid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == store->num_obs) return -1;
+    uint32_t row = store->order[lo];
+    return store->fids[row] == fid ? (int64_t)row : -1;
+}
+
+/**
+ * weights_store_row
+ *
+ * The weights of a row of the store as a v1 WeightsRow pointing into the store: the ids
+ * and the weights values are not contiguous, so the row can be read by the functions of
+ * weights_codec.h but not copied by weights_codec_copy_row().
+ *
+ * @param store
+ * @param r
+ * @param row
+ * @return false if the offsets of the row are not valid
+ */
+static inline bool weights_store_row(const WeightsStore *store, uint32_t r, WeightsRow *row) {
+    uint64_t start = store->offsets[r], end = store->offsets[r + 1];
+    if (start > end || end > store->num_nbrs || end - start > UINT32_MAX) return false;
+
+    row->version = 1;
+    row->w_enc = WEIGHTS_ENC_F32;
+    row->has_weights = store->has_weights;
+    row->wide_count = true;
+    row->idx = store->fids[r];
+    row->num_nbrs = (uint32_t)(end - start);
+    row->ids = (const uint8_t*)(store->ids + start);
+    row->weights = store->has_weights ? (const uint8_t*)(store->weights + start) : NULL;
+    row->start = row->ids;
+    row->end = row->ids + sizeof(uint32_t) * (size_t)row->num_nbrs;
+    return true;
+}
+
+/**
+ * weights_store_open
+ *
+ * The weights store registered as name in geoda_weights_store, mapped read-only. The
+ * mapping is kept by the backend and checked against the file (inode, size, mtime) on
+ * each call, so an exported weights store is mapped again. Raises an ERROR if the store
+ * is not registered or not valid.
+ *
+ * @param name
+ * @param name_len
+ * @return
+ */
+const WeightsStore *weights_store_open(const char *name, size_t name_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
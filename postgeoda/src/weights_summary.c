@@ -0,0 +1,198 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the aggregate weights_summary(): the statistics of the neighbors in one pass
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <access/htup_details.h> /* for heap_form_tuple */
+#include <utils/builtins.h>
+#include <utils/memutils.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "weights.h"
+
+/**
+ * WeightsSummaryState
+ *
+ * The state of the aggregate weights_summary(). Only the counts are kept, not the neighbors:
+ * the median is read from the histogram of the numbers of neighbors, and the symmetry from
+ * the sum of hash(i, j) - hash(j, i) of all neighbors j of i, which is 0 if each neighbor
+ * pair appears in both directions (a non symmetric weights gives 0 with probability 2^-64).
+ */
+typedef struct {
+    int64 num_obs;
+    int64 num_nbrs; /* not including the observation itself */
+    int64 isolates;
+    uint64 asymmetry;
+    int64 *hist; /* hist[k]: the number of observations with k neighbors */
+    uint32 hist_size;
+} WeightsSummaryState;
+
+static inline uint64 weights_summary_hash(uint32 i, uint32 j) {
+    // the finalizer of splitmix64
+    uint64 x = ((uint64)i << 32) | j;
+    x = (x ^ (x >> 30)) * UINT64CONST(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64CONST(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+static void weights_summary_add_row(WeightsSummaryState *state, const WeightsRow *row) {
+    WeightsIdIter it;
+    uint32_t nbr_id;
+    uint32 n_nbrs = 0;
+
+    weights_codec_ids_begin(row, &it);
+    while (weights_codec_ids_next(&it, &nbr_id)) {
+        if (nbr_id == row->idx) continue;
+        n_nbrs += 1;
+        state->asymmetry += weights_summary_hash(row->idx, nbr_id) - weights_summary_hash(nbr_id, row->idx);
+    }
+    if (it.j < row->num_nbrs) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("weights_summary: invalid neighbors of observation %u", row->idx)));
+    }
+
+    if (n_nbrs >= state->hist_size) {
+        uint32 new_size = Max(n_nbrs + 1, state->hist_size * 2);
+        state->hist = repalloc(state->hist, sizeof(int64) * new_size);
+        memset(state->hist + state->hist_size, 0, sizeof(int64) * (new_size - state->hist_size));
+        state->hist_size = new_size;
+    }
+    state->hist[n_nbrs] += 1;
+
+    state->num_obs += 1;
+    state->num_nbrs += n_nbrs;
+    if (n_nbrs == 0) state->isolates += 1;
+}
+
+/**
+ * weights_summary_transfn
+ *
+ * sfunc for Aggregate SQL function `weights_summary()`: the weights (bytea) of one observation,
+ * or a complete weights, in v1 or v2
+ *
+ * @param fcinfo
+ * @return Pointer to WeightsSummaryState
+ */
+Datum weights_summary_transfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_summary_transfn);
+
+Datum weights_summary_transfn(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "weights_summary_transfn called in non-aggregate context");
+    }
+
+    WeightsSummaryState *state;
+    if (PG_ARGISNULL(0)) {
+        state = (WeightsSummaryState*)MemoryContextAllocZero(aggcontext, sizeof(WeightsSummaryState));
+        state->hist_size = 16;
+        state->hist = (int64*)MemoryContextAllocZero(aggcontext, sizeof(int64) * state->hist_size);
+    } else {
+        state = (WeightsSummaryState*)PG_GETARG_POINTER(0);
+    }
+
+    if (PG_ARGISNULL(1)) {
+        PG_RETURN_POINTER(state);
+    }
+
+    bytea *bw = PG_GETARG_BYTEA_PP(1);
+    const uint8_t *data = (const uint8_t*)VARDATA_ANY(bw);
+    size_t size = VARSIZE_ANY_EXHDR(bw);
+
+    WeightsHeader header;
+    if (!weights_codec_read_header(data, size, size, &header)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("weights_summary: invalid weights (%zu bytes)", size)));
+    }
+
+    WeightsRow row;
+    if (header.is_complete) {
+        WeightsReader reader;
+        weights_open(bw, &reader);
+        for (uint32_t i = 0; i < reader.num_obs; ++i) {
+            weights_next_row(&reader, &row);
+            weights_summary_add_row(state, &row);
+        }
+    } else {
+        weights_read_row(bw, &row);
+        weights_summary_add_row(state, &row);
+    }
+
+    PG_FREE_IF_COPY(bw, 1);
+    PG_RETURN_POINTER(state);
+}
+
+/**
+ * weights_summary_finalfn
+ *
+ * finalfunc for Aggregate SQL function `weights_summary()`
+ *
+ * @param fcinfo
+ * @return geoda_weights_summary (num_obs, num_nbrs, min_nbrs, max_nbrs, mean_nbrs, median_nbrs,
+ * isolates, symmetric)
+ */
+Datum weights_summary_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_summary_finalfn);
+
+Datum weights_summary_finalfn(PG_FUNCTION_ARGS)
+{
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+    WeightsSummaryState *state = (WeightsSummaryState*)PG_GETARG_POINTER(0);
+
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("weights_summary: return type must be a row type")));
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    // min, max and median from the histogram: O(max_nbrs)
+    int32 min_nbrs = 0, max_nbrs = 0;
+    double median_nbrs = 0;
+    int64 n = state->num_obs;
+    if (n > 0) {
+        int64 lower_rank = (n - 1) / 2, upper_rank = n / 2, seen = 0;
+        int64 lower = -1, upper = -1;
+        bool has_min = false;
+        for (uint32 k = 0; k < state->hist_size; ++k) {
+            if (state->hist[k] == 0) continue;
+            if (!has_min) {
+                min_nbrs = (int32)k;
+                has_min = true;
+            }
+            max_nbrs = (int32)k;
+            seen += state->hist[k];
+            if (lower < 0 && seen > lower_rank) lower = k;
+            if (upper < 0 && seen > upper_rank) upper = k;
+        }
+        median_nbrs = (lower + upper) / 2.0;
+    }
+
+    Datum values[8];
+    bool nulls[8] = {false, false, false, false, false, false, false, false};
+    values[0] = Int64GetDatum(n);
+    values[1] = Int64GetDatum(state->num_nbrs);
+    values[2] = Int32GetDatum(min_nbrs);
+    values[3] = Int32GetDatum(max_nbrs);
+    values[4] = Float8GetDatum(n > 0 ? (double)state->num_nbrs / (double)n : 0);
+    values[5] = Float8GetDatum(median_nbrs);
+    values[6] = Int64GetDatum(state->isolates);
+    values[7] = BoolGetDatum(state->asymmetry == 0);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,280 @@
+/**
+ * Changes:
+ * 2026-10-16 Add the geoda_weights type: input/output, send/receive, the cast from bytea, and
+ * weights_num_obs(), weights_num_neighbors(), weights_fid() that only read the header
+ * 2026-10-16 Add weights_neighbors()
+ */
+
+#include <postgres.h>
+#include <pg_config.h>
+#include <fmgr.h>
+#include <libpq/pqformat.h>
+#include <utils/builtins.h>
+#include <utils/array.h>
+#include <catalog/pg_type.h>
+#include <utils/lsyscache.h> /* for get_typlenbyvalalign */
+#if PG_VERSION_NUM >= 130000
+#include <access/detoast.h> /* for toast_raw_datum_size */
+#else
+#include <access/tuptoaster.h>
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "weights_codec.h"
+
+/**
+ * weights_check
+ *
+ * Raise an error if the content of the weights (e.g. of a bytea) is not valid v1 or v2
+ * weights of one observation or complete weights
+ *
+ * @param bw
+ * @param caller
+ */
+static void weights_check(const bytea *bw, const char *caller)
+{
+    size_t size = VARSIZE_ANY_EXHDR(bw);
+    if (!weights_codec_validate((const uint8_t*)VARDATA_ANY(bw), size)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("%s: invalid weights (%zu bytes)", caller, size)));
+    }
+}
+
+/**
+ * weights_get_header
+ *
+ * Read the header of the weights from a slice of the first bytes, so a large weights
+ * stored out of line is not detoasted entirely.
+ *
+ * @param arg the geoda_weights (or bytea) datum
+ * @param header
+ * @param caller
+ */
+static void weights_get_header(Datum arg, WeightsHeader *header, const char *caller)
+{
+    size_t size = toast_raw_datum_size(arg) - VARHDRSZ;
+    bytea *prefix = (bytea*)PG_DETOAST_DATUM_SLICE(arg, 0, WEIGHTS_HEADER_MAX_SIZE);
+    size_t prefix_size = VARSIZE_ANY_EXHDR(prefix);
+
+    if (!weights_codec_read_header((const uint8_t*)VARDATA_ANY(prefix), prefix_size, size, header)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("%s: invalid weights (%zu bytes)", caller, size)));
+    }
+    if ((Pointer)prefix != DatumGetPointer(arg)) pfree(prefix);
+}
+
+/**
+ * geoda_weights_in
+ *
+ * The input function of geoda_weights: the same text as bytea (e.g. '\x0100...'), and the
+ * content should be valid weights
+ *
+ * @param fcinfo
+ * @return geoda_weights
+ */
+Datum geoda_weights_in(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(geoda_weights_in);
+
+Datum geoda_weights_in(PG_FUNCTION_ARGS)
+{
+    Datum result = DirectFunctionCall1(byteain, PG_GETARG_DATUM(0));
+    weights_check(DatumGetByteaPP(result), "geoda_weights_in");
+    PG_RETURN_DATUM(result);
+}
+
+/**
+ * geoda_weights_out
+ *
+ * The output function of geoda_weights: the same text as bytea. Use weights_astext() or
+ * geoda_weights_tojson() for a readable text.
+ *
+ * @param fcinfo
+ * @return cstring
+ */
+Datum geoda_weights_out(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(geoda_weights_out);
+
+Datum geoda_weights_out(PG_FUNCTION_ARGS)
+{
+    return DirectFunctionCall1(byteaout, PG_GETARG_DATUM(0));
+}
+
+/**
+ * geoda_weights_recv
+ *
+ * The binary input function of geoda_weights (e.g. COPY BINARY): the content of the weights
+ *
+ * @param fcinfo
+ * @return geoda_weights
+ */
+Datum geoda_weights_recv(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(geoda_weights_recv);
+
+Datum geoda_weights_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    int size = buf->len - buf->cursor;
+
+    bytea *result = (bytea *) palloc(size + VARHDRSZ);
+    SET_VARSIZE(result, size + VARHDRSZ);
+    pq_copymsgbytes(buf, VARDATA(result), size);
+
+    weights_check(result, "geoda_weights_recv");
+    PG_RETURN_BYTEA_P(result);
+}
+
+/**
+ * geoda_weights_send
+ *
+ * The binary output function of geoda_weights
+ *
+ * @param fcinfo
+ * @return bytea
+ */
+Datum geoda_weights_send(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(geoda_weights_send);
+
+Datum geoda_weights_send(PG_FUNCTION_ARGS)
+{
+    bytea *bw = PG_GETARG_BYTEA_PP(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendbytes(&buf, VARDATA_ANY(bw), VARSIZE_ANY_EXHDR(bw));
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/**
+ * geoda_weights_from_bytea
+ *
+ * Used in the cast from bytea (e.g. returned by queen_weights()) to geoda_weights: the content
+ * is checked, not copied
+ *
+ * @param fcinfo
+ * @return geoda_weights
+ */
+Datum geoda_weights_from_bytea(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(geoda_weights_from_bytea);
+
+Datum geoda_weights_from_bytea(PG_FUNCTION_ARGS)
+{
+    bytea *bw = PG_GETARG_BYTEA_PP(0);
+    weights_check(bw, "geoda_weights");
+    PG_FREE_IF_COPY(bw, 0);
+    PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+}
+
+/**
+ * weights_header_num_obs
+ *
+ * Used in SQL function weights_num_obs(w)
+ *
+ * @param fcinfo
+ * @return the number of observations: 1 for the weights of one observation
+ */
+Datum weights_header_num_obs(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_header_num_obs);
+
+Datum weights_header_num_obs(PG_FUNCTION_ARGS)
+{
+    WeightsHeader header;
+    weights_get_header(PG_GETARG_DATUM(0), &header, "weights_num_obs");
+    PG_RETURN_INT64(header.num_obs);
+}
+
+/**
+ * weights_header_num_neighbors
+ *
+ * Used in SQL function weights_num_neighbors(w)
+ *
+ * @param fcinfo
+ * @return the number of neighbors of the observation, NULL for the complete weights
+ */
+Datum weights_header_num_neighbors(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_header_num_neighbors);
+
+Datum weights_header_num_neighbors(PG_FUNCTION_ARGS)
+{
+    WeightsHeader header;
+    weights_get_header(PG_GETARG_DATUM(0), &header, "weights_num_neighbors");
+    if (header.is_complete) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_INT64(header.num_nbrs);
+}
+
+/**
+ * weights_header_fid
+ *
+ * Used in SQL function weights_fid(w)
+ *
+ * @param fcinfo
+ * @return the fid (index) of the observation, NULL for the complete weights
+ */
+Datum weights_header_fid(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_header_fid);
+
+Datum weights_header_fid(PG_FUNCTION_ARGS)
+{
+    WeightsHeader header;
+    weights_get_header(PG_GETARG_DATUM(0), &header, "weights_fid");
+    if (header.is_complete) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_INT64(header.idx);
+}
+
+/**
+ * weights_row_neighbors
+ *
+ * Used in SQL function weights_neighbors(w), e.g. to collect the values of the neighbors for
+ * local_moran_fast(val, w, nbr_vals, state)
+ *
+ * @param fcinfo
+ * @return the neighbor ids of the observation, in the order of its weights, NULL for the
+ * complete weights
+ */
+Datum weights_row_neighbors(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(weights_row_neighbors);
+
+Datum weights_row_neighbors(PG_FUNCTION_ARGS)
+{
+    WeightsHeader header;
+    weights_get_header(PG_GETARG_DATUM(0), &header, "weights_neighbors");
+    if (header.is_complete) {
+        PG_RETURN_NULL();
+    }
+
+    bytea *bw = PG_GETARG_BYTEA_PP(0);
+    WeightsRow row;
+    bool is_valid = weights_codec_read_row((const uint8_t*)VARDATA_ANY(bw), VARSIZE_ANY_EXHDR(bw), &row);
+    uint32_t *ids = (uint32_t*)palloc(sizeof(uint32_t) * (is_valid && row.num_nbrs > 0 ? row.num_nbrs : 1));
+    if (!is_valid || !weights_codec_get_ids(&row, ids)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("weights_neighbors: invalid weights (%zu bytes)", VARSIZE_ANY_EXHDR(bw))));
+    }
+
+    Datum *elems = (Datum*)palloc(sizeof(Datum) * (row.num_nbrs > 0 ? row.num_nbrs : 1));
+    for (uint32_t j = 0; j < row.num_nbrs; ++j) {
+        elems[j] = Int64GetDatum(ids[j]);
+    }
+    int16 elmlen;
+    bool elmbyval;
+    char elmalign;
+    get_typlenbyvalalign(INT8OID, &elmlen, &elmbyval, &elmalign);
+    ArrayType *array = construct_array(elems, row.num_nbrs, INT8OID, elmlen, elmbyval, elmalign);
+
+    pfree(ids);
+    pfree(elems);
+    PG_FREE_IF_COPY(bw, 0);
+    PG_RETURN_ARRAYTYPE_P(array);
+}
+
+#ifdef __cplusplus
+}
+#endif
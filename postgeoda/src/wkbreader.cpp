@@ -0,0 +1,256 @@
+/**
+ * Changes:
+ * 2026-10-16 Add WKBReader: decode WKB/EWKB straight into libgeoda shapes
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <libgeoda/geofeature.h>
+#include <libgeoda/pg/utils.h>
+
+#include "postgeoda.h"
+#include "wkbreader.h"
+
+// EWKB flags of the geometry type
+#define WKB_Z_FLAG 0x80000000
+#define WKB_M_FLAG 0x40000000
+#define WKB_SRID_FLAG 0x20000000
+
+static bool host_is_little_endian()
+{
+    const uint16_t one = 1;
+    uint8_t first_byte;
+    memcpy(&first_byte, &one, 1);
+    return first_byte == 1;
+}
+
+WKBReader::WKBReader(const uint8_t *wkb, size_t size)
+: wkb(wkb), size(size), pos(0), swap_bytes(false), n_dims(2)
+{
+}
+
+WKBReader::~WKBReader()
+{
+}
+
+void WKBReader::Require(size_t n)
+{
+    if (n > size || pos > size - n) {
+        lwerror("WKBReader: WKB is truncated (%d bytes needed at offset %d, size=%d).", (int)n, (int)pos, (int)size);
+    }
+}
+
+void WKBReader::Skip(size_t n)
+{
+    Require(n);
+    pos += n;
+}
+
+uint8_t WKBReader::ReadByte()
+{
+    Require(1);
+    return wkb[pos++];
+}
+
+uint32_t WKBReader::ReadUInt32()
+{
+    Require(sizeof(uint32_t));
+    uint8_t buf[sizeof(uint32_t)];
+    memcpy(buf, wkb + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+    if (swap_bytes) {
+        std::swap(buf[0], buf[3]);
+        std::swap(buf[1], buf[2]);
+    }
+    uint32_t val;
+    memcpy(&val, buf, sizeof(uint32_t));
+    return val;
+}
+
+double WKBReader::ReadDouble()
+{
+    Require(sizeof(double));
+    uint8_t buf[sizeof(double)];
+    memcpy(buf, wkb + pos, sizeof(double));
+    pos += sizeof(double);
+    if (swap_bytes) {
+        for (size_t i = 0; i < sizeof(double) / 2; ++i) {
+            std::swap(buf[i], buf[sizeof(double) - 1 - i]);
+        }
+    }
+    double val;
+    memcpy(&val, buf, sizeof(double));
+    return val;
+}
+
+void WKBReader::ReadPoint(double &x, double &y)
+{
+    x = ReadDouble();
+    y = ReadDouble();
+    // ignore Z and M
+    Skip(sizeof(double) * (n_dims - 2));
+}
+
+uint32_t WKBReader::ReadHeader()
+{
+    uint8_t byte_order = ReadByte();
+    if (byte_order > 1) {
+        lwerror("WKBReader: invalid byte order %d at offset %d.", byte_order, (int)pos - 1);
+    }
+    // 0: big endian (XDR), 1: little endian (NDR)
+    swap_bytes = (byte_order == 1) != host_is_little_endian();
+
+    uint32_t wkb_type = ReadUInt32();
+
+    // EWKB (PostGIS): dimensions and SRID are flags of the type
+    bool has_z = (wkb_type & WKB_Z_FLAG) != 0;
+    bool has_m = (wkb_type & WKB_M_FLAG) != 0;
+    bool has_srid = (wkb_type & WKB_SRID_FLAG) != 0;
+    wkb_type &= 0x0FFFFFFF;
+
+    // ISO WKB: type + 1000 (Z), + 2000 (M), + 3000 (ZM)
+    uint32_t iso_dims = wkb_type / 1000;
+    wkb_type = wkb_type % 1000;
+    if (iso_dims == 1 || iso_dims == 3) has_z = true;
+    if (iso_dims == 2 || iso_dims == 3) has_m = true;
+
+    n_dims = 2 + (has_z ? 1 : 0) + (has_m ? 1 : 0);
+
+    if (has_srid) Skip(sizeof(uint32_t));
+
+    return wkb_type;
+}
+
+gda::PolygonContents* WKBReader::ReadPolygons(uint32_t geom_type)
+{
+    size_t start = pos;
+    bool start_swap_bytes = swap_bytes;
+    int start_n_dims = n_dims;
+    uint32_t i, j, k;
+
+    // First count the rings and points, so the buffers of the shape are allocated only once
+    uint32_t n_polys = 1;
+    if (geom_type == wkb_multipolygon) n_polys = ReadUInt32();
+
+    size_t n_rings = 0, n_points = 0;
+    for (i = 0; i < n_polys; ++i) {
+        if (geom_type == wkb_multipolygon && ReadHeader() != wkb_polygon) {
+            lwerror("WKBReader: MultiPolygon contains a non-Polygon geometry.");
+        }
+        uint32_t nr = ReadUInt32();
+        for (j = 0; j < nr; ++j) {
+            uint32_t np = ReadUInt32();
+            Skip(sizeof(double) * n_dims * (size_t)np);
+            n_points += np;
+        }
+        n_rings += nr;
+    }
+
+    if (n_points == 0) {
+        // POLYGON EMPTY, MULTIPOLYGON EMPTY
+        return 0;
+    }
+
+    // Then read the coordinates into the shape
+    pos = start;
+    swap_bytes = start_swap_bytes;
+    n_dims = start_n_dims;
+    if (geom_type == wkb_multipolygon) ReadUInt32();
+
+    gda::PolygonContents *poly = new gda::PolygonContents();
+    poly->num_parts = 0;
+    poly->num_points = 0;
+    poly->parts.reserve(n_rings);
+    poly->holes.reserve(n_rings);
+    poly->points.reserve(n_points);
+
+    double minx = std::numeric_limits<double>::max();
+    double miny = std::numeric_limits<double>::max();
+    double maxx = std::numeric_limits<double>::lowest();
+    double maxy = std::numeric_limits<double>::lowest();
+    double x, y;
+
+    /* NOTE: Multipolygons are stored as Polygon shapes with multiple outer rings */
+    for (i = 0; i < n_polys; ++i) {
+        if (geom_type == wkb_multipolygon) ReadHeader();
+        uint32_t nr = ReadUInt32();
+        for (j = 0; j < nr; ++j) {
+            uint32_t np = ReadUInt32();
+
+            /* For each ring, store the coordinate offset for the start of each ring */
+            poly->parts.push_back(poly->num_points);
+            poly->num_parts += 1;
+            poly->holes.push_back(j > 0);
+
+            for (k = 0; k < np; ++k) {
+                ReadPoint(x, y);
+                poly->points.push_back(gda::Point(x, y));
+
+                if (x < minx) minx = x;
+                if (x >= maxx) maxx = x;
+                if (y < miny) miny = y;
+                if (y >= maxy) maxy = y;
+            }
+            poly->num_points += np;
+        }
+    }
+
+    poly->box.resize(4);
+    poly->box[0] = minx;
+    poly->box[1] = miny;
+    poly->box[2] = maxx;
+    poly->box[3] = maxy;
+
+    return poly;
+}
+
+int WKBReader::Read(PostGeoDa *geoda)
+{
+    pos = 0;
+
+    if (wkb == 0 || size == 0) {
+        geoda->AddNullGeometry();
+        return 0;
+    }
+
+    double x, y;
+    uint32_t geom_type = ReadHeader();
+
+    switch (geom_type) {
+        case wkb_point:
+            ReadPoint(x, y);
+            // POINT EMPTY is encoded as NaN coordinates
+            if (std::isnan(x) || std::isnan(y)) break;
+            geoda->AddPoint(x, y);
+            return geom_type;
+
+        case wkb_multipoint:
+            if (ReadUInt32() == 0) break;
+            // only take the first point, even it has multipoints
+            if (ReadHeader() != wkb_point) {
+                lwerror("WKBReader: MultiPoint contains a non-Point geometry.");
+            }
+            ReadPoint(x, y);
+            if (std::isnan(x) || std::isnan(y)) break;
+            geoda->AddPoint(x, y);
+            return geom_type;
+
+        case wkb_polygon:
+        case wkb_multipolygon: {
+            gda::PolygonContents *poly = ReadPolygons(geom_type);
+            if (poly == 0) break;
+            geoda->AddPolygon(poly);
+            return geom_type;
+        }
+
+        default:
+            lwdebug(4, "WKBReader: unsupported WKB type %d", geom_type);
+            break;
+    }
+
+    geoda->AddNullGeometry();
+    return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * Changes:
+ * 2026-10-16 Add WKBReader: decode WKB/EWKB straight into libgeoda shapes
+ */
+
+#ifndef __POST_WKB_READER__
+#define __POST_WKB_READER__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace gda {
+    class PolygonContents;
+}
+
+class PostGeoDa;
+
+/**
+ * WKBReader
+ *
+ * A single pass reader of WKB (ISO and EWKB) geometries. The coordinates are
+ * copied from the WKB bytes into the shape records of PostGeoDa directly, so
+ * no LWGEOM needs to be built (and freed) for each row.
+ *
+ * Supported: Point, MultiPoint (only the first point is used), Polygon and
+ * MultiPolygon, with optional Z/M dimensions and SRID. Empty or unsupported
+ * geometries are added as null shapes.
+ */
+class WKBReader {
+public:
+    enum WKBType { wkb_point = 1, wkb_polygon = 3, wkb_multipoint = 4, wkb_multipolygon = 6 };
+
+    WKBReader(const uint8_t* wkb, size_t size);
+    virtual ~WKBReader();
+
+    /**
+     * Read()
+     *
+     * Decode the WKB and add the shape to geoda.
+     *
+     * @param geoda
+     * @return the WKB geometry type of the added shape, or 0 if a null shape was added
+     */
+    int Read(PostGeoDa* geoda);
+
+protected:
+    const uint8_t* wkb;
+    size_t size;
+    size_t pos;
+
+    bool swap_bytes; // byte order of the WKB is not the same as the host
+    int n_dims; // 2, 3 (Z or M) or 4 (ZM)
+
+    void Require(size_t n);
+    void Skip(size_t n);
+    uint8_t ReadByte();
+    uint32_t ReadUInt32();
+    double ReadDouble();
+    void ReadPoint(double& x, double& y);
+
+    // Read the byte order and geometry type (and SRID) of a (sub-)geometry
+    uint32_t ReadHeader();
+
+    // Read a Polygon or MultiPolygon, return 0 if it is empty
+    gda::PolygonContents* ReadPolygons(uint32_t geom_type);
+};
+
+#endif
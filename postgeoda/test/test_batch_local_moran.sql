@@ -0,0 +1,61 @@
+-- Regression test of batch_local_moran(): a 2-D array {lisa, p-value, cluster} of each variable,
+-- the lisa of each variable is the one of local_moran(), the variables share the permutations,
+-- a NULL value is undefined only in its variable, and the variables of all rows must match.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS crm_prs, "Crm_prp"::float8 AS crm_prp, "Litercy"::float8 AS litercy,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS queen
+FROM guerry;
+
+SELECT count(*) AS num_obs, count(*) FILTER (WHERE array_dims(r) <> '[1:3][1:3]') AS bad_dims,
+       count(*) FILTER (WHERE abs(r[1][1] - a[1]) > 1e-9 OR abs(r[2][1] - b[1]) > 1e-9 OR
+                              abs(r[3][1] - c[1]) > 1e-9) AS lisa_mismatches,
+       count(*) FILTER (WHERE r[1][2] <= 0 OR r[1][2] > 1 OR r[2][2] <= 0 OR r[2][2] > 1 OR
+                              r[3][2] <= 0 OR r[3][2] > 1) AS bad_p
+FROM (SELECT batch_local_moran(ARRAY[crm_prs, crm_prp, litercy], queen, 999, 'lookup', 0.05, 2, 123456789) OVER () AS r,
+             local_moran(crm_prs, queen) OVER () AS a,
+             local_moran(crm_prp, queen) OVER () AS b,
+             local_moran(litercy, queen) OVER () AS c
+      FROM guerry_w) AS s;
+
+-- the same variable twice: the same permutations, so the same results
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE r[1][1] <> r[2][1] OR r[1][2] <> r[2][2] OR r[1][3] <> r[2][3]) AS mismatches
+FROM (SELECT batch_local_moran(ARRAY[crm_prs, crm_prs], queen) OVER () AS r FROM guerry_w) AS s;
+
+-- the value of crm_prp of fid 1 is NULL: the lisa of crm_prs doesn't change
+SELECT count(*) AS num_obs, count(*) FILTER (WHERE array_dims(r) <> '[1:2][1:3]') AS bad_dims,
+       count(*) FILTER (WHERE abs(r[1][1] - a[1][1]) > 1e-9) AS lisa_mismatches
+FROM (SELECT batch_local_moran(ARRAY[crm_prs, CASE WHEN ogc_fid = 1 THEN NULL ELSE crm_prp END], queen) OVER () AS r,
+             batch_local_moran(ARRAY[crm_prs, crm_prp], queen) OVER () AS a
+      FROM guerry_w) AS s;
+
+-- the array of fid 2 is NULL: all its variables are undefined
+SELECT count(r) AS num_results, count(*) FILTER (WHERE array_dims(r) <> '[1:2][1:3]') AS bad_dims
+FROM (SELECT batch_local_moran(CASE WHEN ogc_fid = 2 THEN NULL ELSE ARRAY[crm_prs, crm_prp] END, queen)
+             OVER () AS r
+      FROM guerry_w) AS s;
+
+SELECT batch_local_moran(CASE WHEN ogc_fid = 10 THEN ARRAY[crm_prs] ELSE ARRAY[crm_prs, crm_prp] END, queen)
+       OVER (ORDER BY ogc_fid)
+FROM guerry_w;
+
+SELECT batch_local_moran(ARRAY[crm_prs, crm_prp], CASE WHEN ogc_fid = 3 THEN NULL ELSE queen END)
+       OVER (ORDER BY ogc_fid)
+FROM guerry_w;
+
+\q
@@ -0,0 +1,75 @@
+-- Regression test of the weights read from the rows of a query Window (BinWeightView):
+-- local_moran() with v1 and v2 weights, a duplicated fid, and neighbors that are not in
+-- the Window.
+--
+-- The lisa of local moran is z_i * avg(z_j) over the neighbors j, with z = (x - mean) / sd, so
+-- lisa_i / ((x_i - mean) * avg(x_j - mean)) is the same (1 / sd^2) for all observations, whatever
+-- the sd is. A neighbor fid is the last row with this fid in the Window, and the neighbors that
+-- are not in the Window are dropped; an observation without neighbors in the Window has lisa 0.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x, queen_weights(ogc_fid, wkb_geometry) OVER () AS w
+FROM guerry;
+
+-- the cases: the rows of each Window in the order of pos
+CREATE TABLE cases AS
+SELECT 'v1' AS name, ogc_fid AS pos, ogc_fid AS fid, x, w FROM guerry_w
+UNION ALL
+SELECT 'v2', ogc_fid, ogc_fid, x, weights_compress(w) FROM guerry_w
+UNION ALL
+-- fid 1 is duplicated: its neighbors see the last row (pos 100), with another value
+SELECT 'duplicated fid', ogc_fid, ogc_fid, x, w FROM guerry_w
+UNION ALL
+SELECT 'duplicated fid', 100, ogc_fid, x + 1000, w FROM guerry_w WHERE ogc_fid = 1
+UNION ALL
+-- the neighbors with fid > 40 are not in the Window
+SELECT 'subset v1', ogc_fid, ogc_fid, x, w FROM guerry_w WHERE ogc_fid <= 40
+UNION ALL
+SELECT 'subset v2', ogc_fid, ogc_fid, x, weights_compress(w) FROM guerry_w WHERE ogc_fid <= 40;
+
+CREATE TABLE results AS
+SELECT name, pos, (local_moran(x, w) OVER (PARTITION BY name ORDER BY pos))[1] AS lisa
+FROM cases;
+
+CREATE TABLE expected AS
+WITH means AS (
+    SELECT name, avg(x) AS mean FROM cases GROUP BY name
+), last_rows AS (
+    SELECT DISTINCT ON (name, fid) name, fid, x FROM cases ORDER BY name, fid, pos DESC
+), lags AS (
+    SELECT c.name, c.pos, avg(l.x - m.mean) AS lag_dev
+    FROM cases c
+    JOIN means m ON m.name = c.name
+    CROSS JOIN LATERAL unnest(weights_neighbors(c.w)) AS n(fid)
+    JOIN last_rows l ON l.name = c.name AND l.fid = n.fid
+    GROUP BY c.name, c.pos
+)
+SELECT c.name, c.pos, (c.x - m.mean) * g.lag_dev AS dev
+FROM cases c
+JOIN means m ON m.name = c.name
+LEFT JOIN lags g ON g.name = c.name AND g.pos = c.pos;
+
+SELECT r.name,
+       count(*) AS num_obs,
+       bool_and(r.lisa = 0) FILTER (WHERE e.dev IS NULL) IS NOT FALSE AND
+       max(r.lisa / e.dev) FILTER (WHERE abs(e.dev) > 1e-3) /
+       min(r.lisa / e.dev) FILTER (WHERE abs(e.dev) > 1e-3) - 1 < 1e-9 AS ok
+FROM results r JOIN expected e ON e.name = r.name AND e.pos = r.pos
+GROUP BY r.name
+ORDER BY r.name;
+
+\q
@@ -0,0 +1,57 @@
+-- Regression test of the "analytic" method of local_moran(), local_g() and local_geary(): the
+-- z-scores of the statistics under conditional randomization, the same for any cpu_threads, with
+-- the same statistics as the permutation methods.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS qw
+FROM guerry;
+
+CREATE TABLE results AS
+SELECT ogc_fid,
+       local_moran(x, qw, 999, 'analytic', 0.05, 1, 123456789) OVER () AS moran_1,
+       local_moran(x, qw, 999, 'analytic', 0.05, 8, 123456789) OVER () AS moran_8,
+       local_moran(x, qw) OVER () AS moran_perm,
+       local_g(x, qw, 999, 'analytic', 0.05, 1, 123456789) OVER () AS g,
+       local_geary(x, qw, 999, 'analytic', 0.05, 1, 123456789) OVER () AS geary
+FROM guerry_w;
+
+-- the z-score is the 4th value, the statistics are the ones of the permutations, and with the
+-- binary weights, the p-values of local moran and local g are the same
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE moran_1 IS DISTINCT FROM moran_8) AS thread_mismatches,
+       bool_and(array_length(moran_1, 1) = 4 AND array_length(g, 1) = 4
+                AND array_length(geary, 1) = 4) AS has_zscores,
+       count(*) FILTER (WHERE abs(moran_1[1] - moran_perm[1]) > 1e-9) AS lisa_mismatches,
+       count(*) FILTER (WHERE abs(moran_1[2] - g[2]) > 1e-9) AS pvalue_mismatches
+FROM results;
+
+-- the p-value is one-sided, 1 - Phi(|z|), and the clusters are the significant ones (p <= 0.05)
+SELECT ogc_fid, round(moran_1[4]::numeric, 4) AS z, round(moran_1[2]::numeric, 6) AS p,
+       moran_1[3]::integer AS cluster
+FROM results
+ORDER BY abs(moran_1[4]) DESC
+LIMIT 5;
+
+SELECT 'moran' AS stat, moran_1[3]::integer AS cluster, count(*) FROM results GROUP BY 1, 2
+UNION ALL
+SELECT 'g', g[3]::integer, count(*) FROM results GROUP BY 1, 2
+UNION ALL
+SELECT 'geary', geary[3]::integer, count(*) FROM results GROUP BY 1, 2
+ORDER BY 1, 2;
+
+\q
@@ -0,0 +1,63 @@
+-- Regression test of local_moran_queen() and local_moran_knn(): the weights built in the window
+-- function are the same as the default queen_weights() and knn_weights() (libgeoda), for any
+-- cpu_threads of the local moran, so the results are the same as local_moran() with the weights
+-- of a first window.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE two_pass AS
+SELECT ogc_fid,
+       local_moran(x, qw) OVER () AS queen,
+       local_moran(x, kw) OVER () AS knn
+FROM (SELECT ogc_fid, "Crm_prs"::float8 AS x,
+             queen_weights(ogc_fid, wkb_geometry) OVER () AS qw,
+             knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS kw
+      FROM guerry) AS w;
+
+-- the default arguments of the local moran, then one thread for the permutations
+CREATE TABLE fused AS
+SELECT ogc_fid,
+       local_moran_queen("Crm_prs"::float8, ogc_fid, wkb_geometry) OVER () AS queen,
+       local_moran_knn("Crm_prs"::float8, ogc_fid, wkb_geometry, 4) OVER () AS knn
+FROM guerry;
+
+CREATE TABLE two_pass_1 AS
+SELECT ogc_fid,
+       local_moran(x, qw, 999, 'lookup', 0.05, 1, 123456789) OVER () AS queen,
+       local_moran(x, kw, 999, 'lookup', 0.05, 1, 123456789) OVER () AS knn
+FROM (SELECT ogc_fid, "Crm_prs"::float8 AS x,
+             queen_weights(ogc_fid, wkb_geometry) OVER () AS qw,
+             knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS kw
+      FROM guerry) AS w;
+
+CREATE TABLE fused_1 AS
+SELECT ogc_fid,
+       local_moran_queen("Crm_prs"::float8, ogc_fid, wkb_geometry, 999, 'lookup', 0.05, 1, 123456789) OVER () AS queen,
+       local_moran_knn("Crm_prs"::float8, ogc_fid, wkb_geometry, 4, 999, 'lookup', 0.05, 1, 123456789) OVER () AS knn
+FROM guerry;
+
+SELECT 'default' AS args,
+       count(*) AS num_obs,
+       count(*) FILTER (WHERE f.queen IS DISTINCT FROM t.queen) AS queen_mismatches,
+       count(*) FILTER (WHERE f.knn IS DISTINCT FROM t.knn) AS knn_mismatches
+FROM fused f JOIN two_pass t ON t.ogc_fid = f.ogc_fid
+UNION ALL
+SELECT 'cpu_threads 1',
+       count(*),
+       count(*) FILTER (WHERE f.queen IS DISTINCT FROM t.queen),
+       count(*) FILTER (WHERE f.knn IS DISTINCT FROM t.knn)
+FROM fused_1 f JOIN two_pass_1 t ON t.ogc_fid = f.ogc_fid;
+
+\q
@@ -0,0 +1,77 @@
+-- Regression test of local_moran_halo() with weights values: with the inverse distance weights
+-- of the 4 nearest neighbors, the lag and the permutations of each row are weighted, and the
+-- results of the partitions by region, with their halos, are the same as with one partition,
+-- and with the queen weights, the lisa are the same as the ones of local_moran() OVER().
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Region" AS region, "Crm_prs"::float8 AS x,
+       knn_weights(ogc_fid, wkb_geometry, 4, 1.0, TRUE, FALSE) OVER () AS w
+FROM guerry;
+
+CREATE TABLE state AS
+SELECT local_moran_state(x, 999, 123456789) AS state FROM guerry_w;
+
+-- the neighbors of the rows of each region that are in other regions
+CREATE TABLE halo AS
+SELECT t.region, array_agg(t.fid) AS fids, array_agg(t.x) AS vals
+FROM (SELECT DISTINCT a.region, b.ogc_fid::bigint AS fid, b.x
+      FROM guerry_w a, unnest(weights_neighbors(a.w)) AS n(fid), guerry_w b
+      WHERE b.ogc_fid = n.fid AND b.region <> a.region) t
+GROUP BY t.region;
+
+CREATE TABLE whole AS
+SELECT ogc_fid, local_moran_halo(x, w, NULL::bigint[], NULL::float8[], s.state) OVER () AS r
+FROM guerry_w, state s;
+
+CREATE TABLE partitioned AS
+SELECT g.ogc_fid, local_moran_halo(g.x, g.w, h.fids, h.vals, s.state) OVER (PARTITION BY g.region) AS r
+FROM guerry_w g LEFT JOIN halo h USING (region), state s;
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE w.r IS DISTINCT FROM p.r) AS mismatches,
+       bool_and(p.r[2] > 0 AND p.r[2] <= 0.5) AS valid_pvalues
+FROM whole w JOIN partitioned p ON p.ogc_fid = w.ogc_fid;
+
+
+-- the lisa of the partitions with their halos are the lisa of local_moran() OVER() of all rows,
+-- with the queen weights (the p-values come from other permutations)
+CREATE TABLE guerry_q AS
+SELECT ogc_fid, "Region" AS region, "Crm_prs"::float8 AS x,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS w
+FROM guerry;
+
+CREATE TABLE halo_q AS
+SELECT t.region, array_agg(t.fid) AS fids, array_agg(t.x) AS vals
+FROM (SELECT DISTINCT a.region, b.ogc_fid::bigint AS fid, b.x
+      FROM guerry_q a, unnest(weights_neighbors(a.w)) AS n(fid), guerry_q b
+      WHERE b.ogc_fid = n.fid AND b.region <> a.region) t
+GROUP BY t.region;
+
+CREATE TABLE moran_q AS
+SELECT ogc_fid, local_moran(x, w) OVER () AS r
+FROM guerry_q;
+
+CREATE TABLE partitioned_q AS
+SELECT g.ogc_fid, local_moran_halo(g.x, g.w, h.fids, h.vals, s.state) OVER (PARTITION BY g.region) AS r
+FROM guerry_q g LEFT JOIN halo_q h USING (region), state s;
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE abs(m.r[1] - p.r[1]) > 1e-9) AS lisa_mismatches,
+       count(*) FILTER (WHERE m.r[3] <> 0 AND p.r[3] <> 0 AND m.r[3] <> p.r[3]) AS cluster_mismatches
+FROM moran_q m JOIN partitioned_q p ON p.ogc_fid = m.ogc_fid;
+
+\q
@@ -0,0 +1,42 @@
+-- Regression test of the "philox" permutation method of local_moran(): the random neighbors
+-- come from the table of permutations of the seed, so the results are the same for any
+-- cpu_threads, with the queen and the KNN weights.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS qw,
+       knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS kw
+FROM guerry;
+
+CREATE TABLE results AS
+SELECT ogc_fid,
+       local_moran(x, qw, 999, 'philox', 0.05, 1, 123456789) OVER () AS queen_1,
+       local_moran(x, qw, 999, 'philox', 0.05, 8, 123456789) OVER () AS queen_8,
+       local_moran(x, kw, 999, 'philox', 0.05, 1, 123456789) OVER () AS knn_1,
+       local_moran(x, kw, 999, 'philox', 0.05, 8, 123456789) OVER () AS knn_8
+FROM guerry_w;
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE queen_1 IS DISTINCT FROM queen_8) AS queen_mismatches,
+       count(*) FILTER (WHERE knn_1 IS DISTINCT FROM knn_8) AS knn_mismatches,
+       bool_and(array_length(queen_1, 1) = 3 AND queen_1[2] > 0 AND queen_1[2] <= 0.5) AS valid_pvalues
+FROM results;
+
+-- only local_moran() has the philox method
+SELECT local_g(x, qw, 999, 'philox', 0.05, 1, 123456789) OVER () FROM guerry_w LIMIT 1;
+
+\q
@@ -0,0 +1,55 @@
+-- Regression test of the "sequential" permutation method of local_moran(): the significant
+-- observations use all permutations, with the pseudo p-values of the "philox" method, and the
+-- observations that can't be significant stop early.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS qw
+FROM guerry;
+
+-- 999 permutations and the cutoff 0.05: a test stops once the smaller count reaches
+-- h = floor(0.05 * 1000) = 50, after a multiple of 64 (the block) permutations
+CREATE TABLE results AS
+SELECT ogc_fid,
+       local_moran(x, qw, 999, 'sequential', 0.05, 1, 123456789) OVER () AS seq_1,
+       local_moran(x, qw, 999, 'sequential', 0.05, 8, 123456789) OVER () AS seq_8,
+       local_moran(x, qw, 999, 'philox', 0.05, 1, 123456789) OVER () AS philox
+FROM guerry_w;
+
+-- the permutations used are the 4th value, the same for any cpu_threads
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE seq_1 IS DISTINCT FROM seq_8) AS thread_mismatches,
+       bool_and(array_length(seq_1, 1) = 4 AND seq_1[4] >= 64 AND seq_1[4] <= 999) AS valid_counts
+FROM results;
+
+-- a significant observation (p <= 0.05 with all permutations) never reaches h, so it uses all
+-- permutations and has the same pseudo p-value and cluster as "philox"
+SELECT count(*) FILTER (WHERE philox[2] <= 0.05 AND seq_1[4] <> 999) AS significant_stopped,
+       count(*) FILTER (WHERE seq_1[4] = 999 AND
+                        (abs(seq_1[2] - philox[2]) > 1e-12 OR seq_1[3] <> philox[3])) AS full_mismatches
+FROM results;
+
+-- an observation with a pseudo p-value >= 0.09 has a count >= 89 - 39 = 50 after 960 permutations,
+-- so it stops early, with the p-value (h + 1) / (used + 1) > 0.05 and no cluster
+SELECT count(*) FILTER (WHERE philox[2] >= 0.09 AND seq_1[4] = 999) AS insignificant_full,
+       count(*) FILTER (WHERE seq_1[4] < 999) > 0 AS some_stopped,
+       count(*) FILTER (WHERE seq_1[4] < 999 AND
+                        (seq_1[4]::integer % 64 <> 0 OR abs(seq_1[2] - 51.0 / (seq_1[4] + 1)) > 1e-12
+                         OR seq_1[3] <> 0)) AS stopped_mismatches
+FROM results;
+
+\q
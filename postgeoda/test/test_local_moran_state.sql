@@ -0,0 +1,62 @@
+-- Regression test of the two-phase local_moran_fast(): the state of local_moran_state() is
+-- computed once over the whole table, then each row only needs its weights and the values of
+-- its neighbors, so the results of two shards of the table are the same as the results of
+-- the whole table. The state has all values of a small table, and a bounded sample of a large one.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x, queen_weights(ogc_fid, wkb_geometry) OVER () AS w
+FROM guerry;
+
+CREATE TABLE state AS
+SELECT local_moran_state(x, 999, 123456789) AS state FROM guerry_w;
+
+-- the whole table
+CREATE TABLE whole AS
+SELECT a.ogc_fid,
+       local_moran_fast(a.x, a.w,
+                        ARRAY(SELECT b.x FROM guerry_w b WHERE b.ogc_fid = ANY(weights_neighbors(a.w))),
+                        s.state) AS r
+FROM guerry_w a, state s;
+
+-- two shards, the neighbors of a row can be in the other shard
+CREATE TABLE shard_0 AS SELECT * FROM guerry_w WHERE ogc_fid % 2 = 0;
+CREATE TABLE shard_1 AS SELECT * FROM guerry_w WHERE ogc_fid % 2 = 1;
+
+CREATE TABLE sharded AS
+SELECT a.ogc_fid,
+       local_moran_fast(a.x, a.w,
+                        ARRAY(SELECT b.x FROM guerry_w b WHERE b.ogc_fid = ANY(weights_neighbors(a.w))),
+                        s.state) AS r
+FROM shard_0 a, state s
+UNION ALL
+SELECT a.ogc_fid,
+       local_moran_fast(a.x, a.w,
+                        ARRAY(SELECT b.x FROM guerry_w b WHERE b.ogc_fid = ANY(weights_neighbors(a.w))),
+                        s.state) AS r
+FROM shard_1 a, state s;
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE w.r[0] <> s.r[0] OR w.r[1] <> s.r[1]) AS mismatches,
+       bool_and(s.r[1] > 0 AND s.r[1] <= 1) AS valid_pvalues
+FROM whole w JOIN sharded s ON s.ogc_fid = w.ogc_fid;
+
+-- the state is bounded: all values of the 85 rows, and a sample of 65536 values of a larger table
+SELECT length(state) AS state_bytes FROM state;
+
+SELECT length(local_moran_state(x::float8)) AS state_bytes FROM generate_series(1, 100000) AS x;
+
+\q
@@ -0,0 +1,67 @@
+-- Regression test of the worker threads of the backend (parallel.h): the functions that run on
+-- them give the same results with the workers (postgeoda.max_threads = 8) as serially
+-- (postgeoda.max_threads = 1), over the whole table and over many small partitions.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- build the weights every time, instead of reading them from the weights build cache
+SET postgeoda.weights_build_cache_size = 0;
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Region" AS region, "Crm_prs"::float8 AS x,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS w
+FROM guerry;
+
+-- serially: parallel_for() runs in the calling thread
+SET postgeoda.max_threads = 1;
+
+CREATE TABLE serial AS
+SELECT g.ogc_fid,
+       queen_weights(g.ogc_fid, g.wkb_geometry, 1, FALSE, 0, 8) OVER () AS queen,
+       knn_weights(g.ogc_fid, g.wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 8) OVER () AS knn,
+       local_moran(w.x, w.w, 999, 'philox', 0.05, 8, 123456789) OVER () AS philox,
+       local_moran(w.x, w.w, 9999, 'sequential', 0.05, 8, 123456789) OVER () AS sequential,
+       local_moran(w.x, w.w, 999, 'analytic', 0.05, 8, 123456789) OVER () AS analytic,
+       local_g(w.x, w.w, 999, 'analytic', 0.05, 8, 123456789) OVER () AS g_analytic,
+       local_moran(w.x, w.w, 999, 'philox', 0.05, 8, 123456789) OVER (PARTITION BY w.region) AS philox_region
+FROM guerry g JOIN guerry_w w USING (ogc_fid);
+
+-- with the workers
+SET postgeoda.max_threads = 8;
+
+CREATE TABLE pooled AS
+SELECT g.ogc_fid,
+       queen_weights(g.ogc_fid, g.wkb_geometry, 1, FALSE, 0, 8) OVER () AS queen,
+       knn_weights(g.ogc_fid, g.wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 8) OVER () AS knn,
+       local_moran(w.x, w.w, 999, 'philox', 0.05, 8, 123456789) OVER () AS philox,
+       local_moran(w.x, w.w, 9999, 'sequential', 0.05, 8, 123456789) OVER () AS sequential,
+       local_moran(w.x, w.w, 999, 'analytic', 0.05, 8, 123456789) OVER () AS analytic,
+       local_g(w.x, w.w, 999, 'analytic', 0.05, 8, 123456789) OVER () AS g_analytic,
+       local_moran(w.x, w.w, 999, 'philox', 0.05, 8, 123456789) OVER (PARTITION BY w.region) AS philox_region
+FROM guerry g JOIN guerry_w w USING (ogc_fid);
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE s.queen <> p.queen) AS queen,
+       count(*) FILTER (WHERE s.knn <> p.knn) AS knn,
+       count(*) FILTER (WHERE s.philox <> p.philox) AS philox,
+       count(*) FILTER (WHERE s.sequential <> p.sequential) AS sequential,
+       count(*) FILTER (WHERE s.analytic <> p.analytic) AS analytic,
+       count(*) FILTER (WHERE s.g_analytic <> p.g_analytic) AS g_analytic,
+       count(*) FILTER (WHERE s.philox_region <> p.philox_region) AS philox_region
+FROM serial s JOIN pooled p USING (ogc_fid);
+
+RESET postgeoda.max_threads;
+
+\q
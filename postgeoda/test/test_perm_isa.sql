@@ -0,0 +1,66 @@
+-- Regression test of the GUC postgeoda.perm_isa: the permutations of the LISA functions forced to
+-- the scalar, AVX2 and AVX-512 kernels (capped by the CPU) give the same results.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+SHOW postgeoda.perm_isa;
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x, queen_weights(ogc_fid, wkb_geometry) OVER () AS qw
+FROM guerry;
+
+CREATE TABLE state AS
+SELECT local_moran_state(x, 999, 123456789) AS state FROM guerry_w;
+
+-- the philox and sequential methods, and local_moran_fast() with the state
+CREATE VIEW results AS
+SELECT a.ogc_fid,
+       local_moran(a.x, a.qw, 999, 'philox', 0.05, 4, 123456789) OVER () AS philox,
+       local_moran(a.x, a.qw, 999, 'sequential', 0.05, 4, 123456789) OVER () AS seq,
+       local_moran_fast(a.x, a.qw,
+                        ARRAY(SELECT b.x FROM guerry_w b WHERE b.ogc_fid = ANY(weights_neighbors(a.qw))),
+                        s.state) AS fast
+FROM guerry_w a, state s;
+
+SET postgeoda.perm_isa = 'scalar';
+CREATE TABLE results_scalar AS SELECT * FROM results;
+
+SET postgeoda.perm_isa = 'avx2';
+CREATE TABLE results_avx2 AS SELECT * FROM results;
+
+SET postgeoda.perm_isa = 'avx512';
+CREATE TABLE results_avx512 AS SELECT * FROM results;
+
+RESET postgeoda.perm_isa;
+CREATE TABLE results_auto AS SELECT * FROM results;
+
+SELECT isa, count(*) AS num_obs,
+       count(*) FILTER (WHERE r.philox IS DISTINCT FROM s.philox) AS philox_mismatches,
+       count(*) FILTER (WHERE r.seq IS DISTINCT FROM s.seq) AS sequential_mismatches,
+       count(*) FILTER (WHERE r.fast IS DISTINCT FROM s.fast) AS fast_mismatches
+FROM (SELECT 'avx2' AS isa, * FROM results_avx2
+      UNION ALL
+      SELECT 'avx512', * FROM results_avx512
+      UNION ALL
+      SELECT 'auto', * FROM results_auto) AS r
+JOIN results_scalar s USING (ogc_fid)
+GROUP BY isa
+ORDER BY isa;
+
+SET postgeoda.perm_isa = 'sse';
+
+SHOW postgeoda.perm_isa;
+
+\q
@@ -0,0 +1,61 @@
+-- Regression test of the weights Window functions that return the rows of one pre-serialized
+-- arena per partition: each row is the weights of its observation (v1: idx, number of neighbors,
+-- ids and the float weights), for the whole table and for each partition, with neighborless rows.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- build the weights every time, instead of reading them from the weights build cache
+SET postgeoda.weights_build_cache_size = 0;
+
+CREATE FUNCTION sorted_neighbors(w bytea) RETURNS bigint[] AS $$
+    SELECT array_agg(n ORDER BY n) FROM unnest(weights_neighbors(w)) AS n
+$$ LANGUAGE sql IMMUTABLE STRICT;
+
+CREATE TABLE guerry_arena AS
+SELECT ogc_fid, "Region" AS region,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS queen,
+       queen_weights(ogc_fid, wkb_geometry) OVER (PARTITION BY "Region") AS queen_region,
+       knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS knn,
+       knn_weights(ogc_fid, wkb_geometry, 4) OVER (PARTITION BY "Region") AS knn_region
+FROM guerry;
+
+-- a row is 4 + 2 + 4 bytes per neighbor, and 4 more bytes per neighbor with the weights values
+SELECT count(*) AS num_obs,
+       sum(length(queen)) AS queen_bytes,
+       count(*) FILTER (WHERE length(queen) <> 6 + 4 * cardinality(weights_neighbors(queen))) AS queen_bad_rows,
+       sum(length(knn)) AS knn_bytes,
+       count(*) FILTER (WHERE length(knn_region) <> 38) AS knn_region_bad_rows
+FROM guerry_arena;
+
+SELECT ogc_fid, sorted_neighbors(queen) AS neighbors FROM guerry_arena WHERE ogc_fid = 1;
+
+-- the weights of each partition: the neighbors in the same region, and fid 55 has none
+SELECT region, count(*) AS num_obs, sum(cardinality(weights_neighbors(queen_region))) AS num_nbrs,
+       sum(length(queen_region)) AS queen_bytes,
+       count(*) FILTER (WHERE cardinality(weights_neighbors(queen_region)) = 0) AS isolates
+FROM guerry_arena
+GROUP BY region
+ORDER BY region;
+
+SELECT count(*) AS mismatches
+FROM guerry_arena a
+WHERE sorted_neighbors(a.queen_region) IS DISTINCT FROM
+      (SELECT array_agg(b.ogc_fid::bigint ORDER BY b.ogc_fid)
+       FROM guerry_arena b
+       WHERE b.region = a.region AND b.ogc_fid = ANY(weights_neighbors(a.queen)));
+
+SELECT weights_astext(queen_region) AS isolate FROM guerry_arena WHERE ogc_fid = 55;
+
+\q
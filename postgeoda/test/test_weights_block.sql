@@ -0,0 +1,77 @@
+-- Regression test of the KNN weights in blocks: the rows of knn_weights_block() over disjoint
+-- fid ranges, merged by weights_merge(), are the ones of knn_weights() from the kd-tree
+-- (cpu_threads > 1), whatever the order of the blocks.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- build the weights every time, instead of reading them from the weights build cache
+SET postgeoda.weights_build_cache_size = 0;
+
+-- the neighbors of one observation sorted by id, with the weights rounded to 4 decimals:
+-- the neighbors at the same distance can be in another order
+CREATE FUNCTION knn_pairs(w bytea) RETURNS text AS $$
+    SELECT string_agg(nbr || ':' || coalesce(round(wt::numeric, 4)::text, ''), ',' ORDER BY nbr)
+    FROM (SELECT (j->0->>(i - 1))::integer AS nbr, (j->1->>(i - 1))::float8 AS wt
+          FROM (SELECT split_part(weights_astext(w), ':', 2)::json AS j) AS s,
+               generate_series(1, json_array_length(j->0)) AS i) AS t
+$$ LANGUAGE sql IMMUTABLE STRICT;
+CREATE FUNCTION row_fid(w bytea) RETURNS integer AS $$
+    SELECT split_part(weights_astext(w), ':', 1)::integer
+$$ LANGUAGE sql IMMUTABLE STRICT;
+
+CREATE TABLE guerry_knn AS
+SELECT ogc_fid,
+       knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS g4,
+       knn_weights(ogc_fid, wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 8) OVER () AS t4
+FROM guerry;
+
+CREATE TABLE guerry_knn_index AS SELECT knn_index(ogc_fid, wkb_geometry) AS idx FROM guerry;
+
+-- three blocks of fids, as if computed in different sessions
+CREATE TABLE guerry_knn_blocks AS
+SELECT 1 AS block, knn_weights_block(idx, 4, 0, 30) AS w FROM guerry_knn_index
+UNION ALL
+SELECT 2, knn_weights_block(idx, 4, 30, 60, 1, FALSE, TRUE, 8) FROM guerry_knn_index
+UNION ALL
+SELECT 3, knn_weights_block(idx, 4, 60, 100) FROM guerry_knn_index;
+
+-- every observation is in one block, and its row is the one of knn_weights()
+SELECT count(*) AS num_obs,
+       count(DISTINCT row_fid(b.w)) AS num_fids,
+       count(*) FILTER (WHERE b.w IS DISTINCT FROM k.t4) AS kdtree_mismatches,
+       count(*) FILTER (WHERE knn_pairs(b.w) IS DISTINCT FROM knn_pairs(k.g4)) AS libgeoda_mismatches
+FROM guerry_knn_blocks b FULL JOIN guerry_knn k ON row_fid(b.w) = k.ogc_fid;
+
+-- weights_merge() sorts the rows by fid: the same bytes for any order of the blocks, and
+-- geoda_weights_toset() splits them into the rows of knn_weights()
+CREATE TABLE guerry_knn_merged AS
+SELECT weights_merge(w ORDER BY block) AS w_asc,
+       weights_merge(w ORDER BY block DESC, md5(w)) AS w_desc
+FROM guerry_knn_blocks;
+
+SELECT w_asc = w_desc AS same_weights FROM guerry_knn_merged;
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE m.w IS DISTINCT FROM k.t4) AS kdtree_mismatches
+FROM (SELECT geoda_weights_toset(w_asc) AS w FROM guerry_knn_merged) AS m
+FULL JOIN guerry_knn k ON row_fid(m.w) = k.ogc_fid;
+
+-- a duplicated fid (overlapping blocks) is an error
+SELECT weights_merge(w)
+FROM (SELECT w FROM guerry_knn_blocks
+      UNION ALL
+      SELECT knn_weights_block(idx, 4, 25, 35) FROM guerry_knn_index) AS s;
+
+\q
@@ -0,0 +1,61 @@
+-- Regression test of the conversions of the weights between v1 and the compact v2 format
+-- (weights_compress() and weights_decompress()) with f32, f16 and q8 weights values.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS queen_w,
+       knn_weights(ogc_fid, wkb_geometry, 6) OVER () AS knn_w
+FROM guerry;
+
+-- the queen neighbors are sorted, so the round trip gives the same bytes
+SELECT count(*) AS mismatches
+FROM guerry_w
+WHERE weights_decompress(weights_compress(queen_w)) <> queen_w;
+
+-- v2 sorts the KNN neighbors by id: the order by distance is lost, but not the neighbors
+SELECT count(*) AS mismatches
+FROM guerry_w
+WHERE weights_neighbors(weights_compress(knn_w)) <>
+      ARRAY(SELECT n FROM unnest(weights_neighbors(knn_w)) AS n ORDER BY n);
+
+SELECT count(*) AS mismatches
+FROM guerry_w, unnest(ARRAY['f32', 'f16', 'q8']) AS enc
+WHERE ARRAY(SELECT n FROM unnest(weights_neighbors(weights_decompress(weights_compress(knn_w, enc)))) AS n ORDER BY n) <>
+      ARRAY(SELECT n FROM unnest(weights_neighbors(knn_w)) AS n ORDER BY n)
+   OR weights_num_neighbors(weights_decompress(weights_compress(knn_w, enc))::geoda_weights) <>
+      weights_num_neighbors(knn_w::geoda_weights);
+
+-- after the first conversion, v2 -> v1 -> v2 gives the same bytes
+SELECT count(*) AS mismatches
+FROM guerry_w, unnest(ARRAY['f32', 'f16', 'q8']) AS enc
+WHERE weights_compress(weights_decompress(weights_compress(knn_w, enc)), enc) <> weights_compress(knn_w, enc);
+
+-- the complete weights
+CREATE TABLE guerry_complete AS
+SELECT weights_merge(queen_w) AS queen_w, weights_merge(knn_w) AS knn_w FROM guerry_w;
+
+SELECT weights_astext(weights_decompress(weights_compress(queen_w))) = weights_astext(queen_w) AS queen_round_trip,
+       weights_compress(weights_decompress(weights_compress(knn_w)), 'f32') = weights_compress(knn_w) AS knn_round_trip
+FROM guerry_complete;
+
+SELECT count(*) AS mismatches
+FROM guerry_complete, unnest(ARRAY['f32', 'f16', 'q8']) AS enc,
+     LATERAL (SELECT (weights_summary(knn_w)).*) AS a,
+     LATERAL (SELECT (weights_summary(weights_decompress(weights_compress(knn_w, enc)))).*) AS b
+WHERE a.num_obs <> b.num_obs OR a.num_nbrs <> b.num_nbrs;
+
+\q
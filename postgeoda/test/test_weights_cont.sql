@@ -0,0 +1,62 @@
+-- Regression test of the queen and rook weights created by ContiguityBuilder (cpu_threads > 1):
+-- the neighbors are the same as libgeoda's (one thread, the default), and a precision_threshold
+-- is only supported by libgeoda.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- build the weights every time, instead of reading them from the weights build cache
+SET postgeoda.weights_build_cache_size = 0;
+
+-- the neighbors of one observation sorted by id: libgeoda doesn't always sort them
+CREATE FUNCTION sorted_neighbors(w bytea) RETURNS bigint[] AS $$
+    SELECT array_agg(n ORDER BY n) FROM unnest(weights_neighbors(w)) AS n
+$$ LANGUAGE sql IMMUTABLE STRICT;
+
+CREATE TABLE guerry_cont AS
+SELECT ogc_fid,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS queen_g,
+       queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 8) OVER () AS queen_b,
+       rook_weights(ogc_fid, wkb_geometry) OVER () AS rook_g,
+       rook_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 8) OVER () AS rook_b,
+       queen_weights(ogc_fid, wkb_geometry, 2, FALSE, 0, 1) OVER () AS order2_g,
+       queen_weights(ogc_fid, wkb_geometry, 2, FALSE, 0, 8) OVER () AS order2_b,
+       queen_weights(ogc_fid, wkb_geometry, 3, TRUE, 0, 1) OVER () AS lower3_g,
+       queen_weights(ogc_fid, wkb_geometry, 3, TRUE, 0, 8) OVER () AS lower3_b
+FROM guerry;
+
+-- libgeoda and ContiguityBuilder: the same neighbors
+SELECT count(*) FILTER (WHERE sorted_neighbors(queen_g) IS DISTINCT FROM sorted_neighbors(queen_b)) AS queen,
+       count(*) FILTER (WHERE sorted_neighbors(rook_g) IS DISTINCT FROM sorted_neighbors(rook_b)) AS rook,
+       count(*) FILTER (WHERE sorted_neighbors(order2_g) IS DISTINCT FROM sorted_neighbors(order2_b)) AS order2,
+       count(*) FILTER (WHERE sorted_neighbors(lower3_g) IS DISTINCT FROM sorted_neighbors(lower3_b)) AS lower3
+FROM guerry_cont;
+
+SELECT num_obs, num_nbrs, min_nbrs, max_nbrs, median_nbrs, isolates, symmetric
+FROM (SELECT (weights_summary(queen_g)).* FROM guerry_cont) AS s;
+
+-- ContiguityBuilder sorts the neighbors
+SELECT count(*) AS unsorted
+FROM guerry_cont
+WHERE weights_neighbors(queen_b) <> sorted_neighbors(queen_b);
+
+-- a precision threshold with one thread (libgeoda), and with more threads
+SELECT count(*) AS num_obs
+FROM (SELECT queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0.001, 1) OVER () AS w FROM guerry) AS s;
+
+SELECT queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0.001, 8) OVER () FROM guerry;
+
+SELECT rook_weights(ogc_fid, wkb_geometry, 1, FALSE, 0.001, 8) OVER () FROM guerry;
+
+\q
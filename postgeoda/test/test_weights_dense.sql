@@ -0,0 +1,47 @@
+-- Regression test of the observations with more than 65535 neighbors: a synthetic dense
+-- cluster of 70000 cells around one hub polygon, so the hub has 70000 queen neighbors.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+-- the hub: a strip with a vertex at each corner of the cells, gid 0
+CREATE TABLE dense_cluster AS
+SELECT 0 AS gid,
+       ST_GeomFromText('POLYGON((0 0,70000 0,' ||
+                       string_agg(x || ' 1', ',' ORDER BY x DESC) || ',0 0))') AS geom
+FROM generate_series(0, 70000) AS x;
+
+-- the cells on top of the hub, gid 1..70000
+INSERT INTO dense_cluster
+SELECT i + 1, ST_MakeEnvelope(i, 1, i + 1, 2)
+FROM generate_series(0, 69999) AS i;
+
+CREATE TABLE dense_w AS
+SELECT gid, queen_weights(gid, ST_AsBinary(geom)) OVER () AS w FROM dense_cluster;
+
+-- the weights of the hub are a v2 row: a v1 row can not have more than 65535 neighbors
+SELECT get_byte(w, 0) = 32 AS is_v2 FROM dense_w WHERE gid = 0;
+
+SELECT num_obs, num_nbrs, min_nbrs, max_nbrs, median_nbrs, isolates, symmetric
+FROM (SELECT (weights_summary(w)).* FROM dense_w) AS s;
+
+-- the complete weights in v2, and in the wide v1 format ('A')
+CREATE TABLE dense_complete AS
+SELECT weights_merge(w) AS w FROM dense_w;
+
+SELECT get_byte(weights_decompress(w), 0) AS v1_type FROM dense_complete;
+
+SELECT max_nbrs, symmetric
+FROM (SELECT (weights_summary(weights_decompress(w))).* FROM dense_complete) AS s;
+
+SELECT weights_compress(weights_decompress(w)) = w AS round_trip FROM dense_complete;
+
+SELECT length(weights_astext(weights_decompress(w))) = length(weights_astext(w)) AS same_text
+FROM dense_complete;
+
+\q
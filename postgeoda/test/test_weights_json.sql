@@ -0,0 +1,47 @@
+-- Regression test of the text and JSON of the weights: geoda_weights_tojson() of the complete
+-- weights is the text of its rows (weights_astext()), and geoda_weights_tojson_rows() returns one
+-- JSON object per observation.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- the complete weights ('w', v1) of 3 observations: 0 has the neighbors 1 and 2 (0.5 each),
+-- 1 has the neighbor 0 (1.0) and 2 has no neighbors
+CREATE TABLE small_w AS
+SELECT '\x770300000000000000020001000000020000000000003f0000003f010000000100000000000000803f020000000000'::bytea AS w;
+
+SELECT geoda_weights_tojson(w) FROM small_w;
+
+SELECT geoda_weights_tojson_rows(w) AS row FROM small_w;
+
+-- the queen weights and the weights of the 84 nearest neighbors (all other observations)
+CREATE TABLE guerry_complete AS
+SELECT geoda_weights_cont(ogc_fid, wkb_geometry, TRUE) AS queen_w,
+       geoda_weights_knn(ogc_fid, wkb_geometry, 84) AS knn_w
+FROM guerry;
+
+SELECT geoda_weights_tojson(queen_w) = (SELECT '{' || string_agg(weights_astext(r), ',' ORDER BY i) || '}'
+                                        FROM geoda_weights_toset(queen_w) WITH ORDINALITY AS t(r, i)) AS queen_text,
+       geoda_weights_tojson(knn_w) = (SELECT '{' || string_agg(weights_astext(r), ',' ORDER BY i) || '}'
+                                      FROM geoda_weights_toset(knn_w) WITH ORDINALITY AS t(r, i)) AS knn_text
+FROM guerry_complete;
+
+SELECT 'queen' AS weights, count(*) AS num_obs, sum(json_array_length(j->'neighbors')) AS num_nbrs,
+       count(DISTINCT (j->>'id')::integer) AS num_ids
+FROM guerry_complete, geoda_weights_tojson_rows(queen_w) AS j
+UNION ALL
+SELECT 'knn', count(*), sum(json_array_length(j->'neighbors')), count(DISTINCT (j->>'id')::integer)
+FROM guerry_complete, geoda_weights_tojson_rows(knn_w) AS j;
+
+\q
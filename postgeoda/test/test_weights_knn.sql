@@ -0,0 +1,88 @@
+-- Regression test of the KNN weights created by the kd-tree (cpu_threads > 1): the neighbors
+-- and the weights are the same as libgeoda's (one thread, the default), and the ones of
+-- knn_weights_index(), and the fids must be unique.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- build the weights every time, instead of reading them from the weights build cache
+SET postgeoda.weights_build_cache_size = 0;
+
+-- the neighbors of one observation sorted by id, with the weights rounded to 4 decimals:
+-- the neighbors at the same distance can be in another order
+CREATE FUNCTION knn_pairs(w bytea) RETURNS text AS $$
+    SELECT string_agg(nbr || ':' || coalesce(round(wt::numeric, 4)::text, ''), ',' ORDER BY nbr)
+    FROM (SELECT (j->0->>(i - 1))::integer AS nbr, (j->1->>(i - 1))::float8 AS wt
+          FROM (SELECT split_part(weights_astext(w), ':', 2)::json AS j) AS s,
+               generate_series(1, json_array_length(j->0)) AS i) AS t
+$$ LANGUAGE sql IMMUTABLE STRICT;
+
+CREATE TABLE guerry_knn AS
+SELECT ogc_fid,
+       knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS g4,
+       knn_weights(ogc_fid, wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 8) OVER () AS t4,
+       knn_weights(ogc_fid, wkb_geometry, 6, 2, TRUE, FALSE, TRUE, 1) OVER () AS g6,
+       knn_weights(ogc_fid, wkb_geometry, 6, 2, TRUE, FALSE, TRUE, 8) OVER () AS t6,
+       knn_weights_sub(ogc_fid, wkb_geometry, 4, 10, 40) OVER () AS gsub,
+       knn_weights_sub(ogc_fid, wkb_geometry, 4, 10, 40, 1, FALSE, FALSE, TRUE, 8) OVER () AS tsub
+FROM guerry;
+
+-- every observation has k neighbors
+SELECT min(cardinality(weights_neighbors(g4))) AS g4_min, max(cardinality(weights_neighbors(g4))) AS g4_max,
+       min(cardinality(weights_neighbors(t4))) AS t4_min, max(cardinality(weights_neighbors(t4))) AS t4_max,
+       min(cardinality(weights_neighbors(t6))) AS t6_min, max(cardinality(weights_neighbors(t6))) AS t6_max
+FROM guerry_knn;
+
+-- libgeoda and the kd-tree: the same neighbors and weights
+SELECT count(*) FILTER (WHERE knn_pairs(g4) IS DISTINCT FROM knn_pairs(t4)) AS knn_mismatches,
+       count(*) FILTER (WHERE knn_pairs(g6) IS DISTINCT FROM knn_pairs(t6)) AS inverse_mismatches,
+       count(*) FILTER (WHERE knn_pairs(gsub) IS DISTINCT FROM knn_pairs(tsub)) AS sub_mismatches
+FROM guerry_knn;
+
+-- the kd-tree: the same weights for any number of threads
+SELECT count(*) AS mismatches
+FROM (SELECT ogc_fid, knn_weights(ogc_fid, wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 2) OVER () AS t2
+      FROM guerry) AS s
+JOIN guerry_knn k USING (ogc_fid)
+WHERE s.t2 <> k.t4;
+
+-- knn_weights_index(): the neighbors by the distance of the centroids, from the GiST index on
+-- the centroids, with the same weights as knn_weights()
+CREATE TABLE guerry_geom AS
+SELECT ogc_fid, ST_GeomFromWKB(wkb_geometry) AS geom FROM guerry;
+
+CREATE INDEX guerry_geom_centroid_idx ON guerry_geom USING GIST (ST_Centroid(geom));
+
+SELECT count(*) AS num_obs,
+       count(*) FILTER (WHERE knn_pairs(k.g4) IS DISTINCT FROM
+                        knn_pairs(knn_weights_index(g.ogc_fid, g.geom, 4, 'guerry_geom', 'ogc_fid', 'geom')))
+           AS index_mismatches,
+       count(*) FILTER (WHERE knn_pairs(k.g6) IS DISTINCT FROM
+                        knn_pairs(knn_weights_index(g.ogc_fid, g.geom, 6, 'guerry_geom', 'ogc_fid', 'geom',
+                                                    2, TRUE)))
+           AS inverse_mismatches
+FROM guerry_geom g JOIN guerry_knn k USING (ogc_fid);
+
+-- the fids must be unique
+SELECT knn_weights(fid, wkb_geometry, 4) OVER ()
+FROM (SELECT ogc_fid AS fid, wkb_geometry FROM guerry
+      UNION ALL
+      SELECT 1, wkb_geometry FROM guerry WHERE ogc_fid = 2) AS s;
+
+SELECT knn_weights_sub(fid, wkb_geometry, 4, 0, 10, 1, FALSE, FALSE, TRUE, 8) OVER ()
+FROM (SELECT ogc_fid AS fid, wkb_geometry FROM guerry
+      UNION ALL
+      SELECT 1, wkb_geometry FROM guerry WHERE ogc_fid = 2) AS s;
+
+\q
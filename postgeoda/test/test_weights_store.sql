@@ -0,0 +1,71 @@
+-- Regression test of the weights store: the weights exported to a server-side file (in the data
+-- directory), registered, replaced and dropped by name, and the references used in place of the
+-- weights by the LISA functions.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Crm_prs"::float8 AS x,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS queen,
+       knn_weights(ogc_fid, wkb_geometry, 4) OVER () AS knn
+FROM guerry;
+
+SELECT weights_store_export('guerry', 'guerry_w', 'queen', 'guerry_queen.gws');
+
+SELECT weights_store_register('guerry_copy', 'guerry_queen.gws');
+
+SELECT name, num_obs, num_nbrs, has_weights FROM geoda_weights_store ORDER BY name;
+
+-- the references give the same LISA as the weights
+SELECT count(*) AS num_obs, count(*) FILTER (WHERE a IS DISTINCT FROM b) AS mismatches,
+       count(*) FILTER (WHERE a IS DISTINCT FROM c) AS copy_mismatches
+FROM (SELECT local_moran(x, queen, 999, 'philox', 0.05, 1, 123456789) OVER () AS a,
+             local_moran(x, weights_store_ref('guerry', ogc_fid), 999, 'philox', 0.05, 1, 123456789) OVER () AS b,
+             local_moran(x, weights_store_ref('guerry_copy', ogc_fid), 999, 'philox', 0.05, 1, 123456789) OVER () AS c
+      FROM guerry_w) AS s;
+
+-- export again under the same name: the knn weights replace the queen weights
+SELECT weights_store_export('guerry', 'guerry_w', 'knn', 'guerry_knn.gws');
+
+SELECT name, num_obs, num_nbrs, has_weights FROM geoda_weights_store ORDER BY name;
+
+SELECT count(*) AS num_obs, count(*) FILTER (WHERE a IS DISTINCT FROM b) AS mismatches
+FROM (SELECT local_moran(x, knn, 999, 'philox', 0.05, 1, 123456789) OVER () AS a,
+             local_moran(x, weights_store_ref('guerry', ogc_fid), 999, 'philox', 0.05, 1, 123456789) OVER () AS b
+      FROM guerry_w) AS s;
+
+SELECT weights_store_drop('guerry_copy');
+
+SELECT weights_store_drop('guerry_copy');
+
+SELECT name FROM geoda_weights_store ORDER BY name;
+
+SELECT local_moran(x, weights_store_ref('guerry_copy', ogc_fid)) OVER () FROM guerry_w;
+
+SELECT weights_store_ref('guerry', fid) FROM (VALUES (-1)) AS v(fid);
+
+-- an observation can't be in two rows
+CREATE TABLE guerry_dup AS
+SELECT queen AS w FROM guerry_w
+UNION ALL
+SELECT queen FROM guerry_w WHERE ogc_fid = 7;
+
+SELECT weights_store_export('guerry_dup', 'guerry_dup', 'w', 'guerry_dup.gws');
+
+SELECT weights_store_export('guerry_dup', 'guerry_w', 'ogc_fid', 'guerry_dup.gws');
+
+SELECT name FROM geoda_weights_store ORDER BY name;
+
+\q
@@ -0,0 +1,53 @@
+-- Regression test of the aggregate weights_summary(): the statistics of the neighbors of the
+-- rows of a weights column and of the complete weights, in v1 and v2, for each partition, and
+-- the isolates and the symmetry (the observation itself is not its neighbor).
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+CREATE TABLE guerry_w AS
+SELECT ogc_fid, "Region" AS region,
+       queen_weights(ogc_fid, wkb_geometry) OVER () AS queen,
+       queen_weights(ogc_fid, wkb_geometry) OVER (PARTITION BY "Region") AS queen_region
+FROM guerry;
+
+-- the rows, the complete weights and the v2 rows: the same statistics
+SELECT source, num_obs, num_nbrs, min_nbrs, max_nbrs, round(mean_nbrs::numeric, 4) AS mean_nbrs,
+       median_nbrs, isolates, symmetric
+FROM (SELECT 1 AS i, 'rows' AS source, (weights_summary(queen)).* FROM guerry_w
+      UNION ALL
+      SELECT 2, 'complete', (weights_summary(w)).*
+      FROM (SELECT geoda_weights_cont(ogc_fid, wkb_geometry, TRUE) AS w FROM guerry) AS c
+      UNION ALL
+      SELECT 3, 'v2 rows', (weights_summary(weights_compress(queen))).* FROM guerry_w) AS s
+ORDER BY i;
+
+-- the weights of each region: fid 55 has no neighbor in its region
+SELECT region, num_obs, num_nbrs, min_nbrs, max_nbrs, round(mean_nbrs::numeric, 4) AS mean_nbrs,
+       median_nbrs, isolates, symmetric
+FROM (SELECT region, (weights_summary(queen_region)).* FROM guerry_w GROUP BY region) AS s
+ORDER BY region;
+
+-- observation 1 has the neighbors 1 (itself) and 2, 2 has none, then 2 has the neighbor 1
+SELECT num_obs, num_nbrs, min_nbrs, max_nbrs, mean_nbrs, median_nbrs, isolates, symmetric
+FROM (SELECT (weights_summary(w)).*
+      FROM (VALUES ('\x0100000002000100000002000000'::bytea), ('\x020000000000'::bytea)) AS v(w)) AS s;
+
+SELECT num_obs, num_nbrs, min_nbrs, max_nbrs, mean_nbrs, median_nbrs, isolates, symmetric
+FROM (SELECT (weights_summary(w)).*
+      FROM (VALUES ('\x0100000002000100000002000000'::bytea), ('\x02000000010001000000'::bytea)) AS v(w)) AS s;
+
+SELECT weights_summary(w) FROM (VALUES ('\x0100'::bytea)) AS v(w);
+
+\q
@@ -0,0 +1,88 @@
+-- Regression test of the weights built with different cpu_threads > 1 (ContiguityBuilder and
+-- the kd-tree): the weights must not depend on the number of threads. One thread is libgeoda,
+-- see test_weights_cont.sql and test_weights_knn.sql.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- build the weights every time, instead of reading them from the weights build cache
+SET postgeoda.weights_build_cache_size = 0;
+
+-- queen weights (85 observations, 420 neighbors, min 2, max 8)
+CREATE TABLE guerry_queen AS
+SELECT ogc_fid,
+       queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 2) OVER () AS w2,
+       queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 8) OVER () AS w8
+FROM guerry;
+
+SELECT count(*) AS mismatches FROM guerry_queen WHERE w2 <> w8;
+
+SELECT num_obs, num_nbrs, min_nbrs, max_nbrs, median_nbrs, isolates, symmetric
+FROM (SELECT (weights_summary(w2)).* FROM guerry_queen) AS s;
+
+-- rook weights
+SELECT count(*) AS mismatches
+FROM (SELECT rook_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 2) OVER () AS w2,
+             rook_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 8) OVER () AS w8
+      FROM guerry) AS s
+WHERE w2 <> w8;
+
+-- higher order queen weights, with and without the lower orders
+SELECT count(*) AS mismatches
+FROM (SELECT queen_weights(ogc_fid, wkb_geometry, 2, FALSE, 0, 2) OVER () AS w2,
+             queen_weights(ogc_fid, wkb_geometry, 2, FALSE, 0, 8) OVER () AS w8,
+             queen_weights(ogc_fid, wkb_geometry, 3, TRUE, 0, 2) OVER () AS l2,
+             queen_weights(ogc_fid, wkb_geometry, 3, TRUE, 0, 8) OVER () AS l8
+      FROM guerry) AS s
+WHERE w2 <> w8 OR l2 <> l8;
+
+-- knn weights
+SELECT count(*) AS mismatches
+FROM (SELECT knn_weights(ogc_fid, wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 2) OVER () AS w2,
+             knn_weights(ogc_fid, wkb_geometry, 4, 1, FALSE, FALSE, TRUE, 8) OVER () AS w8,
+             knn_weights(ogc_fid, wkb_geometry, 6, 2, TRUE, FALSE, TRUE, 2) OVER () AS i2,
+             knn_weights(ogc_fid, wkb_geometry, 6, 2, TRUE, FALSE, TRUE, 8) OVER () AS i8
+      FROM guerry) AS s
+WHERE w2 <> w8 OR i2 <> i8;
+
+-- knn weights of the observations [10, 40)
+SELECT count(*) AS mismatches
+FROM (SELECT knn_weights_sub(ogc_fid, wkb_geometry, 4, 10, 40, 1, FALSE, FALSE, TRUE, 2) OVER () AS w2,
+             knn_weights_sub(ogc_fid, wkb_geometry, 4, 10, 40, 1, FALSE, FALSE, TRUE, 8) OVER () AS w8
+      FROM guerry) AS s
+WHERE w2 IS DISTINCT FROM w8;
+
+-- the weights build cache is disabled by default
+RESET postgeoda.weights_build_cache_size;
+
+SHOW postgeoda.weights_build_cache_size;
+
+-- with the weights build cache, the weights cached by 8 threads are the weights of 2 threads
+SET postgeoda.weights_build_cache_size = 64;
+
+SELECT weights_build_cache_reset();
+
+SELECT count(*) AS mismatches
+FROM (SELECT ogc_fid, queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 8) OVER () AS w FROM guerry) AS s
+JOIN guerry_queen q USING (ogc_fid)
+WHERE s.w <> q.w2;
+
+SELECT count(*) AS mismatches
+FROM (SELECT ogc_fid, queen_weights(ogc_fid, wkb_geometry, 1, FALSE, 0, 2) OVER () AS w FROM guerry) AS s
+JOIN guerry_queen q USING (ogc_fid)
+WHERE s.w <> q.w2;
+
+SELECT hits, misses FROM weights_build_cache_stats();
+
+\q
@@ -0,0 +1,55 @@
+-- Regression test of the geoda_weights type: the weights are checked when they are read (text
+-- input or the cast from bytea), the header accessors, and the implicit cast to bytea for the
+-- functions of the weights.
+DROP DATABASE IF EXISTS contrib_regression;
+
+CREATE DATABASE contrib_regression;
+
+\c contrib_regression
+
+CREATE EXTENSION postgis CASCADE;
+CREATE EXTENSION postgeoda;
+
+\set QUIET on
+\set ECHO none
+\ir data/guerry.sql
+\set ECHO all
+\set QUIET off
+
+-- observation 1 with the neighbors 2 and 3 (v1: idx, number of neighbors, ids), and with the
+-- weights values 0.5 and 0.25
+SELECT w, weights_num_obs(w) AS num_obs, weights_num_neighbors(w) AS num_nbrs, weights_fid(w) AS fid,
+       weights_neighbors(w) AS neighbors, weights_astext(w) AS text
+FROM (VALUES ('\x0100000002000200000003000000'::geoda_weights),
+             ('\x01000000020002000000030000000000003f0000803e'::geoda_weights)) AS v(w);
+
+-- the neighbors are truncated
+SELECT t::geoda_weights FROM (VALUES ('\x01000000020002000000'::text)) AS v(t);
+
+SELECT geoda_weights('\x0100'::bytea);
+
+-- the rows of queen_weights() are checked when they are stored in a geoda_weights column
+CREATE TABLE guerry_w (ogc_fid integer, x float8, w geoda_weights);
+
+INSERT INTO guerry_w
+SELECT ogc_fid, "Crm_prs", queen_weights(ogc_fid, wkb_geometry) OVER () FROM guerry;
+
+SELECT count(*) AS num_obs, sum(weights_num_neighbors(w)) AS num_nbrs,
+       count(*) FILTER (WHERE weights_fid(w) <> ogc_fid OR weights_num_obs(w) <> 1) AS header_mismatches,
+       count(*) FILTER (WHERE weights_num_neighbors(w) <> cardinality(weights_neighbors(w))) AS nbr_mismatches,
+       count(*) FILTER (WHERE geoda_weights_send(w) <> w::bytea) AS send_mismatches
+FROM guerry_w;
+
+-- the LISA functions take geoda_weights as bytea
+SELECT count(*) AS mismatches
+FROM (SELECT local_moran(x, w, 999, 'philox', 0.05, 1, 123456789) OVER () AS a,
+             local_moran(x, w::bytea, 999, 'philox', 0.05, 1, 123456789) OVER () AS b
+      FROM guerry_w) AS s
+WHERE a IS DISTINCT FROM b;
+
+-- the complete weights
+SELECT weights_num_obs(w) AS num_obs, weights_num_neighbors(w) IS NULL AS no_num_nbrs,
+       weights_fid(w) IS NULL AS no_fid
+FROM (SELECT geoda_weights_cont(ogc_fid, wkb_geometry, TRUE)::geoda_weights AS w FROM guerry) AS s;
+
+\q